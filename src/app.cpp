@@ -47,7 +47,7 @@ void app::new_project(game_iso game) {
 				return std::make_optional(std::move(result));
 			} catch(stream_error& err) {
 				log << err.what() << "\n";
-				log << err.stack_trace;
+				log << err.stack_trace();
 			}
 			return std::optional<project_ptr>();
 		},
@@ -86,7 +86,7 @@ void app::open_project(std::string path) {
 				return std::make_optional(std::move(result));
 			} catch(stream_error& err) {
 				log << err.what() << "\n";
-				log << err.stack_trace;
+				log << err.stack_trace();
 			}
 			return std::optional<project_ptr>();
 		},
@@ -174,6 +174,7 @@ const char* settings_file_path = "wrench_settings.ini";
 void config::read() {
 	// Default settings
 	compression_threads = 8;
+	wad_cache_budget_mb = 1024;
 	gui_scale = 1.f;
 	vsync = true;
 	debug.stream_tracing = false;
@@ -186,6 +187,7 @@ void config::read() {
 			emulator_path =
 				toml::find_or(general_table, "emulator_path", emulator_path);
 			compression_threads = toml::find_or(general_table, "compression_threads", 8);
+			wad_cache_budget_mb = toml::find_or(general_table, "wad_cache_budget_mb", 1024);
 
 			auto gui_table = toml::find_or(settings_file, "gui", toml::value());
 			gui_scale = toml::find_or(gui_table, "scale", 1.f);
@@ -231,7 +233,8 @@ void config::write() {
 	toml::value file {
 		{"general", {
 			{"emulator_path", emulator_path},
-			{"compression_threads", compression_threads}
+			{"compression_threads", compression_threads},
+			{"wad_cache_budget_mb", wad_cache_budget_mb}
 		}},
 		{"gui", {
 			{"scale", gui_scale},
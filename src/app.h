@@ -96,6 +96,7 @@ struct config {
 	std::string emulator_path;
 	std::vector<game_iso> game_isos;
 	int compression_threads;
+	int wad_cache_budget_mb; // See iso_stream::evict_lru_wad_streams.
 	float gui_scale;
 	bool vsync;
 	struct {
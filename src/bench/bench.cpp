@@ -0,0 +1,193 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+# /*
+# 	Microbenchmarks for the codec and parser hot paths. Unlike the tests in
+# 	src/tests/, these only measure throughput - correctness is assumed. Run
+# 	with --save to record a baseline and --baseline to compare against one.
+# */
+
+#include <map>
+#include <chrono>
+#include <cstdio>
+#include <random>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <fstream>
+#include <functional>
+
+#include "../util.h"
+#include "../command_line.h"
+#include "../formats/wad.h"
+#include "../formats/vif.h"
+#include "../formats/world.h"
+
+struct bench_result {
+	std::string name;
+	double mb_per_s;
+};
+
+static std::vector<bench_result> results;
+
+// Time fn over the given number of iterations and report the throughput in
+// terms of how many bytes of input each iteration chews through. The fixed
+// iteration counts (rather than a time budget) keep runs comparable.
+static void run_bench(
+		const char* name, std::size_t bytes_per_iter, int iterations,
+		std::function<void()> fn) {
+	// Warm up caches and fault in the buffers so the first timed iteration
+	// isn't an outlier.
+	fn();
+
+	auto start = std::chrono::steady_clock::now();
+	for(int i = 0; i < iterations; i++) {
+		fn();
+	}
+	auto end = std::chrono::steady_clock::now();
+
+	double seconds = std::chrono::duration<double>(end - start).count();
+	double mb_per_s = (bytes_per_iter * (double) iterations) / (seconds * 1024.0 * 1024.0);
+	printf("%-24s %8.2f MB/s  (%d iterations, %.3fs)\n",
+		name, mb_per_s, iterations, seconds);
+	results.push_back({ name, mb_per_s });
+}
+
+// Mostly zeroes with the odd random byte - the same distribution the
+// compression test uses, and a reasonable stand-in for game data.
+static array_stream make_compressible_buffer(std::size_t size) {
+	std::mt19937 rng(1337); // Fixed seed so every run compresses the same bytes.
+	array_stream plaintext;
+	plaintext.buffer.reserve(size);
+	for(std::size_t i = 0; i < size; i++) {
+		if(rng() % 8 == 0) {
+			plaintext.write8(rng());
+		} else {
+			plaintext.write8(0);
+		}
+	}
+	return plaintext;
+}
+
+static void bench_wad_codec() {
+	static const std::size_t BUFFER_SIZE = 4 * 1024 * 1024;
+	array_stream plaintext = make_compressible_buffer(BUFFER_SIZE);
+
+	array_stream compressed;
+	run_bench("compress_wad", BUFFER_SIZE, 8, [&]() {
+		compressed = array_stream();
+		plaintext.seek(0);
+		compress_wad(compressed, plaintext, 1);
+	});
+
+	run_bench("decompress_wad", BUFFER_SIZE, 16, [&]() {
+		array_stream output;
+		compressed.seek(0);
+		decompress_wad(output, compressed);
+	});
+}
+
+static void bench_parse_vif_chain() {
+	// A chain of zeroes is a chain of NOPs: the smallest possible packets,
+	// which is the worst case for per-packet overhead.
+	static const std::size_t CHAIN_SIZE = 8 * 1024 * 1024;
+	array_stream chain;
+	chain.buffer.resize(CHAIN_SIZE, 0);
+
+	run_bench("parse_vif_chain", CHAIN_SIZE, 8, [&]() {
+		parse_vif_chain(&chain, 0, CHAIN_SIZE / 16);
+	});
+}
+
+static void bench_world_segment() {
+	// This one needs real game data: a decompressed R&C2/3 world segment,
+	// e.g. dumped with wadcli from a level file.
+	const char* world_path = getenv("WRENCH_BENCH_WORLD");
+	if(world_path == nullptr) {
+		printf("%-24s skipped (set WRENCH_BENCH_WORLD to a decompressed world segment)\n",
+			"world_segment");
+		return;
+	}
+
+	array_stream segment;
+	{
+		file_stream file(world_path);
+		file.seek(0);
+		stream::copy_n(segment, file, file.size());
+	}
+
+	// read_rac23 works out the game from the header itself.
+	run_bench("world_segment::read", segment.size(), 16, [&]() {
+		world_segment world;
+		world.backing = &segment;
+		world.read_rac23();
+	});
+
+	world_segment world;
+	world.backing = &segment;
+	world.read_rac23();
+	run_bench("world_segment::write", segment.size(), 16, [&]() {
+		array_stream dest;
+		world.write_rac23(dest);
+	});
+}
+
+int main(int argc, char** argv) {
+	cxxopts::Options options("wrench_bench", "Microbenchmarks for wrench's codec and parser hot paths.");
+	options.add_options()
+		("b,baseline", "A results file to compare against.",
+			cxxopts::value<std::string>())
+		("s,save", "Write the results out to the given file.",
+			cxxopts::value<std::string>());
+
+	auto args = parse_command_line_args(argc, argv, options);
+	std::string baseline_path = cli_get_or(args, "baseline", "");
+	std::string save_path = cli_get_or(args, "save", "");
+
+	bench_wad_codec();
+	bench_parse_vif_chain();
+	bench_world_segment();
+
+	if(baseline_path != "") {
+		std::map<std::string, double> baseline;
+		std::ifstream file(baseline_path);
+		std::string name;
+		double mb_per_s;
+		while(file >> name >> mb_per_s) {
+			baseline[name] = mb_per_s;
+		}
+
+		printf("\nvs %s:\n", baseline_path.c_str());
+		for(bench_result& result : results) {
+			auto iter = baseline.find(result.name);
+			if(iter == baseline.end()) {
+				printf("%-24s (not in baseline)\n", result.name.c_str());
+				continue;
+			}
+			double delta = (result.mb_per_s / iter->second - 1.0) * 100.0;
+			printf("%-24s %+7.1f%%\n", result.name.c_str(), delta);
+		}
+	}
+
+	if(save_path != "") {
+		std::ofstream file(save_path);
+		for(bench_result& result : results) {
+			file << result.name << " " << result.mb_per_s << "\n";
+		}
+	}
+}
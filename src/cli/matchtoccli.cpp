@@ -27,6 +27,27 @@
 #include "../command_line.h"
 #include "../formats/toc.h"
 
+// The parsed TOC is cached on disk keyed on a hash of the raw TOC bytes, so
+// iterating on a rebuilt ISO only pays for the sector scan when the TOC
+// actually changed.
+static table_of_contents read_toc_cached(
+		stream& iso, std::size_t toc_base, const array_stream& toc_stream) {
+	uint64_t hash = fnv1a(toc_stream.buffer.data(), toc_stream.buffer.size());
+	std::string path = std::string("cache/toc/") + int_to_hex(hash) + ".bin";
+	if(auto cached = toc_read_cache(path, toc_base)) {
+		return std::move(*cached);
+	}
+	table_of_contents toc = read_toc(iso, toc_base);
+	try {
+		fs::create_directory("cache");
+		fs::create_directory("cache/toc");
+	} catch(fs::filesystem_error&) {
+		// Best effort - toc_write_cache will just fail to open the file.
+	}
+	toc_write_cache(path, toc_base, toc);
+	return toc;
+}
+
 int main(int argc, char** argv) {
 	cxxopts::Options options("Match the contents of a table of contents with loose files.");
 	options.add_options()
@@ -52,8 +73,8 @@ int main(int argc, char** argv) {
 	iso.seek(toc_base);
 	stream::copy_n(toc_stream, iso, TOC_MAX_SIZE);
 	
-	table_of_contents toc = read_toc(iso, toc_base);
-	
+	table_of_contents toc = read_toc_cached(iso, toc_base, toc_stream);
+
 	std::vector<uint8_t> loose_file_buffer;
 	
 	// Match tables to files.
@@ -18,10 +18,12 @@
 
 #include <sstream>
 #include <iostream>
+#include <algorithm>
 
 #include "../util.h"
 #include "../command_line.h"
 #include "../fs_includes.h"
+#include "../thread_pool.h"
 #include "../formats/fip.h"
 #include "../formats/wad.h"
 #include "../formats/racpak.h"
@@ -31,7 +33,7 @@
 #	CLI tool to inspect, unpack and repack .WAD archives (racpaks).
 # */
 
-void extract_archive(std::string dest_dir, racpak& archive);
+void extract_archive(std::string dest_dir, std::string src_path, std::size_t src_offset);
 void scan_for_archives(std::string src_path);
 
 int main(int argc, char** argv) {
@@ -71,14 +73,11 @@ int main(int argc, char** argv) {
 			std::cout << entry.size << "\n";
 		}
 	} else if(command == "extract") {
-		file_stream src_file(src_path);
-		racpak archive(&src_file, src_offset, src_file.size());
-		
 		if(dest_path == "") {
 			std::cerr << "Must specify destination.\n";
 			return 0;
 		}
-		extract_archive(dest_path, archive);
+		extract_archive(dest_path, src_path, src_offset);
 	} else if(command == "extractdir") {
 		if(dest_path == "") {
 			std::cerr << "Must specify destination.\n";
@@ -88,12 +87,8 @@ int main(int argc, char** argv) {
 		auto end = fs::directory_iterator();
 		for(auto iter = begin; iter != end; iter++) {
 			auto path = iter->path();
-			
-			file_stream src_file(path.string());
-			racpak archive(&src_file, 0, src_file.size());
-			
 			std::string dest_dir = dest_path + "/" + path.filename().string();
-			extract_archive(dest_dir, archive);
+			extract_archive(dest_dir, path.string(), 0);
 		}
 	} else if(command == "scan") {
 		scan_for_archives(src_path);
@@ -102,27 +97,47 @@ int main(int argc, char** argv) {
 	}
 }
 
-void extract_archive(std::string dest_dir, racpak& archive) {
-	std::size_t num_entries = archive.num_entries();
+void extract_archive(std::string dest_dir, std::string src_path, std::size_t src_offset) {
+	std::size_t num_entries;
+	{
+		file_stream src_file(src_path);
+		racpak archive(&src_file, src_offset, src_file.size());
+		num_entries = archive.num_entries();
+	}
 	if(num_entries > 4096) {
 		std::cerr << "Error: More than 4096 entries in " << dest_dir << "!? It's probably not a valid racpack.\n";
 		return;
 	}
-	for(std::size_t i = 0; i < num_entries; i++) {
-		try {
-			auto entry = archive.entry(i);
-			fs::create_directories(dest_dir);
-			
-			std::string dest_name = std::to_string(i) + "_" + int_to_hex(entry.offset);
-			file_stream dest(dest_dir + "/" + dest_name, std::ios::in | std::ios::out | std::ios::trunc);
-			
-			stream* src = archive.open(entry);
-			src->seek(0);
-			stream::copy_n(dest, *src, src->size());
-		} catch(stream_error&) {
-			std::cerr << "Error: Failed to extract item " << i << " for " << dest_dir << "\n";
+	fs::create_directories(dest_dir);
+
+	// The entries are independent of each other, so fan the copies out over
+	// the thread pool. Streams aren't thread safe, so each worker gets its
+	// own file handle (and its own racpak over it) plus a reusable copy
+	// buffer, and walks the entry list with a stride.
+	std::size_t chunk_count = std::min(
+		thread_pool::shared().thread_count() + 1,
+		std::max(num_entries, (std::size_t) 1));
+	thread_pool::shared().parallel_for(chunk_count, [&](std::size_t chunk) {
+		file_stream src_file(src_path);
+		racpak archive(&src_file, src_offset, src_file.size());
+		std::vector<char> buffer;
+		for(std::size_t i = chunk; i < num_entries; i += chunk_count) {
+			try {
+				auto entry = archive.entry(i);
+
+				std::string dest_name = std::to_string(i) + "_" + int_to_hex(entry.offset);
+				file_stream dest(dest_dir + "/" + dest_name, std::ios::in | std::ios::out | std::ios::trunc);
+
+				stream* src = archive.open(entry);
+				buffer.resize(src->size());
+				src->seek(0);
+				src->read_n(buffer.data(), buffer.size());
+				dest.write_n(buffer.data(), buffer.size());
+			} catch(stream_error&) {
+				fprintf(stderr, "Error: Failed to extract item %ld for %s\n", i, dest_dir.c_str());
+			}
 		}
-	}
+	});
 }
 
 // Scan an ISO file for racpak archives, where the table of contents is not
@@ -33,6 +33,10 @@
 template <typename T>
 void read_shuffle_write(stream& backing, std::size_t offset, std::size_t num_elements);
 
+// Shuffle moby placements within each level's world segment in memory, then
+// rebuild the whole level file in one pass.
+static void shuffle_mobies(wrench_project& project);
+
 int main(int argc, char** argv) {
 	cxxopts::Options options("randomiser", "Randomise textures.");
 	options.add_options()
@@ -41,7 +45,9 @@ int main(int argc, char** argv) {
 		("p,project", "The path of the new project to create.",
 			cxxopts::value<std::string>())
 		("s,seed", "Password to seed the random number generator.",
-			cxxopts::value<std::string>());
+			cxxopts::value<std::string>())
+		("m,mode", "What to randomise. Possible values are: textures, mobies.",
+			cxxopts::value<std::string>()->default_value("textures"));
 
 	options.parse_positional({
 		"iso", "project", "seed"
@@ -51,6 +57,12 @@ int main(int argc, char** argv) {
 	std::string iso_path = cli_get(args, "iso");
 	std::string project_path = cli_get(args, "project");
 	std::string password = cli_get_or(args, "seed", "");
+	std::string mode = cli_get_or(args, "mode", "textures");
+
+	if(mode != "textures" && mode != "mobies") {
+		fprintf(stderr, "error: Invalid mode.\n");
+		return 1;
+	}
 	
 	if(password == "") {
 		srand(time(0));
@@ -76,7 +88,14 @@ int main(int argc, char** argv) {
 	
 	worker_logger log;
 	wrench_project project(game, log);
-	
+
+	if(mode == "mobies") {
+		shuffle_mobies(project);
+		project.set_project_path(project_path);
+		project.save();
+		return 0;
+	}
+
 	for(toc_level level : project.toc.levels) {
 		auto file_header = level::read_file_header(&project.iso, level.main_part.bytes());
 		proxy_stream file(&project.iso, file_header.base_offset.bytes(), 0);
@@ -127,6 +146,43 @@ int main(int argc, char** argv) {
 	project.save();
 }
 
+static void shuffle_mobies(wrench_project& project) {
+	// Unlike the texture shuffle, this one respects the seed.
+	std::mt19937 urng(rand());
+
+	for(std::size_t i = 0; i < project.toc.levels.size(); i++) {
+		toc_level& header = project.toc.levels[i];
+		try {
+			// Load the level directly instead of going through open_level so
+			// only one level is resident at a time.
+			level lvl;
+			sector32 base_offset = project.iso.read<sector32>(header.main_part.bytes() + 4);
+			lvl.read(&project.iso, header, header.main_part.bytes(), base_offset, base_offset, header.main_part_size.bytes());
+
+			// Swap the placements around but leave everything else - class,
+			// pvars, UIDs - attached to the original moby, so scripting that
+			// looks entities up by UID still finds them.
+			std::vector<moby_entity>& mobies = lvl.world.mobies;
+			std::vector<std::pair<glm::vec3, glm::vec3>> placements(mobies.size());
+			for(std::size_t j = 0; j < mobies.size(); j++) {
+				placements[j] = { mobies[j].position, mobies[j].rotation };
+			}
+			std::shuffle(placements.begin(), placements.end(), urng);
+			for(std::size_t j = 0; j < mobies.size(); j++) {
+				mobies[j].position = placements[j].first;
+				mobies[j].rotation = placements[j].second;
+			}
+
+			// One serialise-and-write pass per level, instead of a patch per
+			// entity going through the stream layer.
+			lvl.write_back(&project.iso);
+			printf("Shuffled %ld mobies in level %ld.\n", mobies.size(), i);
+		} catch(stream_error& err) {
+			fprintf(stderr, "warning: Failed to randomise level %ld: %s\n", i, err.what());
+		}
+	}
+}
+
 template <typename T>
 void read_shuffle_write(stream& backing, std::size_t offset, std::size_t num_elements) {
 	std::vector<T> elements(num_elements);
@@ -17,9 +17,11 @@
 */
 
 #include <sstream>
+#include <iostream>
 #include <nlohmann/json.hpp>
 
 #include "../util.h"
+#include "../thread_pool.h"
 #include "../command_line.h"
 #include "../formats/wad.h"
 #include "../formats/fip.h"
@@ -28,6 +30,67 @@
 #	CLI tool to scan game files for known data segments.
 # */
 
+static void scan_offset(file_stream& src, std::size_t offset, std::size_t buffer_size, std::ostream& out) {
+	proxy_stream segment(&src, offset, src.size() - offset);
+	stream* segment_ptr = &segment;
+
+	nlohmann::json outer_output;
+	nlohmann::json output;
+	array_stream decompressed_segment;
+
+	// If a segment is compressed, partially decompress it and then inspect
+	// the result. Otherwise just inspect the raw data.
+	char magic[4];
+	segment.seek(0);
+	segment.read_n(magic, 4);
+	if(validate_wad(magic)) {
+		auto wad = segment.read<wad_header>(0);
+		try {
+			// Decompress WAD.
+			array_stream dest_array;
+			array_stream src_array;
+
+			segment.seek(0);
+			stream::copy_n(src_array, segment, wad.total_size);
+
+			decompress_wad_n(dest_array, src_array, buffer_size);
+
+			stream::copy_n(decompressed_segment, dest_array, dest_array.size());
+			segment_ptr = &decompressed_segment;
+
+			outer_output["type"] = "wad";
+			std::size_t total_size = wad.total_size;
+			outer_output["compressed_size"] = total_size;
+		} catch(stream_error& e) {
+			output["error"] = e.what();
+		}
+	}
+
+	segment_ptr->seek(0);
+	segment_ptr->read_n(magic, 4);
+	if(validate_fip(magic)) {
+		auto fip = segment_ptr->read<fip_header>(0);
+		output["type"] = "fip";
+		int width = fip.width;
+		output["width"] = width;
+		int height = fip.height;
+		output["height"] = height;
+		output["size"] = sizeof(fip_header) + width * height;
+	}
+
+	if(!outer_output.empty()) {
+		outer_output["offset"] = offset;
+		outer_output["compressed_data"] = output;
+		out << outer_output.dump() << "\n";
+		return;
+	}
+
+	if(!output.empty()) {
+		output["offset"] = offset;
+		out << output.dump() << "\n";
+	}
+}
+
 int main(int argc, char** argv) {
 	cxxopts::Options options("scan", "Scan a given file for game data segments.");
 	options.add_options()
@@ -51,65 +114,31 @@ int main(int argc, char** argv) {
 
 	std::size_t buffer_size = std::max(sizeof(wad_header), sizeof(fip_header));
 	std::size_t max_offset = src.size() - buffer_size - initial_offset;
-	for(std::size_t offset = initial_offset; offset < max_offset; offset += alignment) {
-
-		proxy_stream segment(&src, offset, src.size() - offset);
-		stream* segment_ptr = &segment;
-
-		nlohmann::json outer_output;
-		nlohmann::json output;
-		array_stream decompressed_segment;
-
-		// If a segment is compressed, partially decompress it and then inspect
-		// the result. Otherwise just inspect the raw data.
-		char magic[4];
-		segment.seek(0);
-		segment.read_n(magic, 4);
-		if(validate_wad(magic)) {
-			auto wad = segment.read<wad_header>(0);
-			try {
-				// Decompress WAD.
-				array_stream dest_array;
-				array_stream src_array;
-				
-				uint32_t compressed_size = src.read<uint32_t>(0x3);
-				stream::copy_n(src_array, segment, compressed_size);
-				
-				decompress_wad_n(dest_array, src_array, buffer_size);
-				
-				stream::copy_n(decompressed_segment, dest_array, dest_array.size());
-				segment_ptr = &decompressed_segment;
-				
-				outer_output["type"] = "wad";
-				std::size_t total_size = wad.total_size;
-				outer_output["compressed_size"] = total_size;
-			} catch(stream_error& e) {
-				output["error"] = e.what();
-			}
-		}
+	std::size_t offset_count = 0;
+	if(initial_offset < max_offset) {
+		offset_count = (max_offset - initial_offset + alignment - 1) / alignment;
+	}
 
-		segment_ptr->seek(0);
-		segment_ptr->read_n(magic, 4);
-		if(validate_fip(magic)) {
-			auto fip = segment_ptr->read<fip_header>(0);
-			output["type"] = "fip";
-			int width = fip.width;
-			output["width"] = width;
-			int height = fip.height;
-			output["height"] = height;
-			output["size"] = sizeof(fip_header) + width * height;
-		}
-		
-		if(!outer_output.empty()) {
-			outer_output["offset"] = offset;
-			outer_output["compressed_data"] = output;
-			std::cout << outer_output.dump() << std::endl;
-			continue;
+	// Each candidate offset is independent, so the scan is split into one
+	// contiguous range of offsets per worker. Streams aren't thread safe, so
+	// every worker opens its own handle to the file, and results are buffered
+	// per range and printed in order at the end so the output matches what a
+	// serial scan would produce.
+	std::size_t chunk_count = std::min(
+		thread_pool::shared().thread_count() + 1, std::max(offset_count, (std::size_t) 1));
+	std::vector<std::string> results(chunk_count);
+	thread_pool::shared().parallel_for(chunk_count, [&](std::size_t chunk) {
+		file_stream chunk_src(src_path);
+		std::stringstream out;
+		std::size_t begin = chunk * offset_count / chunk_count;
+		std::size_t end = (chunk + 1) * offset_count / chunk_count;
+		for(std::size_t i = begin; i < end; i++) {
+			scan_offset(chunk_src, initial_offset + i * alignment, buffer_size, out);
 		}
+		results[chunk] = out.str();
+	});
 
-		if(!output.empty()) {
-			output["offset"] = offset;
-			std::cout << output.dump() << std::endl;
-		}
+	for(std::string& result : results) {
+		std::cout << result;
 	}
 }
@@ -63,31 +63,49 @@ int main(int argc, char** argv) {
 	}
 	std::vector<std::size_t> target_hash = hash_pixel_data(pixels.data(), 256);
 	
-	// Iterate over all uncompressed 2FIP textures.
-	for(std::size_t i = 0; i < iso.size(); i += 0x800) {
-		char magic[0x14];
-		iso.seek(i);
-		iso.read_n(magic, 0x14);
-		
-		std::optional<std::size_t> fip_offset;
-		if(validate_fip(magic)) {
-			fip_offset = 0;
-		} else if(validate_fip(magic + 0x10)) {
-			fip_offset = 0x10;
-		}
-		
-		if(fip_offset) {
-			// The sector contains a 2FIP texture.
-			std::size_t test_offset = i + *fip_offset;
-			char test_pixels[256];
-			iso.seek(test_offset + sizeof(fip_header));
-			iso.read_n(test_pixels, 256);
-			
-			// We cannot just compare each byte, since the palette indices
-			// may be different.
-			std::vector<std::size_t> test_hash = hash_pixel_data(test_pixels, 256);
-			if(test_hash == target_hash) {
-				std::cout << "Possible matching texture found at 0x" << std::hex << test_offset << "\n";
+	// Iterate over all uncompressed 2FIP textures. The file is pulled in as
+	// large blocks and the magic checks run over the resident buffer - the
+	// probes only ever look at two fixed offsets per sector, so this is just
+	// a (compiler-vectorised) memcmp per candidate rather than a seek and a
+	// small read per sector. Each block carries enough slack past its last
+	// sector that a hit near the end can be hashed without re-reading.
+	static const std::size_t SECTOR_SIZE = 0x800;
+	static const std::size_t BLOCK_SECTORS = 0x2000; // 16MiB blocks.
+	const std::size_t block_slack = 0x10 + sizeof(fip_header) + 256;
+	std::vector<char> block(BLOCK_SECTORS * SECTOR_SIZE + block_slack);
+	for(std::size_t base = 0; base < iso.size(); base += BLOCK_SECTORS * SECTOR_SIZE) {
+		std::size_t bytes = std::min(block.size(), iso.size() - base);
+		iso.seek(base);
+		iso.read_n(block.data(), bytes);
+
+		for(std::size_t s = 0; s < BLOCK_SECTORS; s++) {
+			std::size_t rel = s * SECTOR_SIZE;
+			if(base + rel + 0x14 > iso.size() || rel + 0x14 > bytes) {
+				break;
+			}
+			char* sector = block.data() + rel;
+
+			std::optional<std::size_t> fip_offset;
+			if(validate_fip(sector)) {
+				fip_offset = 0;
+			} else if(validate_fip(sector + 0x10)) {
+				fip_offset = 0x10;
+			}
+
+			if(fip_offset) {
+				// The sector contains a 2FIP texture.
+				std::size_t test_rel = rel + *fip_offset;
+				if(base + test_rel + sizeof(fip_header) + 256 > iso.size()) {
+					continue;
+				}
+				char* test_pixels = block.data() + test_rel + sizeof(fip_header);
+
+				// We cannot just compare each byte, since the palette indices
+				// may be different.
+				std::vector<std::size_t> test_hash = hash_pixel_data(test_pixels, 256);
+				if(test_hash == target_hash) {
+					std::cout << "Possible matching texture found at 0x" << std::hex << (base + test_rel) << "\n";
+				}
 			}
 		}
 	}
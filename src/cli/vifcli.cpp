@@ -20,12 +20,18 @@
 # 	CLI tool to parse VIF chains.
 # */
 
-#include <iostream>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
 
 #include "../util.h"
 #include "../command_line.h"
 #include "../formats/vif.h"
 
+// Big enough that we only pay for a write syscall every few thousand lines.
+static const std::size_t OUTPUT_FLUSH_THRESHOLD = 1024 * 64;
+
 int main(int argc, char** argv) {
 	cxxopts::Options options("vif", "Parse PS2 VIF chains until an invalid VIF code is encountered.");
 	options.add_options()
@@ -46,20 +52,63 @@ int main(int argc, char** argv) {
 	std::size_t end_offset = parse_number(cli_get_or(args, "end", "0"));
 
 	file_stream src(src_path);
-	std::vector<vif_packet> chain = parse_vif_chain(&src, offset, SIZE_MAX);
-	while(chain.size() > 0) {
-		vif_packet& packet = chain.front();
-		if(packet.error == "") {
-			std::cout << std::hex << packet.address << " " << packet.code.to_string() << std::endl;
-			chain.erase(chain.begin());
+	if(offset >= src.size()) {
+		fprintf(stderr, "error: Offset is past the end of the file.\n");
+		return 1;
+	}
+
+	// Read the whole chain up front, then disassemble packet by packet
+	// straight out of the buffer into a chunked writer. This bounds the
+	// working set to the input size - the old code materialised every
+	// packet's payload into a vif_packet and flushed stdout once per line.
+	std::vector<uint8_t> buffer(src.size() - offset);
+	src.seek(offset);
+	src.read_v(buffer);
+
+	std::string out;
+	out.reserve(OUTPUT_FLUSH_THRESHOLD + 0x100);
+	auto emit = [&](std::size_t address, const std::string& text) {
+		char prefix[0x20];
+		snprintf(prefix, sizeof(prefix), "%lx ", address);
+		out += prefix;
+		out += text;
+		out += '\n';
+		if(out.size() >= OUTPUT_FLUSH_THRESHOLD) {
+			fwrite(out.data(), 1, out.size(), stdout);
+			out.clear();
+		}
+	};
+
+	// pos is the file offset of the next VIF code. Like parse_vif_chain, the
+	// address reported for each packet points just past the code itself.
+	std::size_t pos = offset;
+	while(pos - offset + sizeof(uint32_t) <= buffer.size()) {
+		std::size_t address = pos + 4;
+
+		uint32_t val;
+		std::memcpy(&val, &buffer[pos - offset], sizeof(uint32_t));
+		std::optional<vif_code> code = vif_code::parse(val);
+
+		const char* error = nullptr;
+		if(!code) {
+			error = "failed to parse VIF code";
+		} else if(code->packet_size() > 0x10000) {
+			error = "packet_size > 0x10000";
+		}
+
+		if(error == nullptr) {
+			emit(address, code->to_string());
+			pos += code->packet_size();
 		} else {
-			std::cout << std::hex << packet.address << " " << packet.error << std::endl;
-			if(packet.address > end_offset) {
+			emit(address, error);
+			if(address > end_offset) {
 				break;
-			} else {
-				chain = parse_vif_chain(&src, packet.address, SIZE_MAX);
-				continue;
 			}
+			// Resume the scan just past the bad code, where the old code
+			// would restart parse_vif_chain from.
+			pos = address;
 		}
 	}
+
+	fwrite(out.data(), 1, out.size(), stdout);
 }
@@ -16,9 +16,12 @@
 	along with this program.  If not, see <https://www.gnu.org/licenses/>.
 */
 
+#include <atomic>
+#include <fstream>
 #include <sstream>
 
 #include "../util.h"
+#include "../thread_pool.h"
 #include "../command_line.h"
 #include "../formats/wad.h"
 
@@ -28,11 +31,69 @@
 void copy_and_decompress(stream& dest, stream& src);
 void copy_and_compress(stream& dest, stream& src);
 
+// Decompress many segments from one input file in a single process. The
+// manifest has one job per line: the offset of the WAD header (the size is
+// read from the header itself), then the output path. Lines starting with
+// '#' are skipped. Jobs run on the shared thread pool, with one handle to
+// the input file per worker since streams aren't thread safe.
+static int run_batch(std::string src_path, std::string manifest_path) {
+	struct batch_job {
+		std::size_t offset;
+		std::string dest_path;
+	};
+	std::vector<batch_job> jobs;
+	std::ifstream manifest(manifest_path);
+	if(!manifest) {
+		std::cerr << "Failed to open manifest file.\n";
+		return 1;
+	}
+	std::string line;
+	while(std::getline(manifest, line)) {
+		if(line.empty() || line[0] == '#') {
+			continue;
+		}
+		std::stringstream ss(line);
+		std::string offset_str, dest_path;
+		ss >> offset_str >> dest_path;
+		if(offset_str.empty() || dest_path.empty()) {
+			std::cerr << "Invalid manifest line: " << line << "\n";
+			return 1;
+		}
+		jobs.push_back({ parse_number(offset_str), dest_path });
+	}
+
+	std::atomic<std::size_t> error_count = 0;
+	std::size_t chunk_count = std::min(
+		thread_pool::shared().thread_count() + 1, std::max(jobs.size(), (std::size_t) 1));
+	thread_pool::shared().parallel_for(chunk_count, [&](std::size_t chunk) {
+		file_stream src_file(src_path);
+		for(std::size_t i = chunk; i < jobs.size(); i += chunk_count) {
+			batch_job& job = jobs[i];
+			try {
+				uint32_t compressed_size = src_file.read<uint32_t>(job.offset + 0x3);
+				array_stream src, dest;
+				src_file.seek(job.offset);
+				stream::copy_n(src, src_file, compressed_size);
+				decompress_wad(dest, src);
+
+				file_stream dest_file(job.dest_path, std::ios::in | std::ios::out | std::ios::trunc);
+				dest.seek(0);
+				stream::copy_n(dest_file, dest, dest.size());
+			} catch(stream_error& e) {
+				fprintf(stderr, "error: Job at offset 0x%lx failed: %s\n",
+					(unsigned long) job.offset, e.what());
+				error_count++;
+			}
+		}
+	});
+	return error_count == 0 ? 0 : 1;
+}
+
 int main(int argc, char** argv) {
 	cxxopts::Options options(argv[0], "Compress and decompress WAD segments.");
-	options.positional_help("compress|decompress <input file> <output file>");
+	options.positional_help("compress|decompress <input file> <output file>, or batch <input file> <manifest file>");
 	options.add_options()
-		("c,command", "The operation to perform. Possible values are: compress, decompress.",
+		("c,command", "The operation to perform. Possible values are: compress, decompress, batch. For batch, the third argument is a manifest with one '<offset> <output file>' decompression job per line.",
 			cxxopts::value<std::string>())
 		("s,src", "The input file.",
 			cxxopts::value<std::string>())
@@ -58,6 +119,11 @@ int main(int argc, char** argv) {
 		thread_count = 1;
 	}
 	
+	if(command == "batch") {
+		// In batch mode the dest argument names the manifest file.
+		return run_batch(src_path, dest_path);
+	}
+
 	bool decompress = command == "decompress";
 	bool compress = command == "compress";
 	if(!decompress && !compress) {
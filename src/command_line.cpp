@@ -18,11 +18,14 @@
 
 #include "command_line.h"
 
+#include <atomic>
 #include <sstream>
 #include <iostream>
 
 #include "util.h"
 #include "config.h"
+#include "fs_includes.h"
+#include "thread_pool.h"
 
 cxxopts::ParseResult parse_command_line_args(int argc, char** argv, cxxopts::Options options) {
 	options.add_options()
@@ -65,9 +68,10 @@ int run_cli_converter(
 	options.add_options()
 		("c,command", command_description.c_str(),
 			cxxopts::value<std::string>())
-		("s,src", "The input file.",
+		("s,src", "The input file, or a directory to convert recursively in batch.",
+			cxxopts::value<std::string>())
+		("d,dest", "The output file, or the output directory in batch mode.",
 			cxxopts::value<std::string>())
-		("d,dest", "The output file.", cxxopts::value<std::string>())
 		("o,offset", "The offset in the input file where the header begins.",
 			cxxopts::value<std::string>()->default_value("0"));
 
@@ -81,17 +85,47 @@ int run_cli_converter(
 	std::string dest_path = cli_get(args, "dest");
 	std::size_t offset = parse_number(cli_get_or(args, "offset", "0"));
 
-	file_stream src(src_path);
-	file_stream dest(dest_path, std::ios::in | std::ios::out | std::ios::trunc);
-	
-	proxy_stream src_proxy(&src, offset, src.size() - offset);
-
 	auto op = commands.find(command);
 	if(op == commands.end()) {
 		std::cerr << "Invalid command.\n";
 		return 1;
 	}
 
+	// Batch mode: if the input is a directory, every file under it is
+	// converted to a file of the same relative path under the output
+	// directory, with the jobs spread over the shared thread pool. Files
+	// that fail to convert are reported and skipped.
+	if(fs::is_directory(src_path)) {
+		std::vector<fs::path> inputs;
+		for(auto& entry : fs::recursive_directory_iterator(src_path)) {
+			if(entry.is_regular_file()) {
+				inputs.push_back(entry.path());
+			}
+		}
+
+		std::atomic<std::size_t> error_count = 0;
+		thread_pool::shared().parallel_for(inputs.size(), [&](std::size_t i) {
+			fs::path out_path = fs::path(dest_path) / fs::relative(inputs[i], src_path);
+			try {
+				fs::create_directories(out_path.parent_path());
+				file_stream src(inputs[i].string());
+				file_stream dest(out_path.string(), std::ios::in | std::ios::out | std::ios::trunc);
+				proxy_stream src_proxy(&src, offset, src.size() - offset);
+				(*op).second(dest, src_proxy);
+			} catch(std::exception& e) {
+				fprintf(stderr, "error: Failed to convert %s: %s\n",
+					inputs[i].string().c_str(), e.what());
+				error_count++;
+			}
+		});
+		return error_count == 0 ? 0 : 1;
+	}
+
+	file_stream src(src_path);
+	file_stream dest(dest_path, std::ios::in | std::ios::out | std::ios::trunc);
+
+	proxy_stream src_proxy(&src, offset, src.size() - offset);
+
 	(*op).second(dest, src_proxy);
 
 	return 0;
@@ -19,6 +19,8 @@
 #include "armor_archive.h"
 
 #include "../util.h"
+#include "../thread_pool.h"
+#include "fip.h"
 
 armor_archive::armor_archive() {}
 
@@ -27,14 +29,24 @@ bool armor_archive::read(stream& iso, const toc_table& table) {
 	if(table.header.size > 0x1000) {
 		return false;
 	}
-	
+
+	// Pass one: pull each set's data out of the ISO serially (streams are not
+	// thread safe), making an in-memory copy of every model and a FIP slice
+	// for every texture.
+	struct pending_texture {
+		std::size_t model; // Index into models.
+		std::string name;
+		std::size_t fip_offset; // For the error message.
+	};
+	std::vector<array_stream> fip_slices;
+	std::vector<pending_texture> pending_textures;
+
 	for(std::size_t i = 0; i < table.data.size(); i += 16) {
 		auto armor = table.data.peek<armor_table_entry>(i);
 		if(armor.texture.sectors == 0) {
 			continue; // We're probably reading off the end of the array.
 		}
-		
-		// Read the model.
+
 		auto model_header = iso.peek<moby_model_armor_header>(base_offset + armor.model.bytes());
 		uint32_t submodel_table_offset = model_header.submodel_table_offset;
 		if(submodel_table_offset > 0x10) {
@@ -46,49 +58,68 @@ bool armor_archive::read(stream& iso, const toc_table& table) {
 		if(armor.model.bytes() == 0) {
 			continue;
 		}
-		
+
+		auto& model_data = _model_data.emplace_back(std::make_unique<array_stream>());
+		iso.seek(base_offset + armor.model.bytes());
+		stream::copy_n(*model_data, iso, armor.model_size.bytes());
+
 		moby_model& model = models.emplace_back(
-			&iso,
-			base_offset + armor.model.bytes(),
+			model_data.get(),
+			0,
 			armor.model_size.bytes(),
 			moby_model_header_type::ARMOR);
 		model.set_name("armor " + std::to_string(i / 16));
-		model.read();
-		
+
 		std::string set_name = std::string("set") + std::to_string(i / 16);
-		
-		// Single texture.
 		std::size_t fip_offset = base_offset + armor.texture.bytes();
-		std::optional<texture> tex = create_fip_texture(&iso, fip_offset);
-		if(tex) {
-			model.texture_indices.push_back(textures.size());
-			textures.emplace_back(std::move(*tex));
-			textures.back().name = set_name;
+
+		// Single texture.
+		if(validate_fip(iso.peek<fip_header>(fip_offset).magic)) {
+			copy_fip_slice(fip_slices.emplace_back(), iso, fip_offset);
+			pending_textures.push_back({ models.size() - 1, set_name, fip_offset });
 			continue;
 		}
-	
+
 		// One or more textures.
-		auto num_textures = iso.read<uint32_t>(base_offset + armor.texture.bytes());
+		auto num_textures = iso.read<uint32_t>(fip_offset);
 		if(num_textures > 0x1000) {
 			return false;
 		}
-		
+
 		for(std::size_t j = 0; j < num_textures; j++) {
 			auto rel_offset = iso.read<uint32_t>();
-			std::size_t abs_offset = base_offset + armor.texture.bytes() + rel_offset;
-			std::optional<texture> tex = create_fip_texture(&iso, abs_offset);
-			if(tex) {
-				model.texture_indices.push_back(textures.size());
-				textures.emplace_back(std::move(*tex));
-				textures.back().name =
-					set_name + "_part" + std::to_string(j);
-			} else {
-				std::cerr << "Failed to load 2FIP texture from ARMOR.WAD at "
-				          << iso.resource_path().c_str()
-				          << "+0x" << std::hex << fip_offset << "\n";
-			}
+			std::size_t abs_offset = fip_offset + rel_offset;
+			std::size_t pos = iso.tell();
+			copy_fip_slice(fip_slices.emplace_back(), iso, abs_offset);
+			iso.seek(pos);
+			pending_textures.push_back({
+				models.size() - 1,
+				set_name + "_part" + std::to_string(j),
+				fip_offset
+			});
+		}
+	}
+
+	// Pass two: parse the models across the pool. Each one reads from its own
+	// in-memory copy, so there's no contention on the ISO.
+	thread_pool::shared().parallel_for(models.size(), [&](std::size_t i) {
+		models[i].read();
+	});
+
+	// ... and decode the textures the same way.
+	std::vector<std::optional<texture>> decoded = decode_fip_textures(fip_slices);
+	for(std::size_t i = 0; i < decoded.size(); i++) {
+		pending_texture& pending = pending_textures[i];
+		if(decoded[i]) {
+			models[pending.model].texture_indices.push_back(textures.size());
+			textures.emplace_back(std::move(*decoded[i]));
+			textures.back().name = pending.name;
+		} else {
+			std::cerr << "Failed to load 2FIP texture from ARMOR.WAD at "
+			          << iso.resource_path().c_str()
+			          << "+0x" << std::hex << pending.fip_offset << "\n";
 		}
 	}
-	
+
 	return true;
 }
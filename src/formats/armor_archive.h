@@ -44,9 +44,15 @@ public:
 	armor_archive();
 	
 	bool read(stream& iso, const toc_table& table);
-	
+
 	std::vector<moby_model> models;
 	std::vector<texture> textures;
+
+private:
+	// In-memory copy of each set's model data. The models' backing streams
+	// point into these rather than at the ISO, so the sets can be parsed in
+	// parallel (streams aren't thread safe, but each model gets its own).
+	std::vector<std::unique_ptr<array_stream>> _model_data;
 };
 
 #endif
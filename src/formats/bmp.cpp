@@ -55,19 +55,27 @@ void texture_to_bmp(stream& dest, texture* src) {
 	info.num_important_colours = 0;
 	dest.write<bmp_info_header>(info);
 
+	std::vector<bmp_colour_table_entry> palette(256);
 	for(int i = 0; i < 256; i++) {
-		bmp_colour_table_entry pixel;
-		pixel.b = src->palette[i].b;
-		pixel.g = src->palette[i].g;
-		pixel.r = src->palette[i].r;
-		pixel.pad = 0;
-		dest.write<bmp_colour_table_entry>(pixel);
+		palette[i].b = src->palette[i].b;
+		palette[i].g = src->palette[i].g;
+		palette[i].r = src->palette[i].r;
+		palette[i].pad = 0;
 	}
+	dest.write_v(palette);
 
+	// Assemble the flipped, padded pixel block in one reusable buffer and
+	// flush it with a single write instead of a stream call per row.
 	uint32_t row_size = ((info.bits_per_pixel * info.width + 31) / 32) * 4;
-	for(int y = info.height - 1; y >= 0; y--) {
-		dest.write_n(reinterpret_cast<char*>(src->pixels.data()) + y * row_size, row_size);
+	thread_local std::vector<uint8_t> image;
+	image.assign(info.height * row_size, 0);
+	for(int y = 0; y < info.height; y++) {
+		std::memcpy(
+			&image[y * row_size],
+			src->pixels->data() + (info.height - 1 - y) * info.width,
+			info.width);
 	}
+	dest.write_n(reinterpret_cast<char*>(image.data()), image.size());
 }
 
 
@@ -100,20 +108,31 @@ void bmp_to_texture(texture* dest, stream& src) {
 	// Some BMP files have a larger header.
 	src.seek(secondary_header_offset + info_header.info_header_size);
 	
+	std::vector<bmp_colour_table_entry> palette(info_header.num_colours);
+	src.read_v(palette);
 	uint32_t i;
 	for(i = 0; i < info_header.num_colours; i++) {
-		auto src_pixel = src.read<bmp_colour_table_entry>();
-		dest->palette[i] = { src_pixel.r, src_pixel.g, src_pixel.b, 0x80 };
+		dest->palette[i] = { palette[i].r, palette[i].g, palette[i].b, 0x80 };
 	}
 	for(; i < 256; i++) {
 		// Set unused palette entries to black.
 		dest->palette[i] = { 0, 0, 0, 0x80 };
 	}
 
+	// Slurp the padded pixel block in one read and flip it in memory.
 	uint32_t row_size = ((info_header.bits_per_pixel * info_header.width + 31) / 32) * 4;
+	thread_local std::vector<uint8_t> block;
+	block.resize(info_header.height * row_size);
+	src.read_n(reinterpret_cast<char*>(block.data()), block.size());
+
 	std::vector<uint8_t> pixels(info_header.width * info_header.height);
-	for(int y = info_header.height - 1; y >= 0; y--) {
-		src.read_n(reinterpret_cast<char*>(pixels.data()) + y * row_size, row_size);
+	for(int y = 0; y < info_header.height; y++) {
+		std::memcpy(
+			&pixels[y * info_header.width],
+			&block[(info_header.height - 1 - y) * row_size],
+			info_header.width);
 	}
-	dest->pixels = pixels;
+	// The old buffer may be shared with other textures, so don't write into
+	// it - give this texture a fresh one.
+	dest->pixels = std::make_shared<std::vector<uint8_t>>(std::move(pixels));
 }
@@ -18,11 +18,28 @@
 
 #include "fip.h"
 
+#include <array>
 #include <cstring>
 #include <stdexcept>
 
 #include "bmp.h"
 
+// Translate a whole buffer of palette indices at once through a precomputed
+// table. Keeping this loop free of virtual stream calls lets the compiler
+// unroll and vectorise it, which matters when exporting whole texture sets.
+static void decode_palette_indices(uint8_t* indices, std::size_t count) {
+	static const std::array<uint8_t, 256> table = [] {
+		std::array<uint8_t, 256> result;
+		for(int i = 0; i < 256; i++) {
+			result[i] = decode_palette_index(i);
+		}
+		return result;
+	}();
+	for(std::size_t i = 0; i < count; i++) {
+		indices[i] = table[indices[i]];
+	}
+}
+
 bool validate_fip(char* magic) {
 	return std::memcmp(magic, "2FIP", 4) == 0;
 }
@@ -60,26 +77,34 @@ void fip_to_bmp(stream& dest, stream& src) {
 	info.num_important_colours = 0;
 	dest.write<bmp_info_header>(info);
 
+	std::vector<bmp_colour_table_entry> palette(256);
 	for(int i = 0; i < 256; i++) {
 		auto src_pixel = src_header.palette[i];
-		bmp_colour_table_entry pixel;
-		pixel.b = src_pixel.b;
-		pixel.g = src_pixel.g;
-		pixel.r = src_pixel.r;
-		pixel.pad = 0;
-		dest.write<bmp_colour_table_entry>(pixel);
+		palette[i].b = src_pixel.b;
+		palette[i].g = src_pixel.g;
+		palette[i].r = src_pixel.r;
+		palette[i].pad = 0;
 	}
+	dest.write_v(palette);
 
 	uint32_t row_size = ((info.bits_per_pixel * info.width + 31) / 32) * 4;
-	std::size_t pixel_data = dest.tell();
 
-	for(int y = info.height - 1; y >= 0; y--) {
-		dest.seek(pixel_data + y * row_size);
-		for(int x = 0; x < info.width; x++) {
-			uint8_t palette_index = src.read<uint8_t>();
-			dest.write<uint8_t>(decode_palette_index(palette_index));
-		}
+	std::vector<uint8_t> pixels(info.width * info.height);
+	src.read_n((char*) pixels.data(), pixels.size());
+	decode_palette_indices(pixels.data(), pixels.size());
+
+	// Assemble the flipped, padded pixel block in one reusable buffer and
+	// flush it with a single write - batch exports were spending most of
+	// their time in a stream call per row.
+	thread_local std::vector<uint8_t> image;
+	image.assign(info.height * row_size, 0);
+	for(int y = 0; y < info.height; y++) {
+		std::memcpy(
+			&image[y * row_size],
+			&pixels[(info.height - 1 - y) * info.width],
+			info.width);
 	}
+	dest.write_n((char*) image.data(), image.size());
 }
 
 void bmp_to_fip(stream& dest, stream& src) {
@@ -108,13 +133,14 @@ void bmp_to_fip(stream& dest, stream& src) {
 	std::memset(header.unknown2, 0, sizeof(header.unknown2));
 	// Some BMP files have a larger header.
 	src.seek(secondary_header_offset + info_header.info_header_size);
+	std::vector<bmp_colour_table_entry> palette(info_header.num_colours);
+	src.read_v(palette);
 	uint32_t i;
 	for(i = 0; i < info_header.num_colours; i++) {
-		auto src_pixel = src.read<bmp_colour_table_entry>();
 		auto& dest_pixel = header.palette[i];
-		dest_pixel.r = src_pixel.r;
-		dest_pixel.g = src_pixel.g;
-		dest_pixel.b = src_pixel.b;
+		dest_pixel.r = palette[i].r;
+		dest_pixel.g = palette[i].g;
+		dest_pixel.b = palette[i].b;
 		dest_pixel.a = 0x80;
 	}
 	for(; i < 256; i++) {
@@ -130,13 +156,22 @@ void bmp_to_fip(stream& dest, stream& src) {
 	uint32_t row_size = ((info_header.bits_per_pixel * info_header.width + 31) / 32) * 4;
 	uint32_t pixel_data = file_header.pixel_data.value;
 
-	for(int y = info_header.height - 1; y >= 0; y--) {
-		src.seek(pixel_data + y * row_size);
-		for(int x = 0; x < info_header.width; x++) {
-			uint8_t palette_index = src.read<uint8_t>();
-			dest.write<uint8_t>(decode_palette_index(palette_index));
-		}
+	// Slurp the whole padded pixel block and flip it in memory instead of a
+	// seek and two stream calls per row.
+	thread_local std::vector<uint8_t> block;
+	block.resize(info_header.height * row_size);
+	src.seek(pixel_data);
+	src.read_n((char*) block.data(), block.size());
+
+	std::vector<uint8_t> out(info_header.width * info_header.height);
+	for(int y = 0; y < info_header.height; y++) {
+		std::memcpy(
+			&out[y * info_header.width],
+			&block[(info_header.height - 1 - y) * row_size],
+			info_header.width);
 	}
+	decode_palette_indices(out.data(), out.size());
+	dest.write_n((char*) out.data(), out.size());
 }
 
 uint8_t decode_palette_index(uint8_t index) {
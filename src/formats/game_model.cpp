@@ -18,12 +18,16 @@
 
 #include "game_model.h"
 
+#include <mutex>
+
 #include <glm/glm.hpp>
 #include <glm/common.hpp>
 #include <glm/gtc/matrix_transform.hpp>
 
 #include "../app.h"
 #include "../util.h"
+#include "../xxhash.h"
+#include "../thread_pool.h"
 #include "model_utils.h"
 
 moby_model::moby_model(
@@ -58,57 +62,110 @@ void moby_model::read() {
 	submodel_entries.resize(submodel_count);
 	_backing.seek(submodel_table_offset);
 	_backing.read_v(submodel_entries);
-	
-	submodels.clear();
+
+	// Most moby classes appear in many levels with identical data, so parsed
+	// submodels are pooled between models with the same name and source bytes
+	// instead of being parsed (and having GL buffers built) once per level.
+	// weak_ptr entries mean the pool never keeps submodels alive on its own.
+	// The mutex is for armor_archive, which parses its models on the pool;
+	// map entries are stable so holding a pointer across the parse is fine.
+	static std::mutex pool_mutex;
+	static std::map<std::pair<std::string, uint64_t>, std::weak_ptr<std::vector<moby_submodel>>> pool;
+	uint64_t source_hash = hash_source_data(submodel_entries);
+	std::weak_ptr<std::vector<moby_submodel>>* pool_entry = nullptr;
+	if(source_hash != 0) {
+		std::lock_guard<std::mutex> guard(pool_mutex);
+		pool_entry = &pool[{_backing.name, source_hash}];
+		if(std::shared_ptr<std::vector<moby_submodel>> pooled = pool_entry->lock()) {
+			submodels = std::move(pooled);
+			return;
+		}
+	}
+
+	// Pull everything out of the stream serially; the interpretation work
+	// runs across threads below.
+	auto parsed = std::make_shared<std::vector<moby_submodel>>();
 	for(moby_submodel_entry& entry : submodel_entries) {
 		moby_submodel submodel;
-		
+
 		submodel.vif_list = parse_vif_chain(
 			&_backing, entry.vif_list_offset, entry.vif_list_quadword_count);
-			
-		auto interpreted_vif_list = interpret_vif_list(submodel.vif_list);
-		submodel.index_header = interpreted_vif_list.index_header;
-		submodel.st_coords = std::move(interpreted_vif_list.st_data);
-		submodel.subsubmodels = read_subsubmodels(interpreted_vif_list);
-		
+
 		auto vertex_header = _backing.read<moby_model_vertex_table_header>(entry.vertex_offset);
 		if(vertex_header.vertex_table_offset / 0x10 > entry.vertex_data_quadword_count) {
-			warn_current_submodel("bad vertex table offset or size");
+			warn_submodel(parsed->size(), "bad vertex table offset or size");
 			continue;
 		}
 		if(entry.transfer_vertex_count != vertex_header.transfer_vertex_count) {
-			warn_current_submodel("conflicting vertex counts");
+			warn_submodel(parsed->size(), "conflicting vertex counts");
 			continue;
 		}
 		if(entry.unknown_e != (3 + entry.transfer_vertex_count) / 4) {
-			warn_current_submodel("weird value in submodel table entry at +0xe");
+			warn_submodel(parsed->size(), "weird value in submodel table entry at +0xe");
 			continue;
 		}
 		if(entry.unknown_d != (0xf + entry.transfer_vertex_count * 6) / 0x10) {
-			warn_current_submodel("weird value in submodel table entry at +0xd");
+			warn_submodel(parsed->size(), "weird value in submodel table entry at +0xd");
 			continue;
 		}
 		submodel.vertices.resize(vertex_header.vertex_count_2 + vertex_header.vertex_count_4 + vertex_header.main_vertex_count);
 		_backing.seek(entry.vertex_offset + vertex_header.vertex_table_offset);
 		_backing.read_v(submodel.vertices);
-		
+
 		// This is almost certainly wrong, but makes the models look better for the time being.
 		if(submodel.vertices.size() > 0) {
 			for(std::size_t i = 0; i < vertex_header.vertex_count_8; i++) {
 				submodel.vertices.push_back(submodel.vertices.back());
 			}
 		}
-		
+
+		parsed->emplace_back(std::move(submodel));
+	}
+
+	// Interpreting the VIF lists is pure CPU work on buffers we've already
+	// read, and submodels are independent of each other, so fan it out. Note
+	// that the stream reads above must stay on this thread as streams are not
+	// thread safe.
+	thread_pool::shared().parallel_for(parsed->size(), [&](std::size_t i) {
+		moby_submodel& submodel = (*parsed)[i];
+		auto interpreted_vif_list = interpret_vif_list(submodel.vif_list, i);
+		submodel.index_header = interpreted_vif_list.index_header;
+		submodel.st_coords = std::move(interpreted_vif_list.st_data);
+		submodel.subsubmodels = read_subsubmodels(std::move(interpreted_vif_list), i);
 		if(!validate_indices(submodel)) {
-			warn_current_submodel("indices that overrun the vertex table");
+			warn_submodel(i, "indices that overrun the vertex table");
 		}
-		
-		submodels.emplace_back(std::move(submodel));
+	});
+
+	submodels = std::move(parsed);
+	if(pool_entry != nullptr) {
+		std::lock_guard<std::mutex> guard(pool_mutex);
+		*pool_entry = submodels;
+	}
+}
+
+uint64_t moby_model::hash_source_data(const std::vector<moby_submodel_entry>& entries) {
+	XXH64_CTX ctx;
+	XXH64Init(&ctx, 0);
+	XXH64Update(&ctx, (const uint8_t*) entries.data(), entries.size() * sizeof(moby_submodel_entry));
+	for(const moby_submodel_entry& entry : entries) {
+		const char* vif_list = _backing.map_n(
+			entry.vif_list_offset, entry.vif_list_quadword_count * 0x10);
+		const char* vertex_data = _backing.map_n(
+			entry.vertex_offset, entry.vertex_data_quadword_count * 0x10);
+		if(vif_list == nullptr || vertex_data == nullptr) {
+			// The backing isn't resident in memory (e.g. armor models read
+			// straight out of the ISO), so this model can't be pooled.
+			return 0;
+		}
+		XXH64Update(&ctx, (const uint8_t*) vif_list, entry.vif_list_quadword_count * 0x10);
+		XXH64Update(&ctx, (const uint8_t*) vertex_data, entry.vertex_data_quadword_count * 0x10);
 	}
+	return XXH64Final(&ctx) | 1; // Zero means "don't pool".
 }
 
 moby_model::interpreted_moby_vif_list moby_model::interpret_vif_list(
-		const std::vector<vif_packet>& vif_list) {
+		const std::vector<vif_packet>& vif_list, std::size_t submodel_index) {
 	interpreted_moby_vif_list result;
 	
 	std::size_t unpack_index = 0;
@@ -121,7 +178,7 @@ moby_model::interpreted_moby_vif_list moby_model::interpret_vif_list(
 		switch(unpack_index) {
 			case 0: { // ST unpack.
 				if(packet.code.unpack.vnvl != vif_vnvl::V2_16) {
-					warn_current_submodel("malformed first UNPACK (wrong format)");
+					warn_submodel(submodel_index, "malformed first UNPACK (wrong format)");
 					return {};
 				}
 				result.st_data.resize(packet.data.size() / sizeof(moby_model_st));
@@ -130,7 +187,7 @@ moby_model::interpreted_moby_vif_list moby_model::interpret_vif_list(
 			}
 			case 1: { // Index buffer unpack.
 				if(packet.data.size() < 4) {
-					warn_current_submodel("malformed second UNPACK (too small)");
+					warn_submodel(submodel_index, "malformed second UNPACK (too small)");
 					return {};
 				}
 				result.index_header = *(moby_model_index_header*) &packet.data.front();
@@ -140,11 +197,11 @@ moby_model::interpreted_moby_vif_list moby_model::interpret_vif_list(
 			}
 			case 2: { // Texture unpack (optional).
 				if(packet.data.size() % sizeof(moby_model_texture_data) != 0) {
-					warn_current_submodel("malformed third UNPACK (wrong size)");
+					warn_submodel(submodel_index, "malformed third UNPACK (wrong size)");
 					return {};
 				}
 				if(packet.code.unpack.vnvl != vif_vnvl::V4_32) {
-					warn_current_submodel("malformed third UNPACK (wrong format)");
+					warn_submodel(submodel_index, "malformed third UNPACK (wrong format)");
 					return {};
 				}
 				result.textures.resize(packet.data.size() / sizeof(moby_model_texture_data));
@@ -152,7 +209,7 @@ moby_model::interpreted_moby_vif_list moby_model::interpret_vif_list(
 				break;
 			}
 			case 3: {
-					warn_current_submodel("too many UNPACK packets");
+					warn_submodel(submodel_index, "too many UNPACK packets");
 				return {};
 			}
 		}
@@ -161,7 +218,7 @@ moby_model::interpreted_moby_vif_list moby_model::interpret_vif_list(
 	}
 	
 	if(unpack_index < 2) {
-		warn_current_submodel("VIF list with not enough UNPACK packets");
+		warn_submodel(submodel_index, "VIF list with not enough UNPACK packets");
 		return {};
 	}
 	
@@ -169,7 +226,7 @@ moby_model::interpreted_moby_vif_list moby_model::interpret_vif_list(
 }
 
 std::vector<moby_subsubmodel> moby_model::read_subsubmodels(
-		interpreted_moby_vif_list submodel_data) {
+		interpreted_moby_vif_list submodel_data, std::size_t submodel_index) {
 	std::vector<moby_subsubmodel> result;
 	
 	std::optional<moby_model_texture_data> texture;
@@ -186,7 +243,7 @@ std::vector<moby_subsubmodel> moby_model::read_subsubmodels(
 				// At this point the game would push a command to update the
 				// GS texture registers.
 				if(next_texture_index >= submodel_data.textures.size()) {
-					warn_current_submodel("too few textures for its index buffer");
+					warn_submodel(submodel_index, "too few textures for its index buffer");
 					return {};
 				}
 				texture = submodel_data.textures[next_texture_index++];
@@ -220,6 +277,7 @@ std::vector<moby_subsubmodel> moby_model::read_subsubmodels(
 						}
 					}
 				}
+				subsubmodel.low_detail_indices = build_low_detail_indices(subsubmodel.indices);
 				subsubmodel.texture = texture;
 				result.emplace_back(std::move(subsubmodel));
 				
@@ -232,6 +290,34 @@ std::vector<moby_subsubmodel> moby_model::read_subsubmodels(
 	return result;
 }
 
+std::vector<uint8_t> moby_model::build_low_detail_indices(
+		const std::vector<uint8_t>& indices) {
+	std::size_t triangle_count = indices.size() / 3;
+	if(triangle_count < 8) {
+		// Not worth the extra index buffer.
+		return {};
+	}
+	std::vector<uint8_t> result;
+	result.reserve((triangle_count / 2 + 1) * 3);
+	for(std::size_t i = 0; i < triangle_count; i += 2) {
+		result.push_back(indices[i * 3 + 0]);
+		result.push_back(indices[i * 3 + 1]);
+		result.push_back(indices[i * 3 + 2]);
+	}
+	return result;
+}
+
+std::vector<glm::vec3> decode_vertex_positions(const std::vector<moby_model_vertex>& vertices) {
+	std::vector<glm::vec3> result(vertices.size());
+	const float scale = 1.f / INT16_MAX;
+	for(std::size_t i = 0; i < vertices.size(); i++) {
+		result[i].x = vertices[i].x * scale;
+		result[i].y = vertices[i].y * scale;
+		result[i].z = vertices[i].z * scale;
+	}
+	return result;
+}
+
 bool moby_model::validate_indices(const moby_submodel& submodel) {
 	for(const moby_subsubmodel& subsubmodel : submodel.subsubmodels) {
 		for(uint8_t index : subsubmodel.indices) {
@@ -243,18 +329,20 @@ bool moby_model::validate_indices(const moby_submodel& submodel) {
 	return true;
 }
 
-void moby_model::warn_current_submodel(const char* message) {
+void moby_model::warn_submodel(std::size_t submodel_index, const char* message) {
 	fprintf(stderr, "warning: Model %s (at %s), submodel %ld has %s.\n",
-		_backing.name.c_str(), _backing.resource_path().c_str(), submodels.size(), message);
+		_backing.name.c_str(), _backing.resource_path().c_str(), submodel_index, message);
 }
 
 void moby_model::import_ply(std::string path) {
 	std::vector<ply_vertex> vertices = read_ply_model(path);
-	
-	submodels.clear();
-	
+
+	// Detach from the submodel pool - other models may still be sharing the
+	// old geometry and shouldn't see the import.
+	submodels = std::make_shared<std::vector<moby_submodel>>();
+
 	const auto emit_submodel = [&](std::size_t begin, std::size_t end) {
-		moby_submodel& submodel = submodels.emplace_back();
+		moby_submodel& submodel = submodels->emplace_back();
 		
 		for(std::size_t i = begin; i < end; i++) {
 			ply_vertex& in_vertex = vertices[i];
@@ -288,6 +376,7 @@ void moby_model::import_ply(std::string path) {
 		for(std::size_t i = 0; i < end - begin; i++) {
 			subsubmodel.indices.push_back(i);
 		}
+		subsubmodel.low_detail_indices = build_low_detail_indices(subsubmodel.indices);
 		
 		submodel.vif_list = regenerate_submodel_vif_list(submodel);
 	};
@@ -408,12 +497,12 @@ void moby_model::write() {
 	}
 	
 	// Skip past the submodel table.
-	_backing.seek((submodels.size() + 1) * 0x10);
+	_backing.seek((submodels->size() + 1) * 0x10);
 	
 	uint32_t texture_unpack_offset_all = 0;
 	
 	std::vector<moby_submodel_entry> submodel_table;
-	for(moby_submodel& submodel : submodels) {
+	for(moby_submodel& submodel : *submodels) {
 		moby_submodel_entry& entry = submodel_table.emplace_back();
 		
 		_backing.pad(0x10, 0x0);
@@ -493,7 +582,7 @@ void moby_model::write() {
 	_backing.write_v(submodel_table);
 	
 	moby_model_armor_header header;
-	header.submodel_count_1 = submodels.size();
+	header.submodel_count_1 = submodels->size();
 	header.submodel_count_2 = 0;
 	header.submodel_count_3 = 0;
 	header.submodel_count_1_plus_2 = header.submodel_count_1 + header.submodel_count_2;
@@ -20,6 +20,8 @@
 #define FORMATS_GAME_MODEL_H
 
 #include <map>
+#include <memory>
+#include <glm/glm.hpp>
 
 #include "../model.h"
 #include "../stream.h"
@@ -139,10 +141,21 @@ packed_struct(moby_model_texture_data, // Third UNPACK.
 // code, we split each submodel into subsubmodels.
 struct moby_subsubmodel {
 	std::vector<uint8_t> indices;
+	// Decimated copy of the above for instances that are small on screen. May
+	// be empty for tiny subsubmodels, in which case the full set is drawn.
+	std::vector<uint8_t> low_detail_indices;
 	std::optional<moby_model_texture_data> texture; // If empty use last texture from last submodel with one.
 	gl_buffer index_buffer;
+	gl_buffer low_detail_index_buffer;
 };
 
+// Decode a packed int16 vertex table into unit-scale float positions in one
+// pass. A straight widen-and-multiply loop over the whole table vectorises
+// well; dividing one component at a time at the call sites does not. Note
+// that the renderer doesn't need this - it feeds the int16 data to GL
+// directly as a normalised attribute.
+std::vector<glm::vec3> decode_vertex_positions(const std::vector<moby_model_vertex>& vertices);
+
 struct moby_submodel {
 	std::vector<vif_packet> vif_list;
 	moby_model_index_header index_header;
@@ -174,27 +187,40 @@ public:
 	void read();
 
 	// Reads data from the parsed VIF DMA list into a more suitable structure.
+	// May run on a worker thread, hence the explicit submodel index for
+	// warning messages.
 	interpreted_moby_vif_list interpret_vif_list(
-		const std::vector<vif_packet>& vif_list);
-	
+		const std::vector<vif_packet>& vif_list, std::size_t submodel_index);
+
 	// Splits a submodel into subsubmodels such that each part of a submodel
 	// with a different texture has its own subsubmodel. The game will change
 	// the applied texture when an index of zero is encountered, so when we
 	// split up the index buffer, we need to make cuts at those positions.
 	std::vector<moby_subsubmodel> read_subsubmodels(
-		interpreted_moby_vif_list submodel_data);
+		interpreted_moby_vif_list submodel_data, std::size_t submodel_index);
 	
+	// Build the low detail index set for a subsubmodel by dropping every
+	// other triangle. Crude, but distant instances are only a few pixels
+	// tall so it doesn't read as damage from the camera.
+	static std::vector<uint8_t> build_low_detail_indices(
+		const std::vector<uint8_t>& indices);
+
 	// Check if any of the indices overrun the vertex table.
 	bool validate_indices(const moby_submodel& submodel);
 	
-	// Print message along with details of the current submodel.
-	void warn_current_submodel(const char* message);
+	// Print message along with details of the given submodel.
+	void warn_submodel(std::size_t submodel_index, const char* message);
 	
 	void import_ply(std::string path);
 	static std::vector<vif_packet> regenerate_submodel_vif_list(moby_submodel& submodel);
 	void write();
 	
-	std::vector<moby_submodel> submodels;
+	// Shared between all models with the same name and source data - most moby
+	// classes are identical across levels, so keeping three levels open
+	// shouldn't cost three copies of every parsed model (or three sets of GL
+	// buffers). See the pool in moby_model::read.
+	std::shared_ptr<std::vector<moby_submodel>> submodels =
+		std::make_shared<std::vector<moby_submodel>>();
 	float scale = 1.f;
 	
 	gl_texture thumbnail;
@@ -209,6 +235,11 @@ public:
 	// into the std::vector of moby textures.
 	std::vector<std::size_t> texture_indices;
 private:
+	// Fingerprint the source data read() is about to parse, for the submodel
+	// pool. Returns zero if the backing isn't resident in memory, in which
+	// case the model isn't pooled.
+	uint64_t hash_source_data(const std::vector<moby_submodel_entry>& entries);
+
 	proxy_stream _backing;
 	moby_model_header_type _type;
 };
@@ -17,9 +17,13 @@
 */
 
 #include "level_impl.h"
+
+#include <thread>
+
 #include "tfrag.h"
 
 #include "../app.h"
+#include "../iso_stream.h"
 
 void level::read(
 		stream* src,
@@ -32,6 +36,13 @@ void level::read(
 	index.main_part_size = sector32::size_from_bytes(size_in_bytes);
 	file_header = read_file_header(src, header_offset);
 	file_header.base_offset = base_offset;
+
+	// Levels are usually read from the patched ISO, in which case derived
+	// data like the baked tfrag meshes can be cached on disk between runs.
+	if(iso_stream* iso = dynamic_cast<iso_stream*>(src)) {
+		_tfrag_cache_path = iso->derived_cache_path(
+			"tfrags_lvl_" + std::to_string(index.level_table_index) + ".bin");
+	}
 	
 	_file.emplace(src);
 	_file->buffer.resize(index.main_part_size.bytes());
@@ -58,35 +69,82 @@ void level::read(
 	code_segment.bytes.resize(_primary_header.code_segment.size - sizeof(level_code_segment_header));
 	_file->read_v(code_segment.bytes);
 
-	_world_segment.emplace(&(*_file), file_header.world_segment.offset.bytes());
-	_world_segment->name = "World Segment";
-	
-	world.backing = &(*_world_segment);
-	switch(file_header.type) {
-		case level_type::RAC23:
-		case level_type::RAC2_68:
-			world.read_rac23();
-			break;
-		case level_type::RAC4:
-			world.read_rac4();
-			break;
-	}
-	
 	size_t asset_wad_offset =
 		file_header.primary_header.offset.bytes() +
 		_primary_header.asset_wad.offset;
-	_asset_segment.emplace(&(*_file), asset_wad_offset);
+
+	// The world segment and the asset wad are independent of each other, and
+	// each side only touches its own segment once the compressed bytes have
+	// been sliced out (which has to happen serially - _file can't be read
+	// from two threads at once). So instead of inflating both segments and
+	// only then starting to parse, each side inflates its own segment and
+	// parses it as soon as it's ready: the world decompression overlaps the
+	// asset decompression, and whichever side finishes inflating first gets
+	// on with parsing while the other is still in the codec.
+	_world_segment.emplace(&(*_file));
+	_world_segment->name = "World Segment";
+	_asset_segment.emplace(&(*_file));
 	_asset_segment->name = "Asset Segment";
-	
+
+	size_t world_wad_offset = file_header.world_segment.offset.bytes();
+	array_stream world_compressed;
+	uint32_t world_compressed_size = _file->peek<uint32_t>(world_wad_offset + 0x3);
+	_file->seek(world_wad_offset);
+	stream::copy_n(world_compressed, *_file, world_compressed_size);
+
+	array_stream asset_compressed;
+	uint32_t asset_compressed_size = _file->peek<uint32_t>(asset_wad_offset + 0x3);
+	_file->seek(asset_wad_offset);
+	stream::copy_n(asset_compressed, *_file, asset_compressed_size);
+
+	world.backing = &(*_world_segment);
+	std::exception_ptr world_error;
+	std::thread world_thread([&]() {
+		try {
+			decompress_wad(*_world_segment, world_compressed);
+			_world_segment->retrack();
+			switch(file_header.type) {
+				case level_type::RAC23:
+				case level_type::RAC2_68:
+					world.read_rac23();
+					break;
+				case level_type::RAC4:
+					world.read_rac4();
+					break;
+			}
+		} catch(...) {
+			world_error = std::current_exception();
+		}
+	});
+
 	uint32_t asset_offset = file_header.primary_header.offset.bytes() + _primary_header.asset_header.offset;
 	auto asset_header = _file->read<level_asset_header>(asset_offset);
-	
-	read_moby_models(asset_offset, asset_header);
-	read_textures(asset_offset, asset_header);
-	
-	read_tfrags();
-	read_tcol(asset_offset, asset_header);
-	
+
+	std::exception_ptr asset_error;
+	try {
+		decompress_wad(*_asset_segment, asset_compressed);
+		_asset_segment->retrack();
+		read_moby_models(asset_offset, asset_header);
+		read_textures(asset_offset, asset_header);
+	} catch(...) {
+		// Don't leave the world thread running over live locals if the asset
+		// parsers throw.
+		asset_error = std::current_exception();
+	}
+
+	world_thread.join();
+	if(asset_error != nullptr) {
+		std::rethrow_exception(asset_error);
+	}
+	if(world_error != nullptr) {
+		std::rethrow_exception(world_error);
+	}
+
+	// Tfrags and collision are parsed lazily, see tfrags() and
+	// baked_collisions() below.
+	_asset_offset = asset_offset;
+	_asset_header = asset_header;
+
 	if(file_header.type == level_type::RAC4) {
 		return;
 	}
@@ -126,16 +184,21 @@ void level::clear_selection() {
 	for_each<entity>([&](entity& ent) {
 		ent.selected = false;
 	});
+	selection.clear();
 }
 
-std::vector<entity_id> level::selected_entity_ids() {
-	std::vector<entity_id> ids;
+void level::update_selection() {
+	selection.clear();
 	for_each<entity>([&](entity& ent) {
 		if(ent.selected) {
-			ids.push_back(ent.id);
+			selection.push_back(ent.id);
 		}
 	});
-	return ids;
+	std::sort(selection.begin(), selection.end());
+}
+
+std::vector<entity_id> level::selected_entity_ids() {
+	return selection;
 }
 
 void level::read_moby_models(std::size_t asset_offset, level_asset_header asset_header) {
@@ -168,7 +231,10 @@ void level::read_moby_models(std::size_t asset_offset, level_asset_header asset_
 		}
 		
 		uint32_t o_class = entry.o_class;
-		moby_class_to_model.emplace(o_class, moby_models.size() - 1);
+		if(o_class >= moby_class_to_model.size()) {
+			moby_class_to_model.resize(o_class + 1, -1);
+		}
+		moby_class_to_model[o_class] = moby_models.size() - 1;
 	}
 }
 
@@ -188,6 +254,7 @@ void level::read_textures(std::size_t asset_offset, level_asset_header asset_hea
 		}
 		vec2i size { descriptor.width, descriptor.height };
 		texture tex = create_texture_from_streams(size, &(*_file), abs_offset, &(*_file), last_palette_offset);
+		tex.deduplicate();
 		mipmap_textures.emplace_back(std::move(tex));
 	}
 	
@@ -207,6 +274,8 @@ void level::read_textures(std::size_t asset_offset, level_asset_header asset_hea
 			else {
 				tex = create_texture_from_streams(size, &(*_asset_segment), ptr, &(*_file), palette);
 			}
+			// The same textures appear in multiple tables and levels.
+			tex.deduplicate();
 			textures.emplace_back(std::move(tex));
 		}
 		return textures;
@@ -231,22 +300,83 @@ void level::read_tfrags() {
 	auto tfrag_head = _asset_segment->read<tfrag_header>(0);
 	_asset_segment->seek(tfrag_head.entry_list_offset);
 
-	for (std::size_t i = 0; i < tfrag_head.count; i++) {
-		auto entry = _asset_segment->read<tfrag_entry>();
-		tfrag frag = tfrag(&(*_asset_segment), tfrag_head.entry_list_offset + entry.offset, entry);
-		frag.update();
-		tfrags.emplace_back(std::move(frag));
+	std::vector<tfrag_entry> entries(tfrag_head.count);
+	_asset_segment->read_v(entries);
+
+	// FNV-1a over the entry table. The cache file name already bakes in the
+	// patch hash, this just guards against a stale file being picked up.
+	uint64_t entry_hash = fnv1a(entries.data(), entries.size() * sizeof(tfrag_entry));
+
+	bool from_cache = false;
+	if (_tfrag_cache_path.size() > 0) {
+		if (auto baked = read_tfrag_mesh_cache(_tfrag_cache_path, entry_hash)) {
+			for (std::vector<float>& triangles : *baked) {
+				_tfrags.emplace_back(tfrag(std::move(triangles)));
+			}
+			from_cache = true;
+		}
+	}
+
+	if (!from_cache) {
+		for (tfrag_entry& entry : entries) {
+			_tfrags.emplace_back(tfrag(&(*_asset_segment), tfrag_head.entry_list_offset + entry.offset, entry));
+		}
+
+		if (_tfrag_cache_path.size() > 0) {
+			write_tfrag_mesh_cache(_tfrag_cache_path, entry_hash, _tfrags);
+		}
+	}
+
+	// Merge everything into one mesh so the renderer can draw the terrain in
+	// a single call. The individual frags keep their triangle lists (the mesh
+	// cache is written from them) but never get their own GL buffers.
+	std::size_t total_floats = 0;
+	std::vector<std::vector<float>> frag_triangles;
+	frag_triangles.reserve(_tfrags.size());
+	for (tfrag& frag : _tfrags) {
+		frag_triangles.emplace_back(frag.triangles());
+		total_floats += frag_triangles.back().size();
+	}
+	if (total_floats > 0) {
+		std::vector<float> merged;
+		merged.reserve(total_floats);
+		for (std::vector<float>& triangles : frag_triangles) {
+			merged.insert(merged.end(), triangles.begin(), triangles.end());
+		}
+		_tfrag_terrain.emplace(std::move(merged));
+		_tfrag_terrain->update();
 	}
 }
 
 void level::read_tcol(std::size_t asset_offset, level_asset_header asset_header) {
-	baked_collisions.push_back(tcol(&(*_asset_segment), asset_header.collision));
+	_baked_collisions.push_back(tcol(&(*_asset_segment), asset_header.collision));
 
-	for (auto& col : baked_collisions) {
+	for (auto& col : _baked_collisions) {
 		col.update();
 	}
 }
 
+std::vector<tfrag>& level::tfrags() {
+	if(!_tfrags_read) {
+		_tfrags_read = true;
+		read_tfrags();
+	}
+	return _tfrags;
+}
+
+model* level::tfrag_terrain() {
+	tfrags(); // Parse the frags and build the merged mesh if necessary.
+	return _tfrag_terrain.has_value() ? &(*_tfrag_terrain) : nullptr;
+}
+
+std::vector<tcol>& level::baked_collisions() {
+	if(!_tcol_read) {
+		_tcol_read = true;
+		read_tcol(_asset_offset, _asset_header);
+	}
+	return _baked_collisions;
+}
+
 void level::read_hud_banks(stream* file) {
 	//const auto read_hud_bank = [&](int index, uint32_t relative_offset, uint32_t size) {
 	//	if(size > 0x10) {
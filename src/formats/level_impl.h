@@ -25,6 +25,7 @@
 
 #include "../util.h"
 #include "../stream.h"
+#include "../spatial_index.h"
 #include "../worker_logger.h"
 #include "world.h"
 #include "toc.h"
@@ -100,6 +101,9 @@ public:
 	toc_level index;
 	level_file_header file_header;
 	world_segment world;
+	// Grid over the moby/tie/shrub positions, used to find the entities near
+	// the pick ray. Kept up to date by the edit tools.
+	spatial_index entity_index;
 	
 	template <typename T, typename F>
 	void for_each(F callback) {
@@ -120,7 +124,14 @@ public:
 		}
 	}
 	
+	// Sorted ids of every selected entity, mirroring the per-entity selected
+	// flags (which remain the O(1) membership test). Lets per-frame code walk
+	// or hash the selection without scanning every entity vector. Code that
+	// writes entity::selected directly must call update_selection() after.
+	std::vector<entity_id> selection;
+
 	void clear_selection();
+	void update_selection();
 	std::vector<entity_id> selected_entity_ids();
 	
 	template <typename T>
@@ -148,9 +159,31 @@ public:
 	void write(array_stream& dest);
 
 	stream* moby_stream();
-	
+
+	// The tfrag and collision meshes are only needed when the renderer has
+	// them switched on, so they're parsed from the asset segment on first
+	// access instead of up front in read().
+	std::vector<tfrag>& tfrags();
+	std::vector<tcol>& baked_collisions();
+
+	// All the terrain fragments merged into one mesh. The frags are baked in
+	// world space and drawn with the same transform and colour, so the whole
+	// terrain can go out as a single draw call instead of one per frag.
+	// Returns nullptr if the level has no terrain.
+	model* tfrag_terrain();
+
 	// Asset segment
-	std::map<uint32_t, std::size_t> moby_class_to_model;
+	// Maps moby class numbers to indices into moby_models. Built in
+	// read_moby_models as a dense array indexed by class, so the per-batch
+	// lookups in the render loop are one bounds check and one array read
+	// instead of a tree walk. -1 means no model exists for that class.
+	std::vector<int32_t> moby_class_to_model;
+	int32_t model_index_for_class(std::size_t class_num) const {
+		if(class_num >= moby_class_to_model.size()) {
+			return -1;
+		}
+		return moby_class_to_model[class_num];
+	}
 	std::vector<moby_model> moby_models;
 	std::vector<texture> mipmap_textures;
 	std::vector<texture> terrain_textures;
@@ -158,18 +191,28 @@ public:
 	std::vector<texture> tie_textures;
 	std::vector<texture> shrub_textures;
 	std::vector<texture> sprite_textures;
-	std::vector<tfrag> tfrags;
-	std::vector<tcol> baked_collisions;
-	
+
 	level_code_segment code_segment;
-	
+
 	std::vector<texture> loading_screen_textures;
-	
+
 private:
 	level_primary_header _primary_header;
 	std::optional<array_stream> _file;
 	std::optional<simple_wad_stream> _world_segment;
 	std::optional<simple_wad_stream> _asset_segment;
+
+	// For materialising the lazy subsystems above after read() has returned.
+	std::size_t _asset_offset;
+	level_asset_header _asset_header;
+	// Empty if the level wasn't read from an iso_stream, in which case the
+	// tfrag meshes are always rebuilt from the asset segment.
+	std::string _tfrag_cache_path;
+	std::vector<tfrag> _tfrags;
+	std::optional<tfrag> _tfrag_terrain; // Merged mesh, see tfrag_terrain().
+	std::vector<tcol> _baked_collisions;
+	bool _tfrags_read = false;
+	bool _tcol_read = false;
 };
 
 void swap_level_file_header_rac23(level_file_header& l, level_file_header_rac23& r);
@@ -18,59 +18,74 @@
 
 #include "model_utils.h"
 
+#include <cstdlib>
+#include <cstring>
 #include <fstream>
 
 #include "../stream.h"
 
-float read_float(const std::string& line, std::size_t& index) {
-	std::size_t float_end = index + line.substr(index).find(" ");
-	float result = std::stof(line.substr(index, float_end));
-	index = float_end + 1;
-	return result;
-}
-
 std::vector<ply_vertex> read_ply_model(std::string path) {
-	std::ifstream file(path);
+	// Slurp the whole file up front and tokenise in memory. Extracting half a
+	// million vertices through iostreams a line at a time is painfully slow.
+	std::ifstream file(path, std::ios::binary);
 	if(!file) {
 		throw stream_io_error("Failed to open .PLY file!");
 	}
-	
-	std::vector<ply_vertex> vertices;
-	
-	std::string line;
+	file.seekg(0, std::ios::end);
+	std::size_t file_size = file.tellg();
+	file.seekg(0);
+	std::vector<char> data(file_size + 1);
+	file.read(data.data(), file_size);
+	data[file_size] = '\0'; // So strtof can't run off the end.
+
+	const char* end = data.data() + file_size;
+	char* ptr = data.data();
 	std::size_t vertex_count = 0;
-	bool reading_vertices = false;
-	while(std::getline(file, line)) {
-		if(line.find("element vertex ") == 0) {
-			try {
-				vertex_count = std::stoi(line.substr(strlen("element vertex ")));
-			} catch(std::logic_error&) {
-				throw stream_format_error("Failed to read vertex count from .PLY file.");
-			}
+	bool binary = false;
+	bool header_done = false;
+	while(ptr < end && !header_done) {
+		char* line_end = static_cast<char*>(std::memchr(ptr, '\n', end - ptr));
+		if(line_end == nullptr) {
+			line_end = data.data() + file_size;
+		}
+		auto line_is = [&](const char* prefix) {
+			return std::strncmp(ptr, prefix, std::strlen(prefix)) == 0;
+		};
+		if(line_is("element vertex ")) {
+			vertex_count = std::strtoul(ptr + std::strlen("element vertex "), nullptr, 10);
+		} else if(line_is("format binary_little_endian")) {
+			binary = true;
+		} else if(line_is("format binary_big_endian")) {
+			throw stream_format_error("Big endian .PLY files are not supported.");
+		} else if(line_is("end_header")) {
+			header_done = true;
+		}
+		ptr = line_end + 1;
+	}
+	if(!header_done) {
+		throw stream_format_error("Missing end_header in .PLY file.");
+	}
+
+	std::vector<ply_vertex> vertices(vertex_count);
+	if(binary) {
+		// The vertex layout is assumed to match ply_vertex exactly (see the
+		// header), so the binary body is just a block copy.
+		if(static_cast<std::size_t>(end - ptr) < vertex_count * sizeof(ply_vertex)) {
+			throw stream_format_error("Unexpected end of .PLY file.");
 		}
-		
-		if(line.find("end_header") == 0) {
-			reading_vertices = true;
-		} else if(reading_vertices && vertex_count > 0) {
-			ply_vertex vertex;
-			std::size_t pos = 0;
-			try {
-				vertex.x = read_float(line, pos);
-				vertex.y = read_float(line, pos);
-				vertex.z = read_float(line, pos);
-				vertex.nx = read_float(line, pos);
-				vertex.ny = read_float(line, pos);
-				vertex.nz = read_float(line, pos);
-				vertex.s = read_float(line, pos);
-				vertex.t = read_float(line, pos);
-			} catch(std::logic_error&) {
-				throw stream_format_error("Failed to read vertices from .PLY file.");
+		std::memcpy(vertices.data(), ptr, vertex_count * sizeof(ply_vertex));
+	} else {
+		for(std::size_t i = 0; i < vertex_count; i++) {
+			float* fields = &vertices[i].x;
+			for(std::size_t j = 0; j < 8; j++) {
+				char* after;
+				fields[j] = std::strtof(ptr, &after);
+				if(after == ptr) {
+					throw stream_format_error("Failed to read vertices from .PLY file.");
+				}
+				ptr = after;
 			}
-			vertices.push_back(vertex);
-			
-			vertex_count--;
 		}
 	}
-	
 	return vertices;
 }
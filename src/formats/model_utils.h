@@ -32,6 +32,7 @@ struct ply_vertex {
 //
 // It assumes that each vertex is laid out like the above ply_vertex struct, and
 // that the index buffer is equivalent to using GL_TRIANGLES without indices.
+// Both ASCII and binary little endian bodies are accepted.
 std::vector<ply_vertex> read_ply_model(std::string path);
 
 #endif
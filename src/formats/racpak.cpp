@@ -24,12 +24,13 @@ racpak::racpak(stream* backing, std::size_t offset, std::size_t size)
 	: _backing(backing, offset, size),
 	  _base(offset) {}
 
+// Keeping every inflated entry alive would let a browse through a big archive
+// eat memory without bound, so only this many are cached at once.
+static const std::size_t MAX_DECOMPRESSED_ENTRIES = 8;
+
 std::size_t racpak::num_entries() {
-	uint32_t value = _backing.peek<uint32_t>(0);
-	if(value < 8) {
-		value = _backing.peek<uint32_t>(4);
-	}
-	return value / 8 - 1;
+	cache_entry_table();
+	return _entries->size();
 }
 
 std::size_t racpak::base() {
@@ -37,17 +38,66 @@ std::size_t racpak::base() {
 }
 
 racpak_entry racpak::entry(std::size_t index) {
-	_backing.seek((index + 1) * 8);
-	return {
-		_backing.read<uint32_t>() * 0x800,
-		_backing.read<uint32_t>() * 0x800
-	};
+	cache_entry_table();
+	return (*_entries)[index];
+}
+
+void racpak::cache_entry_table() {
+	if(_entries.has_value()) {
+		return;
+	}
+
+	uint32_t value = _backing.peek<uint32_t>(0);
+	if(value < 8) {
+		value = _backing.peek<uint32_t>(4);
+	}
+	std::size_t count = value / 8 - 1;
+
+	std::vector<uint32_t> raw_entries(count * 2);
+	_backing.seek(8);
+	_backing.read_v(raw_entries);
+
+	_entries.emplace();
+	_entries->reserve(count);
+	for(std::size_t i = 0; i < count; i++) {
+		_entries->push_back({
+			raw_entries[i * 2] * (std::size_t) 0x800,
+			raw_entries[i * 2 + 1] * (std::size_t) 0x800
+		});
+	}
 }
 
 stream* racpak::open(racpak_entry entry) {
-	_open_segments.emplace_back(
-		std::make_unique<proxy_stream>(&_backing, entry.offset, entry.size));
-	return _open_segments.back().get();
+	std::unique_ptr<proxy_stream>& segment = _open_segments[entry.offset];
+	if(segment.get() == nullptr) {
+		segment = std::make_unique<proxy_stream>(&_backing, entry.offset, entry.size);
+	}
+	return segment.get();
+}
+
+stream* racpak::open_decompressed(racpak_entry entry) {
+	auto existing = _decompressed_entries.find(entry.offset);
+	if(existing != _decompressed_entries.end()) {
+		existing->second.last_used = _use_counter++;
+		return existing->second.buffer.get();
+	}
+
+	// Same idea as iso_stream::evict_lru_wad_streams: drop the least recently
+	// used buffer once the cache is full.
+	while(_decompressed_entries.size() >= MAX_DECOMPRESSED_ENTRIES) {
+		auto lru = _decompressed_entries.begin();
+		for(auto iter = _decompressed_entries.begin(); iter != _decompressed_entries.end(); iter++) {
+			if(iter->second.last_used < lru->second.last_used) {
+				lru = iter;
+			}
+		}
+		_decompressed_entries.erase(lru);
+	}
+
+	decompressed_entry& slot = _decompressed_entries[entry.offset];
+	slot.buffer = std::make_unique<simple_wad_stream>(&_backing, entry.offset);
+	slot.last_used = _use_counter++;
+	return slot.buffer.get();
 }
 
 bool racpak::is_compressed(racpak_entry entry) {
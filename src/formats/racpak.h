@@ -19,6 +19,8 @@
 #ifndef FORMATS_RACPAK_H
 #define FORMATS_RACPAK_H
 
+#include <map>
+#include <memory>
 #include <vector>
 
 #include "../stream.h"
@@ -42,12 +44,30 @@ public:
 	std::size_t base();
 	racpak_entry entry(std::size_t index);
 	stream* open(racpak_entry file);
+	// Inflate a WAD-compressed entry, caching the result so that accessing the
+	// same entry again doesn't decompress it a second time.
+	stream* open_decompressed(racpak_entry file);
 	bool is_compressed(racpak_entry entry);
 
 private:
+	// Read the whole entry table in one go the first time it's queried,
+	// instead of hitting the backing stream for every entry() call.
+	void cache_entry_table();
+
 	proxy_stream _backing;
 	std::size_t _base;
-	std::vector<std::unique_ptr<proxy_stream>> _open_segments;
+	std::optional<std::vector<racpak_entry>> _entries;
+	// Keyed by entry offset so opening the same entry twice hands back the
+	// same stream. Proxies are cheap, so they're never evicted.
+	std::map<std::size_t, std::unique_ptr<proxy_stream>> _open_segments;
+	// Decompressed entries are not cheap, so only a handful are kept around
+	// and the least recently used one is dropped beyond that.
+	struct decompressed_entry {
+		std::unique_ptr<simple_wad_stream> buffer;
+		uint64_t last_used;
+	};
+	std::map<std::size_t, decompressed_entry> _decompressed_entries;
+	uint64_t _use_counter = 0;
 };
 
 #endif
@@ -17,6 +17,9 @@
 */
 
 #include "tcol.h"
+
+#include <cstring>
+
 #include "../util.h"
 
 tcol::tcol(stream *backing, std::size_t base_offset)
@@ -159,44 +162,54 @@ tcol::tcol(stream *backing, std::size_t base_offset)
 
 		position_offset.z += 4;
 	}
+
+	// The lookup is only needed while the faces are being pushed.
+	_vertex_lookup.clear();
 }
 
 void tcol::push_face(vec3f offset, tcol::tcol_face face, tcol::tcol_data data) {
-	auto v0 = data.vertices[face.v0] + offset;
-	auto v1 = data.vertices[face.v1] + offset;
-	auto v2 = data.vertices[face.v2] + offset;
-
-	_tcol_triangles.push_back(v0.x);
-	_tcol_triangles.push_back(v0.y);
-	_tcol_triangles.push_back(v0.z);
-	_tcol_triangles.push_back(v1.x);
-	_tcol_triangles.push_back(v1.y);
-	_tcol_triangles.push_back(v1.z);
-	_tcol_triangles.push_back(v2.x);
-	_tcol_triangles.push_back(v2.y);
-	_tcol_triangles.push_back(v2.z);
+	auto color = get_collision_color(face.collision_id);
+
+	auto i0 = add_vertex(data.vertices[face.v0] + offset, color);
+	auto i1 = add_vertex(data.vertices[face.v1] + offset, color);
+	auto i2 = add_vertex(data.vertices[face.v2] + offset, color);
+
+	_tcol_indices.push_back(i0);
+	_tcol_indices.push_back(i1);
+	_tcol_indices.push_back(i2);
 
 	if (face.is_quad) {
-		auto v3 = data.vertices[face.v3] + offset;
-
-		_tcol_triangles.push_back(v0.x);
-		_tcol_triangles.push_back(v0.y);
-		_tcol_triangles.push_back(v0.z);
-		_tcol_triangles.push_back(v2.x);
-		_tcol_triangles.push_back(v2.y);
-		_tcol_triangles.push_back(v2.z);
-		_tcol_triangles.push_back(v3.x);
-		_tcol_triangles.push_back(v3.y);
-		_tcol_triangles.push_back(v3.z);
+		auto i3 = add_vertex(data.vertices[face.v3] + offset, color);
+
+		_tcol_indices.push_back(i0);
+		_tcol_indices.push_back(i2);
+		_tcol_indices.push_back(i3);
 	}
+}
 
-	auto color = get_collision_color(face.collision_id);
-	int v_count = 3 + (face.is_quad ? 3 : 0);
-	for (int i = 0; i < v_count; ++i) {
-		_tcol_vertex_colors.push_back(color.x);
-		_tcol_vertex_colors.push_back(color.y);
-		_tcol_vertex_colors.push_back(color.z);
+uint32_t tcol::add_vertex(const vec3f& position, const vec3f& color) {
+	std::array<uint32_t, 4> key;
+	std::memcpy(&key[0], &position.x, sizeof(float));
+	std::memcpy(&key[1], &position.y, sizeof(float));
+	std::memcpy(&key[2], &position.z, sizeof(float));
+	key[3] = (uint32_t)(color.x * 255.0) |
+	         ((uint32_t)(color.y * 255.0) << 8) |
+	         ((uint32_t)(color.z * 255.0) << 16);
+
+	auto existing = _vertex_lookup.find(key);
+	if (existing != _vertex_lookup.end()) {
+		return existing->second;
 	}
+
+	uint32_t index = _tcol_vertices.size() / 3;
+	_tcol_vertices.push_back(position.x);
+	_tcol_vertices.push_back(position.y);
+	_tcol_vertices.push_back(position.z);
+	_tcol_vertex_colors.push_back(color.x);
+	_tcol_vertex_colors.push_back(color.y);
+	_tcol_vertex_colors.push_back(color.z);
+	_vertex_lookup.emplace(key, index);
+	return index;
 }
 
 vec3f tcol::get_collision_color(uint8_t colId) {
@@ -226,9 +239,13 @@ vec3f tcol::unpack_vertex(uint32_t vertex) {
 }
 
 std::vector<float> tcol::triangles() const {
-	return _tcol_triangles;
+	return _tcol_vertices;
 }
 
 std::vector<float> tcol::colors() const {
 	return _tcol_vertex_colors;
 }
+
+std::vector<uint32_t> tcol::indices() const {
+	return _tcol_indices;
+}
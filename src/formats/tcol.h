@@ -64,17 +64,25 @@ public:
 
 	std::vector<float> triangles() const override;
 	std::vector<float> colors() const override;
+	std::vector<uint32_t> indices() const override;
 
 	tcol_list<tcol_list<tcol_list<tcol_data>>> data;
 
 private:
+	// Deduplicate on (position, color) so the faces can share vertices. Keyed
+	// on the bit patterns since the floats are all derived from the same
+	// packed integers.
+	uint32_t add_vertex(const vec3f& position, const vec3f& color);
+
 	proxy_stream _backing;
 
 	uint8_t _final_vertex_count;
 	size_t _base_offset;
 
-	std::vector<float> _tcol_triangles;
+	std::vector<float> _tcol_vertices;
 	std::vector<float> _tcol_vertex_colors;
+	std::vector<uint32_t> _tcol_indices;
+	std::map<std::array<uint32_t, 4>, uint32_t> _vertex_lookup;
 };
 
 #endif
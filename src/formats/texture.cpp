@@ -18,27 +18,157 @@
 
 #include "texture.h"
 
+#include <map>
+
 #include "../util.h" // int_to_hex
 #include "../iso_stream.h"
+#include "../thread_pool.h"
+#include "../fs_includes.h"
 #include "fip.h" // decode_palette_index
 
+uint64_t texture::content_hash() const {
+	// FNV-1a over the pixels, then the palette.
+	uint64_t hash = fnv1a(pixels->data(), pixels->size());
+	return fnv1a(palette, sizeof(palette), hash);
+}
+
+void texture::deduplicate() {
+	// Keyed by a hash of the pixels only, so palette swapped variants of a
+	// texture still share one pixel buffer. weak_ptr entries mean the pool
+	// never keeps a buffer alive on its own.
+	static std::map<uint64_t, std::weak_ptr<std::vector<uint8_t>>> pool;
+
+	uint64_t hash = fnv1a(pixels->data(), pixels->size());
+
+	std::weak_ptr<std::vector<uint8_t>>& entry = pool[hash];
+	std::shared_ptr<std::vector<uint8_t>> pooled = entry.lock();
+	if(pooled != nullptr && *pooled == *pixels) {
+		pixels = std::move(pooled);
+	} else {
+		entry = pixels;
+	}
+}
+
 #ifdef WRENCH_EDITOR
+// Expand the given region of a palettized image into one of a shared ring of
+// pixel unpack buffers and leave it bound. The following glTexImage2D or
+// glTexSubImage2D call then just schedules a DMA transfer instead of copying
+// out of client memory on the spot, so uploading a page of texture browser
+// thumbnails doesn't stall the GUI thread. The buffers are orphaned on reuse
+// rather than fenced.
+static void expand_to_unpack_buffer(const texture& tex, vec2i top_left, vec2i extent) {
+	static GLuint unpack_buffers[4] = {};
+	static std::size_t next_unpack_buffer = 0;
+	if(unpack_buffers[0] == 0) {
+		glGenBuffers(4, unpack_buffers);
+	}
+	GLuint unpack_buffer = unpack_buffers[next_unpack_buffer];
+	next_unpack_buffer = (next_unpack_buffer + 1) % 4;
+
+	std::size_t buffer_size = extent.x * extent.y * 4;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, unpack_buffer);
+	glBufferData(GL_PIXEL_UNPACK_BUFFER, buffer_size, nullptr, GL_STREAM_DRAW);
+	uint8_t* colour_data = static_cast<uint8_t*>(glMapBufferRange(
+		GL_PIXEL_UNPACK_BUFFER, 0, buffer_size,
+		GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+	// Mapping can fail (e.g. after a context loss) - convert into a scratch
+	// buffer and upload it the slow way instead.
+	std::vector<uint8_t> scratch;
+	if(colour_data == nullptr) {
+		scratch.resize(buffer_size);
+		colour_data = scratch.data();
+	}
+	for(std::size_t y = 0; y < extent.y; y++) {
+		const uint8_t* src_row = tex.pixels->data() + (top_left.y + y) * tex.size.x + top_left.x;
+		uint8_t* dest_row = colour_data + y * extent.x * 4;
+		for(std::size_t x = 0; x < extent.x; x++) {
+			colour c = tex.palette[src_row[x]];
+			dest_row[x * 4] = c.r;
+			dest_row[x * 4 + 1] = c.g;
+			dest_row[x * 4 + 2] = c.b;
+			dest_row[x * 4 + 3] = static_cast<int>(c.a) * 2 - 1;
+		}
+	}
+	if(scratch.empty()) {
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+	} else {
+		glBufferSubData(GL_PIXEL_UNPACK_BUFFER, 0, buffer_size, scratch.data());
+	}
+}
+
 void texture::upload_to_opengl() {
-	std::vector<uint8_t> colour_data(pixels.size() * 4);
-	for(std::size_t i = 0; i < pixels.size(); i++) {
-		colour c = palette[pixels[i]];
-		colour_data[i * 4] = c.r;
-		colour_data[i * 4 + 1] = c.g;
-		colour_data[i * 4 + 2] = c.b;
-		colour_data[i * 4 + 3] = static_cast<int>(c.a) * 2 - 1;
-	}
-	
-	glDeleteTextures(1, &opengl_texture.id);
-	glGenTextures(1, &opengl_texture.id);
-	glBindTexture(GL_TEXTURE_2D, opengl_texture.id);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, colour_data.data());
+	// Identical textures from different WADs get one GL object between them.
+	// The cache owns the GL objects and outlives any given project;
+	// texture::opengl_texture is a non-owning handle into it.
+	static std::map<uint64_t, gl_texture> shared_opengl_textures;
+
+	uint64_t hash = content_hash();
+	auto cached = shared_opengl_textures.find(hash);
+	if(cached != shared_opengl_textures.end()) {
+		opengl_texture.id = cached->second();
+		return;
+	}
+
+	expand_to_unpack_buffer(*this, { 0, 0 }, size);
+
+	gl_texture& shared = shared_opengl_textures[hash];
+	glGenTextures(1, &shared());
+	glBindTexture(GL_TEXTURE_2D, shared());
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	// The browser grids draw these at thumbnail size, so minified sampling
+	// dominates - without mipmaps every 128px thumbnail reads the full
+	// resolution image, which eats memory bandwidth on integrated GPUs.
+	glGenerateMipmap(GL_TEXTURE_2D);
+	opengl_texture.id = shared();
+
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+}
+
+void texture::update_opengl() {
+	update_opengl({ 0, 0 }, size);
+}
+
+void texture::update_opengl(vec2i top_left, vec2i extent) {
+	// Private GL objects for textures under edit, keyed by their own id. The
+	// ids handed out by upload_to_opengl may be shared between any number of
+	// textures with identical content, so those objects can never be mutated
+	// in place; each id in this map belongs to exactly one texture.
+	struct edited_texture {
+		gl_texture object;
+		vec2i allocated_size;
+	};
+	static std::map<GLuint, edited_texture> edited_opengl_textures;
+
+	auto edited = edited_opengl_textures.find(opengl_texture.id);
+	if(edited == edited_opengl_textures.end() || edited->second.allocated_size != size) {
+		// First edit of this texture (or a pixel import changed its
+		// dimensions): move it onto a private object with a full upload.
+		// Subsequent edits take the sub-rectangle path below.
+		if(edited != edited_opengl_textures.end()) {
+			edited_opengl_textures.erase(edited);
+		}
+		expand_to_unpack_buffer(*this, { 0, 0 }, size);
+		gl_texture private_texture;
+		glGenTextures(1, &private_texture());
+		glBindTexture(GL_TEXTURE_2D, private_texture());
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glGenerateMipmap(GL_TEXTURE_2D);
+		opengl_texture.id = private_texture();
+		edited_opengl_textures.emplace(
+			opengl_texture.id, edited_texture { std::move(private_texture), size });
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+
+	expand_to_unpack_buffer(*this, top_left, extent);
+	glBindTexture(GL_TEXTURE_2D, edited->second.object());
+	glTexSubImage2D(GL_TEXTURE_2D, 0, top_left.x, top_left.y, extent.x, extent.y, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glGenerateMipmap(GL_TEXTURE_2D);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
 }
 #endif
 
@@ -76,7 +206,7 @@ texture create_texture_from_streams_rac4(vec2i size, stream* pixel_src, size_t p
 	texture result;
 	int buffer_size = size.x * size.y;
 	result.size = size;
-	result.pixels.resize(buffer_size);
+	result.pixels->resize(buffer_size);
 	pixel_src->seek(pixel_offset);
 	if (size.x >= 32 && size.y >= 4) {
 		for (int i = 0; i < buffer_size; ++i) {
@@ -84,11 +214,11 @@ texture create_texture_from_streams_rac4(vec2i size, stream* pixel_src, size_t p
 			if (map >= buffer_size) {
 				map = buffer_size - 1;
 			}
-			result.pixels[map] = pixel_src->read<uint8_t>();
+			(*result.pixels)[map] = pixel_src->read<uint8_t>();
 		}
 	}
 	else {
-		pixel_src->read_v(result.pixels);
+		pixel_src->read_v(*result.pixels);
 	}
 	colour temp_palette[256];
 	palette_src->seek(palette_offset);
@@ -103,9 +233,9 @@ texture create_texture_from_streams(vec2i size, stream* pixel_src, size_t pixel_
 	texture result;
 	int buffer_size = size.x * size.y;
 	result.size = size;
-	result.pixels.resize(buffer_size);
+	result.pixels->resize(buffer_size);
 	pixel_src->seek(pixel_offset);
-	pixel_src->read_v(result.pixels);
+	pixel_src->read_v(*result.pixels);
 	colour temp_palette[256];
 	palette_src->seek(palette_offset);
 	palette_src->read_n((char*) temp_palette, sizeof(temp_palette));
@@ -129,19 +259,126 @@ std::optional<texture> create_fip_texture(stream* backing, std::size_t offset) {
 	return std::move(tex);
 }
 
+void copy_fip_slice(array_stream& dest, stream& src, std::size_t offset) {
+	if(src.size() < offset + sizeof(fip_header)) {
+		return;
+	}
+	fip_header header = src.peek<fip_header>(offset);
+	std::size_t fip_size = sizeof(fip_header);
+	if(validate_fip(header.magic)) {
+		// If the magic doesn't check out the dimensions are garbage, so only
+		// trust them after validation.
+		fip_size += header.width * header.height;
+	}
+	if(fip_size > src.size() - offset) {
+		fip_size = src.size() - offset;
+	}
+	src.seek(offset);
+	stream::copy_n(dest, src, fip_size);
+}
+
+std::vector<std::optional<texture>> decode_fip_textures(std::vector<array_stream>& backings) {
+	std::vector<std::optional<texture>> textures(backings.size());
+
+	// Each slice decodes into its own output slot so the order is fixed up
+	// front. Errors are rethrown on the calling thread.
+	thread_pool::shared().parallel_for(backings.size(), [&](std::size_t i) {
+		textures[i] = create_fip_texture(&backings[i], 0);
+	});
+
+	return textures;
+}
+
+packed_struct(texture_cache_header,
+	char magic[4]; // "WTEX"
+	uint32_t version;
+	uint32_t count;
+)
+
+packed_struct(texture_cache_entry_header,
+	uint32_t width;
+	uint32_t height;
+	uint32_t name_size;
+	uint32_t pixels_size;
+)
+
+static const uint32_t TEXTURE_CACHE_VERSION = 1;
+
+std::optional<std::vector<texture>> read_texture_list_cache(std::string path) {
+	if(!fs::is_regular_file(path)) {
+		return {};
+	}
+	try {
+		file_stream file(path);
+		auto header = file.read<texture_cache_header>(0);
+		if(std::memcmp(header.magic, "WTEX", 4) != 0 ||
+		   header.version != TEXTURE_CACHE_VERSION) {
+			return {};
+		}
+		std::vector<texture> textures;
+		textures.reserve(header.count);
+		for(uint32_t i = 0; i < header.count; i++) {
+			auto entry = file.read<texture_cache_entry_header>();
+			texture tex;
+			tex.size = { entry.width, entry.height };
+			file.read_n(reinterpret_cast<char*>(tex.palette), sizeof(tex.palette));
+			tex.name.resize(entry.name_size);
+			file.read_n(tex.name.data(), entry.name_size);
+			tex.pixels->resize(entry.pixels_size);
+			file.read_n(reinterpret_cast<char*>(tex.pixels->data()), entry.pixels_size);
+			tex.deduplicate();
+			textures.emplace_back(std::move(tex));
+		}
+		return textures;
+	} catch(stream_error&) {
+		return {};
+	}
+}
+
+void write_texture_list_cache(std::string path, const std::vector<texture>& textures) {
+	try {
+		file_stream file(path, std::ios::in | std::ios::out | std::ios::trunc);
+		texture_cache_header header;
+		std::memcpy(header.magic, "WTEX", 4);
+		header.version = TEXTURE_CACHE_VERSION;
+		header.count = textures.size();
+		file.write<texture_cache_header>(0, header);
+		for(const texture& tex : textures) {
+			texture_cache_entry_header entry;
+			entry.width = tex.size.x;
+			entry.height = tex.size.y;
+			entry.name_size = tex.name.size();
+			entry.pixels_size = tex.pixels->size();
+			file.write<texture_cache_entry_header>(entry);
+			file.write_n(reinterpret_cast<const char*>(tex.palette), sizeof(tex.palette));
+			file.write_n(tex.name.data(), tex.name.size());
+			file.write_n(reinterpret_cast<const char*>(tex.pixels->data()), tex.pixels->size());
+		}
+	} catch(stream_error&) {
+		// Best effort - next open just decodes from scratch again.
+	}
+}
+
 std::vector<texture> read_pif_list(stream* backing, std::size_t offset) {
 	uint32_t count = backing->read<uint32_t>(0);
-	
+
 	std::vector<uint32_t> offsets(count);
 	backing->read_v(offsets);
-	
+
+	std::vector<array_stream> slices(offsets.size());
+	for(std::size_t i = 0; i < offsets.size(); i++) {
+		copy_fip_slice(slices[i], *backing, offset + offsets[i]);
+	}
+
+	std::vector<std::optional<texture>> decoded = decode_fip_textures(slices);
+
 	std::vector<texture> textures;
-	for(uint32_t texture_offset : offsets) {
-		auto texture = create_fip_texture(backing, offset + texture_offset);
+	for(std::optional<texture>& texture : decoded) {
 		if(texture) {
+			texture->deduplicate();
 			textures.emplace_back(std::move(*texture));
 		}
 	}
-	
+
 	return textures;
 }
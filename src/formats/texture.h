@@ -20,6 +20,7 @@
 #define FORMATS_TEXTURE_H
 
 #include <array>
+#include <memory>
 #include <vector>
 #include <stdint.h>
 #include <glm/glm.hpp>
@@ -45,16 +46,40 @@ struct vec2i {
 
 struct texture {
 	vec2i size;
-	std::vector<uint8_t> pixels;
+	// The same textures recur across levels and archives, so after
+	// deduplicate() the pixel buffer may be shared with other texture
+	// objects. Never mutate it in place - assign a fresh buffer instead
+	// (see bmp_to_texture).
+	std::shared_ptr<std::vector<uint8_t>> pixels =
+		std::make_shared<std::vector<uint8_t>>();
 	colour palette[256];
 	std::string name;
-	
+
+	// Hash of the pixels and palette.
+	uint64_t content_hash() const;
+
+	// Share this texture's pixel buffer with any other live texture that has
+	// identical pixels. Not thread safe.
+	void deduplicate();
+
 #ifdef WRENCH_EDITOR
 	void upload_to_opengl();
-	gl_texture opengl_texture;
+	// In-place update of an already uploaded texture. Edits go through a
+	// private GL object (objects in the shared cache are handed out by
+	// content hash, so they can never be mutated) and only respecify the
+	// dirty sub-rectangle, so iterative edits don't pay for a full
+	// glTexImage2D each time. The no-argument form updates the whole image -
+	// use it for palette changes, which touch every expanded texel.
+	void update_opengl();
+	void update_opengl(vec2i top_left, vec2i extent);
+	// Handle to a texture owned by the shared upload cache in texture.cpp,
+	// which is why this isn't an owning gl_texture.
+	struct { GLuint id = 0; } opengl_texture;
 #else
-	// Dummy to get the randomiser linking.
+	// Dummies to get the randomiser linking.
 	void upload_to_opengl() {}
+	void update_opengl() {}
+	void update_opengl(vec2i top_left, vec2i extent) {}
 #endif
 };
 
@@ -64,6 +89,25 @@ texture create_texture_from_streams_rac4(vec2i size, stream* pixel_src, size_t p
 // Won't affect the position indicator of backing.
 std::optional<texture> create_fip_texture(stream* backing, std::size_t offset);
 
+// Copy the bytes of a single 2FIP texture into an in-memory stream so it can
+// be decoded off the thread that owns the source stream. Clamps to the end of
+// the source stream - decoding a truncated slice fails the same way reading
+// the source directly would.
+void copy_fip_slice(array_stream& dest, stream& src, std::size_t offset);
+
+// Decode a batch of 2FIP textures across multiple threads, one backing slice
+// per texture. The output is in the same order as the input. Slices that fail
+// to decode produce empty optionals.
+std::vector<std::optional<texture>> decode_fip_textures(std::vector<array_stream>& backings);
+
+// On-disk cache of decoded texture lists so warm project opens can skip the
+// locate/inflate/decode work entirely. The cache is best effort: reads return
+// nothing if the file is missing or malformed, writes swallow I/O errors.
+// Callers are responsible for putting the files somewhere that gets
+// invalidated when the source data changes (see iso_stream::derived_cache_path).
+std::optional<std::vector<texture>> read_texture_list_cache(std::string path);
+void write_texture_list_cache(std::string path, const std::vector<texture>& textures);
+
 // Read a list of textures in the following format:
 //  uint32_t count;
 //  uint32_t offsets[count];
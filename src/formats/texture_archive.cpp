@@ -25,40 +25,88 @@ packed_struct(texture_table_entry,
 	uint32_t unknown_4;
 )
 
-std::vector<texture> enumerate_fip_textures(iso_stream& iso, const toc_table& table) {
-	std::vector<texture> textures;
-	
+std::vector<texture> enumerate_fip_textures(iso_stream& iso, stream& backing, const toc_table& table) {
+	// Decoding one of the big texture WADs means inflating hundreds of
+	// individually compressed segments, so the decoded list is cached on disk
+	// per table. The cache file name bakes in the patch hash - see
+	// iso_stream::derived_cache_path.
+	std::string cache_path = iso.derived_cache_path(
+		"textures_tbl_" + std::to_string(table.index) + ".bin");
+	if(auto cached = read_texture_list_cache(cache_path)) {
+		return std::move(*cached);
+	}
+
 	std::size_t bad_textures = 0;
-	
+
 	// Prevent crashes when the table.data.size() % sizeof(texture_table_entry) != 0.
 	std::size_t table_size = table.data.size() - sizeof(texture_table_entry) + 1;
-	
+
+	// Generous upper bound on one texture. The pixels are 8bpp, so even a
+	// 1024x1024 image fits comfortably.
+	static const std::size_t MAX_FIP_SIZE = sizeof(fip_header) + 1024 * 1024;
+
+	// Fetch the table's whole sector range in one read, so the header probes
+	// below hit memory. Probing each entry individually issues thousands of
+	// sub-kilobyte reads against the ISO.
+	std::size_t span_begin = SIZE_MAX;
+	std::size_t span_end = 0;
 	for(std::size_t off = 0; off < table_size; off += sizeof(texture_table_entry)) {
 		auto entry = table.data.peek<texture_table_entry>(off);
+		if(entry.offset.bytes() == 0) {
+			continue;
+		}
 		std::size_t abs_offset = table.header.base_offset.bytes() + entry.offset.bytes();
-		
-		if(abs_offset > iso.size()) {
+		if(abs_offset > backing.size()) {
 			return {};
 		}
-		
+		span_begin = std::min(span_begin, abs_offset);
+		span_end = std::max(span_end, abs_offset + MAX_FIP_SIZE);
+	}
+	if(span_begin >= span_end) {
+		return {}; // Every entry was empty.
+	}
+	span_end = std::min(span_end, backing.size());
+
+	array_stream span;
+	backing.seek(span_begin);
+	stream::copy_n(span, backing, span_end - span_begin);
+
+	// Slice the raw 2FIP data out of the span serially - the backing streams
+	// can't be shared between threads - then decode the slices across a
+	// worker pool. The decodes are independent and dominate the time here.
+	std::vector<array_stream> slices;
+	std::vector<std::string> slice_paths; // For error messages.
+
+	for(std::size_t off = 0; off < table_size; off += sizeof(texture_table_entry)) {
+		auto entry = table.data.peek<texture_table_entry>(off);
 		if(entry.offset.bytes() == 0) {
 			continue;
 		}
+		std::size_t abs_offset = table.header.base_offset.bytes() + entry.offset.bytes();
+		std::size_t local_offset = abs_offset - span_begin;
 		
 		stream* file;
 		std::size_t inner_offset;
-		char wad_magic[3];
-		iso.seek(abs_offset);
-		iso.read_n(wad_magic, 3);
-		if(std::memcmp(wad_magic, "WAD", 3) == 0) {
-			file = iso.get_decompressed(abs_offset, true);
+		std::optional<simple_wad_stream> wad;
+		if(local_offset + 3 <= span.buffer.size() &&
+				std::memcmp(span.buffer.data() + local_offset, "WAD", 3) == 0) {
+			// Inflate compressed entries locally instead of through
+			// iso.get_decompressed - the shared wad_stream cache isn't thread
+			// safe and tables may be enumerated on separate workers.
+			try {
+				wad.emplace(&backing, abs_offset);
+			} catch(stream_error&) {
+				bad_textures++;
+				continue;
+			}
+			file = &(*wad);
 			inner_offset = 0;
 		} else {
-			file = &iso;
-			inner_offset = abs_offset;
+			file = &span;
+			inner_offset = local_offset;
 		}
 		
-		if(file == nullptr || file->size() < inner_offset + 0x14) {
+		if(file->size() < inner_offset + 0x14) {
 			bad_textures++;
 			continue;
 		}
@@ -76,25 +124,40 @@ std::vector<texture> enumerate_fip_textures(iso_stream& iso, const toc_table& ta
 		}
 		
 		if(texture_offset) {
-			std::optional<texture> tex = create_fip_texture(file, inner_offset + *texture_offset);
-			if(tex) {
-				if(file != &iso) {
-					file->name =
-						"Tbl " + std::to_string(table.index) +
-						" Tex " + std::to_string(off / sizeof(texture_table_entry));
-				}
-				textures.emplace_back(std::move(*tex));
-			} else {
-				bad_textures++;
-				std::cerr << "Error: Failed to load 2FIP texture at "
-				          << file->resource_path() << "\n";
+			if(file != &span) {
+				file->name =
+					"Tbl " + std::to_string(table.index) +
+					" Tex " + std::to_string(off / sizeof(texture_table_entry));
 			}
+			array_stream& slice = slices.emplace_back();
+			copy_fip_slice(slice, *file, inner_offset + *texture_offset);
+			slice_paths.emplace_back(file == &span ? iso.resource_path() : file->resource_path());
+		}
+	}
+
+	std::vector<std::optional<texture>> decoded = decode_fip_textures(slices);
+
+	std::vector<texture> textures;
+	for(std::size_t i = 0; i < decoded.size(); i++) {
+		if(decoded[i]) {
+			decoded[i]->deduplicate();
+			textures.emplace_back(std::move(*decoded[i]));
+		} else {
+			bad_textures++;
+			std::cerr << "Error: Failed to load 2FIP texture at "
+			          << slice_paths[i] << "\n";
 		}
 	}
-	
+
 	if(bad_textures > 10) {
 		return {};
 	}
-	
+
+	// Don't cache empty results - tables that aren't texture tables are
+	// cheap to reject again next time.
+	if(textures.size() > 0) {
+		write_texture_list_cache(cache_path, textures);
+	}
+
 	return textures;
 }
@@ -23,6 +23,9 @@
 #include "toc.h"
 #include "texture.h"
 
-std::vector<texture> enumerate_fip_textures(iso_stream& iso, const toc_table& table);
+// Reads through backing rather than iso so that tables can be enumerated in
+// parallel - pass each call its own stream over the cache ISO. iso is only
+// used for cache paths and error messages.
+std::vector<texture> enumerate_fip_textures(iso_stream& iso, stream& backing, const toc_table& table);
 
 #endif
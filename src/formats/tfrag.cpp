@@ -18,6 +18,7 @@
 
 #include "tfrag.h"
 #include "../util.h"
+#include "../fs_includes.h"
 
 tfrag::tfrag(stream *backing, std::size_t base_offset, tfrag_entry & entry)
 		: _backing(backing, base_offset, 0), _base_offset(base_offset) {
@@ -81,6 +82,9 @@ tfrag::tfrag(stream *backing, std::size_t base_offset, tfrag_entry & entry)
 	}
 }
 
+tfrag::tfrag(std::vector<float> baked_triangles)
+	: _base_offset(0), _tfrag_triangles(std::move(baked_triangles)) {}
+
 std::vector<float> tfrag::triangles() const {
 	return _tfrag_triangles;
 }
@@ -222,3 +226,63 @@ void tfrag::warn_current_tfrag(const char* message) {
 	fprintf(stderr, "warning: Model %s (at %s), tfrag at %ld has %s.\n",
 		_backing.name.c_str(), _backing.resource_path().c_str(), _base_offset, message);
 }
+
+packed_struct(tfrag_mesh_cache_header,
+	char magic[4]; // "WTFR"
+	uint32_t version;
+	uint32_t count;
+	uint32_t pad;
+	uint64_t entry_hash; // Of the tfrag_entry table the meshes were baked from.
+)
+
+static const uint32_t TFRAG_MESH_CACHE_VERSION = 1;
+
+std::optional<std::vector<std::vector<float>>> read_tfrag_mesh_cache(
+		std::string path, uint64_t entry_hash) {
+	if(!fs::is_regular_file(path)) {
+		return {};
+	}
+	try {
+		file_stream file(path);
+		auto header = file.read<tfrag_mesh_cache_header>(0);
+		if(std::memcmp(header.magic, "WTFR", 4) != 0 ||
+		   header.version != TFRAG_MESH_CACHE_VERSION ||
+		   header.entry_hash != entry_hash) {
+			return {};
+		}
+		std::vector<std::vector<float>> meshes;
+		meshes.reserve(header.count);
+		for(uint32_t i = 0; i < header.count; i++) {
+			auto float_count = file.read<uint32_t>();
+			std::vector<float> triangles(float_count);
+			file.read_v(triangles);
+			meshes.emplace_back(std::move(triangles));
+		}
+		return meshes;
+	} catch(stream_error&) {
+		return {};
+	}
+}
+
+void write_tfrag_mesh_cache(
+		std::string path, uint64_t entry_hash, const std::vector<tfrag>& tfrags) {
+	try {
+		file_stream file(path, std::ios::in | std::ios::out | std::ios::trunc);
+		tfrag_mesh_cache_header header;
+		std::memcpy(header.magic, "WTFR", 4);
+		header.version = TFRAG_MESH_CACHE_VERSION;
+		header.count = tfrags.size();
+		header.pad = 0;
+		header.entry_hash = entry_hash;
+		file.write<tfrag_mesh_cache_header>(0, header);
+		for(const tfrag& frag : tfrags) {
+			std::vector<float> triangles = frag.triangles();
+			file.write<uint32_t>(triangles.size());
+			file.write_n(
+				reinterpret_cast<const char*>(triangles.data()),
+				triangles.size() * sizeof(float));
+		}
+	} catch(stream_error&) {
+		// Best effort - next open just rebuilds the meshes from scratch.
+	}
+}
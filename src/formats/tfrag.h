@@ -20,6 +20,7 @@
 #define FORMATS_TFRAG_H
 
 #include <map>
+#include <optional>
 
 #include "../model.h"
 #include "../stream.h"
@@ -112,6 +113,9 @@ public:
 	};
 
 	tfrag(stream *backing, std::size_t base_offset, tfrag_entry & entry);
+	// Construct from a triangle list baked by a previous run, skipping the
+	// VIF list interpretation entirely. See read_tfrag_mesh_cache.
+	tfrag(std::vector<float> baked_triangles);
 
 	tfrag::interpreted_tfrag_vif_list interpret_vif_list(
 		const std::vector<vif_packet>& vif_list);
@@ -131,4 +135,15 @@ private:
 	std::vector<float> _tfrag_triangles;
 };
 
+// On-disk cache of baked tfrag triangle lists so warm level opens can skip
+// the VIF list interpretation. Best effort, like the texture list cache:
+// reads return nothing if the file is missing, malformed or was baked from a
+// different entry table, writes swallow I/O errors. Put the files somewhere
+// that gets invalidated when the source data changes (see
+// iso_stream::derived_cache_path).
+std::optional<std::vector<std::vector<float>>> read_tfrag_mesh_cache(
+	std::string path, uint64_t entry_hash);
+void write_tfrag_mesh_cache(
+	std::string path, uint64_t entry_hash, const std::vector<tfrag>& tfrags);
+
 #endif
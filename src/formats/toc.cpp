@@ -18,117 +18,245 @@
 
 #include "toc.h"
 
+#include <cstring>
+
 #include "../util.h"
+#include "../fs_includes.h"
 
 table_of_contents read_toc(stream& iso, std::size_t toc_base) {
 	table_of_contents toc;
-	
-	std::size_t level_table_offset = toc_get_level_table_offset(iso, toc_base);
+
+	if(toc_base >= iso.size()) {
+		return toc;
+	}
+
+	// One big sequential read up front. Everything below except the odd magic
+	// probe that points outside the TOC region is served from this buffer
+	// instead of seeking around the ISO sector by sector.
+	std::vector<uint8_t> toc_buffer(std::min(TOC_MAX_SIZE, iso.size() - toc_base));
+	iso.seek(toc_base);
+	iso.read_v(toc_buffer);
+
+	auto read_magic = [&](sector32 header) -> std::optional<uint32_t> {
+		if(header.bytes() > iso.size()) {
+			return {};
+		}
+		if(header.bytes() >= toc_base) {
+			std::size_t rel = header.bytes() - toc_base;
+			if(rel + sizeof(uint32_t) <= toc_buffer.size()) {
+				uint32_t magic;
+				std::memcpy(&magic, &toc_buffer[rel], sizeof(uint32_t));
+				return magic;
+			}
+		}
+		return iso.read<uint32_t>(header.bytes());
+	};
+
+	std::size_t level_table_offset = toc_get_level_table_offset(toc_buffer, toc_base);
 	if(level_table_offset == 0x0) {
 		// We've failed to find the level table, at least try to find some of the other tables.
 		level_table_offset = 0xffff;
 	}
-	
-	iso.seek(toc_base);
+
+	std::size_t pos = 0;
 	std::size_t table_index = 0;
-	while(iso.tell() + 4 * 6 < toc_base + level_table_offset) {
+	while(pos + 4 * 6 < level_table_offset && pos + sizeof(toc_table_header) <= toc_buffer.size()) {
 		toc_table table;
 		table.index = table_index++;
-		table.offset_in_toc = iso.tell() - toc_base;
-		table.header = iso.read<toc_table_header>();
+		table.offset_in_toc = pos;
+		std::memcpy(&table.header, &toc_buffer[pos], sizeof(toc_table_header));
 		if(table.header.size < sizeof(toc_table_header) || table.header.size > 0xffff) {
 			break;
 		}
-		stream::copy_n(table.data, iso, table.header.size - sizeof(toc_table_header));
+		std::size_t data_size = table.header.size - sizeof(toc_table_header);
+		if(pos + sizeof(toc_table_header) + data_size > toc_buffer.size()) {
+			break;
+		}
+		table.data.buffer.assign(
+			(char*) &toc_buffer[pos + sizeof(toc_table_header)],
+			(char*) &toc_buffer[pos + sizeof(toc_table_header) + data_size]);
+		table.data.seek(data_size);
+		pos += table.header.size;
 		toc.tables.emplace_back(std::move(table));
 	}
-	
-	std::vector<toc_level_table_entry> level_table(TOC_MAX_LEVELS);
-	iso.seek(toc_base + level_table_offset);
-	iso.read_v(level_table);
+
 	for(std::size_t i = 0; i < TOC_MAX_LEVELS; i++) {
-		toc_level_table_entry entry = level_table[i];
-		
+		std::size_t entry_offset = level_table_offset + i * sizeof(toc_level_table_entry);
+		if(entry_offset + sizeof(toc_level_table_entry) > toc_buffer.size()) {
+			break;
+		}
+		toc_level_table_entry entry;
+		std::memcpy(&entry, &toc_buffer[entry_offset], sizeof(toc_level_table_entry));
+
 		toc_level level;
 		level.level_table_index = i;
 		bool has_main_part = false;
-		
+
 		// The games have the fields in different orders, so we check the type
 		// of what each field points to so we can support them all.
 		sector32 headers[] = { entry.header_1, entry.header_2, entry.header_3 };
 		sector32 sizes[] = { entry.header_1_size, entry.header_2_size, entry.header_3_size };
 		for(std::size_t j = 0; j < sizeof(headers) / sizeof(sector32); j++) {
-			if(headers[j].bytes() > iso.size()) {
+			std::optional<uint32_t> magic = read_magic(headers[j]);
+			if(!magic) {
 				break;
 			}
-			
-			uint32_t magic = iso.read<uint32_t>(headers[j].bytes());
-			if(contains(TOC_MAIN_PART_MAGIC, magic)) {
+
+			if(contains(TOC_MAIN_PART_MAGIC, *magic)) {
 				level.main_part = headers[j];
 				level.main_part_size = sizes[j];
 				// Find where the file size is stored on disk so we can patch it later.
 				level.main_part_size_offset = toc_base + level_table_offset + (i * 4 * 6) + (j * 8) + 4;
 				has_main_part = true;
 			}
-			
-			if(contains(TOC_AUDIO_PART_MAGIC, magic)) {
+
+			if(contains(TOC_AUDIO_PART_MAGIC, *magic)) {
 				level.audio_part = headers[j];
 				level.audio_part_size = sizes[j];
 			}
-			
-			if(contains(TOC_SCENE_PART_MAGIC, magic)) {
+
+			if(contains(TOC_SCENE_PART_MAGIC, *magic)) {
 				level.scene_part = headers[j];
 				level.scene_part_size = sizes[j];
 			}
 		}
-		
+
 		if(!has_main_part) {
 			continue;
 		}
-		
+
 		toc.levels.push_back(level);
 	}
-	
+
 	return toc;
 }
 
-std::size_t toc_get_level_table_offset(stream& iso, std::size_t toc_base) {
-	std::vector<uint8_t> buffer(TOC_MAX_SIZE);
-	iso.seek(toc_base);
-	iso.read_v(buffer);
-	
-	for(std::size_t i = 0; i < TOC_MAX_INDEX_SIZE - sizeof(toc_level_table_entry); i += sizeof(uint32_t)) {
+packed_struct(toc_cache_header,
+	char magic[4]; // "WTOC"
+	uint32_t version;
+	uint32_t table_count;
+	uint32_t level_count;
+	uint64_t toc_base;
+)
+
+static const uint32_t TOC_CACHE_VERSION = 1;
+
+std::optional<table_of_contents> toc_read_cache(std::string path, std::size_t toc_base) {
+	if(!fs::is_regular_file(path)) {
+		return {};
+	}
+	try {
+		file_stream file(path);
+		auto header = file.read<toc_cache_header>(0);
+		if(std::memcmp(header.magic, "WTOC", 4) != 0 ||
+		   header.version != TOC_CACHE_VERSION ||
+		   header.toc_base != toc_base) {
+			return {};
+		}
+		table_of_contents toc;
+		toc.tables.reserve(header.table_count);
+		for(uint32_t i = 0; i < header.table_count; i++) {
+			toc_table table;
+			table.index = file.read<uint32_t>();
+			table.offset_in_toc = file.read<uint32_t>();
+			table.header = file.read<toc_table_header>();
+			table.data.buffer.resize(file.read<uint32_t>());
+			file.read_n(table.data.buffer.data(), table.data.buffer.size());
+			table.data.seek(table.data.buffer.size());
+			toc.tables.emplace_back(std::move(table));
+		}
+		toc.levels.reserve(header.level_count);
+		for(uint32_t i = 0; i < header.level_count; i++) {
+			toc_level level;
+			level.level_table_index = file.read<uint64_t>();
+			level.main_part_size_offset = file.read<uint64_t>();
+			level.main_part = file.read<sector32>();
+			level.main_part_size = file.read<sector32>();
+			level.audio_part = file.read<sector32>();
+			level.audio_part_size = file.read<sector32>();
+			level.scene_part = file.read<sector32>();
+			level.scene_part_size = file.read<sector32>();
+			toc.levels.push_back(level);
+		}
+		return toc;
+	} catch(stream_error&) {
+		return {};
+	}
+}
+
+void toc_write_cache(std::string path, std::size_t toc_base, const table_of_contents& toc) {
+	try {
+		file_stream file(path, std::ios::in | std::ios::out | std::ios::trunc);
+		toc_cache_header header;
+		std::memcpy(header.magic, "WTOC", 4);
+		header.version = TOC_CACHE_VERSION;
+		header.table_count = toc.tables.size();
+		header.level_count = toc.levels.size();
+		header.toc_base = toc_base;
+		file.write<toc_cache_header>(0, header);
+		for(const toc_table& table : toc.tables) {
+			file.write<uint32_t>(table.index);
+			file.write<uint32_t>(table.offset_in_toc);
+			file.write<toc_table_header>(table.header);
+			file.write<uint32_t>(table.data.buffer.size());
+			file.write_n(table.data.buffer.data(), table.data.buffer.size());
+		}
+		for(const toc_level& level : toc.levels) {
+			file.write<uint64_t>(level.level_table_index);
+			file.write<uint64_t>(level.main_part_size_offset);
+			file.write<sector32>(level.main_part);
+			file.write<sector32>(level.main_part_size);
+			file.write<sector32>(level.audio_part);
+			file.write<sector32>(level.audio_part_size);
+			file.write<sector32>(level.scene_part);
+			file.write<sector32>(level.scene_part_size);
+		}
+	} catch(stream_error&) {
+		// Best effort - the next open just scans the ISO again.
+	}
+}
+
+std::size_t toc_get_level_table_offset(const std::vector<uint8_t>& toc_buffer, std::size_t toc_base) {
+	if(toc_buffer.size() < 2 * sizeof(toc_level_table_entry)) {
+		return 0;
+	}
+
+	std::size_t scan_end = std::min(
+		TOC_MAX_INDEX_SIZE - sizeof(toc_level_table_entry),
+		toc_buffer.size() - 2 * sizeof(toc_level_table_entry));
+	for(std::size_t i = 0; i < scan_end; i += sizeof(uint32_t)) {
 		// Check that the two next entries are valid. This is necessary to
 		// get past a false positive in Deadlocked.
-		toc_level_table_entry entry1 = *(toc_level_table_entry*) &buffer[i];
-		toc_level_table_entry entry2 = *(toc_level_table_entry*) &buffer[i + sizeof(toc_level_table_entry)];
+		toc_level_table_entry entry1 = *(toc_level_table_entry*) &toc_buffer[i];
+		toc_level_table_entry entry2 = *(toc_level_table_entry*) &toc_buffer[i + sizeof(toc_level_table_entry)];
 		sector32 headers[] = {
 			entry1.header_1, entry1.header_2, entry1.header_3,
 			entry2.header_1, entry2.header_2, entry2.header_3
 		};
-		
+
 		int parts = 0;
 		for(sector32 header : headers) {
 			if(header.sectors == 0) {
 				break;
 			}
-			
+
 			std::size_t magic_offset = header.bytes() - toc_base;
-			
-			if(magic_offset > TOC_MAX_SIZE - sizeof(uint32_t)) {
+
+			if(header.bytes() < toc_base ||
+			   magic_offset > toc_buffer.size() - sizeof(uint32_t)) {
 				break;
 			}
-			
-			uint32_t magic = *(uint32_t*) &buffer[magic_offset];
+
+			uint32_t magic = *(uint32_t*) &toc_buffer[magic_offset];
 			if(contains(TOC_MAIN_PART_MAGIC, magic) ||
 			   contains(TOC_AUDIO_PART_MAGIC, magic) ||
 			   contains(TOC_SCENE_PART_MAGIC, magic)) {
 				parts++;
 			}
 		}
-		
+
 		if(parts == 6) {
-			return i * sizeof(buffer[0]);
+			return i * sizeof(toc_buffer[0]);
 		}
 	}
 	return 0;
@@ -19,6 +19,8 @@
 #ifndef FORMATS_TOC_H
 #define FORMATS_TOC_H
 
+#include <optional>
+
 #include "../stream.h"
 
 # /*
@@ -71,6 +73,11 @@ static const std::vector<uint32_t> TOC_AUDIO_PART_MAGIC = { 0x1018, 0x1818, 0x10
 static const std::vector<uint32_t> TOC_SCENE_PART_MAGIC = { 0x137c, 0x2420, 0x26f0 };
 
 table_of_contents read_toc(stream& iso, std::size_t toc_base);
-std::size_t toc_get_level_table_offset(stream& iso, std::size_t toc_base);
+// On-disk cache for parsed TOCs, so warm project opens can skip the sector
+// scan entirely. The caller is responsible for picking a path that encodes
+// the patch state of the ISO (see wrench_project).
+std::optional<table_of_contents> toc_read_cache(std::string path, std::size_t toc_base);
+void toc_write_cache(std::string path, std::size_t toc_base, const table_of_contents& toc);
+std::size_t toc_get_level_table_offset(const std::vector<uint8_t>& toc_buffer, std::size_t toc_base);
 
 #endif
@@ -18,6 +18,7 @@
 
 #include "vif.h"
 
+#include <cstring>
 #include <iomanip>
 #include <sstream>
 
@@ -206,10 +207,10 @@ std::string vif_code::to_string() const {
 			if(!is_unpack()) {
 				return "INVALID VIF CODE";
 			}
-			ss << "UNPACK vnvl=" << enum_to_string({VIF_VNVL_STRINGS}, unpack.vnvl)
+			ss << "UNPACK vnvl=" << enum_to_string(VIF_VNVL_STRINGS, unpack.vnvl)
 			   << " num=" << num
-			   << " flg=" << enum_to_string({VIF_FLG_STRINGS}, unpack.flg)
-			   << " usn=" << enum_to_string({VIF_USN_STRINGS}, unpack.usn)
+			   << " flg=" << enum_to_string(VIF_FLG_STRINGS, unpack.flg)
+			   << " usn=" << enum_to_string(VIF_USN_STRINGS, unpack.usn)
 			   << " addr=" << unpack.addr;
 	}
 	ss << " interrupt=" << interrupt
@@ -217,14 +218,93 @@ std::string vif_code::to_string() const {
 	return ss.str();
 }
 
+std::vector<vif_packet_view> parse_vif_chain_view(const uint8_t* chain, std::size_t base_address, std::size_t qwc) {
+	std::vector<vif_packet_view> result;
+
+	std::size_t offset = 0;
+	while(offset < qwc * 16) {
+		vif_packet_view view;
+		view.address = base_address + offset + 4;
+		view.data = chain + offset + 4;
+		view.data_size = 0;
+		view.error = nullptr;
+
+		uint32_t val;
+		std::memcpy(&val, chain + offset, 4);
+		std::optional<vif_code> code = vif_code::parse(val);
+		if(!code) {
+			view.error = "failed to parse VIF code";
+			result.push_back(view);
+			break;
+		}
+
+		view.code = *code;
+
+		std::size_t packet_size = view.code.packet_size();
+		if(packet_size > 0x10000) {
+			view.error = "packet_size > 0x10000";
+			result.push_back(view);
+			break;
+		}
+
+		view.data_size = packet_size - 4; // Skip VIFcode.
+
+		offset += packet_size;
+		if(offset > qwc * 16) {
+			view.error = "offset > qwc * 16";
+		}
+
+		result.push_back(view);
+	}
+
+	return result;
+}
+
 std::vector<vif_packet> parse_vif_chain(const stream* src, std::size_t base_address, std::size_t qwc) {
+	// Most chains live in in-memory segments which can hand us a pointer to
+	// the whole thing; parsing over that and bulk-copying the payloads beats
+	// peeking them out of the stream one byte at a time. map_n doesn't move
+	// the position indicator, but it isn't const, hence the cast - the same
+	// trick peek uses.
+	if(qwc < SIZE_MAX / 16) {
+		const char* mapped = const_cast<stream*>(src)->map_n(base_address, qwc * 16);
+		if(mapped != nullptr) {
+			std::vector<vif_packet_view> views = parse_vif_chain_view(
+				reinterpret_cast<const uint8_t*>(mapped), base_address, qwc);
+			// A malformed final packet can extend past qwc * 16 (that's the
+			// "offset > qwc * 16" error case). The slow path just peeks past
+			// the end of the range, so before copying, make sure the overrun
+			// is actually resident too.
+			bool in_bounds = true;
+			if(views.size() > 0) {
+				const vif_packet_view& last = views.back();
+				std::size_t extent =
+					(last.data + last.data_size) - reinterpret_cast<const uint8_t*>(mapped);
+				in_bounds = extent <= qwc * 16 ||
+					const_cast<stream*>(src)->map_n(base_address, extent) != nullptr;
+			}
+			if(in_bounds) {
+				std::vector<vif_packet> chain(views.size());
+				for(std::size_t i = 0; i < views.size(); i++) {
+					chain[i].address = views[i].address;
+					chain[i].code = views[i].code;
+					chain[i].data.assign(views[i].data, views[i].data + views[i].data_size);
+					if(views[i].error != nullptr) {
+						chain[i].error = views[i].error;
+					}
+				}
+				return chain;
+			}
+		}
+	}
+
 	std::vector<vif_packet> chain;
-	
+
 	std::size_t offset = 0;
 	while(offset < qwc * 16) {
 		vif_packet vpkt;
 		vpkt.address = base_address + offset + 4;
-		
+
 		uint32_t val = src->peek<uint32_t>(base_address + offset);
 		std::optional<vif_code> code = vif_code::parse(val);
 		if(!code) {
@@ -232,29 +312,29 @@ std::vector<vif_packet> parse_vif_chain(const stream* src, std::size_t base_addr
 			chain.push_back(vpkt);
 			break;
 		}
-		
+
 		vpkt.code = *code;
-		
+
 		std::size_t packet_size = vpkt.code.packet_size();
 		if(packet_size > 0x10000) {
 			vpkt.error = "packet_size > 0x10000";
 			chain.push_back(vpkt);
 			break;
 		}
-		
+
 		// Skip VIFcode.
 		for(std::size_t j = 4; j < packet_size; j++) {
 			vpkt.data.push_back(src->peek<uint8_t>(base_address + offset + j));
 		}
-		
+
 		offset += packet_size;
 		if(offset > qwc * 16) {
 			vpkt.error = "offset > qwc * 16";
 		}
-		
+
 		chain.push_back(vpkt);
 	}
-	
+
 	return chain;
 }
 
@@ -19,6 +19,7 @@
 #ifndef FORMATS_VIF_H
 #define FORMATS_VIF_H
 
+#include <array>
 #include <string>
 #include <optional>
 
@@ -58,8 +59,9 @@ enum class vif_vn {
 	THREE = 0b10,
 	FOUR  = 0b11
 };
-#define VIF_VN_STRINGS \
+constexpr std::array VIF_VN_STRINGS {
 	"ONE", "TWO", "THREE", "FOUR"
+};
 
 enum class vif_vl {
 	QWORD = 0b00,
@@ -67,8 +69,9 @@ enum class vif_vl {
 	BYTE  = 0b10,
 	B5551 = 0b11
 };
-#define VIF_VL_STRINGS \
+constexpr std::array VIF_VL_STRINGS {
 	"QWORD", "DWORD", "BYTE", "B5551"
+};
 
 enum class vif_vnvl {
 	S_32     = 0b0000,
@@ -88,25 +91,28 @@ enum class vif_vnvl {
 	V4_8     = 0b1110,
 	V4_5     = 0b1111
 };
-#define VIF_VNVL_STRINGS \
-	"S_32", "S_16", "ERR_0010", "ERR_0011", \
-	"V2_32", "V2_16", "V2_8", "ERR_0111", \
-	"V3_32", "V3_16", "V3_8", "ERR_1011", \
+constexpr std::array VIF_VNVL_STRINGS {
+	"S_32", "S_16", "ERR_0010", "ERR_0011",
+	"V2_32", "V2_16", "V2_8", "ERR_0111",
+	"V3_32", "V3_16", "V3_8", "ERR_1011",
 	"V4_32", "V4_16", "V4_8", "V4_5"
+};
 
 enum class vif_flg {
 	DO_NOT_USE_VIF1_TOPS = 0x0,
 	USE_VIF1_TOPS        = 0x1
 };
-#define VIF_FLG_STRINGS \
+constexpr std::array VIF_FLG_STRINGS {
 	"DO_NOT_USE_VIF1_TOPS", "USE_VIF1_TOPS"
+};
 
 enum class vif_usn {
 	SIGNED   = 0x0,
 	UNSIGNED = 0x1
 };
-#define VIF_USN_STRINGS \
+constexpr std::array VIF_USN_STRINGS {
 	"SIGNED", "UNSIGNED"
+};
 
 struct vif_code {
 	uint32_t raw = 0;
@@ -152,12 +158,26 @@ struct vif_packet {
 	std::string error;
 };
 
+// Non-owning view of one packet in an in-memory VIF chain. The data pointer
+// aliases the caller's buffer (and doesn't include the VIF code word), so
+// views must not outlive the chain they were parsed from.
+struct vif_packet_view {
+	std::size_t address;
+	vif_code code;
+	const uint8_t* data;
+	std::size_t data_size;
+	const char* error; // nullptr if the packet parsed cleanly.
+};
+
+// Parse a chain directly over memory without copying any payloads.
+std::vector<vif_packet_view> parse_vif_chain_view(const uint8_t* chain, std::size_t base_address, std::size_t qwc);
+
 std::vector<vif_packet> parse_vif_chain(const stream* src, std::size_t base_address, std::size_t qwc);
 
 int bit_range(uint64_t val, int lo, int hi);
 
-template <typename T>
-const char* enum_to_string(const std::vector<const char*> strings, T value) {
+template <std::size_t N, typename T>
+constexpr const char* enum_to_string(const std::array<const char*, N>& strings, T value) {
 	size_t index = static_cast<size_t>(value);
 	if(index < strings.size()) {
 		return strings[index];
@@ -18,12 +18,13 @@
 
 #include "wad.h"
 
-#include <thread>
 #include <cassert>
 #include <iomanip>
 #include <iostream>
 #include <algorithm>
 
+#include "../thread_pool.h"
+
 // Enable/disable debug output for the decompression function.
 #define WAD_DEBUG(cmd) //cmd
 // If this code breaks, dump the correct output and point to that here.
@@ -37,11 +38,48 @@ void decompress_wad(array_stream& dest, array_stream& src) {
 	decompress_wad_n(dest, src, 0);
 }
 
-// We don't want to use stream::copy_n since it uses virtual functions.
+// We don't want to use stream::copy_n since it uses virtual functions. One
+// bounds check and one memcpy per literal instead of one of each per byte.
 void copy_bytes(array_stream& dest, array_stream& src, std::size_t bytes) {
-	for(std::size_t i = 0; i < bytes; i++) {
-		dest.write8(src.read8());
+	if(src.pos + bytes > src.buffer.size()) {
+		throw stream_io_error("Tried to read past end of array_stream!");
+	}
+	std::size_t required_size = dest.pos + bytes;
+	if(required_size > dest.buffer.size()) {
+		dest.buffer.resize(required_size);
 	}
+	std::memcpy(dest.buffer.data() + dest.pos, src.buffer.data() + src.pos, bytes);
+	dest.pos += bytes;
+	src.pos += bytes;
+}
+
+// Copy a match from earlier in dest to the current position. The source and
+// destination ranges may overlap (the pattern then repeats), so we copy in
+// the biggest chunks that don't.
+void copy_match(array_stream& dest, std::size_t lookback_offset, std::size_t bytes) {
+	if(lookback_offset >= dest.pos) {
+		throw stream_format_error("WAD decompression failed: Lookback offset out of range!");
+	}
+	std::size_t required_size = dest.pos + bytes;
+	if(required_size > dest.buffer.size()) {
+		dest.buffer.resize(required_size);
+	}
+	char* buffer = dest.buffer.data();
+	std::size_t distance = dest.pos - lookback_offset;
+	if(distance == 1) {
+		std::memset(buffer + dest.pos, buffer[lookback_offset], bytes);
+	} else {
+		std::size_t copied = 0;
+		while(copied < bytes) {
+			std::size_t chunk = std::min(distance, bytes - copied);
+			std::memcpy(
+				buffer + dest.pos + copied,
+				buffer + lookback_offset + copied,
+				chunk);
+			copied += chunk;
+		}
+	}
+	dest.pos += bytes;
 }
 
 void decompress_wad_n(array_stream& dest, array_stream& src, std::size_t bytes_to_decompress) {
@@ -60,6 +98,15 @@ void decompress_wad_n(array_stream& dest, array_stream& src, std::size_t bytes_t
 		throw stream_format_error("Invalid WAD header.");
 	}
 
+	// Segments usually inflate to a low single-digit multiple of their
+	// compressed size, so grab a sensibly sized buffer up front instead of
+	// letting the inner loop grow it over and over.
+	if(bytes_to_decompress != 0) {
+		dest.buffer.reserve(dest.pos + bytes_to_decompress);
+	} else {
+		dest.buffer.reserve(dest.pos + header.total_size * 4);
+	}
+
 	while(
 		src.pos < header.total_size &&
 		(bytes_to_decompress == 0 || dest.pos < bytes_to_decompress)) {
@@ -133,9 +180,7 @@ void decompress_wad_n(array_stream& dest, array_stream& src, std::size_t bytes_t
 		}
 
 		if(bytes_to_copy != 1) {
-			for(int i = 0; i < bytes_to_copy; i++) {
-				dest.write8(dest.peek8(lookback_offset + i));
-			}
+			copy_match(dest, lookback_offset, bytes_to_copy);
 		}
 		
 		uint32_t little_literal_size = src.peek8(src.pos - 2) & 3;
@@ -226,9 +271,28 @@ const size_t MAX_FAR_MATCH_LOOKBACK_WITH_A_EQ_ZERO = 32704; // 0x4000 + 0b111111
 const int32_t WINDOW_SIZE = 32768;
 const int32_t WINDOW_MASK = WINDOW_SIZE - 1;
 
+// How many hash chain candidates to try per position. With the chain being
+// advanced properly on prefilter misses this is a real depth, so it trades
+// directly between speed and ratio.
+const int MAX_CHAIN_HITS = 32;
+
 const std::vector<char> EMPTY_LITTLE_LITERAL = { 0x11, 0, 0 };
 
 void compress_wad(array_stream& dest, array_stream& src, int thread_count) {
+	std::size_t base = dest.tell();
+	std::size_t end = base;
+	compress_wad([&](std::size_t offset, const char* data, std::size_t size) {
+		dest.seek(base + offset);
+		dest.write_n(data, size);
+		end = std::max(end, base + offset + size);
+	}, src, thread_count);
+	dest.seek(end);
+}
+
+void compress_wad(
+		const std::function<void(std::size_t offset, const char* data, std::size_t size)>& sink,
+		array_stream& src,
+		int thread_count) {
 	WAD_COMPRESS_DEBUG(
 		#ifdef WAD_COMPRESS_DEBUG_EXPECTED_PATH
 			file_stream expected(WAD_COMPRESS_DEBUG_EXPECTED_PATH);
@@ -248,26 +312,23 @@ void compress_wad(array_stream& dest, array_stream& src, int thread_count) {
 		total_size += min_block_size - (total_size % min_block_size);
 		size_t block_size = total_size / thread_count;
 		
-		std::vector<std::thread> threads(thread_count);
-		for(int i = 0; i < thread_count; i++) {
+		thread_pool::shared().parallel_for(thread_count, [&](std::size_t i) {
 			const uint8_t* src_ptr = (uint8_t*) src.buffer.data();
 			size_t src_pos = block_size * i;
 			size_t src_end = std::min(src.buffer.size(), (block_size * (i + 1)));
-			threads[i] = std::thread(compress_wad_intermediate, &intermediates[i].buffer, src_ptr, src_pos, src_end);
-		}
-		for(int i = 0; i < thread_count; i++) {
-			threads[i].join();
-		}
+			compress_wad_intermediate(&intermediates[i].buffer, src_ptr, src_pos, src_end);
+		}, thread_count);
 	}
 	
-	size_t header_pos = dest.tell();
-	const char* header = "\x57\x41\x44\x00\x00\x00\x00\x57\x52\x45\x4e\x43\x48\x30\x31\x30";
-	dest.write_n(header, 0x10);
-	
-	// Append the compressed data and insert padding where required.
+	// Repack each intermediate and hand it off as soon as it's done so the
+	// caller can overlap I/O with the work above, then free it. The segments
+	// only live in memory one repacked block at a time this way.
+	size_t dest_pos = 0x10; // Relative to the start of the segment.
+	array_stream block;
 	for(int i = 0; i < thread_count; i++) {
 		array_stream& intermediate = intermediates[i];
 		intermediate.pos = 0;
+		size_t block_offset = dest_pos;
 		while(intermediate.pos < intermediate.size()) {
 			size_t packet_size = get_wad_packet_size(
 				(uint8_t*) intermediate.buffer.data() + intermediate.pos,
@@ -282,41 +343,51 @@ void compress_wad(array_stream& dest, array_stream& src, int thread_count) {
 			if(insert_dummy) {
 				insert_size += 3;
 			}
-			// dest.pos is offset 0x10 bytes by the header:
+			// dest_pos is offset 0x10 bytes by the header:
 			//  0x0000 WAD. .... .... ....
 			//	0x0010 [data]
 			//   ...
 			//	0x2000 [data]
 			//	0x2010 [start of new block]
-			if((((dest.pos - header_pos) + 0x1ff0) % 0x2000) + insert_size > 0x2000 - 3) {
+			if(((dest_pos + 0x1ff0) % 0x2000) + insert_size > 0x2000 - 3) {
 				// Every 0x2000 bytes or so there must be a pad packet or the
 				// game crashes with a teq exception. This is because the game
 				// copies the compressed data into the EE core's scratchpad, which
 				// is 0x4000 bytes in size.
-				dest.write8(0x12);
-				dest.write8(0x0);
-				dest.write8(0x0);
-				while((dest.pos - header_pos) % 0x2000 != 0x10) {
-					dest.write8(0xee);
+				block.write8(0x12);
+				block.write8(0x0);
+				block.write8(0x0);
+				dest_pos += 3;
+				while(dest_pos % 0x2000 != 0x10) {
+					block.write8(0xee);
+					dest_pos++;
 				}
 			}
 			if(insert_dummy) {
-				dest.write8(0x11);
-				dest.write8(0);
-				dest.write8(0);
+				block.write8(0x11);
+				block.write8(0);
+				block.write8(0);
+				dest_pos += 3;
 			}
-			dest.buffer.insert(dest.buffer.end(),
+			block.buffer.insert(block.buffer.end(),
 				intermediate.buffer.begin() + intermediate.pos,
 				intermediate.buffer.begin() + intermediate.pos + packet_size);
-			dest.pos += packet_size;
+			block.pos += packet_size;
+			dest_pos += packet_size;
 			intermediate.pos += packet_size;
 		}
+		sink(block_offset, block.buffer.data(), block.buffer.size());
+		block.buffer.clear();
+		block.pos = 0;
+		intermediate.buffer = std::vector<char>(); // Free it now, not at the end.
 	}
 	
-	size_t end_pos = dest.tell();
-	uint32_t total_size = end_pos - header_pos;
-	dest.write<uint32_t>(header_pos + 0x3, total_size);
-	dest.seek(end_pos);
+	// The header goes out last since the size field covers the whole segment.
+	char header[0x10];
+	std::memcpy(header, "\x57\x41\x44\x00\x00\x00\x00\x57\x52\x45\x4e\x43\x48\x30\x31\x30", 0x10);
+	uint32_t total_size = dest_pos;
+	std::memcpy(header + 0x3, &total_size, 4);
+	sink(0, header, 0x10);
 }
 
 void compress_wad_intermediate(
@@ -366,25 +437,40 @@ match_result find_match(
 	match.literal_size = max_literal_size;
 	match.match_offset = 0;
 	match.match_size = 0;
-	
+
+	// Greedy parsing takes the first match it sees, which regularly hides a
+	// longer match starting one byte later. So when we find a match we scan
+	// exactly one more position and only keep the original if the deferred
+	// match isn't a real improvement (lazy matching).
+	match_result greedy;
+	bool have_greedy = false;
+
 	// Matching algorithm taken from: https://glinscott.github.io/lz/
 	for(size_t i = 0; i < max_literal_size; i++) {
 		int64_t target = src_pos + i;
 		size_t max_match_size = end_of_buffer ?
 			std::min(MAX_MATCH_SIZE, src_end - src_pos - i) : MAX_MATCH_SIZE;
-		
+
 		int32_t key = hash32(src[target] | (src[target + 1] << 8) | (src[target + 2] << 16));
 		key &= WINDOW_MASK;
 		int64_t next = ht[key];
-		
+
 		int64_t low = target - MAX_FAR_MATCH_LOOKBACK_WITH_A_EQ_ZERO;
 		int hits = 0;
-		while(next > low && ++hits < 16) {
+		while(next > low && ++hits < MAX_CHAIN_HITS) {
+			// The window arrays are shared between hash buckets, so stale
+			// entries can point at or past the current position. Skip them.
+			if(next >= target) {
+				next = chain[next & WINDOW_MASK];
+				continue;
+			}
+
 			// This makes matching much faster.
 			if(!end_of_buffer && *(uint16_t*) &src[next] != *(uint16_t*) &src[target]) {
+				next = chain[next & WINDOW_MASK];
 				continue;
 			}
-			
+
 			// Count number of equal bytes.
 			size_t k = end_of_buffer ? 0 : 2;
 			for(; k < max_match_size; k++) {
@@ -394,7 +480,7 @@ match_result find_match(
 					break;
 				}
 			}
-			
+
 			if(k > match.match_size) {
 				match.match_size = k;
 				match.match_offset = next;
@@ -404,9 +490,25 @@ match_result find_match(
 
 		chain[target & WINDOW_MASK] = ht[key];
 		ht[key] = target;
-		
+
+		if(have_greedy) {
+			// We're one byte past a match. Take this position's match instead
+			// if deferring gained us more than the literal byte it costs.
+			if(match.match_size > greedy.match_size + 1) {
+				match.literal_size = i;
+			} else {
+				match = greedy;
+			}
+			break;
+		}
+
 		if(match.match_size >= 3) {
 			match.literal_size = i;
+			if(i + 1 < max_literal_size) {
+				greedy = match;
+				have_greedy = true;
+				continue;
+			}
 			break;
 		}
 	}
@@ -24,6 +24,7 @@
 #include <map>
 #include <cstring>
 #include <utility>
+#include <functional>
 
 # /*
 #	Decompress and recompress WAD segments used by the games to store various
@@ -45,4 +46,14 @@ void decompress_wad_n(array_stream& dest, array_stream& src, std::size_t bytes_t
 
 void compress_wad(array_stream& dest, array_stream& src, int thread_count);
 
+// Streaming variant: hands each repacked block to sink as soon as it's
+// produced instead of accumulating the whole compressed segment in one
+// buffer, so the caller can overlap writing with compression. Offsets are
+// relative to the start of the segment. The header is emitted last (at
+// offset zero) since its size field can't be filled in until the end.
+void compress_wad(
+	const std::function<void(std::size_t offset, const char* data, std::size_t size)>& sink,
+	array_stream& src,
+	int thread_count);
+
 #endif
@@ -18,12 +18,22 @@
 
 #include "world.h"
 
+#include <glm/gtc/matrix_transform.hpp>
+
 #include "../util.h"
 
+glm::mat4 euler_entity::local_to_world() const {
+	glm::mat4 matrix = glm::translate(glm::mat4(1.f), position);
+	matrix = glm::rotate(matrix, rotation.x, glm::vec3(1, 0, 0));
+	matrix = glm::rotate(matrix, rotation.y, glm::vec3(0, 1, 0));
+	matrix = glm::rotate(matrix, rotation.z, glm::vec3(0, 0, 1));
+	return matrix;
+}
+
 void world_segment::read_rac23() {
 	world_header_rac23 header = backing->read<world_header_rac23>(0);
-	
-	read_table(header.unknown_8c, &thing_8cs);
+
+	thing_8cs = read_opaque_table<world_thing_8c>(header.unknown_8c);
 	
 	properties = backing->read<world_properties>(header.properties);
 	world_property_thing property_thing;
@@ -72,18 +82,18 @@ void world_segment::read_rac23() {
 	korean_strings_hack = backing->read_multiple<uint8_t>(after_korean_strings - header.korean_strings);
 	
 	read_table(header.directional_lights, &directional_lights);
-	read_table(header.unknown_84, &thing_84s);
-	read_table(header.unknown_8, &thing_8s);
-	read_table(header.unknown_c, &thing_cs);
-	thing_48s = read_u32_list(header.unknown_48);
+	thing_84s = read_opaque_table<world_thing_84>(header.unknown_84);
+	thing_8s = read_opaque_table<world_thing_8>(header.unknown_8);
+	thing_cs = read_opaque_table<world_thing_c>(header.unknown_c);
+	thing_48s = read_opaque_u32_list(header.unknown_48);
 	mobies = read_entity_table<moby_entity, world_moby_rac23>(header.mobies, swap_moby_rac23);
 	max_moby_count = mobies.size() + backing->read<uint32_t>(header.mobies + sizeof(uint32_t));
 	pvars = read_pvars(header.pvar_table, header.pvar_data);
-	read_terminated_array(thing_58s, header.unknown_58);
-	read_terminated_array(thing_64s, header.unknown_64);
-	read_table(header.unknown_50, &thing_50_1s, &thing_50_2s);
-	read_table(header.unknown_54, &thing_54_1s, &thing_54_2s);
-	thing_30s = read_u32_list(header.unknown_30);
+	thing_58s = read_opaque_terminated_array<world_thing_58>(header.unknown_58);
+	thing_64s = read_opaque_terminated_array<world_thing_64>(header.unknown_64);
+	thing_50s = read_opaque_table<uint32_t, uint8_t>(header.unknown_50);
+	thing_54s = read_opaque_table<uint8_t, uint64_t>(header.unknown_54);
+	thing_30s = read_opaque_u32_list(header.unknown_30);
 	ties = read_entity_table<tie_entity, world_tie>(header.ties, swap_tie);
 	
 	backing->seek(header.unknown_94);
@@ -100,10 +110,10 @@ void world_segment::read_rac23() {
 		}
 	}
 	
-	read_table(header.unknown_38, &thing_38_1s, &thing_38_2s, (std::vector<char>*) nullptr, true);
-	thing_3cs = read_u32_list(header.unknown_3c);
+	thing_38s = read_opaque_table<uint32_t, uint8_t>(header.unknown_38, true);
+	thing_3cs = read_opaque_u32_list(header.unknown_3c);
 	shrubs = read_entity_table<shrub_entity, world_shrub>(header.shrubs, swap_shrub);
-	read_table(header.unknown_44, &thing_44_1s, &thing_44_2s, (std::vector<char>*) nullptr, true);
+	thing_44s = read_opaque_table<uint32_t, uint8_t>(header.unknown_44, true);
 	
 	auto spline_table = backing->read<world_spline_table>(header.splines);
 	splines = read_splines<regular_spline_entity>(
@@ -112,10 +122,10 @@ void world_segment::read_rac23() {
 		header.splines + spline_table.data_offset);
 	
 	triggers = read_entity_table<trigger_entity, world_trigger>(header.triggers, swap_trigger);
-	read_table(header.unknown_6c, &thing_6cs);
-	read_table(header.unknown_70, &thing_70s);
-	read_table(header.unknown_74, &thing_74s);
-	
+	thing_6cs = read_opaque_table<world_thing_6c>(header.unknown_6c);
+	thing_70s = read_opaque_table<world_thing_70>(header.unknown_70);
+	thing_74s = read_opaque_table<uint32_t>(header.unknown_74);
+
 	uint32_t thing_88_size = backing->read<uint32_t>(header.unknown_88);
 	thing_88 = backing->read_multiple<uint8_t>(thing_88_size);
 	
@@ -163,10 +173,10 @@ void world_segment::read_rac4() {
 	} while (property_things.size() < property_thing.count);
 
 	// equivalent to rac23 0x08
-	read_table(header.unknown_4, &thing_8s);
+	thing_8s = read_opaque_table<world_thing_8>(header.unknown_4);
 
 	// equivalent to rac23 0x0c
-	read_table(header.unknown_8, &thing_cs);
+	thing_cs = read_opaque_table<world_thing_c>(header.unknown_8);
 
 	// 
 	languages[0] = read_language(header.us_english_strings);
@@ -179,28 +189,28 @@ void world_segment::read_rac4() {
 	languages[7] = read_language(header.korean_strings);
 
 	// equivalent to rac23 0x48
-	thing_48s = read_u32_list(header.unknown_2c);
+	thing_48s = read_opaque_u32_list(header.unknown_2c);
 
 	//
 	mobies = read_entity_table<moby_entity, world_moby_rac4>(header.mobies, swap_moby_rac4);
 	max_moby_count = mobies.size() + backing->read<uint32_t>(header.mobies + sizeof(uint32_t));
 
-	// 
-	read_table(header.unknown_34, &thing_50_1s, &thing_50_2s);
-	read_table(header.unknown_38, &thing_54_1s, &thing_54_2s);
-	read_terminated_array(thing_58s, header.unknown_3c);
+	//
+	thing_50s = read_opaque_table<uint32_t, uint8_t>(header.unknown_34);
+	thing_54s = read_opaque_table<uint8_t, uint64_t>(header.unknown_38);
+	thing_58s = read_opaque_terminated_array<world_thing_58>(header.unknown_3c);
 
-	// 
+	//
 	pvars = read_pvars(header.pvar_table, header.pvar_data);
 
 	// equivalent to rac23 0x64
-	read_terminated_array(thing_64s, header.unknown_48);
+	thing_64s = read_opaque_terminated_array<world_thing_64>(header.unknown_48);
 
-	// 
+	//
 	triggers = read_entity_table<trigger_entity, world_trigger>(header.triggers, swap_trigger);
-	read_table(header.unknown_50, &thing_6cs);
-	read_table(header.unknown_54, &thing_70s);
-	read_table(header.unknown_58, &thing_74s);
+	thing_6cs = read_opaque_table<world_thing_6c>(header.unknown_50);
+	thing_70s = read_opaque_table<world_thing_70>(header.unknown_54);
+	thing_74s = read_opaque_table<uint32_t>(header.unknown_58);
 
 	// 
 	auto spline_table = backing->read<world_spline_table>(header.splines);
@@ -229,7 +239,7 @@ void world_segment::read_rac4() {
 	thing_80_2 = backing->read_multiple<uint8_t>(thing_80_table.count_1 * 0x10);
 
 	// equivalent to rac23 0x8c
-	read_table(header.unknown_70, &thing_8cs);
+	thing_8cs = read_opaque_table<world_thing_8c>(header.unknown_70);
 
 	// equivalent to rac23 0x88
 	uint32_t thing_88_size = backing->read<uint32_t>(header.unknown_6c);
@@ -265,6 +275,54 @@ void world_segment::read_table(
 	}
 }
 
+template <typename T_1, typename T_2, typename T_3>
+opaque_world_table world_segment::read_opaque_table(uint32_t offset, bool align) {
+	// Walk over the table the same way read_table would to find its extent,
+	// then capture the bytes without decoding anything.
+	auto table = backing->read<world_object_table>(offset);
+	backing->seek(backing->tell() + table.count_1 * sizeof(T_1));
+	if(align) backing->align(0x10, 0);
+	backing->seek(backing->tell() + table.count_2 * sizeof(T_2));
+	if(align) backing->align(0x10, 0);
+	backing->seek(backing->tell() + table.count_3 * sizeof(T_3));
+	std::size_t end = backing->tell();
+
+	opaque_world_table result;
+	result.bytes.resize(end - offset);
+	backing->seek(offset);
+	backing->read_n((char*) result.bytes.data(), result.bytes.size());
+	return result;
+}
+
+opaque_world_table world_segment::read_opaque_u32_list(uint32_t offset) {
+	auto count = backing->read<uint32_t>(offset);
+	opaque_world_table result;
+	result.bytes.resize(sizeof(uint32_t) + count * sizeof(uint32_t));
+	backing->seek(offset);
+	backing->read_n((char*) result.bytes.data(), result.bytes.size());
+	return result;
+}
+
+template <typename T>
+opaque_world_table world_segment::read_opaque_terminated_array(uint32_t offset) {
+	backing->seek(offset);
+	std::size_t count = 0;
+	for(;;) {
+		T thing = backing->read<T>();
+		if(*(int32_t*) &thing > -1) {
+			count++;
+		} else {
+			break;
+		}
+	}
+
+	opaque_world_table result;
+	result.bytes.resize(count * sizeof(T)); // The terminator is written back separately.
+	backing->seek(offset);
+	backing->read_n((char*) result.bytes.data(), result.bytes.size());
+	return result;
+}
+
 std::vector<game_string> world_segment::read_language(uint32_t offset) {
 	std::vector<game_string> language;
 	
@@ -278,29 +336,31 @@ std::vector<game_string> world_segment::read_language(uint32_t offset) {
 	
 	for(world_string_table_entry& entry : entries) {
 		backing->seek(offset + entry.string.value);
-		language.push_back({
-			entry.id,
-			entry.secondary_id,
-			entry.unknown_c, entry.unknown_e,
-			backing->read_string()
-		});
+		std::string text = backing->read_string();
+		game_string& str = language.emplace_back();
+		str.id = entry.id;
+		str.secondary_id = entry.secondary_id;
+		str.unknown_c = entry.unknown_c;
+		str.unknown_e = entry.unknown_e;
+		str.size = text.size();
+		str.offset = strings.intern(text);
 	}
 	
 	return language;
 }
 
-std::vector<uint32_t> world_segment::read_u32_list(uint32_t offset) {
-		auto count = backing->read<uint32_t>(offset);
-		return backing->read_multiple<uint32_t>(count);
-}
-
-template <typename T_in_mem, typename T_on_disc>
+template <typename T_in_mem, typename T_on_disc, typename T_swap>
 std::vector<T_in_mem> world_segment::read_entity_table(
-		uint32_t offset, std::function<void(T_in_mem&, T_on_disc&)> swap_ent) {
+		uint32_t offset, T_swap swap_ent) {
 	auto table = backing->read<world_object_table>(offset);
-	std::vector<T_on_disc> src = backing->read_multiple<T_on_disc>(table.count_1);
+	// View the on-disc table in place where the backing is resident instead
+	// of copying it out. The swap functions scramble their packed argument,
+	// so copy one entry at a time rather than mutating the view.
+	mapped_array<T_on_disc> src = backing->map_array<T_on_disc>(table.count_1);
 	std::vector<T_in_mem> dest;
-	for(T_on_disc& on_disc : src) {
+	dest.reserve(src.size());
+	for(std::size_t i = 0; i < src.size(); i++) {
+		T_on_disc on_disc = src[i];
 		T_in_mem& ent = dest.emplace_back();
 		ent.id = { _next_entity_id++ };
 		ent.selected = false;
@@ -309,20 +369,7 @@ std::vector<T_in_mem> world_segment::read_entity_table(
 	return dest;
 }
 
-template <typename T>
-void world_segment::read_terminated_array(std::vector<T>& dest, uint32_t offset) {
-	backing->seek(offset);
-	for(;;) {
-		T thing = backing->read<T>();
-		if(*(int32_t*) &thing > -1) {
-			dest.push_back(thing);
-		} else {
-			break;
-		}
-	}
-}
-
-std::vector<std::vector<uint8_t>> world_segment::read_pvars(uint32_t table_offset, uint32_t data_offset) {
+pvar_pool world_segment::read_pvars(uint32_t table_offset, uint32_t data_offset) {
 	int32_t pvar_count = 0;
 	for(moby_entity& moby : mobies) {
 		pvar_count = std::max(pvar_count, moby.pvar_index + 1);
@@ -331,13 +378,18 @@ std::vector<std::vector<uint8_t>> world_segment::read_pvars(uint32_t table_offse
 	std::vector<pvar_table_entry> table(pvar_count);
 	backing->seek(table_offset);
 	backing->read_v(table);
+
+	std::size_t data_size = 0;
+	for(pvar_table_entry& entry : table) {
+		data_size += entry.size;
+	}
 	
-	std::vector<std::vector<uint8_t>> pvars;
+	pvar_pool pvars;
+	pvars.reserve(table.size(), data_size);
 	for(pvar_table_entry& entry : table) {
-		uint32_t size = entry.size;
-		std::vector<uint8_t>& pvar = pvars.emplace_back(size);
+		auto pvar = pvars.push_back(entry.size);
 		backing->seek(data_offset + entry.offset);
-		backing->read_v(pvar);
+		backing->read_n((char*) pvar.begin(), pvar.size());
 	}
 	return pvars;
 }
@@ -374,7 +426,14 @@ void world_segment::write_rac23(array_stream& dest) {
 		dest.write(0, header);
 	});
 	dest.seek(sizeof(world_header_rac23));
-	
+
+	// The rewritten segment comes out at roughly the same size as the one that
+	// was read in, so grab all the memory up front instead of letting the
+	// buffer grow repeatedly as the tables are appended.
+	if(backing != nullptr) {
+		dest.buffer.reserve(backing->size());
+	}
+
 	const auto write_table = [&]<typename T_1, typename T_2 = char, typename T_3 = char>(
 			const std::vector<T_1>& first,
 			const std::vector<T_2>& second = EMPTY_VECTOR,
@@ -396,17 +455,53 @@ void world_segment::write_rac23(array_stream& dest) {
 		return base_pos;
 	};
 	
-	header.unknown_8c = write_table(thing_8cs);
+	// Tables the editor doesn't interpret are spliced back out exactly as
+	// they appeared in the source segment.
+	const auto write_opaque_table = [&](const opaque_world_table& table) {
+		dest.pad(0x10, 0);
+		size_t base_pos = dest.tell();
+		dest.write_v(table.bytes);
+		return base_pos;
+	};
+
+	const auto write_opaque_terminated_array = [&](const opaque_world_table& table) {
+		dest.pad(0x10, 0);
+		size_t base_pos = dest.tell();
+		dest.write_v(table.bytes);
+		dest.write<uint64_t>(0xffffffffffffffff); // terminator
+		return base_pos;
+	};
+
+	header.unknown_8c = write_opaque_table(thing_8cs);
 	
 	dest.pad(0x10, 0);
 	header.properties = dest.tell();
 	dest.write(properties);
 	dest.write_v(property_things);
 	
+	// Re-encode a section if it's been touched since the last write, otherwise
+	// splice the bytes produced last time. Everything within these sections is
+	// addressed relative to the section base, so the cached bytes stay valid
+	// even when the section lands at a different offset.
+	const auto write_cached_section = [&](std::vector<char>& cache, bool dirty, auto encode) {
+		size_t base_pos = dest.tell();
+		if(dirty || cache.size() == 0) {
+			encode();
+			cache.assign(dest.buffer.begin() + base_pos, dest.buffer.begin() + dest.tell());
+		} else {
+			dest.write_n(cache.data(), cache.size());
+		}
+		return base_pos;
+	};
+
 	const auto write_language = [&](std::vector<game_string>& language) {
 		size_t base_pos = dest.tell();
-		dest.seek(base_pos + sizeof(world_string_table_header));
-		
+
+		// Assemble both halves of the table in memory so each one goes out in a
+		// single write instead of a virtual call per entry.
+		std::vector<world_string_table_entry> entries;
+		entries.reserve(language.size());
+		std::vector<char> string_data;
 		size_t data_pos = sizeof(world_string_table_header) +
 			language.size() * sizeof(world_string_table_entry);
 		for(game_string& str : language) {
@@ -419,31 +514,32 @@ void world_segment::write_rac23(array_stream& dest) {
 			entry.secondary_id = str.secondary_id;
 			entry.unknown_c = str.unknown_c;
 			entry.unknown_e = str.unknown_e;
-			dest.write(entry);
-			data_pos += str.str.size() + 1;
+			entries.push_back(entry);
+			const char* text = strings.c_str(str.offset);
+			string_data.insert(string_data.end(), text, text + str.size);
+			string_data.push_back('\0');
+			data_pos += str.size + 1;
 			if(game == world_type::RAC2) {
-				while(data_pos % 4 != 0) data_pos++;
+				while(data_pos % 4 != 0) {
+					data_pos++;
+					string_data.push_back('\0');
+				}
 			}
 		}
-		
-		for(game_string& str : language) {
-			if(game == world_type::RAC2) {
-				dest.pad(0x4, 0);
-			}
-			dest.write_n(str.str.c_str(), str.str.size() + 1);
-		}
-		dest.pad(0x10, 0);
-		
+
 		world_string_table_header string_table;
 		string_table.num_strings = language.size();
 		string_table.size = data_pos;
 		if(game == world_type::RAC3) {
 			string_table.size -= sizeof(world_string_table_header);
 		}
-		dest.write(base_pos, string_table);
-		
+		dest.write(string_table);
+		dest.write_v(entries);
+		dest.write_v(string_data);
+		dest.pad(0x10, 0);
+
 		dest.seek(base_pos + data_pos);
-		
+
 		return base_pos;
 	};
 	dest.pad(0x10, 0);
@@ -451,42 +547,45 @@ void world_segment::write_rac23(array_stream& dest) {
 		assert(unknown_10_val.has_value());
 		dest.write<uint32_t>(*unknown_10_val);
 	}
-	header.us_english_strings = write_language(languages[0]);
+	const auto write_cached_language = [&](std::size_t index) {
+		return write_cached_section(_language_cache[index], languages_dirty, [&] {
+			write_language(languages[index]);
+		});
+	};
+	header.us_english_strings = write_cached_language(0);
 	dest.pad(0x10, 0);
-	header.uk_english_strings = write_language(languages[1]);
+	header.uk_english_strings = write_cached_language(1);
 	dest.pad(0x10, 0);
-	header.french_strings = write_language(languages[2]);
+	header.french_strings = write_cached_language(2);
 	dest.pad(0x10, 0);
-	header.german_strings = write_language(languages[3]);
+	header.german_strings = write_cached_language(3);
 	dest.pad(0x10, 0);
-	header.spanish_strings = write_language(languages[4]);
+	header.spanish_strings = write_cached_language(4);
 	dest.pad(0x10, 0);
-	header.italian_strings = write_language(languages[5]);
+	header.italian_strings = write_cached_language(5);
 	dest.pad(0x10, 0);
-	header.japanese_strings = write_language(languages[6]);
+	header.japanese_strings = write_cached_language(6);
 	dest.pad(0x10, 0);
 	//header.korean_strings = write_language(languages[7]);
 	header.korean_strings = dest.tell();
 	dest.write_v(korean_strings_hack); // HACK: See read_rac23 comment.
 	
 	header.directional_lights = write_table(directional_lights);
-	header.unknown_84 = write_table(thing_84s);
-	header.unknown_8 = write_table(thing_8s);
-	header.unknown_c = write_table(thing_cs);
-	
-	const auto write_u32_list = [&](const std::vector<uint32_t>& list) {
-		dest.pad(0x10, 0);
-		size_t base_pos = dest.tell();
-		dest.write<uint32_t>(list.size());
-		dest.write_v(list);
-		return base_pos;
-	};
-	header.unknown_48 = write_u32_list(thing_48s);
-	
+	header.unknown_84 = write_opaque_table(thing_84s);
+	header.unknown_8 = write_opaque_table(thing_8s);
+	header.unknown_c = write_opaque_table(thing_cs);
+	header.unknown_48 = write_opaque_table(thing_48s);
+	
+	// The swap function scrambles its in-memory argument, so each entity is
+	// copied into a temporary first rather than copying the whole table. The
+	// swap function comes in as a plain function pointer instead of a
+	// std::function so the compiler can inline it into the loop.
 	const auto write_entity_table = [&]<typename T_in_mem, typename T_on_disc>(
-			std::vector<T_in_mem> ents, std::function<void(T_in_mem&, T_on_disc&)> swap_ent) {
+			const std::vector<T_in_mem>& ents, void (*swap_ent)(T_in_mem&, T_on_disc&)) {
 		std::vector<T_on_disc> dest;
-		for(T_in_mem& ent : ents) {
+		dest.reserve(ents.size());
+		for(const T_in_mem& src : ents) {
+			T_in_mem ent = src;
 			T_on_disc& on_disc = dest.emplace_back();
 			ent.id = { _next_entity_id++ };
 			ent.selected = false;
@@ -501,62 +600,56 @@ void world_segment::write_rac23(array_stream& dest) {
 	
 	dest.pad(0x10, 0);
 	header.pvar_table = dest.tell();
-	size_t next_pvar_offset = 0;
 	header.pvar_data = header.pvar_table + pvars.size() * sizeof(pvar_table_entry);
 	while(header.pvar_data % 0x10 != 0) header.pvar_data++;
-	for(std::vector<uint8_t>& pvar : pvars) {
+	// The pool already stores the pvars back to back in index order, so the
+	// table falls out of its offsets and the arena can be flushed in one go.
+	std::vector<pvar_table_entry> pvar_entries;
+	pvar_entries.reserve(pvars.size());
+	for(std::size_t i = 0; i < pvars.size(); i++) {
 		pvar_table_entry entry;
-		entry.offset = next_pvar_offset;
-		entry.size = pvar.size();
-		dest.write(entry);
-		size_t next_pos = dest.tell();
-		
-		dest.seek(header.pvar_data + next_pvar_offset);
-		dest.write_v(pvar);
-		
-		next_pvar_offset += pvar.size();
-		dest.seek(next_pos);
+		entry.offset = pvars.offset_of(i);
+		entry.size = pvars[i].size();
+		pvar_entries.push_back(entry);
 	}
+	dest.write_v(pvar_entries);
 	dest.pad(0x10, 0);
-	dest.seek(header.pvar_data + next_pvar_offset); // Skip past the pvar data section.
+	dest.write_v(pvars.data());
 	
-	const auto write_terminated_array = [&]<typename T>(const std::vector<T>& things) {
-		dest.pad(0x10, 0);
-		size_t result = dest.tell();
-		dest.write_v(things);
-		dest.write<uint64_t>(0xffffffffffffffff); // terminator
-		return result;
-	};
-	header.unknown_58 = write_terminated_array(thing_58s);
-	header.unknown_64 = write_terminated_array(thing_64s);
-	header.unknown_50 = write_table(thing_50_1s, thing_50_2s);
-	header.unknown_54 = write_table(thing_54_1s, thing_54_2s);
-	header.unknown_30 = write_u32_list(thing_30s);
+	header.unknown_58 = write_opaque_terminated_array(thing_58s);
+	header.unknown_64 = write_opaque_terminated_array(thing_64s);
+	header.unknown_50 = write_opaque_table(thing_50s);
+	header.unknown_54 = write_opaque_table(thing_54s);
+	header.unknown_30 = write_opaque_table(thing_30s);
 	header.ties = write_entity_table.operator()<tie_entity, world_tie>(ties, swap_tie);
 	
 	dest.pad(0x10, 0);
 	header.unknown_94 = dest.tell();
+	std::vector<uint8_t> thing_94_data;
 	for(thing_94& thing : thing_94s) {
-		dest.write<int16_t>(thing.index);
-		dest.write<int16_t>(thing.data.size() / 2);
-		dest.write_v(thing.data);
+		int16_t index = thing.index;
+		int16_t count = thing.data.size() / 2;
+		thing_94_data.insert(thing_94_data.end(), (uint8_t*) &index, (uint8_t*) (&index + 1));
+		thing_94_data.insert(thing_94_data.end(), (uint8_t*) &count, (uint8_t*) (&count + 1));
+		thing_94_data.insert(thing_94_data.end(), thing.data.begin(), thing.data.end());
 	}
+	dest.write_v(thing_94_data);
 	dest.write<uint16_t>(0xffff);
 	
-	header.unknown_38 = write_table(thing_38_1s, thing_38_2s, EMPTY_VECTOR, true);
-	header.unknown_3c = write_u32_list(thing_3cs);
+	header.unknown_38 = write_opaque_table(thing_38s);
+	header.unknown_3c = write_opaque_table(thing_3cs);
 	header.shrubs = write_entity_table.operator()<shrub_entity, world_shrub>(shrubs, swap_shrub);
-	header.unknown_44 = write_table(thing_44_1s, thing_44_2s, EMPTY_VECTOR, true);
+	header.unknown_44 = write_opaque_table(thing_44s);
 	
-	const auto write_vertex_list = [&](std::vector<std::vector<glm::vec4>> list) {
+	const auto write_vertex_list = [&](const std::vector<std::vector<glm::vec4>>& list) {
 		size_t base_pos = dest.tell();
-		
+
 		dest.seek(dest.tell() + list.size() * sizeof(uint32_t));
 		dest.pad(0x10, 0);
 		size_t data_pos = dest.tell();
-		
+
 		std::vector<uint32_t> offsets;
-		for(std::vector<glm::vec4> vertices : list) {
+		for(const std::vector<glm::vec4>& vertices : list) {
 			dest.pad(0x10, 0);
 			offsets.push_back(dest.tell() - data_pos);
 			world_vertex_header vertex_header;
@@ -565,12 +658,9 @@ void world_segment::write_rac23(array_stream& dest) {
 			vertex_header.pad[1] = 0;
 			vertex_header.pad[2] = 0;
 			dest.write(vertex_header);
-			for(glm::vec4& vertex : vertices) {
-				dest.write(vertex.x);
-				dest.write(vertex.y);
-				dest.write(vertex.z);
-				dest.write(vertex.w);
-			}
+			// A glm::vec4 is four packed floats, so the whole vertex array can
+			// go out in a single write.
+			dest.write_v(vertices);
 		}
 		
 		size_t end_pos = dest.tell();
@@ -582,28 +672,30 @@ void world_segment::write_rac23(array_stream& dest) {
 	};
 	
 	dest.pad(0x10, 0);
-	header.splines = dest.tell();
-	
-	world_spline_table spline_table;
-	defer([&]() {
-		dest.write(header.splines, spline_table);
+	header.splines = write_cached_section(_spline_cache, splines_dirty, [&] {
+		size_t base_pos = dest.tell();
+		dest.seek(base_pos + sizeof(world_spline_table));
+
+		std::vector<std::vector<glm::vec4>> spline_vertices;
+		for(spline_entity& spline : splines) {
+			spline_vertices.push_back(spline.vertices);
+		}
+		world_spline_table spline_table;
+		spline_table.spline_count = splines.size();
+		spline_table.data_offset = write_vertex_list(spline_vertices) - base_pos;
+		spline_table.data_size = dest.tell() - base_pos - spline_table.data_offset;
+		spline_table.pad = 0;
+
+		size_t end_pos = dest.tell();
+		dest.write(base_pos, spline_table);
+		dest.seek(end_pos);
 	});
-	dest.seek(dest.tell() + sizeof(world_spline_table));
-	
-	std::vector<std::vector<glm::vec4>> spline_vertices;
-	for(spline_entity& spline : splines) {
-		spline_vertices.push_back(spline.vertices);
-	} 
-	spline_table.spline_count = splines.size();
-	spline_table.data_offset = write_vertex_list(spline_vertices) - header.splines;
-	spline_table.data_size = dest.tell() - header.splines - spline_table.data_offset;
-	spline_table.pad = 0;
 	
 	header.triggers = write_entity_table.operator()<trigger_entity, world_trigger>(triggers, swap_trigger);
 	
-	header.unknown_6c = write_table(thing_6cs);
-	header.unknown_70 = write_table(thing_70s);
-	header.unknown_74 = write_table(thing_74s); // Not sure if this is right.
+	header.unknown_6c = write_opaque_table(thing_6cs);
+	header.unknown_70 = write_opaque_table(thing_70s);
+	header.unknown_74 = write_opaque_table(thing_74s); // Not sure if this is right.
 	
 	dest.pad(0x10, 0);
 	header.unknown_88 = dest.tell();
@@ -622,33 +714,37 @@ void world_segment::write_rac23(array_stream& dest) {
 	dest.write_v(thing_80_2);
 	
 	dest.pad(0x10, 0);
-	header.grindrails = dest.tell();
-	
-	world_grindrail_header thing_7c_header;
-	defer([&]() {
-		dest.write(header.grindrails, thing_7c_header);
+	header.grindrails = write_cached_section(_grindrail_cache, splines_dirty, [&] {
+		size_t base_pos = dest.tell();
+		dest.seek(base_pos + sizeof(world_grindrail_header));
+
+		std::vector<world_grindrail_part_1> grindrail_table;
+		grindrail_table.reserve(grindrails.size());
+		for(grindrail_spline_entity& ent : grindrails) {
+			world_grindrail_part_1& grindrail = grindrail_table.emplace_back();
+			grindrail.x = ent.special_point.x;
+			grindrail.y = ent.special_point.y;
+			grindrail.z = ent.special_point.z;
+			grindrail.w = ent.special_point.w;
+			std::memcpy(grindrail.unknown_10, ent.unknown_10, 0x10);
+		}
+		dest.write_v(grindrail_table);
+
+		std::vector<std::vector<glm::vec4>> grind_rail_vertices;
+		for(spline_entity& grindrail : grindrails) {
+			grind_rail_vertices.push_back(grindrail.vertices);
+		}
+		world_grindrail_header thing_7c_header;
+		thing_7c_header.count = grindrails.size();
+		thing_7c_header.part_2_data_offset = write_vertex_list(grind_rail_vertices) - base_pos;
+		thing_7c_header.part_2_data_size = dest.tell() -
+			thing_7c_header.part_2_data_offset - base_pos;
+		thing_7c_header.pad = 0;
+
+		size_t end_pos = dest.tell();
+		dest.write(base_pos, thing_7c_header);
+		dest.seek(end_pos);
 	});
-	dest.seek(dest.tell() + sizeof(world_grindrail_header));
-	
-	for(grindrail_spline_entity& ent : grindrails) {
-		world_grindrail_part_1 grindrail;
-		grindrail.x = ent.special_point.x;
-		grindrail.y = ent.special_point.y;
-		grindrail.z = ent.special_point.z;
-		grindrail.w = ent.special_point.w;
-		std::memcpy(grindrail.unknown_10, ent.unknown_10, 0x10);
-		dest.write(grindrail);
-	}
-	
-	std::vector<std::vector<glm::vec4>> grind_rail_vertices;
-	for(spline_entity& grindrail : grindrails) {
-		grind_rail_vertices.push_back(grindrail.vertices);
-	}
-	thing_7c_header.count = grindrails.size();
-	thing_7c_header.part_2_data_offset = write_vertex_list(grind_rail_vertices) - header.grindrails;
-	thing_7c_header.part_2_data_size = dest.tell() -
-		thing_7c_header.part_2_data_offset - header.grindrails;
-	thing_7c_header.pad = 0;
 	
 	dest.pad(0x10, 0);
 	header.unknown_98 = dest.tell();
@@ -673,6 +769,9 @@ void world_segment::write_rac23(array_stream& dest) {
 	} else {
 		header.unknown_90 = 0;
 	}
+
+	languages_dirty = false;
+	splines_dirty = false;
 }
 
 void swap_tie(tie_entity& l, world_tie& r) {
@@ -681,14 +780,11 @@ void swap_tie(tie_entity& l, world_tie& r) {
 	l.local_to_world[3][3] = 1.f;
 	r.local_to_world.m44 = 0.01f;
 	// tie_entity
-	SWAP_PACKED(l.unknown_0, r.unknown_0);
-	SWAP_PACKED(l.unknown_4, r.unknown_4);
-	SWAP_PACKED(l.unknown_8, r.unknown_8);
-	SWAP_PACKED(l.unknown_c, r.unknown_c);
-	SWAP_PACKED(l.unknown_50, r.unknown_50);
-	SWAP_PACKED(l.uid, r.uid);
-	SWAP_PACKED(l.unknown_58, r.unknown_58);
-	SWAP_PACKED(l.unknown_5c, r.unknown_5c);
+	// Both sides lay these fields out contiguously in the same order - the
+	// on-disc matrix in the middle is the only thing that differs - so each
+	// half can be exchanged in bulk.
+	SWAP_PACKED_RUN(l.unknown_0, r.unknown_0, 0x10); // unknown_0 to unknown_c.
+	SWAP_PACKED_RUN(l.unknown_50, r.unknown_50, 0x10); // unknown_50 to unknown_5c.
 }
 
 void swap_shrub(shrub_entity& l, world_shrub& r) {
@@ -697,18 +793,8 @@ void swap_shrub(shrub_entity& l, world_shrub& r) {
 	l.local_to_world[3][3] = 1.f;
 	r.local_to_world.m44 = 0.01f;
 	// shrub_entity
-	SWAP_PACKED(l.unknown_0, r.unknown_0);
-	SWAP_PACKED(l.unknown_4, r.unknown_4);
-	SWAP_PACKED(l.unknown_8, r.unknown_8);
-	SWAP_PACKED(l.unknown_c, r.unknown_c);
-	SWAP_PACKED(l.unknown_50, r.unknown_50);
-	SWAP_PACKED(l.unknown_54, r.unknown_54);
-	SWAP_PACKED(l.unknown_58, r.unknown_58);
-	SWAP_PACKED(l.unknown_5c, r.unknown_5c);
-	SWAP_PACKED(l.unknown_60, r.unknown_60);
-	SWAP_PACKED(l.unknown_64, r.unknown_64);
-	SWAP_PACKED(l.unknown_68, r.unknown_68);
-	SWAP_PACKED(l.unknown_6c, r.unknown_6c);
+	SWAP_PACKED_RUN(l.unknown_0, r.unknown_0, 0x10); // unknown_0 to unknown_c.
+	SWAP_PACKED_RUN(l.unknown_50, r.unknown_50, 0x20); // unknown_50 to unknown_6c.
 }
 
 void swap_moby_rac23(moby_entity& l, world_moby_rac23& r) {
@@ -716,34 +802,10 @@ void swap_moby_rac23(moby_entity& l, world_moby_rac23& r) {
 	SWAP_PACKED(l.position, r.position);
 	SWAP_PACKED(l.rotation, r.rotation);
 	// moby_entity
-	SWAP_PACKED(l.size, r.size);
-	SWAP_PACKED(l.unknown_4, r.unknown_4);
-	SWAP_PACKED(l.unknown_8, r.unknown_8);
-	SWAP_PACKED(l.unknown_c, r.unknown_c);
-	SWAP_PACKED(l.uid, r.uid);
-	SWAP_PACKED(l.unknown_14, r.unknown_14);
-	SWAP_PACKED(l.unknown_18, r.unknown_18);
-	SWAP_PACKED(l.unknown_1c, r.unknown_1c);
-	SWAP_PACKED(l.unknown_20, r.unknown_20);
-	SWAP_PACKED(l.unknown_24, r.unknown_24);
-	SWAP_PACKED(l.class_num, r.class_num);
-	SWAP_PACKED(l.scale, r.scale);
-	SWAP_PACKED(l.unknown_30, r.unknown_30);
-	SWAP_PACKED(l.unknown_34, r.unknown_34);
-	SWAP_PACKED(l.unknown_38, r.unknown_38);
-	SWAP_PACKED(l.unknown_3c, r.unknown_3c);
-	SWAP_PACKED(l.unknown_58, r.unknown_58);
-	SWAP_PACKED(l.unknown_5c, r.unknown_5c);
-	SWAP_PACKED(l.unknown_60, r.unknown_60);
-	SWAP_PACKED(l.unknown_64, r.unknown_64);
-	SWAP_PACKED(l.pvar_index, r.pvar_index);
-	SWAP_PACKED(l.unknown_6c, r.unknown_6c);
-	SWAP_PACKED(l.unknown_70, r.unknown_70);
-	SWAP_PACKED(l.unknown_74, r.unknown_74);
-	SWAP_PACKED(l.unknown_78, r.unknown_78);
-	SWAP_PACKED(l.unknown_7c, r.unknown_7c);
-	SWAP_PACKED(l.unknown_80, r.unknown_80);
-	SWAP_PACKED(l.unknown_84, r.unknown_84);
+	// Everything except the position and rotation matches the on-disc layout
+	// exactly, so the fields either side of them go out as two bulk runs.
+	SWAP_PACKED_RUN(l.size, r.size, 0x40); // size to unknown_3c.
+	SWAP_PACKED_RUN(l.unknown_58, r.unknown_58, 0x30); // unknown_58 to unknown_84.
 }
 
 void swap_moby_rac4(moby_entity& l, world_moby_rac4& r) {
@@ -20,8 +20,13 @@
 #define FORMATS_WORLD_H
 
 #include <array>
+#include <atomic>
+#include <cstring>
+#include <stdexcept>
 #include <functional>
+#include <unordered_map>
 
+#include "../util.h"
 #include "level_types.h"
 
 struct entity_id {
@@ -47,8 +52,10 @@ struct matrix_entity : public entity {
 struct euler_entity : public entity {
 	glm::vec3 position;
 	glm::vec3 rotation;
-	glm::mat4 local_to_world_cache;
-	glm::mat4 local_to_clip_cache;
+	// Computed on demand. The renderer keeps its own densely packed matrix
+	// caches (see gl_renderer::prepare_frame) so the per-frame transform pass
+	// doesn't have to walk these fat structs.
+	glm::mat4 local_to_world() const;
 };
 
 struct tie_entity final : public matrix_entity {
@@ -132,7 +139,44 @@ struct game_string {
 	uint32_t secondary_id;
 	uint16_t unknown_c;
 	uint16_t unknown_e;
-	std::string str;
+	uint32_t offset; // Offset of the text within the segment's string table.
+	uint32_t size; // Not including the null terminator.
+};
+
+// Backing storage for every language's strings. Each distinct piece of text
+// is stored once, null terminated, in one contiguous arena shared between
+// the languages - the same line often appears several times (untranslated
+// text, button glyphs), so interning it beats a std::string per entry.
+class game_string_table {
+public:
+	// Append text to the arena, reusing an existing copy if the same text has
+	// been interned before. Returns the offset of the string in the arena.
+	uint32_t intern(const std::string& text) {
+		uint64_t hash = hash_text(text);
+		auto range = _lookup.equal_range(hash);
+		for(auto iter = range.first; iter != range.second; iter++) {
+			if(std::strcmp(c_str(iter->second), text.c_str()) == 0) {
+				return iter->second;
+			}
+		}
+		uint32_t offset = _arena.size();
+		_arena.insert(_arena.end(), text.begin(), text.end());
+		_arena.push_back('\0');
+		_lookup.emplace(hash, offset);
+		return offset;
+	}
+
+	const char* c_str(uint32_t offset) const { return _arena.data() + offset; }
+
+private:
+	// FNV-1a, same as texture::content_hash. Collisions fall back to the
+	// strcmp in intern, hence the multimap.
+	static uint64_t hash_text(const std::string& text) {
+		return fnv1a(text.data(), text.size());
+	}
+
+	std::vector<char> _arena;
+	std::unordered_multimap<uint64_t, uint32_t> _lookup;
 };
 
 struct thing_94 {
@@ -140,6 +184,92 @@ struct thing_94 {
 	std::vector<uint8_t> data;
 };
 
+// A table the editor never interprets. The raw bytes are captured as-is on
+// read and spliced back out verbatim on write, so these tables are neither
+// decoded nor re-encoded. Call decode() if some code does end up needing the
+// typed view of one of them.
+struct opaque_world_table {
+	std::vector<uint8_t> bytes; // Includes the count header where there is one.
+
+	// Only valid for tables framed by a world_object_table header. Returns
+	// the first part of the table.
+	template <typename T>
+	std::vector<T> decode() const {
+		uint32_t count;
+		std::memcpy(&count, bytes.data(), sizeof(uint32_t)); // count_1
+		std::vector<T> result(count);
+		std::memcpy(result.data(), bytes.data() + 0x10, count * sizeof(T));
+		return result;
+	}
+};
+
+// All of a level's pvars packed back to back in a single byte arena, with an
+// offset/length table on the side. A level can contain thousands of mobies,
+// and storing each pvar in its own std::vector meant one small heap
+// allocation per moby - the pool does the whole lot in two.
+class pvar_pool {
+public:
+	// A non-owning window onto one pvar. Mirrors the bits of the std::vector
+	// interface the callers were already using. Invalidated by push_back.
+	class pvar_view {
+	public:
+		pvar_view(uint8_t* data, std::size_t size)
+			: _data(data), _size(size) {}
+
+		std::size_t size() const { return _size; }
+		uint8_t& operator[](std::size_t index) const { return _data[index]; }
+		uint8_t& at(std::size_t index) const {
+			if(index >= _size) {
+				throw std::out_of_range("pvar_pool::pvar_view::at");
+			}
+			return _data[index];
+		}
+		uint8_t* begin() const { return _data; }
+		uint8_t* end() const { return _data + _size; }
+
+	private:
+		uint8_t* _data;
+		std::size_t _size;
+	};
+
+	std::size_t size() const { return _pvars.size(); }
+	pvar_view operator[](std::size_t index) {
+		pvar_slot& slot = _pvars[index];
+		return pvar_view(_data.data() + slot.offset, slot.size);
+	}
+	pvar_view at(std::size_t index) {
+		if(index >= _pvars.size()) {
+			throw std::out_of_range("pvar_pool::at");
+		}
+		return (*this)[index];
+	}
+
+	void reserve(std::size_t pvar_count, std::size_t data_size) {
+		_pvars.reserve(pvar_count);
+		_data.reserve(data_size);
+	}
+
+	// Append a zeroed pvar of the given size and return a view of its bytes.
+	pvar_view push_back(std::size_t size) {
+		_pvars.push_back({ _data.size(), size });
+		_data.resize(_data.size() + size);
+		return (*this)[_pvars.size() - 1];
+	}
+
+	// The arena itself. The pvars are laid out back to back in index order,
+	// so the writer can splice this straight into the segment.
+	const std::vector<uint8_t>& data() const { return _data; }
+	std::size_t offset_of(std::size_t index) const { return _pvars.at(index).offset; }
+
+private:
+	struct pvar_slot {
+		std::size_t offset;
+		std::size_t size;
+	};
+	std::vector<pvar_slot> _pvars;
+	std::vector<uint8_t> _data;
+};
+
 #define LANGUAGE_COUNT 8
 #define LANGUAGE_NAMES \
 	"US English", "UK English", "French", "German", \
@@ -148,46 +278,48 @@ struct thing_94 {
 class world_segment {
 public:
 	world_segment() {}
-	
+
+	// Never reused, so caches keyed on a world (e.g. the renderer's spline
+	// vertex buffers) can't confuse two worlds that happen to be allocated
+	// at the same address.
+	const uint64_t world_id = next_world_id();
+
 	world_type game;
 	
 	world_properties properties;
 	std::vector<world_property_thing> property_things;
 	std::vector<world_directional_light> directional_lights;
-	std::vector<world_thing_8> thing_8s;
-	std::vector<world_thing_c> thing_cs;
+	opaque_world_table thing_8s; // world_thing_8
+	opaque_world_table thing_cs; // world_thing_c
 	std::optional<uint32_t> unknown_10_val; // Just before the US strings.
+	game_string_table strings; // Text for all the languages below.
 	std::array<std::vector<game_string>, LANGUAGE_COUNT> languages;
 	std::vector<uint8_t> korean_strings_hack;
-	std::vector<uint32_t> thing_30s;
+	opaque_world_table thing_30s; // uint32_t list
 	std::vector<tie_entity> ties;
-	std::vector<uint32_t> thing_38_1s;
-	std::vector<uint8_t> thing_38_2s;
-	std::vector<uint32_t> thing_3cs;
+	opaque_world_table thing_38s; // uint32_t + uint8_t parts
+	opaque_world_table thing_3cs; // uint32_t list
 	std::vector<shrub_entity> shrubs;
-	std::vector<uint32_t> thing_44_1s;
-	std::vector<uint8_t> thing_44_2s;
-	std::vector<uint32_t> thing_48s;
+	opaque_world_table thing_44s; // uint32_t + uint8_t parts
+	opaque_world_table thing_48s; // uint32_t list
 	std::vector<moby_entity> mobies;
 	uint32_t max_moby_count;
-	std::vector<uint32_t> thing_50_1s;
-	std::vector<uint8_t> thing_50_2s;
-	std::vector<uint8_t> thing_54_1s;
-	std::vector<uint64_t> thing_54_2s;
-	std::vector<world_thing_58> thing_58s;
-	std::vector<std::vector<uint8_t>> pvars;
-	std::vector<world_thing_64> thing_64s;
+	opaque_world_table thing_50s; // uint32_t + uint8_t parts
+	opaque_world_table thing_54s; // uint8_t + uint64_t parts
+	opaque_world_table thing_58s; // world_thing_58, terminated array
+	pvar_pool pvars;
+	opaque_world_table thing_64s; // world_thing_64, terminated array
 	std::vector<trigger_entity> triggers;
-	std::vector<world_thing_6c> thing_6cs;
-	std::vector<world_thing_70> thing_70s;
-	std::vector<uint32_t> thing_74s; // Unknown type.
+	opaque_world_table thing_6cs; // world_thing_6c
+	opaque_world_table thing_70s; // world_thing_70
+	opaque_world_table thing_74s; // Unknown type.
 	std::vector<regular_spline_entity> splines;
 	std::vector<grindrail_spline_entity> grindrails;
 	std::vector<uint8_t> thing_80_1;
 	std::vector<uint8_t> thing_80_2;
-	std::vector<world_thing_84> thing_84s;
+	opaque_world_table thing_84s; // world_thing_84
 	std::vector<uint8_t> thing_88;
-	std::vector<world_thing_8c> thing_8cs;
+	opaque_world_table thing_8cs; // world_thing_8c
 	std::vector<world_thing_90> thing_90_1s;
 	std::vector<world_thing_90> thing_90_2s;
 	std::vector<world_thing_90> thing_90_3s;
@@ -199,7 +331,23 @@ public:
 	stream* backing;
 	void read_rac23();
 	void read_rac4();
-	
+
+	// Dirty flags for the incremental writer. A section that hasn't been
+	// touched since the last write is spliced from the bytes produced that
+	// time instead of being re-encoded. The entity tables are always
+	// re-encoded - they're cheap swap loops - but the string tables and the
+	// per-vertex spline lists are not, and they're almost never edited.
+	bool languages_dirty = true;
+	bool splines_dirty = true; // Also covers the grindrails.
+	// Bumped on every spline edit. The writer resets splines_dirty once it
+	// has re-encoded the section, so the renderer keys its persistent spline
+	// vertex buffers off this counter instead - it only ever increases.
+	uint64_t spline_generation = 0;
+	void mark_splines_dirty() {
+		splines_dirty = true;
+		spline_generation++;
+	}
+
 private:
 	template <typename T_1, typename T_2 = char, typename T_3 = char>
 	void read_table( // Defined in world.cpp.
@@ -208,14 +356,22 @@ private:
 		std::vector<T_2>* second = nullptr,
 		std::vector<T_3>* third = nullptr,
 		bool align = false);
+	// Like read_table, but captures the raw bytes of the table instead of
+	// decoding it. The template arguments determine the element sizes used to
+	// find the end of the table.
+	template <typename T_1, typename T_2 = char, typename T_3 = char>
+	opaque_world_table read_opaque_table( // Defined in world.cpp.
+		uint32_t offset, bool align = false);
+	opaque_world_table read_opaque_u32_list(uint32_t offset);
+	template <typename T>
+	opaque_world_table read_opaque_terminated_array(uint32_t offset); // Defined in world.cpp.
 	std::vector<game_string> read_language(uint32_t offset);
-	std::vector<uint32_t> read_u32_list(uint32_t offset);
-	template <typename T_in_mem, typename T_on_disc>
+	// The swap function is a deduced template parameter rather than a
+	// std::function so that it inlines into the conversion loop.
+	template <typename T_in_mem, typename T_on_disc, typename T_swap>
 	std::vector<T_in_mem> read_entity_table( // Defined in world.cpp.
-		uint32_t offset, std::function<void(T_in_mem&, T_on_disc&)> swap_ent);
-	std::vector<std::vector<uint8_t>> read_pvars(uint32_t table_offset, uint32_t data_offset);
-	template <typename T>
-	void read_terminated_array(std::vector<T>& dest, uint32_t offset); // Defined in world.cpp.
+		uint32_t offset, T_swap swap_ent);
+	pvar_pool read_pvars(uint32_t table_offset, uint32_t data_offset);
 	template <typename T> // Either regular_spline_entity or grindrail_spline_entity.
 	std::vector<T> read_splines( // Defined in world.cpp.
 		uint32_t table_offset,
@@ -226,11 +382,26 @@ public:
 	void write_rac23(array_stream& dest);
 	
 private:
+	static uint64_t next_world_id() {
+		static std::atomic<uint64_t> counter = 0;
+		return ++counter;
+	}
+
 	std::size_t _next_entity_id = 1;
+
+	// Encoded section bytes from the last write, see the dirty flags above.
+	// All offsets within these sections are relative to the section base, so
+	// the bytes stay valid even when the section moves around in the segment.
+	std::array<std::vector<char>, LANGUAGE_COUNT> _language_cache;
+	std::vector<char> _spline_cache;
+	std::vector<char> _grindrail_cache;
 };
 
 // Swaps data between the on-disc and in-memory representation of entities.
-// These functions can hence be used for both reading and writing.
+// These functions can hence be used for both reading and writing. Runs of
+// fields that are laid out identically on both sides are exchanged in bulk
+// (see SWAP_PACKED_RUN); only fields the formats genuinely reorder are
+// swapped individually.
 void swap_tie(tie_entity& l, world_tie& r);
 void swap_shrub(shrub_entity& l, world_shrub& r);
 void swap_moby_rac23(moby_entity& l, world_moby_rac23& r);
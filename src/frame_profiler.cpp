@@ -0,0 +1,106 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "frame_profiler.h"
+
+#include <map>
+#include <string>
+#include <cstdio>
+
+#include "imgui_includes.h"
+
+static const int HISTORY_SIZE = 120;
+static const int QUERY_RING_SIZE = 4;
+
+struct profiler_stage {
+	float cpu_history[HISTORY_SIZE] = {};
+	float gpu_history[HISTORY_SIZE] = {};
+	int cpu_cursor = 0;
+	int gpu_cursor = 0;
+
+	GLuint queries[QUERY_RING_SIZE] = {};
+	int next_query = 0;
+	int oldest_query = 0;
+	int queries_in_flight = 0;
+};
+
+static std::map<std::string, profiler_stage> stages;
+
+void frame_profiler_begin_frame() {
+	for(auto& [name, stage] : stages) {
+		// Results usually become available a frame or two after the query was
+		// issued. Never wait for one - just leave it for a later frame.
+		while(stage.queries_in_flight > 0) {
+			GLuint query = stage.queries[stage.oldest_query];
+			GLuint available = 0;
+			glGetQueryObjectuiv(query, GL_QUERY_RESULT_AVAILABLE, &available);
+			if(!available) {
+				break;
+			}
+			GLuint64 nanoseconds = 0;
+			glGetQueryObjectui64v(query, GL_QUERY_RESULT, &nanoseconds);
+			stage.gpu_history[stage.gpu_cursor] = nanoseconds / 1000000.f;
+			stage.gpu_cursor = (stage.gpu_cursor + 1) % HISTORY_SIZE;
+			stage.oldest_query = (stage.oldest_query + 1) % QUERY_RING_SIZE;
+			stage.queries_in_flight--;
+		}
+	}
+}
+
+void frame_profiler_draw_overlay() {
+	for(auto& [name, stage] : stages) {
+		int last_cpu = (stage.cpu_cursor + HISTORY_SIZE - 1) % HISTORY_SIZE;
+		int last_gpu = (stage.gpu_cursor + HISTORY_SIZE - 1) % HISTORY_SIZE;
+		char overlay[128];
+		snprintf(overlay, sizeof(overlay), "%s: %.2fms cpu, %.2fms gpu",
+			name.c_str(), stage.cpu_history[last_cpu], stage.gpu_history[last_gpu]);
+		ImGui::PlotLines("##cpu", stage.cpu_history, HISTORY_SIZE, stage.cpu_cursor,
+			overlay, 0.f, 16.f, ImVec2(256, 40));
+		ImGui::PlotLines("##gpu", stage.gpu_history, HISTORY_SIZE, stage.gpu_cursor,
+			nullptr, 0.f, 16.f, ImVec2(256, 20));
+	}
+}
+
+frame_timer::frame_timer(const char* stage_name) {
+	_stage = &stages[stage_name];
+
+	if(_stage->queries[0] == 0) {
+		glGenQueries(QUERY_RING_SIZE, _stage->queries);
+	}
+	// If the whole ring is in flight the GPU is several frames behind - skip
+	// timing this one rather than blocking on a result.
+	_query_issued = _stage->queries_in_flight < QUERY_RING_SIZE;
+	if(_query_issued) {
+		glBeginQuery(GL_TIME_ELAPSED, _stage->queries[_stage->next_query]);
+	}
+
+	_cpu_start = std::chrono::steady_clock::now();
+}
+
+frame_timer::~frame_timer() {
+	auto cpu_end = std::chrono::steady_clock::now();
+	float milliseconds = std::chrono::duration<float, std::milli>(cpu_end - _cpu_start).count();
+	_stage->cpu_history[_stage->cpu_cursor] = milliseconds;
+	_stage->cpu_cursor = (_stage->cpu_cursor + 1) % HISTORY_SIZE;
+
+	if(_query_issued) {
+		glEndQuery(GL_TIME_ELAPSED);
+		_stage->next_query = (_stage->next_query + 1) % QUERY_RING_SIZE;
+		_stage->queries_in_flight++;
+	}
+}
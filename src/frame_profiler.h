@@ -0,0 +1,52 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef FRAME_PROFILER_H
+#define FRAME_PROFILER_H
+
+#include <chrono>
+
+#include "gl_includes.h"
+
+# /*
+#	Scoped CPU timers plus GL timer queries for the stages of a frame, with
+#	a short per-stage history that can be drawn as an overlay in the 3D view.
+# */
+
+// Collect finished GPU queries. Call once at the start of each frame.
+void frame_profiler_begin_frame();
+
+// Draw a PlotLines graph per stage into the current ImGui window.
+void frame_profiler_draw_overlay();
+
+// Times a stage of the frame on both the CPU and the GPU. The GPU side goes
+// through a small ring of GL_TIME_ELAPSED queries whose results are collected
+// in later frames, so timing never blocks. Stages must not nest - GL only
+// allows one TIME_ELAPSED query to be active at a time.
+class frame_timer {
+public:
+	frame_timer(const char* stage_name);
+	~frame_timer();
+
+private:
+	struct profiler_stage* _stage;
+	bool _query_issued;
+	std::chrono::steady_clock::time_point _cpu_start;
+};
+
+#endif
@@ -19,11 +19,15 @@
 #include "game_db.h"
 
 #include <cctype>
+#include <cstring>
 #include <fstream>
 #include <sstream>
+#include <optional>
 #include <functional>
 
 #include "util.h"
+#include "stream.h"
+#include "fs_includes.h"
 
 struct gamedb_parser {
 	std::vector<std::string> tokens;
@@ -36,18 +40,29 @@ std::map<std::size_t, std::string> gamedb_read_subsection(gamedb_parser& parser)
 std::string gamedb_read_token(gamedb_parser& parser);
 std::string gamedb_read_until_newline(gamedb_parser& parser);
 
+static std::optional<std::vector<gamedb_game>> gamedb_read_cache(uint64_t source_hash);
+static void gamedb_write_cache(uint64_t source_hash, const std::vector<gamedb_game>& games);
+
 std::vector<gamedb_game> gamedb_read() {
 	std::ifstream file("data/gamedb.txt");
 	if(!file) {
 		return {};
 	}
-	
+
 	std::stringstream ss;
 	ss << file.rdbuf();
-	
+
 	std::string content = ss.str();
+
+	// The parsed database is cached in a binary form keyed on a hash of the
+	// text, so most launches skip the lexing/parsing below.
+	uint64_t source_hash = fnv1a(content.data(), content.size());
+	if(auto cached = gamedb_read_cache(source_hash)) {
+		return std::move(*cached);
+	}
+
 	gamedb_parser parser = gamedb_lex(content);
-	
+
 	std::vector<gamedb_game> result;
 	while(parser.pos < parser.tokens.size()) {
 		gamedb_game game;
@@ -71,10 +86,101 @@ std::vector<gamedb_game> gamedb_read() {
 		}
 		result.push_back(game);
 	}
-	
+
+	gamedb_write_cache(source_hash, result);
+
 	return result;
 }
 
+packed_struct(gamedb_cache_header,
+	char magic[4]; // "WGDB"
+	uint32_t version;
+	uint32_t game_count;
+	uint32_t pad;
+	uint64_t source_hash; // Of the gamedb.txt the cache was built from.
+)
+
+static const uint32_t GAMEDB_CACHE_VERSION = 1;
+static const char* GAMEDB_CACHE_PATH = "cache/gamedb.bin";
+
+static std::string gamedb_cache_read_string(file_stream& file) {
+	std::string result;
+	result.resize(file.read<uint32_t>());
+	file.read_n(result.data(), result.size());
+	return result;
+}
+
+static std::map<std::size_t, std::string> gamedb_cache_read_map(file_stream& file) {
+	std::map<std::size_t, std::string> result;
+	uint32_t count = file.read<uint32_t>();
+	for(uint32_t i = 0; i < count; i++) {
+		uint64_t key = file.read<uint64_t>();
+		result.emplace(key, gamedb_cache_read_string(file));
+	}
+	return result;
+}
+
+static std::optional<std::vector<gamedb_game>> gamedb_read_cache(uint64_t source_hash) {
+	if(!fs::is_regular_file(GAMEDB_CACHE_PATH)) {
+		return {};
+	}
+	try {
+		file_stream file(GAMEDB_CACHE_PATH);
+		auto header = file.read<gamedb_cache_header>(0);
+		if(std::memcmp(header.magic, "WGDB", 4) != 0 ||
+		   header.version != GAMEDB_CACHE_VERSION ||
+		   header.source_hash != source_hash) {
+			return {};
+		}
+		std::vector<gamedb_game> games;
+		games.reserve(header.game_count);
+		for(uint32_t i = 0; i < header.game_count; i++) {
+			gamedb_game game;
+			game.name = gamedb_cache_read_string(file);
+			game.tables = gamedb_cache_read_map(file);
+			game.levels = gamedb_cache_read_map(file);
+			games.emplace_back(std::move(game));
+		}
+		return games;
+	} catch(stream_error&) {
+		return {};
+	}
+}
+
+static void gamedb_cache_write_string(file_stream& file, const std::string& value) {
+	file.write<uint32_t>(value.size());
+	file.write_n(value.data(), value.size());
+}
+
+static void gamedb_cache_write_map(file_stream& file, const std::map<std::size_t, std::string>& map) {
+	file.write<uint32_t>(map.size());
+	for(auto& [key, value] : map) {
+		file.write<uint64_t>(key);
+		gamedb_cache_write_string(file, value);
+	}
+}
+
+static void gamedb_write_cache(uint64_t source_hash, const std::vector<gamedb_game>& games) {
+	try {
+		fs::create_directory("cache");
+		file_stream file(GAMEDB_CACHE_PATH, std::ios::in | std::ios::out | std::ios::trunc);
+		gamedb_cache_header header;
+		std::memcpy(header.magic, "WGDB", 4);
+		header.version = GAMEDB_CACHE_VERSION;
+		header.game_count = games.size();
+		header.pad = 0;
+		header.source_hash = source_hash;
+		file.write<gamedb_cache_header>(0, header);
+		for(const gamedb_game& game : games) {
+			gamedb_cache_write_string(file, game.name);
+			gamedb_cache_write_map(file, game.tables);
+			gamedb_cache_write_map(file, game.levels);
+		}
+	} catch(stream_error&) {
+		// Best effort - next launch just parses the text again.
+	}
+}
+
 gamedb_parser gamedb_lex(std::string input) {
 	gamedb_parser parser;
 	std::string current;
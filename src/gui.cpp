@@ -18,7 +18,9 @@
 
 #include "gui.h"
 
+#include <set>
 #include <cmath>
+#include <cstring>
 #include <fstream>
 #include <iomanip>
 #include <sstream>
@@ -32,6 +34,7 @@
 #include "window.h"
 #include "renderer.h"
 #include "worker_thread.h"
+#include "memory_tracker.h"
 #include "formats/bmp.h"
 
 #include "unwindows.h"
@@ -86,6 +89,22 @@ void gui::render(app& a) {
 	ImGui::End(); // docking
 }
 
+bool gui::input_active() {
+	ImGuiIO& io = ImGui::GetIO();
+	if(io.MouseDelta.x != 0.f || io.MouseDelta.y != 0.f || io.MouseWheel != 0.f) {
+		return true;
+	}
+	if(ImGui::IsAnyMouseDown()) {
+		return true;
+	}
+	for(int i = 0; i < IM_ARRAYSIZE(io.KeysDown); i++) {
+		if(io.KeysDown[i]) {
+			return true;
+		}
+	}
+	return io.InputQueueCharacters.Size > 0;
+}
+
 void gui::create_dock_layout(const app& a) {
 	ImGuiID dockspace_id = ImGui::GetID("dock_space");
 	
@@ -167,6 +186,19 @@ float gui::render_menu_bar(app& a) {
 		}
 	}
 	
+	static prompt_box export_iso_box("Export ISO");
+	if(auto path = export_iso_box.render()) {
+		if(auto project = a.get_project()) {
+			try {
+				// Make sure pending WAD edits are in the patch list first.
+				project->commit_iso();
+				project->iso.export_iso(*path);
+			} catch(stream_error&) {
+				message_box.open("Export failed!");
+			}
+		}
+	}
+
 	static prompt_box export_level_box("Export Level");
 	if(auto path = export_level_box.render()) {
 		if(level* lvl = a.get_level()) {
@@ -227,6 +259,8 @@ float gui::render_menu_bar(app& a) {
 		if(ImGui::BeginMenu("Export")) {
 			if(!a.get_project()) {
 				ImGui::Text("You must create a new project (File->New) before exporting a level.");
+			} else if(ImGui::MenuItem("Playable ISO")) {
+				export_iso_box.open();
 			}
 			if(level* lvl = a.get_level()) {
 				if(ImGui::MenuItem("Level WAD")) {
@@ -282,7 +316,7 @@ float gui::render_menu_bar(app& a) {
 	//		} catch(stream_error& err) {
 	//			std::stringstream error_message;
 	//			error_message << err.what() << "\n";
-	//			error_message << err.stack_trace;
+	//			error_message << err.stack_trace();
 	//			save_error_box.open(error_message.str());
 	//		}
 	//	}
@@ -335,6 +369,17 @@ float gui::render_menu_bar(app& a) {
 			ImGui::Checkbox("Grind Rails", &a.renderer.draw_grind_rails);
 			ImGui::Checkbox("Tfrags", &a.renderer.draw_tfrags);
 			ImGui::Checkbox("Baked Collision", &a.renderer.draw_tcols);
+			ImGui::Checkbox("Frame Times", &a.renderer.draw_frame_times);
+			ImGui::Checkbox("Occlusion Culling", &a.renderer.occlusion_culling);
+			ImGui::Separator();
+			ImGui::Text("Culled: %zu mobies, %zu ties, %zu shrubs",
+				a.renderer.culled_moby_count,
+				a.renderer.culled_tie_count,
+				a.renderer.culled_shrub_count);
+			ImGui::Text("Occluded: %zu mobies, %zu ties, %zu shrubs",
+				a.renderer.occluded_moby_count,
+				a.renderer.occluded_tie_count,
+				a.renderer.occluded_shrub_count);
 			ImGui::EndMenu();
 		}
 		ImGui::EndMenu();
@@ -352,7 +397,7 @@ float gui::render_menu_bar(app& a) {
 				}
 				
 				// Recompress WAD segments still using the old patching system.
-				project->iso.commit();
+				project->commit_iso();
 				
 				if(fs::is_regular_file(config::get().emulator_path)) {
 					std::string emulator_path = fs::canonical(config::get().emulator_path).string();
@@ -426,6 +471,7 @@ float gui::render_menu_bar(app& a) {
 		if(ImGui::BeginMenu("Debug Tools")) {
 			render_menu_bar_window_toggle<manual_patcher>(a);
 			render_menu_bar_window_toggle<stream_viewer>(a);
+			render_menu_bar_window_toggle<memory_window>(a);
 			ImGui::EndMenu();
 		}
 		ImGui::EndMenu();
@@ -553,14 +599,7 @@ void gui::inspector::render(app& a) {
 	wrench_project& proj = *a.get_project();
 	level& lvl = *proj.selected_level();
 	
-	bool selection_empty = true;
-	lvl.for_each<entity>([&](entity& ent) {
-		if(ent.selected) {
-			selection_empty = false;
-		}
-	});
-	
-	if(selection_empty) {
+	if(lvl.selection.empty()) {
 		ImGui::Text("<no entity selected>");
 		return;
 	}
@@ -646,12 +685,12 @@ void gui::inspector::render(app& a) {
 	if(should_draw_pvars && last_pvar_index) {
 		ImGui::Text("Pvar %d", *last_pvar_index);
 		
-		auto& first_pvar = lvl.world.pvars.at(*last_pvar_index);
+		auto first_pvar = lvl.world.pvars.at(*last_pvar_index);
 		for(std::size_t i = 0; i < first_pvar.size(); i++) {
 			bool should_be_blank = false;
 			lvl.for_each<moby_entity>([&](moby_entity& ent) {
 				if(ent.selected && ent.pvar_index > -1) {
-					auto& pvar = lvl.world.pvars.at(ent.pvar_index);
+					auto pvar = lvl.world.pvars.at(ent.pvar_index);
 					if(pvar.at(i) != first_pvar[i]) {
 						should_be_blank = true;
 					}
@@ -753,6 +792,13 @@ void inspector_input(wrench_project& proj, const char* label, T_field T_entity::
 			}
 		}
 		
+		// Successive edits of the same field on the same selection coalesce
+		// into one undo entry.
+		uint64_t coalesce_key = fnv1a(label, strlen(label));
+		for(entity_id id : ids) {
+			coalesce_key = fnv1a(&id.value, sizeof(id.value), coalesce_key);
+		}
+
 		proj.push_command(
 			[lvlp, ids, field, first_lane, input_lanes, new_values]() {
 				lvlp.get().for_each<T_entity>([&](T_entity& ent) {
@@ -765,6 +811,13 @@ void inspector_input(wrench_project& proj, const char* label, T_field T_entity::
 						}
 					}
 				});
+				if constexpr(std::is_base_of_v<spline_entity, T_entity>) {
+					lvlp.get().world.mark_splines_dirty();
+				}
+				// The matrix and position lanes are declared on these two types.
+				if constexpr(std::is_same_v<T_entity, matrix_entity> || std::is_same_v<T_entity, euler_entity>) {
+					lvlp.get().entity_index.mark_stale();
+				}
 			},
 			[lvlp, ids, field, old_values]() {
 				lvlp.get().for_each<T_entity>([&](T_entity& ent) {
@@ -772,7 +825,14 @@ void inspector_input(wrench_project& proj, const char* label, T_field T_entity::
 						ent.*field = old_values.at(ent.id);
 					}
 				});
-			});
+				if constexpr(std::is_base_of_v<spline_entity, T_entity>) {
+					lvlp.get().world.mark_splines_dirty();
+				}
+				if constexpr(std::is_same_v<T_entity, matrix_entity> || std::is_same_v<T_entity, euler_entity>) {
+					lvlp.get().entity_index.mark_stale();
+				}
+			},
+			coalesce_key);
 	}
 }
 
@@ -831,6 +891,7 @@ void gui::moby_list::render(app& a) {
 			if(ImGui::Selectable(row.str().c_str(), moby.selected)) {
 				lvl.clear_selection();
 				moby.selected = true;
+				lvl.selection = { moby.id };
 			}
 		}
 		ImGui::ListBoxFooter();
@@ -875,6 +936,34 @@ ImVec2 gui::string_viewer::initial_size() const {
 }
 
 void gui::string_viewer::render(app& a) {
+	if(auto project = a.get_project()) {
+		// Search across every level's string tables, not just the open one.
+		// The first use of the box kicks off a background index build - see
+		// wrench_project::string_search_index.
+		ImGui::InputText("Search", &_search_query);
+		if(_search_query.size() > 0) {
+			string_index* index = project->string_search_index();
+			if(index == nullptr) {
+				ImGui::Text("Building index...");
+				return;
+			}
+			const char* lang_names[LANGUAGE_COUNT] = {LANGUAGE_NAMES};
+			auto results = index->search(_search_query, 1000);
+			ImGui::BeginChild(1);
+			ImGuiListClipper clipper;
+			clipper.Begin(results.size());
+			while(clipper.Step()) {
+				for(int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+					string_index::result& result = results[i];
+					ImGui::Text("LVL%d %s %x: %s",
+						result.level, lang_names[result.language], result.id, result.text);
+				}
+			}
+			ImGui::EndChild();
+			return;
+		}
+	}
+
 	if(auto lvl = a.get_level()) {
 		static std::size_t language_index = 0;
 		std::vector<game_string>& language = lvl->world.languages[language_index];
@@ -886,7 +975,8 @@ void gui::string_viewer::render(app& a) {
 		if(auto path = string_exporter.prompt()) {
 			std::ofstream out_file(*path);
 			for(game_string& string : language) {
-				out_file << std::hex << string.id << ": " << string.str << "\n";
+				out_file << std::hex << string.id << ": "
+					<< lvl->world.strings.c_str(string.offset) << "\n";
 			}
 		}
 		
@@ -904,8 +994,16 @@ void gui::string_viewer::render(app& a) {
 		ImGui::Columns(1);
 
 		ImGui::BeginChild(1);
-		for(game_string& string : language) {
-			ImGui::Text("%x: %s", string.id, string.str.c_str());
+		// R&C3 has thousands of strings per language, so only build widgets
+		// for the rows that are actually on screen. The clipper measures the
+		// first row and seeks straight to the visible range.
+		ImGuiListClipper clipper;
+		clipper.Begin(language.size());
+		while(clipper.Step()) {
+			for(int i = clipper.DisplayStart; i < clipper.DisplayEnd; i++) {
+				game_string& string = language[i];
+				ImGui::Text("%x: %s", string.id, lvl->world.strings.c_str(string.offset));
+			}
 		}
 		ImGui::EndChild();
 	}
@@ -995,7 +1093,9 @@ void gui::texture_browser::render(app& a) {
 					if(auto path = importer.prompt()) {
 						file_stream bmp_file(*path);
 						bmp_to_texture(tex, bmp_file);
-						tex->upload_to_opengl();
+						// In-place update so re-importing while iterating on
+						// an image doesn't respecify the whole GL texture.
+						tex->update_opengl();
 					}
 					
 					static prompt_box exporter("Export Selected", "Enter Export Path");
@@ -1033,7 +1133,19 @@ void gui::texture_browser::render(app& a) {
 }
 
 void gui::texture_browser::render_grid(app& a, std::vector<texture>& tex_list) {
-	int num_this_frame = 0;
+	// Budget uploads by size rather than by count, so a frame can push
+	// through a whole batch of small textures but won't try to swallow more
+	// than a couple of big ones. The uploads themselves go through pixel
+	// unpack buffers (see texture::upload_to_opengl) so this is the only
+	// part that costs GUI thread time.
+	static const std::size_t UPLOAD_BUDGET_BYTES = 2 * 1024 * 1024;
+	std::size_t bytes_this_frame = 0;
+
+	// Only upload thumbnails for cells within a page of the viewport, so
+	// opening a huge texture table doesn't upload thousands of images the
+	// user may never scroll to.
+	float view_top = ImGui::GetScrollY();
+	float view_bottom = view_top + ImGui::GetWindowHeight();
 
 	for(std::size_t i = 0; i < tex_list.size(); i++) {
 		texture* tex = &tex_list[i];
@@ -1043,14 +1155,22 @@ void gui::texture_browser::render_grid(app& a, std::vector<texture>& tex_list) {
 		}
 
 		if(tex->opengl_texture.id == 0) {
-			// Only load 10 textures per frame.
-			if(num_this_frame >= 10) {
+			float cell_top = ImGui::GetCursorPosY();
+			bool near_view =
+				cell_top + 128 > view_top - ImGui::GetWindowHeight() &&
+				cell_top < view_bottom + ImGui::GetWindowHeight();
+			if(!near_view || bytes_this_frame >= UPLOAD_BUDGET_BYTES) {
+				// Keep the cell the same size as a thumbnail so the scroll
+				// range and the visibility test above stay stable.
+				ImVec2 padding = ImGui::GetStyle().FramePadding;
+				ImGui::Dummy(ImVec2(128 + padding.x * 2, 128 + padding.y * 2));
+				ImGui::Text("%ld %s", i, tex->name.c_str());
 				ImGui::NextColumn();
 				continue;
 			}
 
 			tex->upload_to_opengl();
-			num_this_frame++;
+			bytes_this_frame += tex->pixels->size() * 4;
 		}
 
 		bool clicked = ImGui::ImageButton(
@@ -1287,7 +1407,7 @@ moby_model* gui::model_browser::render_selection_grid(
 			_model = i;
 			
 			// Reset submodel visibility.
-			for(moby_submodel& submodel : model.submodels) {
+			for(moby_submodel& submodel : *model.submodels) {
 				submodel.visible_in_model_viewer = true;
 			}
 		}
@@ -1339,7 +1459,7 @@ void gui::model_browser::render_preview(
 		&local_to_clip, GL_STATIC_DRAW);
 
 	render_to_texture(target, preview_size.x, preview_size.y, [&]() {
-		renderer.draw_moby_models(model, textures, params.mode, false, local_to_clip_buffer(), 0, 1);
+		renderer.draw_moby_models(model, textures, params.mode, false, local_to_clip_buffer(), 0, 1, moby_lod::FULL);
 	});
 	
 	if(params.show_vertex_indices) {
@@ -1359,18 +1479,15 @@ void gui::model_browser::render_preview(
 			return screen_pos;
 		};
 		
-		for(const moby_submodel& submodel : model.submodels) {
+		for(const moby_submodel& submodel : *model.submodels) {
 			if(!submodel.visible_in_model_viewer) {
 				continue;
 			}
 			
 			auto draw_list = ImGui::GetWindowDrawList();
-			for(std::size_t j = 0; j < submodel.vertices.size(); j++) {
-				const moby_model_vertex& vert = submodel.vertices[j];
-				glm::vec3 proj_pos = apply_local_to_screen(glm::vec4(
-					vert.x / (float) INT16_MAX,
-					vert.y / (float) INT16_MAX,
-					vert.z / (float) INT16_MAX, 1.f));
+			std::vector<glm::vec3> positions = decode_vertex_positions(submodel.vertices);
+			for(std::size_t j = 0; j < positions.size(); j++) {
+				glm::vec3 proj_pos = apply_local_to_screen(glm::vec4(positions[j], 1.f));
 				if(proj_pos.z > 0.f) {
 					draw_list->AddText(ImVec2(proj_pos.x, proj_pos.y), 0xffffffff, int_to_hex(j).c_str());
 				}
@@ -1394,13 +1511,13 @@ void gui::model_browser::render_submodel_list(moby_model& model) {
 	for(std::size_t i = 0; i < SUBMODEL_GROUPS; i++) {
 		ImGui::PushID(i);
 		
-		const std::size_t high = model.submodels.size();
+		const std::size_t high = model.submodels->size();
 		
 		// If every submodel in a given group is visible, we should draw the
 		// box as being ticked.
 		bool group_ticked = true;
 		for(std::size_t j = low; j < high; j++) {
-			group_ticked &= model.submodels[j].visible_in_model_viewer;
+			group_ticked &= (*model.submodels)[j].visible_in_model_viewer;
 		}
 		const bool group_ticked_before = group_ticked;
 		
@@ -1412,7 +1529,7 @@ void gui::model_browser::render_submodel_list(moby_model& model) {
 		if(group_expanded) {
 			for(std::size_t j = low; j < high; j++) {
 				ImGui::PushID(j);
-				moby_submodel& submodel = model.submodels[j];
+				moby_submodel& submodel = (*model.submodels)[j];
 				
 				std::string submodel_label = "Submodel " + std::to_string(j);
 				bool submodel_expanded = ImGui::TreeNode("submodel", "%s", "");
@@ -1433,7 +1550,7 @@ void gui::model_browser::render_submodel_list(moby_model& model) {
 		// all submodels in the current group.
 		if(group_ticked != group_ticked_before) {
 			for(std::size_t j = low; j < high; j++) {
-				model.submodels[j].visible_in_model_viewer = group_ticked;
+				(*model.submodels)[j].visible_in_model_viewer = group_ticked;
 			}
 		}
 		
@@ -1442,9 +1559,9 @@ void gui::model_browser::render_submodel_list(moby_model& model) {
 }
 
 void gui::model_browser::render_dma_debug_info(moby_model& mdl) {
-	for(std::size_t i = 0; i < mdl.submodels.size(); i++) {
+	for(std::size_t i = 0; i < mdl.submodels->size(); i++) {
 		ImGui::PushID(i);
-		moby_submodel& submodel = mdl.submodels[i];
+		moby_submodel& submodel = (*mdl.submodels)[i];
 		
 		if(ImGui::TreeNode("submodel", "Submodel %ld", i)) {
 			for(vif_packet& vpkt : submodel.vif_list) {
@@ -1769,8 +1886,8 @@ void gui::stream_viewer::render(app& a) {
 		stream* selection = _selection;
 		
 		// The stream might not exist anymore, so we need to make sure that
-		// it's still in the tree before dereferencing it.
-		if(!project->iso.contains(selection)) {
+		// it's still alive before dereferencing it.
+		if(!stream::is_live(selection, _selection_generation)) {
 			error_box.open("The selected stream no longer exists.");
 			return;
 		}
@@ -1821,13 +1938,13 @@ void gui::stream_viewer::render_stream_tree_node(stream* node, std::size_t index
 	std::stringstream text;
 	text << index;
 	text << " " << node->name;
-	text << " (" << node->children.size() <<")";
-	
+	text << " (" << node->child_count() <<")";
+
 	ImGuiTreeNodeFlags flags = ImGuiTreeNodeFlags_None;
 	if(is_selected) {
 		flags |= ImGuiTreeNodeFlags_Selected;
 	}
-	if(node->children.size() == 0) {
+	if(node->first_child == nullptr) {
 		flags |= ImGuiTreeNodeFlags_Leaf;
 	}
 	
@@ -1841,20 +1958,23 @@ void gui::stream_viewer::render_stream_tree_node(stream* node, std::size_t index
 	ImGui::NextColumn();
 	if(expanded) {
 		// Display streams with children before leaf streams.
-		for(std::size_t i = 0; i < node->children.size(); i++) {
-			if(node->children[i]->children.size() != 0) {
-				render_stream_tree_node(node->children[i], i);
+		std::size_t i = 0;
+		for(stream* child = node->first_child; child != nullptr; child = child->next_sibling, i++) {
+			if(child->first_child != nullptr) {
+				render_stream_tree_node(child, i);
 			}
 		}
-		for(std::size_t i = 0; i < node->children.size(); i++) {
-			if(node->children[i]->children.size() == 0) {
-				render_stream_tree_node(node->children[i], i);
+		i = 0;
+		for(stream* child = node->first_child; child != nullptr; child = child->next_sibling, i++) {
+			if(child->first_child == nullptr) {
+				render_stream_tree_node(child, i);
 			}
 		}
 		ImGui::TreePop();
 	}
 	if(make_selection) {
 		_selection = node;
+		_selection_generation = node->generation();
 	}
 	ImGui::PopID();
 }
@@ -1862,7 +1982,7 @@ void gui::stream_viewer::render_stream_tree_node(stream* node, std::size_t index
 void gui::stream_viewer::export_trace(trace_stream* node) {
 	std::vector<uint8_t> buffer(node->size());
 	node->seek(0);
-	node->parent->read_v(buffer); // Avoid tarnishing the read_mask buffer.
+	node->parent->read_v(buffer); // Avoid tarnishing the recorded read ranges.
 	
 	static const std::size_t image_side_length = 1024;
 	static const std::size_t image_pixel_count = image_side_length * image_side_length;
@@ -1874,7 +1994,10 @@ void gui::stream_viewer::export_trace(trace_stream* node) {
 	
 	// Convert stream to pixel data.
 	float scale_factor = buffer.size() / (float) image_pixel_count;
-	
+
+	std::vector<trace_stream_range> ranges = node->coalesced_read_ranges();
+	std::size_t range_cursor = 0;
+
 	for(std::size_t i = 0; i < image_pixel_count; i++) {
 		std::size_t in_index = (std::size_t) (i * scale_factor);
 		std::size_t in_index_end = (std::size_t) ((i + 1) * scale_factor);
@@ -1882,12 +2005,16 @@ void gui::stream_viewer::export_trace(trace_stream* node) {
 			bgr_pixel_data[i] = { 0, 0, 0, 0 };
 			continue;
 		}
-		
+
 		uint8_t pixel = buffer[in_index];
-		bool read = false;
-		for(std::size_t j = in_index; j < in_index_end; j++) {
-			read |= node->read_mask[j];
-		}
+		// The pixels walk the stream monotonically, so a cursor over the
+		// sorted ranges finds the overlap without a per-byte scan.
+		while(range_cursor < ranges.size() &&
+				ranges[range_cursor].offset + ranges[range_cursor].size <= in_index) {
+			range_cursor++;
+		}
+		bool read = range_cursor < ranges.size() &&
+			ranges[range_cursor].offset < in_index_end;
 		bgr_pixel_data[i] = bgr32 {
 			(uint8_t) (read ? 0 : pixel),
 			(uint8_t) (read ? 0 : pixel),
@@ -1925,6 +2052,48 @@ void gui::stream_viewer::export_trace(trace_stream* node) {
 	bmp_file.write_v(bgr_pixel_data);
 }
 
+/*
+	memory_window
+*/
+
+const char* gui::memory_window::title_text() const {
+	return "Memory";
+}
+
+ImVec2 gui::memory_window::initial_size() const {
+	return ImVec2(350, 250);
+}
+
+void gui::memory_window::render(app& a) {
+	auto print_row = [](const char* name, std::size_t bytes) {
+		ImGui::Text("%-16s %8.1f MB", name, bytes / (1024.f * 1024.f));
+	};
+
+	for(std::size_t i = 0; i < (std::size_t) mem_tag::COUNT; i++) {
+		mem_tag tag = (mem_tag) i;
+		print_row(mem_tag_name(tag), mem_usage(tag));
+	}
+
+	if(auto project = a.get_project()) {
+		// Pixel buffers are shared between texture objects after
+		// deduplication, so count each underlying buffer once.
+		std::set<const void*> counted;
+		std::size_t texture_bytes = 0;
+		for(auto& [_, list] : project->texture_lists(&a)) {
+			for(texture& tex : *list) {
+				if(counted.emplace(tex.pixels.get()).second) {
+					texture_bytes += tex.pixels->capacity();
+				}
+			}
+		}
+		print_row("Textures", texture_bytes);
+
+		ImGui::NewLine();
+		ImGui::Text("Undo history: %ld entries", project->undo_history_length());
+		ImGui::TextWrapped("The undo closures and the entity state they capture can't be sized, only counted.");
+	}
+}
+
 /*
 	alert_box
 */
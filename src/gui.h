@@ -39,6 +39,9 @@ namespace gui {
 	void render(app& a);
 	float render_menu_bar(app& a);
 	void render_tools(app& a, float menu_bar_height);
+	// Is the user currently pressing or moving anything? Only valid after
+	// ImGui::NewFrame. Used to decide when the main loop can stop redrawing.
+	bool input_active();
 
 	void create_dock_layout(const app& a);
 	void begin_docking();
@@ -72,6 +75,9 @@ namespace gui {
 		const char* title_text() const override;
 		ImVec2 initial_size() const override;
 		void render(app& a) override;
+
+	private:
+		std::string _search_query;
 	};
 	
 	class texture_browser : public window {
@@ -196,6 +202,7 @@ namespace gui {
 	private:
 		// Validate this before dereferencing it!
 		stream* _selection = nullptr;
+		uint64_t _selection_generation = 0; // For stream::is_live.
 	};
 	
 	class alert_box {
@@ -254,6 +261,15 @@ namespace gui {
 		std::function<void(std::string)> _callback;
 	};
 	
+	// Live view of where the memory is going: the tracked counters from
+	// memory_tracker.h plus a few figures computed by walking the project.
+	class memory_window : public window {
+	public:
+		const char* title_text() const override;
+		ImVec2 initial_size() const override;
+		void render(app& a) override;
+	};
+
 	class hex_dump : public window {
 	public:
 		hex_dump(uint8_t* data, std::size_t size_in_bytes);
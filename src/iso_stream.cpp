@@ -18,12 +18,29 @@
 
 #include "iso_stream.h"
 
+#include <algorithm>
+#include <ZipLib/methods/StoreMethod.h>
+#include <ZipLib/extlibs/zlib/zlib.h>
+
+#ifdef __linux__
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <linux/fs.h>
+	#include <sys/ioctl.h>
+#endif
+
 #include "app.h"
 #include "md5.h"
+#include "thread_pool.h"
+#include "xxhash.h"
 #include "util.h"
 #include "fs_includes.h"
+#include "memory_tracker.h"
 #include "formats/wad.h"
 
+// Defined above init_cache. Also used by export_iso, which comes first.
+static void clone_or_copy_file(const std::string& src_path, const std::string& dest_path);
+
 simple_wad_stream::simple_wad_stream(stream* backing, size_t offset)
 	: array_stream(backing) {
 	array_stream compressed;
@@ -31,6 +48,19 @@ simple_wad_stream::simple_wad_stream(stream* backing, size_t offset)
 	backing->seek(offset);
 	stream::copy_n(compressed, *backing, compressed_size);
 	decompress_wad(*this, compressed);
+	retrack();
+}
+
+simple_wad_stream::simple_wad_stream(stream* backing)
+	: array_stream(backing) {}
+
+simple_wad_stream::~simple_wad_stream() {
+	mem_track(mem_tag::LEVEL_SEGMENTS, -(std::int64_t) _tracked_bytes);
+}
+
+void simple_wad_stream::retrack() {
+	mem_track(mem_tag::LEVEL_SEGMENTS, (std::int64_t) buffer.size() - (std::int64_t) _tracked_bytes);
+	_tracked_bytes = buffer.size();
 }
 
 // All code below this point is obsolete and should be removed at some point.
@@ -41,25 +71,58 @@ wad_stream::wad_stream(iso_stream* backing, std::size_t offset, std::vector<wad_
 	  _offset(offset),
 	  _wad_patches(patches),
 	  _dirty(true) {
+	inflate();
+}
+
+wad_stream::~wad_stream() {
+	mem_track(mem_tag::WAD_SEGMENTS, -(std::int64_t) _tracked_bytes);
+}
+
+void wad_stream::inflate() {
 	// Read in the stock WAD.
 	array_stream segment;
-	uint32_t compressed_size = _backing->_iso.peek<uint32_t>(offset + 0x3);
-	_backing->_iso.seek(offset);
+	uint32_t compressed_size = _backing->_iso.peek<uint32_t>(_offset + 0x3);
+	_backing->_iso.seek(_offset);
 	stream::copy_n(segment, _backing->_iso, compressed_size);
 	decompress_wad(_uncompressed_buffer, segment);
-	
-	// Apply patches from project file.
-	for(auto& p : patches) {
+
+	// Apply patches from the project file and from this session.
+	for(auto& p : _wad_patches) {
 		_uncompressed_buffer.seek(p.offset);
 		_uncompressed_buffer.write_n(p.buffer.data(), p.buffer.size());
 	}
+	_uncompressed_buffer.seek(0);
+	_evicted = false;
+
+	mem_track(mem_tag::WAD_SEGMENTS,
+		(std::int64_t) _uncompressed_buffer.buffer.size() - (std::int64_t) _tracked_bytes);
+	_tracked_bytes = _uncompressed_buffer.buffer.size();
+}
+
+void wad_stream::ensure_inflated() {
+	if(_evicted) {
+		inflate();
+	}
+}
+
+void wad_stream::evict() {
+	assert(!_dirty);
+	// vector::clear keeps the allocation around, so swap it away instead.
+	_uncompressed_buffer.buffer = std::vector<char>();
+	_uncompressed_buffer.pos = 0;
+	_evicted = true;
+
+	mem_track(mem_tag::WAD_SEGMENTS, -(std::int64_t) _tracked_bytes);
+	_tracked_bytes = 0;
 }
 
 std::size_t wad_stream::size() const {
+	const_cast<wad_stream*>(this)->ensure_inflated();
 	return _uncompressed_buffer.size();
 }
 
 void wad_stream::seek(std::size_t offset) {
+	ensure_inflated();
 	_uncompressed_buffer.seek(offset);
 }
 
@@ -68,10 +131,21 @@ std::size_t wad_stream::tell() const {
 }
 
 void wad_stream::read_n(char* dest, std::size_t size) {
+	ensure_inflated();
 	_uncompressed_buffer.read_n(dest, size);
 }
 
 void wad_stream::write_n(const char* data, std::size_t size) {
+	ensure_inflated();
+	// Writes that don't change anything (round-tripped tables rewritten
+	// verbatim, undos putting an entity back) shouldn't dirty the segment or
+	// bloat the patch list.
+	std::size_t offset = tell();
+	if(offset + size <= _uncompressed_buffer.size() &&
+			std::memcmp(_uncompressed_buffer.data() + offset, data, size) == 0) {
+		_uncompressed_buffer.seek(offset + size);
+		return;
+	}
 	_wad_patches.emplace_back();
 	_wad_patches.back().offset = tell();
 	_wad_patches.back().buffer = std::vector<char>(data, data + size);
@@ -79,24 +153,53 @@ void wad_stream::write_n(const char* data, std::size_t size) {
 	_dirty = true;
 }
 
+const char* wad_stream::map_n(std::size_t offset, std::size_t size) {
+	ensure_inflated();
+	return _uncompressed_buffer.map_n(offset, size);
+}
+
 std::string wad_stream::resource_path() const {
 	proxy_stream segment(_backing, _offset, 0);
 	return std::string("wad(") + segment.resource_path() + ")";
 }
 
-void wad_stream::commit() {
+std::optional<array_stream> wad_stream::take_commit_snapshot() {
 	if(!_dirty || discard) {
-		return; // The segment hasn't been modified since the last time it was committed.
+		return {}; // The segment hasn't been modified since the last time it was committed.
 	}
 	_dirty = false;
-	
-	array_stream compressed_buffer;
-	_uncompressed_buffer.seek(0);
-	compress_wad(compressed_buffer, _uncompressed_buffer, config::get().compression_threads);
-	
-	compressed_buffer.seek(0);
-	_backing->seek(_offset);
-	_backing->write_n(compressed_buffer.data(), compressed_buffer.size(), false);
+
+	// Hashing the segment is orders of magnitude cheaper than recompressing
+	// it, so check whether the content actually differs from what was
+	// committed last time before copying anything out.
+	std::string hash = md5_from_stream(_uncompressed_buffer);
+	if(hash == _last_committed_hash) {
+		return {};
+	}
+	_last_committed_hash = hash;
+
+	array_stream snapshot;
+	snapshot.buffer = _uncompressed_buffer.buffer;
+	return snapshot;
+}
+
+// Fold one patch into a running digest. The patch list is append only, so
+// iso_stream keeps a digest up to date as patches land (see _patch_hash)
+// instead of re-hashing the whole history on every metadata update.
+static void hash_patch(XXH64_CTX& ctx, const patch& p) {
+	XXH64Update(&ctx, reinterpret_cast<const uint8_t*>(&p.offset), 4);
+	std::size_t size = p.buffer.size();
+	XXH64Update(&ctx, reinterpret_cast<const uint8_t*>(&size), 4);
+	XXH64Update(&ctx, reinterpret_cast<const uint8_t*>(p.buffer.data()), p.buffer.size());
+}
+
+static XXH64_CTX hash_all_patches(const std::vector<patch>& patches) {
+	XXH64_CTX ctx;
+	XXH64Init(&ctx, 0);
+	for(const patch& p : patches) {
+		hash_patch(ctx, p);
+	}
+	return ctx;
 }
 
 iso_stream::iso_stream(std::string game_id, std::string iso_path, worker_logger& log)
@@ -105,26 +208,59 @@ iso_stream::iso_stream(std::string game_id, std::string iso_path, worker_logger&
 iso_stream::iso_stream(std::string game_id, std::string iso_path, worker_logger& log, ZipArchive::Ptr root)
 	: stream(nullptr), // Don't worry about including the file_stream in the stream tree.
 	  _iso(iso_path),
+	  _iso_path(iso_path),
 	  _patches(read_patches(root)),
+	  _patch_hash(hash_all_patches(_patches)),
 	  _wad_streams(read_wad_streams(root)),
+	  _game_id(game_id),
 	  _cache_iso_path(std::string("cache/") + game_id + "_patched.iso"),
 	  _cache_meta_path(std::string("cache/") + game_id + "_metadata.json"),
-	  _cache(init_cache(iso_path, log), std::ios::in | std::ios::out) {}
+	  _readahead_path(std::string("cache/") + game_id + "_readahead.json"),
+	  _cache(init_cache(iso_path, log), std::ios::in | std::ios::out) {
+	start_readahead();
+}
+
+// All access to _cache goes through _write_mutex: while a background commit
+// is rewriting segments on a worker, the GUI thread keeps reading the ISO
+// (opening levels, lazy tfrags, the hex viewer), and file_stream carries
+// shared position and buffer state that can't take two users at once.
 
 std::size_t iso_stream::size() const {
+	std::lock_guard<std::mutex> guard(_write_mutex);
 	return _cache.size();
 }
 
 void iso_stream::seek(std::size_t offset) {
+	std::lock_guard<std::mutex> guard(_write_mutex);
 	_cache.seek(offset);
 }
 
 std::size_t iso_stream::tell() const {
+	std::lock_guard<std::mutex> guard(_write_mutex);
 	return _cache.tell();
 }
 
 void iso_stream::read_n(char* dest, std::size_t size) {
-	return _cache.read_n(dest, size);
+	std::lock_guard<std::mutex> guard(_write_mutex);
+	record_read(_cache.tell(), size);
+	_cache.read_n(dest, size);
+}
+
+void iso_stream::record_read(std::size_t offset, std::size_t size) {
+	if(size == 0) {
+		return;
+	}
+	std::lock_guard<std::mutex> guard(_recorded_reads_mutex);
+	// Sequential reads are by far the most common, so try to extend the last
+	// range before starting a new one.
+	if(_recorded_reads.size() > 0) {
+		trace_stream_range& last = _recorded_reads.back();
+		if(offset >= last.offset && offset <= last.offset + last.size) {
+			last.size = std::max(last.size, offset + size - last.offset);
+			return;
+		}
+	}
+	_recorded_reads.push_back({ offset, size });
 }
 
 void iso_stream::write_n(const char* data, std::size_t size) {
@@ -132,11 +268,17 @@ void iso_stream::write_n(const char* data, std::size_t size) {
 }
 
 void iso_stream::write_n(const char* data, std::size_t size, bool save_to_project) {
+	std::lock_guard<std::mutex> guard(_write_mutex);
+	write_n_locked(data, size, save_to_project);
+}
+
+void iso_stream::write_n_locked(const char* data, std::size_t size, bool save_to_project) {
 	_patches.emplace_back();
-	_patches.back().offset = tell();
+	_patches.back().offset = _cache.tell(); // Not tell() - the caller holds _write_mutex.
 	_patches.back().buffer = std::vector<char>(size);
 	_patches.back().save_to_project = save_to_project;
 	std::memcpy(_patches.back().buffer.data(), data, size);
+	hash_patch(_patch_hash, _patches.back());
 	_cache.write_n(data, size);
 	update_cache_metadata();
 }
@@ -149,23 +291,154 @@ std::string iso_stream::cached_iso_path() const {
 	return _cache_iso_path;
 }
 
+void iso_stream::export_iso(std::string dest_path) {
+	// Splice the unchanged sectors straight from the source ISO - as a
+	// reflink or an in-kernel copy where possible - then lay just the patched
+	// regions on top. The WAD segment commits all land in _patches via
+	// write_n, so the patch list alone fully describes the differences
+	// against the source image.
+	clone_or_copy_file(_iso_path, dest_path);
+
+	file_stream dest(dest_path, std::ios::in | std::ios::out);
+	for(patch& p : _patches) {
+		dest.seek(p.offset);
+		dest.write_n(p.buffer.data(), p.buffer.size());
+	}
+}
+
+std::string iso_stream::derived_cache_path(std::string name) {
+	fs::create_directory("cache");
+	fs::create_directory("cache/derived");
+	return "cache/derived/" + _game_id + "_" + hash_patches() + "_" + name;
+}
+
+void iso_stream::start_readahead() {
+	if(!fs::exists(_readahead_path)) {
+		return;
+	}
+	std::vector<trace_stream_range> schedule;
+	try {
+		std::ifstream schedule_file(_readahead_path);
+		auto json = nlohmann::json::parse(schedule_file);
+		for(auto& range : json.find("ranges").value()) {
+			schedule.push_back({ range[0].get<std::size_t>(), range[1].get<std::size_t>() });
+		}
+	} catch(...) {
+		return; // A corrupt schedule only costs us the readahead.
+	}
+	std::string path = _cache_iso_path;
+	thread_pool::shared().post([schedule = std::move(schedule), path]() {
+		try {
+			// Open our own stream - file streams aren't thread safe and the
+			// parsers are already hammering the main one.
+			file_stream iso(path);
+			std::vector<char> buffer(1024 * 1024);
+			for(const trace_stream_range& range : schedule) {
+				std::size_t pos = range.offset;
+				std::size_t end = std::min(range.offset + range.size, iso.size());
+				while(pos < end) {
+					std::size_t chunk = std::min(buffer.size(), end - pos);
+					iso.seek(pos);
+					iso.read_n(buffer.data(), chunk);
+					pos += chunk;
+				}
+			}
+		} catch(stream_error&) {
+			// This is purely a warmup pass, failure doesn't matter.
+		}
+	});
+}
+
+void iso_stream::save_readahead_schedule() {
+	std::vector<trace_stream_range> ranges;
+	{
+		std::lock_guard<std::mutex> guard(_recorded_reads_mutex);
+		ranges = _recorded_reads;
+	}
+	ranges = coalesce_ranges(std::move(ranges));
+	
+	nlohmann::json json;
+	json["ranges"] = nlohmann::json::array();
+	for(trace_stream_range& range : ranges) {
+		json["ranges"].emplace_back(nlohmann::json::array({ range.offset, range.size }));
+	}
+	
+	fs::create_directory("cache");
+	std::ofstream schedule_file(_readahead_path, std::ios::trunc);
+	schedule_file << json.dump();
+}
+
+// Deflate a single patch buffer for storage in a .wrench file. Projects are
+// saved with the patch data compressed up front on a pool of threads (see
+// save_patches_to_and_close) instead of letting ZipLib deflate each entry on
+// one thread while writing the archive out.
+static std::vector<char> deflate_patch_buffer(const std::vector<char>& src) {
+	uLongf dest_size = compressBound(src.size());
+	std::vector<char> dest(dest_size);
+	int result = compress2(
+		reinterpret_cast<Bytef*>(dest.data()), &dest_size,
+		reinterpret_cast<const Bytef*>(src.data()), src.size(),
+		Z_DEFAULT_COMPRESSION);
+	if(result != Z_OK) {
+		throw stream_io_error("Failed to deflate project patch buffer!");
+	}
+	dest.resize(dest_size);
+	return dest;
+}
+
+static std::vector<char> inflate_patch_buffer(const std::vector<char>& src, std::size_t size) {
+	std::vector<char> dest(size);
+	uLongf dest_size = size;
+	int result = uncompress(
+		reinterpret_cast<Bytef*>(dest.data()), &dest_size,
+		reinterpret_cast<const Bytef*>(src.data()), src.size());
+	if(result != Z_OK || dest_size != size) {
+		throw stream_io_error("Failed to inflate project patch buffer!");
+	}
+	return dest;
+}
+
 void iso_stream::save_patches_to_and_close(ZipArchive::Ptr& root, std::string project_path) {
 	std::vector<std::unique_ptr<std::stringstream>> patch_streams;
-	
+
+	// Deflate all the patch buffers in parallel before touching the archive.
+	// The entries are then stored in the zip without further compression and
+	// tagged in patch_list.json so the load path knows to inflate them.
+	std::vector<const std::vector<char>*> sources;
+	for(std::size_t i = 0; i < _patches.size(); i++) {
+		if(_patches[i].save_to_project) {
+			sources.push_back(&_patches[i].buffer);
+		}
+	}
+	for(auto& [wad_offset, wad] : _wad_streams) {
+		for(wad_patch& current : wad->_wad_patches) {
+			sources.push_back(&current.buffer);
+		}
+	}
+
+	std::vector<std::vector<char>> deflated(sources.size());
+	thread_pool::shared().parallel_for(sources.size(), [&](std::size_t i) {
+		deflated[i] = deflate_patch_buffer(*sources[i]);
+	}, config::get().compression_threads);
+
+	std::size_t next_deflated = 0;
 	std::vector<nlohmann::json> patch_list;
 	for(std::size_t i = 0; i < _patches.size(); i++) {
-		auto patch = _patches[i];
+		auto& patch = _patches[i];
 		if(!patch.save_to_project) {
 			continue;
 		}
+		std::vector<char>& data = deflated[next_deflated++];
 		std::string name = std::string("patches/") + std::to_string(i) + ".bin";
 		auto patch_bin = root->CreateEntry(name);
 		patch_streams.emplace_back(std::make_unique<std::stringstream>());
-		patch_streams.back()->write(patch.buffer.data(), patch.buffer.size());
-		patch_bin->SetCompressionStream(*patch_streams.back().get());
+		patch_streams.back()->write(data.data(), data.size());
+		patch_bin->SetCompressionStream(*patch_streams.back().get(), StoreMethod::Create());
 		patch_list.emplace_back(nlohmann::json {
 			{ "offset", patch.offset },
-			{ "data", name }
+			{ "data", name },
+			{ "encoding", "deflate" },
+			{ "size", patch.buffer.size() }
 		});
 	}
 
@@ -174,20 +447,23 @@ void iso_stream::save_patches_to_and_close(ZipArchive::Ptr& root, std::string pr
 		std::vector<nlohmann::json> wad_json;
 		for(std::size_t i = 0; i < wad->_wad_patches.size(); i++) {
 			auto& current = wad->_wad_patches[i];
+			std::vector<char>& data = deflated[next_deflated++];
 			std::string name =
 				std::string("wad_patches/") +
 				int_to_hex(wad_offset) + "_" +
 				std::to_string(i) + ".bin";
 			auto patch_bin = root->CreateEntry(name);
 			patch_streams.emplace_back(std::make_unique<std::stringstream>());
-			patch_streams.back()->write(current.buffer.data(), current.buffer.size());
-			patch_bin->SetCompressionStream(*patch_streams.back().get());
+			patch_streams.back()->write(data.data(), data.size());
+			patch_bin->SetCompressionStream(*patch_streams.back().get(), StoreMethod::Create());
 			wad_json.emplace_back(nlohmann::json {
 				{ "offset", current.offset },
-				{ "data", name }
+				{ "data", name },
+				{ "encoding", "deflate" },
+				{ "size", current.buffer.size() }
 			});
 		}
-		
+
 		wad_patch_list[int_to_hex(wad_offset)] = wad_json;
 	}
 
@@ -214,12 +490,104 @@ wad_stream* iso_stream::get_decompressed(std::size_t offset, bool discard) {
 			_wad_streams.at(offset)->discard = true;
 		}
 	}
-	return _wad_streams.at(offset).get();
+	wad_stream* wad = _wad_streams.at(offset).get();
+	wad->_last_used = ++_wad_use_counter;
+	evict_lru_wad_streams();
+	return wad;
+}
+
+void iso_stream::evict_lru_wad_streams() {
+	std::size_t budget = (std::size_t) config::get().wad_cache_budget_mb * 1024 * 1024;
+	std::size_t total = 0;
+	std::vector<wad_stream*> candidates;
+	for(auto& [offset, wad] : _wad_streams) {
+		if(wad->_evicted) {
+			continue;
+		}
+		total += wad->_uncompressed_buffer.buffer.size();
+		candidates.push_back(wad.get());
+	}
+	if(total <= budget) {
+		return;
+	}
+
+	std::sort(candidates.begin(), candidates.end(),
+		[](wad_stream* lhs, wad_stream* rhs) {
+			return lhs->_last_used < rhs->_last_used;
+		});
+	for(wad_stream* wad : candidates) {
+		if(total <= budget) {
+			break;
+		}
+		// Dirty streams hold uncommitted edits and the stream that's just
+		// been handed out is about to be used, so leave those alone.
+		if(wad->_dirty || wad->_last_used == _wad_use_counter) {
+			continue;
+		}
+		total -= wad->_uncompressed_buffer.buffer.size();
+		wad->evict();
+	}
 }
 
 void iso_stream::commit() {
-	for(auto& wad : _wad_streams) {
-		wad.second->commit();
+	std::vector<wad_commit_snapshot> snapshots = begin_commit();
+	finish_commit(snapshots);
+}
+
+std::vector<wad_commit_snapshot> iso_stream::begin_commit() {
+	std::vector<wad_commit_snapshot> snapshots;
+	for(auto& [offset, wad] : _wad_streams) {
+		std::optional<array_stream> snapshot = wad->take_commit_snapshot();
+		if(snapshot) {
+			snapshots.emplace_back(wad_commit_snapshot { offset, std::move(*snapshot) });
+		}
+	}
+	return snapshots;
+}
+
+// Ask the kernel to write the given range of the file out and drop it from
+// the page cache. The writeback has to complete first - POSIX_FADV_DONTNEED
+// skips dirty pages, so advising straight after the write would do nothing.
+// Elsewhere this is a no-op and the pages age out on their own.
+static void drop_written_pages(const std::string& path, std::size_t offset, std::size_t size) {
+#ifdef __linux__
+	int fd = open(path.c_str(), O_WRONLY);
+	if(fd == -1) {
+		return;
+	}
+	sync_file_range(fd, offset, size,
+		SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+	posix_fadvise(fd, offset, size, POSIX_FADV_DONTNEED);
+	close(fd);
+#endif
+}
+
+void iso_stream::finish_commit(std::vector<wad_commit_snapshot>& snapshots) {
+	for(wad_commit_snapshot& snapshot : snapshots) {
+		// Recompression is the expensive part, so do it outside the lock.
+		// Compressed blocks are streamed into the cache as they're produced
+		// instead of being accumulated first - committing several large
+		// segments at once used to hold every compressed buffer in memory.
+		snapshot.uncompressed.seek(0);
+		std::size_t written_end = 0;
+		compress_wad([&](std::size_t offset, const char* data, std::size_t size) {
+			// Hold the lock across the seek and the write so patches from the
+			// GUI thread can't land in between. Blocks carry their absolute
+			// offset, so patches landing between two blocks are harmless.
+			std::lock_guard<std::mutex> guard(_write_mutex);
+			_cache.seek(snapshot.offset + offset);
+			write_n_locked(data, size, false);
+			written_end = std::max(written_end, offset + size);
+		}, snapshot.uncompressed, config::get().compression_threads);
+
+		// The compressed segment streamed through the page cache exactly once
+		// and won't be read back - the decompressed copy lives in the
+		// wad_stream - so evict it before it evicts data the editor is using.
+		{
+			std::lock_guard<std::mutex> guard(_write_mutex);
+			_cache.flush();
+		}
+		drop_written_pages(_cache_iso_path, snapshot.offset, written_end);
 	}
 }
 
@@ -246,7 +614,14 @@ std::vector<patch> iso_stream::read_patches(ZipArchive::Ptr root) {
 		
 		std::istream* patch_file = zip_entry->GetDecompressionStream();
 		patch_file->read(entry.buffer.data(), entry.buffer.size());
-		
+
+		// Projects saved by newer versions store the patch data pre-deflated.
+		auto encoding = patch_json.find("encoding");
+		if(encoding != patch_json.end() && encoding.value() == "deflate") {
+			entry.buffer = inflate_patch_buffer(
+				entry.buffer, patch_json.find("size").value().operator std::size_t());
+		}
+
 		result.push_back(entry);
 	}
 	
@@ -286,7 +661,13 @@ std::map<std::size_t, std::unique_ptr<wad_stream>> iso_stream::read_wad_streams(
 			
 			std::vector<char> buffer(bin_entry->GetSize());
 			patch_file->read(buffer.data(), buffer.size());
-			
+
+			auto encoding = patch_json.value().find("encoding");
+			if(encoding != patch_json.value().end() && encoding.value() == "deflate") {
+				buffer = inflate_patch_buffer(
+					buffer, patch_json.value().find("size").value().operator std::size_t());
+			}
+
 			wad_patches.emplace_back();
 			wad_patches.back().offset = patch_json.value()["offset"];
 			wad_patches.back().buffer = buffer;
@@ -300,6 +681,55 @@ std::map<std::size_t, std::unique_ptr<wad_stream>> iso_stream::read_wad_streams(
 	return result;
 }
 
+// Copy one file over another, as cheaply as the OS allows. Where the
+// filesystem supports it (btrfs, XFS) the copy is a reflink, which is instant
+// and shares extents with the source until sectors are overwritten, so a new
+// project doesn't double our disk footprint or sit copying 4 GB. Failing
+// that, copy_file_range keeps the bulk copy inside the kernel instead of
+// bouncing every block through a userspace buffer. Anywhere else, a regular
+// copy.
+static void clone_or_copy_file(const std::string& src_path, const std::string& dest_path) {
+#ifdef __linux__
+	int src = open(src_path.c_str(), O_RDONLY);
+	if(src != -1) {
+		int dest = open(dest_path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(dest != -1) {
+			int result = ioctl(dest, FICLONE, src);
+			if(result == 0) {
+				close(dest);
+				close(src);
+				return;
+			}
+
+			// The filesystem can't reflink (EOPNOTSUPP/EXDEV). Try a
+			// kernel-side copy instead.
+			off_t size = lseek(src, 0, SEEK_END);
+			lseek(src, 0, SEEK_SET);
+			ssize_t copied = 0;
+			while(copied < size) {
+				ssize_t chunk = copy_file_range(src, nullptr, dest, nullptr, size - copied, 0);
+				if(chunk <= 0) {
+					break;
+				}
+				copied += chunk;
+			}
+			close(dest);
+			close(src);
+			if(copied == size) {
+				return;
+			}
+			// copy_file_range isn't supported either (old kernel, or the
+			// paths straddle filesystems on an old one). Clean up the partial
+			// file and fall through to a plain copy.
+			fs::remove(dest_path);
+		} else {
+			close(src);
+		}
+	}
+#endif
+	fs::copy(src_path, dest_path, fs::copy_options::overwrite_existing);
+}
+
 std::string iso_stream::init_cache(std::string iso_path, worker_logger& log) {
 	fs::create_directory("cache");
 
@@ -326,7 +756,7 @@ std::string iso_stream::init_cache(std::string iso_path, worker_logger& log) {
 		// The cache is invalid.
 		fs::remove(_cache_iso_path);
 		fs::remove(_cache_meta_path);
-		fs::copy(iso_path, _cache_iso_path);
+		clone_or_copy_file(iso_path, _cache_iso_path);
 
 		// Fixes a problem where if the original level file was read-only the
 		// cache would also be made read only, causing the project creation
@@ -392,26 +822,63 @@ void iso_stream::update_cache_metadata() {
 }
 
 void iso_stream::write_normal_patches(file_stream* cache_iso) {
+	// The patches have to be replayed in history order - later ones may
+	// overwrite earlier ones - but segment commits land as long runs of
+	// adjacent blocks, so merge each contiguous run into a single write
+	// instead of seeking per patch.
+	std::vector<char> run;
+	std::size_t run_offset = 0;
+	auto flush_run = [&]() {
+		if(run.size() > 0) {
+			cache_iso->seek(run_offset);
+			cache_iso->write_n(run.data(), run.size());
+			run.clear();
+		}
+	};
 	for(patch& p : _patches) {
-		cache_iso->seek(p.offset);
-		cache_iso->write_n(p.buffer.data(), p.buffer.size());
+		if(run.size() == 0 || p.offset != run_offset + run.size()) {
+			flush_run();
+			run_offset = p.offset;
+		}
+		run.insert(run.end(), p.buffer.begin(), p.buffer.end());
+		// Don't let a multi-segment commit balloon the scratch buffer - the
+		// batching has long since paid for itself by this point.
+		if(run.size() >= 16 * 1024 * 1024) {
+			std::size_t next_offset = run_offset + run.size();
+			flush_run();
+			run_offset = next_offset;
+		}
 	}
+	flush_run();
 }
 
 std::string iso_stream::hash_patches() {
-	MD5_CTX ctx;
-	MD5Init(&ctx);
+	// This hash is only ever compared against one we generated ourselves to
+	// decide whether the cache is stale, so use the fast hash rather than MD5.
+	// Finalisation mutates the context, so finalise a copy and keep the
+	// running digest intact for the next patch.
+	XXH64_CTX ctx = _patch_hash;
+	return int_to_hex(XXH64Final(&ctx));
+}
 
-	for(patch& p : _patches) {
-		MD5Update(&ctx, reinterpret_cast<uint8_t*>(&p.offset), 4);
-		std::size_t size = p.buffer.size();
-		MD5Update(&ctx, reinterpret_cast<uint8_t*>(&size), 4);
-		MD5Update(&ctx, reinterpret_cast<uint8_t*>(p.buffer.data()), p.buffer.size());
+std::string fast_hash_from_stream(stream& st) {
+	XXH64_CTX ctx;
+	XXH64Init(&ctx, 0);
+
+	static const std::size_t BLOCK_SIZE = 64 * 1024;
+	std::size_t file_size = st.size();
+
+	st.seek(0);
+
+	std::vector<uint8_t> block(BLOCK_SIZE);
+	for(std::size_t i = 0; i < file_size / BLOCK_SIZE; i++) {
+		st.read_n((char*) block.data(), BLOCK_SIZE);
+		XXH64Update(&ctx, block.data(), BLOCK_SIZE);
 	}
+	st.read_n((char*) block.data(), file_size % BLOCK_SIZE);
+	XXH64Update(&ctx, block.data(), file_size % BLOCK_SIZE);
 
-	uint8_t digest[MD5_DIGEST_LENGTH];
-	MD5Final(digest, &ctx);
-	return md5_to_printable_string(digest);
+	return int_to_hex(XXH64Final(&ctx));
 }
 
 std::string md5_from_stream(stream& st) {
@@ -19,11 +19,13 @@
 #ifndef ISO_STREAM_H
 #define ISO_STREAM_H
 
+#include <mutex>
 #include <nlohmann/json.hpp>
 #include <ZipLib/ZipArchive.h>
 #include <ZipLib/ZipFile.h>
 
 #include "stream.h"
+#include "xxhash.h"
 #include "worker_logger.h"
 
 # /*
@@ -34,6 +36,17 @@
 class simple_wad_stream : public array_stream {
 public:
 	simple_wad_stream(stream* backing, size_t offset);
+	// Creates an empty stream for the caller to decompress into (see
+	// level::read, which inflates its segments on different threads).
+	simple_wad_stream(stream* backing);
+	~simple_wad_stream();
+
+	// Update the LEVEL_SEGMENTS memory counter to reflect the current buffer
+	// size. Called after the buffer is (re)filled.
+	void retrack();
+
+private:
+	std::size_t _tracked_bytes = 0;
 };
 
 // All code below this point is obsolete and should be removed at some point.
@@ -55,10 +68,19 @@ struct wad_patch {
 
 class iso_stream;
 
+// A copy of a dirty WAD segment's uncompressed content, taken on the GUI
+// thread so that recompression can run on a worker without racing against
+// further edits. See iso_stream::begin_commit/finish_commit.
+struct wad_commit_snapshot {
+	std::size_t offset;
+	array_stream uncompressed;
+};
+
 class wad_stream : public stream {
 	friend iso_stream;
 public:
 	wad_stream(iso_stream* backing, std::size_t offset, std::vector<wad_patch> patches);
+	~wad_stream();
 
 	std::size_t size() const override;
 	void seek(std::size_t offset) override;
@@ -66,19 +88,40 @@ public:
  	void read_n(char* dest, std::size_t size) override;
 	void write_n(const char* data, std::size_t size) override;
 	std::string resource_path() const override;
-	
-	void commit();
+	const char* map_n(std::size_t offset, std::size_t size) override;
+
+	// If the segment needs recompressing, mark it clean and return a copy of
+	// its content for the committer, otherwise return an empty optional.
+	std::optional<array_stream> take_commit_snapshot();
 
 	// We don't want to recompress some WAD segments right now for speed.
 	// This is the switch for that.
 	bool discard = false;
 
 private:
+	// Read the stock segment out of the source ISO, decompress it and apply
+	// the patch list on top. Called from the constructor and when the stream
+	// is touched again after being evicted.
+	void inflate();
+	void ensure_inflated();
+
+	// Drop the decompressed buffer to free memory. Only valid for clean
+	// streams; the content comes back via inflate on the next access.
+	void evict();
+
 	iso_stream* _backing;
 	std::size_t _offset;
 	array_stream _uncompressed_buffer;
 	std::vector<wad_patch> _wad_patches;
 	bool _dirty; // Does the segment need to be recompressed?
+	// Hash of the uncompressed buffer as of the last commit, so a segment
+	// whose bytes ended up back where they started (e.g. undone edits) isn't
+	// recompressed again.
+	std::string _last_committed_hash;
+	bool _evicted = false;
+	uint64_t _last_used = 0; // For LRU eviction, see evict_lru_wad_streams.
+	// How many bytes this stream has reported to the memory tracker.
+	std::size_t _tracked_bytes = 0;
 };
 
 class iso_stream : public stream {
@@ -98,20 +141,51 @@ public:
 
 	std::string cached_iso_path() const;
 
+	// Build a playable ISO at the given path by cloning the source ISO (a
+	// reflink or kernel-side copy where the OS supports it) and then writing
+	// only the patched regions on top. Almost all sectors are untouched in a
+	// typical project, so this is much faster than streaming the whole image
+	// through userspace.
+	void export_iso(std::string dest_path);
+
+	// Path under the cache directory for data derived from this ISO, e.g.
+	// decoded textures. The name bakes in the patch hash, so editing anything
+	// invalidates caches written under the old name.
+	std::string derived_cache_path(std::string name);
+
+	// Replay the read schedule recorded by the previous session on a worker
+	// thread to warm the OS page cache. Cold opens are latency bound on
+	// synchronous small reads that are entirely predictable from the last
+	// open, so touching the same ranges ahead of the parsers hides most of it.
+	void start_readahead();
+
+	// Write out the ranges read so far for start_readahead to replay next
+	// time. Called once the project has opened successfully.
+	void save_readahead_schedule();
+
 	// Save patches to .wrench file.
 	void save_patches_to_and_close(ZipArchive::Ptr& root, std::string project_path);
 
 	// Decompress a WAD segment. Register the stream so that the segment can be
 	// automatically recompressed when changes need to be commited to the cache.
 	wad_stream* get_decompressed(std::size_t offset, bool discard = false);
-	
+
 	// Recompress all open WAD segments.
 	void commit();
 
+	// Split-phase commit for background saves: begin_commit snapshots the
+	// dirty segments (cheap, call it on the thread that owns the streams),
+	// finish_commit does the recompression and may run on a worker.
+	std::vector<wad_commit_snapshot> begin_commit();
+	void finish_commit(std::vector<wad_commit_snapshot>& snapshots);
+
 	file_stream _iso;
 	
 private:
 
+	// Body of write_n for callers that already hold _write_mutex.
+	void write_n_locked(const char* data, std::size_t size, bool save_to_project);
+
 	std::vector<patch> read_patches(ZipArchive::Ptr root);
 	std::map<std::size_t, std::unique_ptr<wad_stream>> read_wad_streams(ZipArchive::Ptr root);
 
@@ -121,6 +195,11 @@ private:
 	// Remove all patches from the cache ISO (does not affect metadata).
 	void clear_cache_iso(file_stream* cache_iso); // May be called before _cache is initialised.
 
+	// Keep the total size of decompressed wad_stream buffers under the
+	// configured budget by evicting the least recently used clean ones, so
+	// browsing lots of levels in one session doesn't grow memory forever.
+	void evict_lru_wad_streams();
+
 	// Write a hash of the current patches and the ranges that were patched
 	// out to a file.
 	void update_cache_metadata();
@@ -131,14 +210,41 @@ private:
 	// Generate a hash based on _patches.
 	std::string hash_patches();
 
+	// Append a range to _recorded_reads, see save_readahead_schedule.
+	void record_read(std::size_t offset, std::size_t size);
+
+	std::string _iso_path; // Path of the unmodified source ISO.
 	std::vector<patch> _patches;
+	// Running digest over _patches. The patch list is append only, so the
+	// digest can be maintained as patches are added instead of hash_patches
+	// re-hashing every buffer written this session.
+	XXH64_CTX _patch_hash;
 	std::map<std::size_t, std::unique_ptr<wad_stream>> _wad_streams;
+	uint64_t _wad_use_counter = 0;
 
+	std::string _game_id;
 	std::string _cache_iso_path;
 	std::string _cache_meta_path;
+	std::string _readahead_path;
+	// Read ranges recorded this session, in read order. Each read only
+	// coalesces against the last range (most reads are sequential), the rest
+	// is sorted out when the schedule is saved. Guarded by a mutex since
+	// levels are parsed on worker threads.
+	std::vector<trace_stream_range> _recorded_reads;
+	std::mutex _recorded_reads_mutex;
+	// Serialises all _cache access between the GUI thread and background
+	// commits - reads included, since editing (and so reading the ISO)
+	// continues while a commit rewrites segments on a worker. Mutable so the
+	// const accessors (tell, size) can take it too.
+	mutable std::mutex _write_mutex;
 	file_stream _cache; // Must be initialised last.
 };
 
+// Fingerprint a whole stream with XXH64. For cache keys and the like where
+// the collision resistance of md5_from_stream isn't needed. Identification
+// hashes stored in user configs and project files stay MD5.
+std::string fast_hash_from_stream(stream& st);
+
 std::string md5_from_stream(stream& st);
 
 #endif
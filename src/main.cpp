@@ -59,15 +59,27 @@ int main(int argc, char** argv) {
 	
 	{
 		app a;
+
+		auto startup_begin = std::chrono::steady_clock::now();
 		init_gl(a);
+		auto gl_ready = std::chrono::steady_clock::now();
 
 		if(project_path != "") {
 			a.open_project((old_working_dir / project_path).string());
 		}
-		
+
 		a.tools = enumerate_tools();
 		a.game_db = gamedb_read();
-		
+		auto data_ready = std::chrono::steady_clock::now();
+
+		auto phase_ms = [](auto from, auto to) {
+			return std::chrono::duration_cast<std::chrono::milliseconds>(to - from).count();
+		};
+		printf("[startup] gl init %ldms, tools/gamedb %ldms, total %ldms\n",
+			phase_ms(startup_begin, gl_ready),
+			phase_ms(gl_ready, data_ready),
+			phase_ms(startup_begin, data_ready));
+
 		a.windows.emplace_back(std::make_unique<view_3d>());
 		a.windows.emplace_back(std::make_unique<gui::texture_browser>());
 		a.windows.emplace_back(std::make_unique<gui::model_browser>());
@@ -77,12 +89,40 @@ int main(int argc, char** argv) {
 
 		auto last_frame_time = std::chrono::steady_clock::now();
 
+		// Counts down after the last input so ImGui gets a few frames to settle
+		// fades and layout. Once it hits zero the loop goes event driven.
+		int active_frames = 4;
+
 		while(!glfwWindowShouldClose(a.glfw_window)) {
-			glfwPollEvents();
+			if(active_frames > 0) {
+				glfwPollEvents();
+			} else {
+				// Nothing is happening, so sleep until an event arrives instead
+				// of spinning at the swap interval. The timeout is a safety net
+				// so a missed wakeup only ever stalls the GUI briefly.
+				glfwWaitEventsTimeout(0.5);
+			}
 			update_camera(&a);
 
 			gui::render(a);
 
+			// Stream queued texture uploads onto the GPU, and keep rendering
+			// at full rate until they're done.
+			bool uploads_pending = false;
+			if(auto project = a.get_project()) {
+				uploads_pending = project->upload_step();
+			}
+
+			bool window_busy = false;
+			for(auto& window : a.windows) {
+				window_busy |= window.get() != nullptr && window->is_busy();
+			}
+			if(gui::input_active() || a.renderer.camera_control || window_busy || uploads_pending) {
+				active_frames = 4;
+			} else if(active_frames > 0) {
+				active_frames--;
+			}
+
 			ImGui::Render();
 			glfwMakeContextCurrent(a.glfw_window);
 			glfwGetFramebufferSize(a.glfw_window, &a.window_width, &a.window_height);
@@ -0,0 +1,39 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "memory_tracker.h"
+
+#include <atomic>
+
+static std::atomic<std::int64_t> usage[(std::size_t) mem_tag::COUNT];
+
+void mem_track(mem_tag tag, std::int64_t delta) {
+	usage[(std::size_t) tag] += delta;
+}
+
+std::int64_t mem_usage(mem_tag tag) {
+	return usage[(std::size_t) tag];
+}
+
+const char* mem_tag_name(mem_tag tag) {
+	switch(tag) {
+		case mem_tag::WAD_SEGMENTS:   return "WAD segments";
+		case mem_tag::LEVEL_SEGMENTS: return "Level segments";
+		default:                      return "???";
+	}
+}
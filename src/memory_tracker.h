@@ -0,0 +1,44 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef MEMORY_TRACKER_H
+#define MEMORY_TRACKER_H
+
+#include <cstdint>
+#include <cstddef>
+
+# /*
+# 	Tagged accounting for the big allocations, so the memory window in the
+# 	GUI can attribute our RSS to subsystems. Only the heavyweight owners are
+# 	instrumented - decompressed WAD segments and the like - cheap incidental
+# 	allocations aren't worth tagging. Stuff that's awkward to hook (shared
+# 	texture buffers, say) gets measured on demand by the window instead.
+# */
+
+enum class mem_tag {
+	WAD_SEGMENTS,   // wad_stream uncompressed buffers.
+	LEVEL_SEGMENTS, // simple_wad_stream buffers: world, asset and texture segments.
+	COUNT
+};
+
+// Thread safe. Pass a negative delta when freeing.
+void mem_track(mem_tag tag, std::int64_t delta);
+std::int64_t mem_usage(mem_tag tag);
+const char* mem_tag_name(mem_tag tag);
+
+#endif
@@ -22,19 +22,32 @@
 
 model::model()
 	: _vertex_buffer(0),
-	  _vertex_buffer_size(0) {}
+	  _vertex_buffer_size(0),
+	  _index_buffer(0),
+	  _index_buffer_size(0) {}
 
 model::model(model&& rhs)
 	: _vertex_buffer(rhs._vertex_buffer),
-	  _vertex_buffer_size(rhs._vertex_buffer_size) {
+	  _vertex_buffer_size(rhs._vertex_buffer_size),
+	  _index_buffer(rhs._index_buffer),
+	  _index_buffer_size(rhs._index_buffer_size) {
 	rhs._vertex_buffer = 0;
 	rhs._vertex_buffer_size = 0;
+	rhs._index_buffer = 0;
+	rhs._index_buffer_size = 0;
 }
 
 model::~model() {
 	if(_vertex_buffer != 0) {
 		glDeleteBuffers(1, &_vertex_buffer);
 	}
+	if(_index_buffer != 0) {
+		glDeleteBuffers(1, &_index_buffer);
+	}
+}
+
+std::vector<uint32_t> model::indices() const {
+	return {};
 }
 
 void model::update() {
@@ -44,7 +57,12 @@ void model::update() {
 	}
 	
 	glDeleteBuffers(1, &_vertex_buffer);
-	
+	if(_index_buffer != 0) {
+		glDeleteBuffers(1, &_index_buffer);
+		_index_buffer = 0;
+		_index_buffer_size = 0;
+	}
+
 	std::vector<float> vertex_data;
 	std::vector<float> vertex_color_data;
 	try {
@@ -64,6 +82,17 @@ void model::update() {
 		_vertex_buffer_size * sizeof(float),
 		vertex_data.data(), GL_STATIC_DRAW);
 
+	std::vector<uint32_t> index_data = indices();
+	if(index_data.size() > 0) {
+		_index_buffer_size = index_data.size();
+		glGenBuffers(1, &_index_buffer);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, _index_buffer);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER,
+			_index_buffer_size * sizeof(uint32_t),
+			index_data.data(), GL_STATIC_DRAW);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+
 	try {
 		vertex_color_data = colors();
 	}
@@ -97,3 +126,11 @@ GLuint model::vertex_color_buffer() const {
 std::size_t model::vertex_color_buffer_size() const {
 	return _vertex_color_buffer_size;
 }
+
+GLuint model::index_buffer() const {
+	return _index_buffer;
+}
+
+std::size_t model::index_buffer_size() const {
+	return _index_buffer_size;
+}
@@ -21,6 +21,7 @@
 
 #include <array>
 #include <vector>
+#include <stdint.h>
 
 #include "gl_includes.h"
 
@@ -37,20 +38,27 @@ public:
 
 	virtual std::vector<float> triangles() const = 0;
 	virtual std::vector<float> colors() const = 0;
-	
+	// Element indices into triangles()/colors(). If this returns an empty
+	// list (the default), the model is drawn as unindexed triangle soup.
+	virtual std::vector<uint32_t> indices() const;
+
 	// Read the model data, load it into a OpenGL buffer. Only call from main thread!
 	void update();
-	
+
 	GLuint vertex_buffer() const;
 	std::size_t vertex_buffer_size() const;
 	GLuint vertex_color_buffer() const;
 	std::size_t vertex_color_buffer_size() const;
-	
+	GLuint index_buffer() const; // Zero if the model is unindexed.
+	std::size_t index_buffer_size() const;
+
 private:
 	GLuint _vertex_buffer;
 	std::size_t _vertex_buffer_size;
 	GLuint _vertex_color_buffer;
 	std::size_t _vertex_color_buffer_size;
+	GLuint _index_buffer;
+	std::size_t _index_buffer_size;
 };
 
 #endif
@@ -18,6 +18,7 @@
 
 #include "project.h"
 
+#include <algorithm>
 #include <ZipLib/ZipArchive.h>
 #include <ZipLib/ZipFile.h>
 
@@ -25,11 +26,26 @@
 #include "gui.h"
 #include "config.h"
 #include "fs_includes.h"
+#include "thread_pool.h"
+#include "worker_thread.h"
+#include "memory_tracker.h"
 #include "formats/texture_archive.h"
 
 // This is true for R&C2 and R&C3.
 static const std::size_t TOC_BASE = 0x1f4800;
 
+// The cache path encodes the game and the hash of the applied patches, so a
+// stale TOC can never be picked up after the ISO is modified.
+static table_of_contents read_toc_cached(iso_stream& iso, std::size_t toc_base) {
+	std::string path = iso.derived_cache_path("toc.bin");
+	if(auto cached = toc_read_cache(path, toc_base)) {
+		return std::move(*cached);
+	}
+	table_of_contents toc = read_toc(iso, toc_base);
+	toc_write_cache(path, toc_base, toc);
+	return toc;
+}
+
 wrench_project::wrench_project(
 		game_iso game_,
 		worker_logger& log)
@@ -40,8 +56,9 @@ wrench_project::wrench_project(
 	  _selected_level(nullptr),
 	  _id(_next_id++),
 	  iso(game.md5, game.path, log),
-	  toc(read_toc(iso, TOC_BASE)) {
+	  toc(read_toc_cached(iso, TOC_BASE)) {
 	load_tables();
+	iso.save_readahead_schedule();
 }
 
 wrench_project::wrench_project(
@@ -54,20 +71,33 @@ wrench_project::wrench_project(
 	  _history_index(0),
 	  _id(_next_id++),
 	  iso(game.md5, game.path, log, _wrench_archive),
-	  toc(read_toc(iso, TOC_BASE)) {
+	  toc(read_toc_cached(iso, TOC_BASE)) {
 	ZipFile::SaveAndClose(_wrench_archive, project_path);
 	_wrench_archive = nullptr;
 	load_tables();
+	iso.save_readahead_schedule();
 }
 
 void wrench_project::post_load() {
+	// Just queue the uploads - upload_step streams them onto the GPU a batch
+	// per frame, so the editor is interactive as soon as the worker finishes.
 	for(auto& [_, armor] : _armor) {
 		for(texture& tex : armor.textures) {
-			tex.upload_to_opengl();
+			_pending_uploads.push_back(&tex);
 		}
 	}
 }
 
+bool wrench_project::upload_step() {
+	static const std::size_t UPLOADS_PER_FRAME = 16;
+	std::size_t count = std::min(UPLOADS_PER_FRAME, _pending_uploads.size());
+	for(std::size_t i = 0; i < count; i++) {
+		_pending_uploads[_pending_uploads.size() - 1 - i]->upload_to_opengl();
+	}
+	_pending_uploads.resize(_pending_uploads.size() - count);
+	return _pending_uploads.size() > 0;
+}
+
 std::string wrench_project::project_path() const {
 	return _project_path;
 }
@@ -156,10 +186,41 @@ std::map<std::string, model_list> wrench_project::model_lists(app* a) {
 	return result;
 }
 
-void wrench_project::push_command(std::function<void()> apply, std::function<void()> undo) {
+void wrench_project::push_command(std::function<void()> apply, std::function<void()> undo, uint64_t coalesce_key) {
+	auto now = std::chrono::steady_clock::now();
+
+	// Merging keeps the undo closure from the start of the gesture, which
+	// captured the state everything after it overwrote, and composes the
+	// apply closures so redo replays the whole gesture. Coalescing never
+	// reaches across an undo since the branch point resets the stack top.
+	bool coalesce =
+		coalesce_key != 0 &&
+		_history_index == _history_stack.size() &&
+		_history_stack.size() > 0 &&
+		_history_stack.back().coalesce_key == coalesce_key &&
+		now - _last_push_time < std::chrono::seconds(1);
+	_last_push_time = now;
+	if(coalesce) {
+		undo_redo_command& last = _history_stack.back();
+		last.apply = [first = std::move(last.apply), apply]() {
+			first();
+			apply();
+		};
+		apply();
+		return;
+	}
+
 	_history_stack.resize(_history_index++);
-	_history_stack.emplace_back(undo_redo_command { apply, undo });
+	_history_stack.emplace_back(undo_redo_command { apply, undo, coalesce_key });
 	apply();
+
+	// Bound the history so the closures (and the entity state they capture)
+	// from a long editing session can't pile up without limit.
+	static const std::size_t MAX_UNDO_HISTORY = 256;
+	if(_history_stack.size() > MAX_UNDO_HISTORY) {
+		_history_stack.erase(_history_stack.begin());
+		_history_index--;
+	}
 }
 
 void wrench_project::undo() {
@@ -185,14 +246,157 @@ void wrench_project::clear_undo_history() {
 
 void wrench_project::open_level(std::size_t index) {
 	if(_levels.find(index) == _levels.end()) {
-		// The level is not already open.
-		auto lvl = std::make_unique<level>();
-		toc_level& header = toc.levels[index];
-		sector32 base_offset = iso.read<sector32>(header.main_part.bytes() + 4);
-		lvl->read(&iso, header, header.main_part.bytes(), base_offset, base_offset, header.main_part_size.bytes());
-		_levels.emplace(index, std::move(lvl));
+		// The level is not already open. Claim a preloaded copy if a worker
+		// got there first, otherwise parse it here and now.
+		std::unique_ptr<level> preloaded;
+		{
+			std::lock_guard<std::mutex> guard(_preloads->mutex);
+			auto iter = _preloads->ready.find(index);
+			if(iter != _preloads->ready.end()) {
+				preloaded = std::move(iter->second);
+				_preloads->ready.erase(iter);
+			}
+		}
+		if(preloaded != nullptr) {
+			_levels.emplace(index, std::move(preloaded));
+		} else {
+			auto lvl = std::make_unique<level>();
+			toc_level& header = toc.levels[index];
+			sector32 base_offset = iso.read<sector32>(header.main_part.bytes() + 4);
+			lvl->read(&iso, header, header.main_part.bytes(), base_offset, base_offset, header.main_part_size.bytes());
+			_levels.emplace(index, std::move(lvl));
+		}
 	}
 	_selected_level = _levels.at(index).get();
+	preload_adjacent_levels(index);
+}
+
+void wrench_project::preload_adjacent_levels(std::size_t index) {
+	std::vector<std::size_t> candidates;
+	if(index > 0) {
+		candidates.push_back(index - 1);
+	}
+	if(index + 1 < toc.levels.size()) {
+		candidates.push_back(index + 1);
+	}
+
+	// Don't start reading the cache ISO while a commit is rewriting it - the
+	// worker would parse torn data. The next open_level will try again.
+	if(_preloads->commit_in_flight) {
+		return;
+	}
+
+	std::lock_guard<std::mutex> guard(_preloads->mutex);
+
+	// Drop preloads the user has hopped away from, so at most two parsed
+	// levels sit in memory ahead of use.
+	for(auto iter = _preloads->ready.begin(); iter != _preloads->ready.end();) {
+		bool wanted = std::find(candidates.begin(), candidates.end(), iter->first) != candidates.end();
+		if(wanted) {
+			iter++;
+		} else {
+			iter = _preloads->ready.erase(iter);
+		}
+	}
+
+	for(std::size_t candidate : candidates) {
+		if(_levels.find(candidate) != _levels.end() ||
+				_preloads->ready.find(candidate) != _preloads->ready.end() ||
+				_preloads->in_flight.find(candidate) != _preloads->in_flight.end()) {
+			continue;
+		}
+
+		// Reuse the WAD cache budget as the cap here - if the open levels
+		// have already spent it there's no headroom for speculative ones.
+		std::int64_t budget = (std::int64_t) config::get().wad_cache_budget_mb * 1024 * 1024;
+		if(mem_usage(mem_tag::LEVEL_SEGMENTS) > budget) {
+			break;
+		}
+
+		_preloads->in_flight.insert(candidate);
+		std::shared_ptr<level_preloads> preloads = _preloads;
+		std::string path = iso.cached_iso_path();
+		toc_level header = toc.levels[candidate];
+		thread_pool::shared().post([preloads, candidate, header, path]() {
+			auto lvl = std::make_unique<level>();
+			if(preloads->commit_in_flight) {
+				lvl = nullptr;
+			} else {
+				try {
+					// Read through a private stream - iso isn't thread safe
+					// and the GUI thread is still using it.
+					file_stream backing(path);
+					sector32 base_offset = backing.read<sector32>(header.main_part.bytes() + 4);
+					lvl->read(&backing, header, header.main_part.bytes(), base_offset, base_offset, header.main_part_size.bytes());
+				} catch(std::exception& err) {
+					// A failed preload just means the next hop is slow again.
+					fprintf(stderr, "warning: Failed to preload level %zu: %s\n", candidate, err.what());
+					lvl = nullptr;
+				} catch(...) {
+					fprintf(stderr, "warning: Failed to preload level %zu.\n", candidate);
+					lvl = nullptr;
+				}
+			}
+			std::lock_guard<std::mutex> guard(preloads->mutex);
+			preloads->in_flight.erase(candidate);
+			// If a commit started while we were reading, the parse may have
+			// seen a half-rewritten segment - throw it away.
+			if(lvl != nullptr && !preloads->commit_in_flight) {
+				preloads->ready.emplace(candidate, std::move(lvl));
+			}
+		});
+	}
+}
+
+string_index* wrench_project::string_search_index() {
+	std::lock_guard<std::mutex> guard(_string_index->mutex);
+	if(_string_index->index) {
+		return &(*_string_index->index);
+	}
+	if(_string_index->started) {
+		return nullptr; // Still building.
+	}
+	_string_index->started = true;
+
+	std::shared_ptr<string_index_build> build = _string_index;
+	std::string cache_path = iso.derived_cache_path("string_index.bin");
+	std::string iso_path = iso.cached_iso_path();
+	std::vector<toc_level> levels = toc.levels;
+	thread_pool::shared().post([build, cache_path, iso_path, levels]() {
+		if(auto cached = string_index::read(cache_path)) {
+			std::lock_guard<std::mutex> guard(build->mutex);
+			build->index.emplace(std::move(*cached));
+			return;
+		}
+
+		// Parsing a whole level to index its string tables is wasteful, but
+		// this only runs once per patch hash - every session after that reads
+		// the cache file above.
+		string_index index;
+		for(std::size_t i = 0; i < levels.size(); i++) {
+			try {
+				const toc_level& header = levels[i];
+				file_stream backing(iso_path);
+				sector32 base_offset = backing.read<sector32>(header.main_part.bytes() + 4);
+				level lvl;
+				lvl.read(&backing, header, header.main_part.bytes(), base_offset, base_offset, header.main_part_size.bytes());
+				for(std::size_t lang = 0; lang < LANGUAGE_COUNT; lang++) {
+					for(const game_string& str : lvl.world.languages[lang]) {
+						index.add(i, lang, str.id, lvl.world.strings.c_str(str.offset), str.size);
+					}
+				}
+			} catch(...) {
+				// A level that fails to parse just doesn't show up in search
+				// results.
+			}
+		}
+		index.write(cache_path);
+
+		std::lock_guard<std::mutex> guard(build->mutex);
+		build->index.emplace(std::move(index));
+	});
+
+	return nullptr;
 }
 
 int wrench_project::id() {
@@ -218,28 +422,82 @@ void wrench_project::save() {
 	iso.save_patches_to_and_close(root, _project_path);
 }
 
+void wrench_project::save_async(app* a) {
+	if(_lock_save) {
+		return;
+	}
+	_lock_save = true;
+	_preloads->commit_in_flight = true;
+
+	// Copy out the dirty WAD segments on this thread so the worker doesn't
+	// race against edits made while the save is running.
+	auto snapshots = std::make_shared<std::vector<wad_commit_snapshot>>(iso.begin_commit());
+
+	a->emplace_window<worker_thread<int, int>>(
+		"Save Project", 0,
+		[this, snapshots](int, worker_logger& log) {
+			try {
+				iso.finish_commit(*snapshots);
+				save();
+				log << "\nProject saved successfully.";
+				_preloads->commit_in_flight = false;
+				_lock_save = false;
+				return std::make_optional(0);
+			} catch(stream_error& err) {
+				log << err.what() << "\n";
+				log << err.stack_trace();
+			}
+			_preloads->commit_in_flight = false;
+			_lock_save = false;
+			return std::optional<int>();
+		},
+		[](int) {}
+	);
+}
+
+void wrench_project::commit_iso() {
+	_preloads->commit_in_flight = true;
+	try {
+		iso.commit();
+	} catch(...) {
+		_preloads->commit_in_flight = false;
+		throw;
+	}
+	_preloads->commit_in_flight = false;
+}
+
 /*
 	private
 */
 
 void wrench_project::load_tables() {
-	for(std::size_t i = 0; i < toc.tables.size(); i++) {
+	// The tables are independent and decoding the big texture ones dominates
+	// the wait after choosing an ISO, so spread them across the pool. Each
+	// worker reads through its own stream over the cache ISO - iso isn't
+	// thread safe and the armor models keep no pointers into the stream they
+	// were read from.
+	std::mutex tables_mutex;
+	std::string path = iso.cached_iso_path();
+	thread_pool::shared().parallel_for(toc.tables.size(), [&](std::size_t i) {
 		toc_table& table = toc.tables[i];
-		
+		file_stream backing(path);
+
 		armor_archive armor;
-		if(armor.read(iso._iso, table)) {
+		if(armor.read(backing, table)) {
+			std::lock_guard<std::mutex> guard(tables_mutex);
 			_armor.emplace(i, std::move(armor));
-			continue;
+			return;
 		}
-		
-		std::vector<texture> textures = enumerate_fip_textures(iso, table);
+
+		std::vector<texture> textures = enumerate_fip_textures(iso, backing, table);
 		if(textures.size() > 0) {
+			std::lock_guard<std::mutex> guard(tables_mutex);
 			_texture_wads[i] = std::move(textures);
-			continue;
+			return;
 		}
-		
+
 		fprintf(stderr, "warning: File at iso+0x%08lx ignored.\n", table.header.base_offset.bytes());
-	}
+	});
 }
 
 void wrench_project::load_gamedb_info(app* a) {
@@ -260,12 +518,37 @@ game_iso wrench_project::read_game_type(std::vector<game_iso> games) {
 	auto stream = entry->GetDecompressionStream();
 	std::string result;
 	std::getline(*stream, result);
-	std::optional<game_iso> game;
 	for(game_iso current : games) {
 		if(current.md5 == result) {
-			game = current;
-		} 
+			return current;
+		}
 	}
+
+	// None of the hashes stored in the config match, which can happen when an
+	// ISO has been modified since it was added to the settings. Re-hash the
+	// configured ISOs to see if one of them matches now. Hashing a whole ISO
+	// takes a while, so the candidates are spread across the pool - each
+	// worker opens its own file_stream since streams aren't thread safe - and
+	// the remaining workers bail out as soon as a match is found.
+	std::optional<game_iso> game;
+	std::mutex game_mutex;
+	std::atomic<bool> found = false;
+	thread_pool::shared().parallel_for(games.size(), [&](std::size_t i) {
+		if(found) {
+			return;
+		}
+		try {
+			file_stream iso(games[i].path);
+			if(md5_from_stream(iso) == result) {
+				std::lock_guard<std::mutex> guard(game_mutex);
+				game = games[i];
+				found = true;
+			}
+		} catch(stream_io_error&) {
+			// The ISO may have been moved or deleted out from under us. If it
+			// was the right one, the error below covers it.
+		}
+	});
 	if(!game) {
 		throw std::runtime_error("Unknown game hash!");
 	}
@@ -19,10 +19,15 @@
 #ifndef PROJECT_H
 #define PROJECT_H
 
+#include <set>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <ZipLib/ZipArchive.h>
 
 #include "game_db.h"
 #include "iso_stream.h"
+#include "string_index.h"
 #include "worker_logger.h"
 #include "formats/toc.h"
 #include "formats/racpak.h"
@@ -52,6 +57,7 @@ struct model_list {
 struct undo_redo_command {
 	std::function<void()> apply;
 	std::function<void()> undo;
+	uint64_t coalesce_key = 0; // Zero means never coalesce.
 };
 
 class wrench_project {
@@ -65,6 +71,11 @@ public:
 		worker_logger& log); // Open
 
 	void post_load(); // Called from main thread, used for OpenGL things.
+	// Upload a slice of the queued textures. Called once per frame from the
+	// main loop so a freshly opened project streams its textures onto the GPU
+	// over a few frames instead of hitching on one. Returns true if there is
+	// still work left.
+	bool upload_step();
 
 	std::string project_path() const;
 	void set_project_path(std::string project_path);
@@ -77,16 +88,43 @@ public:
 	std::map<std::string, std::vector<texture>*> texture_lists(app* a);
 	std::map<std::string, model_list> model_lists(app* a);
 	
-	void push_command(std::function<void()> apply, std::function<void()> undo);
+	// Commands pushed in quick succession with the same non-zero coalesce key
+	// are merged into a single history entry, so a continuous gesture (e.g.
+	// repeatedly tweaking the same spline vertex or inspector field) undoes in
+	// one step instead of one step per sub-edit.
+	void push_command(std::function<void()> apply, std::function<void()> undo, uint64_t coalesce_key = 0);
 	void undo();
 	void redo();
 	void clear_undo_history();
-	
+	// For the memory window. The closures can't be sized, only counted.
+	std::size_t undo_history_length() const { return _history_stack.size(); }
+
 	void open_level(std::size_t index);
-	
+
+	// Index over every level's string tables, for the search box in the string
+	// viewer. Kicks off a background build on first call and returns nullptr
+	// until it's done; once built it's cached on disk per patch hash, so
+	// subsequent sessions get it back without touching the levels.
+	string_index* string_search_index();
+
+	// Parse the levels either side of the given one on the worker pool, so
+	// hopping between adjacent levels is instant. Preloads read through their
+	// own stream over the cache ISO (iso isn't thread safe), are skipped when
+	// the level segment budget is already spent, and are dropped again once
+	// the user moves more than one level away.
+	void preload_adjacent_levels(std::size_t index);
+
 	int id();
 	
 	void save();
+	// Snapshot dirty WAD segments on the calling thread, then recompress and
+	// write the project archive on a worker so the GUI doesn't freeze. No-op
+	// if a background save is already in flight.
+	void save_async(app* a);
+	// Synchronous iso.commit() that also flags the commit to in-flight level
+	// preloads, which read the cache ISO through their own streams and must
+	// not parse it mid-rewrite.
+	void commit_iso();
 
 	armor_archive& armor() { return _armor.begin()->second; }
 
@@ -108,7 +146,34 @@ public: // Initialisation order matters.
 private:
 	std::size_t _history_index;
 	std::vector<undo_redo_command> _history_stack;
+	std::chrono::steady_clock::time_point _last_push_time;
 	
+	// Textures waiting to be uploaded to OpenGL by upload_step. Pointers into
+	// _armor, which doesn't change after load.
+	std::vector<texture*> _pending_uploads;
+
+	// Shared with the preload workers rather than owned outright, so closing
+	// the project while a preload is still parsing doesn't leave the worker
+	// writing into freed memory - the last holder just drops the state.
+	struct level_preloads {
+		std::mutex mutex;
+		std::map<std::size_t, std::unique_ptr<level>> ready;
+		std::set<std::size_t> in_flight;
+		// Set while a commit is rewriting the cache ISO. Preload workers read
+		// that file directly, so while this is set they bail out - or discard
+		// what they've read - rather than parse a half-rewritten segment.
+		std::atomic<bool> commit_in_flight { false };
+	};
+	std::shared_ptr<level_preloads> _preloads = std::make_shared<level_preloads>();
+
+	// Shared with the build worker for the same reason as _preloads.
+	struct string_index_build {
+		std::mutex mutex;
+		std::optional<string_index> index;
+		bool started = false;
+	};
+	std::shared_ptr<string_index_build> _string_index = std::make_shared<string_index_build>();
+
 	std::map<std::size_t, std::unique_ptr<racpak>> _archives;
 	std::map<std::size_t, std::vector<texture>> _texture_wads;
 	std::map<std::size_t, std::unique_ptr<level>> _levels;
@@ -119,6 +184,8 @@ private:
 	
 	int _id;
 	static int _next_id;
+
+	std::atomic_bool _lock_save = false;
 	
 public:
 	iso_stream iso;
@@ -18,26 +18,312 @@
 
 #include "renderer.h"
 
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
 #include "app.h"
 
+char* frame_arena::alloc(std::size_t size) {
+	// Keep everything 16 byte aligned so glm types are happy.
+	size = (size + 0xf) & ~(std::size_t) 0xf;
+
+	while(_current_block < _blocks.size() && _blocks[_current_block].used + size > _blocks[_current_block].size) {
+		_current_block++;
+	}
+	if(_current_block >= _blocks.size()) {
+		std::size_t block_size = std::max(size, (std::size_t) 64 * 1024);
+		_blocks.push_back({ std::make_unique<char[]>(block_size), block_size, 0 });
+	}
+
+	block& current = _blocks[_current_block];
+	char* result = current.bytes.get() + current.used;
+	current.used += size;
+	return result;
+}
+
+void frame_arena::reset() {
+	for(block& blk : _blocks) {
+		blk.used = 0;
+	}
+	_current_block = 0;
+}
+
+void render_queue::push(GLuint vertex_buffer, std::size_t vertex_count, const glm::mat4& mvp, const glm::vec4& colour) {
+	_records.push_back({ vertex_buffer, vertex_count, mvp, colour });
+}
+
+void render_queue::flush(const shader_programs& shaders) {
+	std::stable_sort(_records.begin(), _records.end(),
+		[](const record& lhs, const record& rhs) {
+			return lhs.vertex_buffer < rhs.vertex_buffer;
+		});
+
+	glUseProgram(shaders.solid_colour.id());
+	glEnableVertexAttribArray(0);
+
+	GLuint bound_buffer = 0;
+	for(const record& rec : _records) {
+		if(rec.vertex_buffer != bound_buffer) {
+			glBindBuffer(GL_ARRAY_BUFFER, rec.vertex_buffer);
+			glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 0, nullptr);
+			bound_buffer = rec.vertex_buffer;
+		}
+		glUniformMatrix4fv(shaders.solid_colour_transform, 1, GL_FALSE, &rec.mvp[0][0]);
+		glUniform4f(shaders.solid_colour_rgb, rec.colour.r, rec.colour.g, rec.colour.b, rec.colour.a);
+		glDrawArrays(GL_TRIANGLES, 0, rec.vertex_count);
+	}
+
+	glDisableVertexAttribArray(0);
+	_records.clear();
+}
+
+// Generous bounding radius for entities drawn as cubes or moby models. Erring
+// on the large side here only means drawing a few extra entities around the
+// edges of the screen.
+static const float ENTITY_CULL_RADIUS = 8.f;
+
+// An instance whose cull sphere would cover less than this fraction of the
+// viewport vertically gets the low detail index buffers. With the fixed 45
+// degree FOV the projected height of a sphere is roughly 2.4 * radius divided
+// by the clip space w of its centre, so this is a test against w.
+static const float MOBY_LOD_SCREEN_FRACTION = 0.05f;
+
 void gl_renderer::prepare_frame(level& lvl, glm::mat4 world_to_clip) {
-	moby_local_to_clip_cache.resize(lvl.world.mobies.size());
+	arena.reset();
+
+	// Extract the six frustum planes from the world to clip matrix
+	// (Gribb-Hartmann) so entities can be culled with four dot products each.
+	for(int i = 0; i < 3; i++) {
+		glm::vec4 row(world_to_clip[0][i], world_to_clip[1][i], world_to_clip[2][i], world_to_clip[3][i]);
+		glm::vec4 row_w(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3], world_to_clip[3][3]);
+		_frustum_planes[i * 2] = row_w + row;
+		_frustum_planes[i * 2 + 1] = row_w - row;
+	}
+
+	rasterise_occluders(lvl, world_to_clip);
+
+	// The matrices live in these densely packed arrays rather than in the
+	// entity structs themselves, so this pass reads a few hot fields per moby
+	// and writes sequentially instead of scattering over fat structs. Only
+	// the mobies that survive the frustum test get a clip matrix.
+	moby_local_to_world_cache.resize(lvl.world.mobies.size());
+	moby_visible_indices.clear();
+	moby_local_to_clip_cache.clear();
+	moby_lod_cache.clear();
+	occluded_moby_count = 0;
+	occluded_tie_count = 0;
+	occluded_shrub_count = 0;
 	for(std::size_t i = 0; i < lvl.world.mobies.size(); i++) {
 		moby_entity& moby = lvl.world.mobies[i];
-		moby.local_to_world_cache = glm::translate(glm::mat4(1.f), moby.position);
-		moby.local_to_world_cache = glm::rotate(moby.local_to_world_cache, moby.rotation.x, glm::vec3(1, 0, 0));
-		moby.local_to_world_cache = glm::rotate(moby.local_to_world_cache, moby.rotation.y, glm::vec3(0, 1, 0));
-		moby.local_to_world_cache = glm::rotate(moby.local_to_world_cache, moby.rotation.z, glm::vec3(0, 0, 1));
-		
-		moby.local_to_clip_cache = world_to_clip * moby.local_to_world_cache;
-		
-		glm::mat4& local_to_clip = moby_local_to_clip_cache[i];
-		local_to_clip = moby.local_to_clip_cache;
-		if(lvl.moby_class_to_model.find(moby.class_num) != lvl.moby_class_to_model.end()) {
-			moby_model& model = lvl.moby_models[lvl.moby_class_to_model.at(moby.class_num)];
+		glm::mat4 local_to_world = moby.local_to_world();
+		moby_local_to_world_cache[i] = local_to_world;
+
+		if(!test_frustum(moby.position, ENTITY_CULL_RADIUS)) {
+			continue;
+		}
+		if(test_occluded(moby.position, ENTITY_CULL_RADIUS)) {
+			occluded_moby_count++;
+			continue;
+		}
+		moby_visible_indices.push_back(i);
+
+		glm::mat4 local_to_clip = world_to_clip * local_to_world;
+		int32_t model_index = lvl.model_index_for_class(moby.class_num);
+		if(model_index > -1) {
+			moby_model& model = lvl.moby_models[model_index];
 			local_to_clip = glm::scale(local_to_clip, glm::vec3(model.scale * moby.scale * 32.f));
 		}
+		moby_local_to_clip_cache.push_back(local_to_clip);
+
+		float clip_w = local_to_clip[3].w;
+		if(clip_w * MOBY_LOD_SCREEN_FRACTION > 2.4f * ENTITY_CULL_RADIUS) {
+			moby_lod_cache.push_back(moby_lod::LOW);
+		} else {
+			moby_lod_cache.push_back(moby_lod::FULL);
+		}
+	}
+	culled_moby_count = lvl.world.mobies.size() - moby_visible_indices.size();
+
+	tie_visible_indices.clear();
+	for(std::size_t i = 0; i < lvl.world.ties.size(); i++) {
+		glm::vec3 position = lvl.world.ties[i].local_to_world[3];
+		if(!test_frustum(position, ENTITY_CULL_RADIUS)) {
+			continue;
+		}
+		if(test_occluded(position, ENTITY_CULL_RADIUS)) {
+			occluded_tie_count++;
+			continue;
+		}
+		tie_visible_indices.push_back(i);
+	}
+	culled_tie_count = lvl.world.ties.size() - tie_visible_indices.size();
+
+	shrub_visible_indices.clear();
+	for(std::size_t i = 0; i < lvl.world.shrubs.size(); i++) {
+		glm::vec3 position = lvl.world.shrubs[i].local_to_world[3];
+		if(!test_frustum(position, ENTITY_CULL_RADIUS)) {
+			continue;
+		}
+		if(test_occluded(position, ENTITY_CULL_RADIUS)) {
+			occluded_shrub_count++;
+			continue;
+		}
+		shrub_visible_indices.push_back(i);
 	}
+	culled_shrub_count = lvl.world.shrubs.size() - shrub_visible_indices.size();
+}
+
+bool gl_renderer::test_frustum(glm::vec3 position, float radius) const {
+	glm::vec4 pos(position, 1.f);
+	for(int i = 0; i < 6; i++) {
+		if(glm::dot(_frustum_planes[i], pos) < -radius * glm::length(glm::vec3(_frustum_planes[i]))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+// Below this w the rasteriser would have to clip triangles against the near
+// plane. Occluders and entities that get this close are just treated as
+// visible instead.
+static const float OCCLUSION_NEAR_W = 0.1f;
+
+void gl_renderer::rasterise_occluders(level& lvl, const glm::mat4& world_to_clip) {
+	_occlusion_ready = false;
+	if(!occlusion_culling) {
+		return;
+	}
+	model* terrain = lvl.tfrag_terrain();
+	if(terrain == nullptr) {
+		return;
+	}
+	if(terrain != _occluder_source) {
+		_occluder_triangles = terrain->triangles();
+		_occluder_source = terrain;
+	}
+	if(_occluder_triangles.size() < 9) {
+		return;
+	}
+
+	static const int W = OCCLUSION_BUFFER_WIDTH;
+	static const int H = OCCLUSION_BUFFER_HEIGHT;
+	_occlusion_buffer.assign(W * H, 0.f);
+	_occlusion_world_to_clip = world_to_clip;
+	// How much one world unit can move a point in clip x, y and w, for
+	// conservative sphere projection in test_occluded.
+	_occlusion_scale = glm::vec3(
+		glm::length(glm::vec3(world_to_clip[0][0], world_to_clip[1][0], world_to_clip[2][0])),
+		glm::length(glm::vec3(world_to_clip[0][1], world_to_clip[1][1], world_to_clip[2][1])),
+		glm::length(glm::vec3(world_to_clip[0][3], world_to_clip[1][3], world_to_clip[2][3])));
+
+	for(std::size_t i = 0; i + 9 <= _occluder_triangles.size(); i += 9) {
+		// Project the triangle. Triangles that reach behind the near plane
+		// would need clipping, so skip them - a missing occluder only ever
+		// means fewer entities get culled.
+		float xs[3], ys[3], inv_ws[3];
+		bool in_front = true;
+		for(int v = 0; v < 3; v++) {
+			glm::vec4 clip = world_to_clip * glm::vec4(
+				_occluder_triangles[i + v * 3],
+				_occluder_triangles[i + v * 3 + 1],
+				_occluder_triangles[i + v * 3 + 2], 1.f);
+			if(clip.w < OCCLUSION_NEAR_W) {
+				in_front = false;
+				break;
+			}
+			inv_ws[v] = 1.f / clip.w;
+			xs[v] = (clip.x * inv_ws[v] * 0.5f + 0.5f) * W;
+			ys[v] = (clip.y * inv_ws[v] * 0.5f + 0.5f) * H;
+		}
+		if(!in_front) {
+			continue;
+		}
+
+		// The terrain is drawn double sided, so flip wound-backwards triangles
+		// rather than culling them.
+		float area = (xs[1] - xs[0]) * (ys[2] - ys[0]) - (ys[1] - ys[0]) * (xs[2] - xs[0]);
+		if(area == 0.f) {
+			continue;
+		}
+		if(area < 0.f) {
+			std::swap(xs[1], xs[2]);
+			std::swap(ys[1], ys[2]);
+			std::swap(inv_ws[1], inv_ws[2]);
+			area = -area;
+		}
+
+		int min_x = std::max((int) std::min(std::min(xs[0], xs[1]), xs[2]), 0);
+		int max_x = std::min((int) std::max(std::max(xs[0], xs[1]), xs[2]), W - 1);
+		int min_y = std::max((int) std::min(std::min(ys[0], ys[1]), ys[2]), 0);
+		int max_y = std::min((int) std::max(std::max(ys[0], ys[1]), ys[2]), H - 1);
+
+		for(int y = min_y; y <= max_y; y++) {
+			for(int x = min_x; x <= max_x; x++) {
+				float px = x + 0.5f;
+				float py = y + 0.5f;
+				float e0 = (xs[2] - xs[1]) * (py - ys[1]) - (ys[2] - ys[1]) * (px - xs[1]);
+				float e1 = (xs[0] - xs[2]) * (py - ys[2]) - (ys[0] - ys[2]) * (px - xs[2]);
+				float e2 = (xs[1] - xs[0]) * (py - ys[0]) - (ys[1] - ys[0]) * (px - xs[0]);
+				if(e0 < 0.f || e1 < 0.f || e2 < 0.f) {
+					continue;
+				}
+				// 1/w interpolates linearly in screen space, so this is
+				// perspective correct. Bigger means closer.
+				float depth = (e0 * inv_ws[0] + e1 * inv_ws[1] + e2 * inv_ws[2]) / area;
+				float& texel = _occlusion_buffer[y * W + x];
+				if(depth > texel) {
+					texel = depth;
+				}
+			}
+		}
+	}
+	_occlusion_ready = true;
+}
+
+bool gl_renderer::test_occluded(glm::vec3 position, float radius) const {
+	if(!_occlusion_ready) {
+		return false;
+	}
+
+	glm::vec4 centre = _occlusion_world_to_clip * glm::vec4(position, 1.f);
+	// The nearest w any point of the sphere can have. If it reaches the near
+	// plane the entity surrounds the camera, so draw it.
+	float w_min = centre.w - radius * _occlusion_scale.z;
+	if(w_min < OCCLUSION_NEAR_W) {
+		return false;
+	}
+
+	static const int W = OCCLUSION_BUFFER_WIDTH;
+	static const int H = OCCLUSION_BUFFER_HEIGHT;
+
+	// Conservative screen rect for the sphere: extents computed against the
+	// nearest w, then dilated a texel to cover rasterisation round-off.
+	float sx = (centre.x / centre.w * 0.5f + 0.5f) * W;
+	float sy = (centre.y / centre.w * 0.5f + 0.5f) * H;
+	float hx = radius * _occlusion_scale.x / w_min * 0.5f * W;
+	float hy = radius * _occlusion_scale.y / w_min * 0.5f * H;
+	int min_x = std::max((int) std::floor(sx - hx) - 1, 0);
+	int max_x = std::min((int) std::ceil(sx + hx) + 1, W - 1);
+	int min_y = std::max((int) std::floor(sy - hy) - 1, 0);
+	int max_y = std::min((int) std::ceil(sy + hy) + 1, H - 1);
+	if(min_x > max_x || min_y > max_y) {
+		// The frustum test let a sphere through on its radius slop but the
+		// rect fell entirely off the buffer. Don't cull on no evidence.
+		return false;
+	}
+
+	// Occluded only if every texel the sphere might touch has terrain in
+	// front of the sphere's nearest point. Empty texels count as visible.
+	float inv_w_min = 1.f / w_min;
+	for(int y = min_y; y <= max_y; y++) {
+		for(int x = min_x; x <= max_x; x++) {
+			if(_occlusion_buffer[y * W + x] <= inv_w_min) {
+				return false;
+			}
+		}
+	}
+	return true;
 }
 
 void gl_renderer::draw_level(level& lvl, glm::mat4 world_to_clip) const {
@@ -54,73 +340,79 @@ void gl_renderer::draw_level(level& lvl, glm::mat4 world_to_clip) const {
 		return selected ? selected_colour : normal_colour;
 	};
 	
+	// Cube and mesh draws get queued up and flushed sorted by vertex buffer,
+	// so the buffer binds scale with the number of distinct meshes rather
+	// than the number of entities.
+	GLuint cube_buffer = cube_vertex_buffer();
+
 	if(draw_ties) {
-		for(tie_entity& tie : lvl.world.ties) {
+		for(std::size_t index : tie_visible_indices) {
+			tie_entity& tie = lvl.world.ties[index];
 			glm::mat4 local_to_clip = world_to_clip * tie.local_to_world;
 			glm::vec4 colour = get_colour(tie.selected, glm::vec4(0.5, 0, 1, 1));
-			draw_cube(local_to_clip, colour);
+			_draw_queue.push(cube_buffer, 108, local_to_clip, colour);
 		}
 	}
-	
+
 	if(draw_shrubs) {
-		for(shrub_entity& shrub : lvl.world.shrubs) {
+		for(std::size_t index : shrub_visible_indices) {
+			shrub_entity& shrub = lvl.world.shrubs[index];
 			glm::mat4 local_to_clip = world_to_clip * shrub.local_to_world;
 			glm::vec4 colour = get_colour(shrub.selected, glm::vec4(0, 0.5, 0, 1));
-			draw_cube(local_to_clip, colour);
+			_draw_queue.push(cube_buffer, 108, local_to_clip, colour);
 		}
 	}
-	
+
 	if(draw_mobies) {
-		gl_buffer moby_local_to_clip_buffer;
-		glGenBuffers(1, &moby_local_to_clip_buffer());
-		glBindBuffer(GL_ARRAY_BUFFER, moby_local_to_clip_buffer());
-		glBufferData(GL_ARRAY_BUFFER,
-			moby_local_to_clip_cache.size() * sizeof(glm::mat4),
-			moby_local_to_clip_cache.data(), GL_STATIC_DRAW);
-		
+		GLuint moby_local_to_clip_buffer = stream_instance_matrices(moby_local_to_clip_cache);
+
 		std::size_t moby_batch_class = INT64_MAX;
 		std::size_t moby_batch_begin = 0;
-		
+		moby_lod moby_batch_lod = moby_lod::FULL;
+
+		// Batch indices here are indices into the visible moby list, which is
+		// what the clip matrix buffer is laid out by.
 		auto draw_moby_batch = [&](std::size_t batch_end) {
-			if(lvl.moby_class_to_model.find(moby_batch_class) != lvl.moby_class_to_model.end()) {
-				std::size_t model_index = lvl.moby_class_to_model.at(moby_batch_class);
+			int32_t model_index = lvl.model_index_for_class(moby_batch_class);
+			if(model_index > -1) {
 				moby_model& model = lvl.moby_models[model_index];
 				draw_moby_models(
 					model,
 					lvl.moby_textures,
 					mode,
 					true,
-					moby_local_to_clip_buffer(),
+					moby_local_to_clip_buffer,
 					moby_batch_begin * sizeof(glm::mat4),
-					batch_end - moby_batch_begin);
+					batch_end - moby_batch_begin,
+					moby_batch_lod);
 			} else {
-				glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
-				glUseProgram(shaders.solid_colour.id());
-				
 				for(std::size_t i = moby_batch_begin; i < batch_end; i++) {
 					const glm::mat4& local_to_clip = moby_local_to_clip_cache[i];
-					glm::vec4 colour = get_colour(lvl.world.mobies[i].selected, glm::vec4(0, 1, 0, 1));
-					draw_cube(local_to_clip, colour);
+					moby_entity& moby = lvl.world.mobies[moby_visible_indices[i]];
+					glm::vec4 colour = get_colour(moby.selected, glm::vec4(0, 1, 0, 1));
+					_draw_queue.push(cube_buffer, 108, local_to_clip, colour);
 				}
 			}
 		};
-		
-		for(std::size_t i = 0; i < lvl.world.mobies.size(); i++) {
-			moby_entity& moby = lvl.world.mobies[i];
-			if(moby.class_num != moby_batch_class) {
+
+		for(std::size_t i = 0; i < moby_visible_indices.size(); i++) {
+			moby_entity& moby = lvl.world.mobies[moby_visible_indices[i]];
+			if(moby.class_num != moby_batch_class || moby_lod_cache[i] != moby_batch_lod) {
 				draw_moby_batch(i);
 				moby_batch_class = moby.class_num;
 				moby_batch_begin = i;
+				moby_batch_lod = moby_lod_cache[i];
 			}
 		}
-		draw_moby_batch(lvl.world.mobies.size());
-		
+		draw_moby_batch(moby_visible_indices.size());
+		fence_streamed_instances();
+
 		glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
 		glUseProgram(shaders.solid_colour.id());
-		
-		for(std::size_t i = 0; i < lvl.world.mobies.size(); i++) {
-			if(lvl.world.mobies[i].selected) {
-				draw_cube(moby_local_to_clip_cache[i], selected_colour);
+
+		for(std::size_t i = 0; i < moby_visible_indices.size(); i++) {
+			if(lvl.world.mobies[moby_visible_indices[i]].selected) {
+				_draw_queue.push(cube_buffer, 108, moby_local_to_clip_cache[i], selected_colour);
 			}
 		}
 	}
@@ -129,36 +421,38 @@ void gl_renderer::draw_level(level& lvl, glm::mat4 world_to_clip) const {
 		for(trigger_entity& trigger : lvl.world.triggers) {
 			glm::mat4 local_to_clip = world_to_clip * trigger.local_to_world;
 			glm::vec4 colour = get_colour(trigger.selected, glm::vec4(0, 0, 1, 1));
-			draw_cube(local_to_clip, colour);
+			_draw_queue.push(cube_buffer, 108, local_to_clip, colour);
 		}
 	}
-	
+
 	if(draw_splines) {
-		for(regular_spline_entity& spline : lvl.world.splines) {
-			glm::vec4 colour = get_colour(spline.selected, glm::vec4(1, 0.5, 0, 1));
-			draw_spline(spline, world_to_clip, colour);
-		}
+		draw_spline_batch(_spline_batch, lvl.world, lvl.world.splines, world_to_clip, glm::vec4(1, 0.5, 0, 1));
 	}
-	
+
 	if(draw_grind_rails) {
+		draw_spline_batch(_grindrail_batch, lvl.world, lvl.world.grindrails, world_to_clip, glm::vec4(0, 0.5, 1, 1));
+
 		for(grindrail_spline_entity& spline : lvl.world.grindrails) {
 			glm::vec4 colour = get_colour(spline.selected, glm::vec4(0, 0.5, 1, 1));
-			draw_spline(spline, world_to_clip, colour);
-			
 			glm::mat4 local_to_world = glm::translate(glm::mat4(1.f), glm::vec3(spline.special_point));
-			draw_cube(world_to_clip * local_to_world, colour);
+			_draw_queue.push(cube_buffer, 108, world_to_clip * local_to_world, colour);
 		}
 	}
-	
+
 	if(draw_tfrags) {
-		for(auto& frag : lvl.tfrags) {
+		// The terrain is pre-merged into one mesh (see level::tfrag_terrain),
+		// so the thousands of tiny frags cost a single draw.
+		if(model* terrain = lvl.tfrag_terrain()) {
 			glm::vec4 colour(0.5, 0.5, 0.5, 1);
-			draw_model(frag, world_to_clip, colour);
+			_draw_queue.push(terrain->vertex_buffer(), terrain->vertex_buffer_size() / 3, world_to_clip, colour);
 		}
 	}
-	
+
+	glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
+	_draw_queue.flush(shaders);
+
 	if (draw_tcols) {
-		for (auto& col : lvl.baked_collisions) {
+		for (auto& col : lvl.baked_collisions()) {
 			draw_model_vcolor(col, world_to_clip);
 		}
 	}
@@ -166,12 +460,59 @@ void gl_renderer::draw_level(level& lvl, glm::mat4 world_to_clip) const {
 	glPolygonMode(GL_FRONT_AND_BACK, GL_FILL);
 }
 
-void gl_renderer::draw_pickframe(level& lvl, glm::mat4 world_to_clip) const {
+GLuint gl_renderer::stream_instance_matrices(const std::vector<glm::mat4>& matrices) const {
+	instance_buffer& ring = _instance_buffers[_next_instance_buffer];
+	_next_instance_buffer = (_next_instance_buffer + 1) % 3;
+	_streaming_buffer = &ring;
+
+	// With three buffers in flight the fence will almost always have been
+	// signalled ages ago, so this wait is just a safety net.
+	if(ring.fence != nullptr) {
+		glClientWaitSync(ring.fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX);
+		glDeleteSync(ring.fence);
+		ring.fence = nullptr;
+	}
+
+	if(ring.buffer() == 0) {
+		glGenBuffers(1, &ring.buffer());
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, ring.buffer());
+	if(ring.capacity < matrices.size()) {
+		// Allocate some headroom so a few extra entities coming into view
+		// doesn't force a respecify every frame.
+		ring.capacity = matrices.size() + matrices.size() / 2;
+		glBufferData(GL_ARRAY_BUFFER, ring.capacity * sizeof(glm::mat4), nullptr, GL_STREAM_DRAW);
+	}
+	if(matrices.size() > 0) {
+		void* mapped = glMapBufferRange(
+			GL_ARRAY_BUFFER, 0, matrices.size() * sizeof(glm::mat4),
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+		if(mapped != nullptr) {
+			std::memcpy(mapped, matrices.data(), matrices.size() * sizeof(glm::mat4));
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+		} else {
+			// Mapping can fail (e.g. after a context loss) - take the
+			// synchronising upload path rather than writing through null.
+			glBufferSubData(GL_ARRAY_BUFFER, 0, matrices.size() * sizeof(glm::mat4), matrices.data());
+		}
+	}
+
+	return ring.buffer();
+}
+
+void gl_renderer::fence_streamed_instances() const {
+	if(_streaming_buffer != nullptr) {
+		_streaming_buffer->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		_streaming_buffer = nullptr;
+	}
+}
+
+void gl_renderer::draw_pickframe(level& lvl, glm::mat4 world_to_clip, glm::vec3 pick_ray) const {
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS);
-	
+
 	glUseProgram(shaders.solid_colour.id());
-	
+
 	auto encode_pick_colour = [&](entity_id id) {
 		glm::vec4 colour;
 		// IDs are unique across all object types.
@@ -181,47 +522,141 @@ void gl_renderer::draw_pickframe(level& lvl, glm::mat4 world_to_clip) const {
 		colour.a = ((id.value & 0xff000000) >> 24) / 255.f;
 		return colour;
 	};
-	
-	if(draw_ties) {
-		for(tie_entity& tie : lvl.world.ties) {
-			glm::mat4 local_to_clip = world_to_clip * tie.local_to_world;
-			glm::vec4 colour = encode_pick_colour(tie.id);
-			draw_cube(local_to_clip, colour);
+
+	// Only entities near the pick ray can end up under the cursor, so walk
+	// the spatial index along the ray instead of submitting the whole level.
+	GLuint cube_buffer = cube_vertex_buffer();
+	static const float MAX_PICK_DISTANCE = 1000.f;
+	lvl.entity_index.for_each_near_ray(
+			lvl.world, camera_position, pick_ray, MAX_PICK_DISTANCE,
+			[&](const spatial_index_record& record) {
+		switch(record.kind) {
+			case spatial_index_record::TIE: {
+				if(!draw_ties) break;
+				tie_entity& tie = lvl.world.ties[record.index];
+				glm::mat4 local_to_clip = world_to_clip * tie.local_to_world;
+				_draw_queue.push(cube_buffer, 108, local_to_clip, encode_pick_colour(tie.id));
+				break;
+			}
+			case spatial_index_record::SHRUB: {
+				if(!draw_shrubs) break;
+				shrub_entity& shrub = lvl.world.shrubs[record.index];
+				glm::mat4 local_to_clip = world_to_clip * shrub.local_to_world;
+				_draw_queue.push(cube_buffer, 108, local_to_clip, encode_pick_colour(shrub.id));
+				break;
+			}
+			case spatial_index_record::MOBY: {
+				if(!draw_mobies) break;
+				moby_entity& moby = lvl.world.mobies[record.index];
+				glm::mat4 local_to_world =
+					record.index < moby_local_to_world_cache.size() ?
+					moby_local_to_world_cache[record.index] : moby.local_to_world();
+				_draw_queue.push(cube_buffer, 108, world_to_clip * local_to_world, encode_pick_colour(moby.id));
+				break;
+			}
 		}
-	}
-	
-	if(draw_shrubs) {
-		for(shrub_entity& shrub : lvl.world.shrubs) {
-			glm::mat4 local_to_clip = world_to_clip * shrub.local_to_world;
-			glm::vec4 colour = encode_pick_colour(shrub.id);
-			draw_cube(local_to_clip, colour);
+	});
+	_draw_queue.flush(shaders);
+
+	if(draw_splines) {
+		update_spline_batch(_spline_batch, lvl.world, lvl.world.splines);
+		for(std::size_t i = 0; i < lvl.world.splines.size(); i++) {
+			glm::vec4 colour = encode_pick_colour(lvl.world.splines[i].id);
+			draw_spline_from_batch(_spline_batch, i, world_to_clip, colour);
 		}
 	}
-	
-	if(draw_mobies) {
-		for(moby_entity& moby : lvl.world.mobies) {
-			glm::vec4 colour = encode_pick_colour(moby.id);
-			draw_cube(moby.local_to_clip_cache, colour);
+
+	if(draw_grind_rails) {
+		update_spline_batch(_grindrail_batch, lvl.world, lvl.world.grindrails);
+		for(std::size_t i = 0; i < lvl.world.grindrails.size(); i++) {
+			glm::vec4 colour = encode_pick_colour(lvl.world.grindrails[i].id);
+			draw_spline_from_batch(_grindrail_batch, i, world_to_clip, colour);
 		}
 	}
-	
-	if(draw_splines) {
-		for(regular_spline_entity& spline : lvl.world.splines) {
-			glm::vec4 colour = encode_pick_colour(spline.id);
-			draw_spline(spline, world_to_clip, colour);
+}
+
+template <typename T>
+void gl_renderer::update_spline_batch(spline_batch& batch, const world_segment& world, const std::vector<T>& splines) const {
+	if(batch.world == world.world_id && batch.generation == world.spline_generation && batch.buffer() != 0) {
+		return;
+	}
+
+	batch.firsts.clear();
+	batch.counts.clear();
+	std::size_t total = 0;
+	for(const T& spline : splines) {
+		total += spline.vertices.size();
+	}
+	std::vector<glm::vec4> vertices;
+	vertices.reserve(total);
+	for(const T& spline : splines) {
+		batch.firsts.push_back(vertices.size());
+		batch.counts.push_back(spline.vertices.size());
+		vertices.insert(vertices.end(), spline.vertices.begin(), spline.vertices.end());
+	}
+
+	if(batch.buffer() == 0) {
+		glGenBuffers(1, &batch.buffer());
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, batch.buffer());
+	glBufferData(GL_ARRAY_BUFFER,
+		vertices.size() * sizeof(glm::vec4),
+		vertices.data(), GL_STATIC_DRAW);
+
+	batch.world = world.world_id;
+	batch.generation = world.spline_generation;
+}
+
+template <typename T>
+void gl_renderer::draw_spline_batch(spline_batch& batch, const world_segment& world, const std::vector<T>& splines, const glm::mat4& world_to_clip, const glm::vec4& base_colour) const {
+	update_spline_batch(batch, world, splines);
+	if(splines.size() == 0) {
+		return;
+	}
+
+	glUniformMatrix4fv(shaders.solid_colour_transform, 1, GL_FALSE, &world_to_clip[0][0]);
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, batch.buffer());
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), nullptr);
+
+	// All the unselected splines share a colour, so they go out together.
+	GLint* firsts = arena.alloc_array<GLint>(splines.size());
+	GLsizei* counts = arena.alloc_array<GLsizei>(splines.size());
+	GLsizei unselected = 0;
+	for(std::size_t i = 0; i < splines.size(); i++) {
+		if(!splines[i].selected) {
+			firsts[unselected] = batch.firsts[i];
+			counts[unselected] = batch.counts[i];
+			unselected++;
 		}
 	}
-	
-	if(draw_grind_rails) {
-		for(grindrail_spline_entity& spline : lvl.world.grindrails) {
-			glm::vec4 colour = encode_pick_colour(spline.id);
-			draw_spline(spline, world_to_clip, colour);
+	glUniform4f(shaders.solid_colour_rgb, base_colour.r, base_colour.g, base_colour.b, base_colour.a);
+	glMultiDrawArrays(GL_LINE_STRIP, firsts, counts, unselected);
+
+	for(std::size_t i = 0; i < splines.size(); i++) {
+		if(splines[i].selected) {
+			glUniform4f(shaders.solid_colour_rgb, 1, 0, 0, 1);
+			glDrawArrays(GL_LINE_STRIP, batch.firsts[i], batch.counts[i]);
 		}
 	}
+
+	glDisableVertexAttribArray(0);
 }
 
-void gl_renderer::draw_spline(spline_entity& spline, const glm::mat4& world_to_clip, const glm::vec4& colour) const{
-	
+void gl_renderer::draw_spline_from_batch(spline_batch& batch, std::size_t index, const glm::mat4& world_to_clip, const glm::vec4& colour) const {
+	glUniformMatrix4fv(shaders.solid_colour_transform, 1, GL_FALSE, &world_to_clip[0][0]);
+	glUniform4f(shaders.solid_colour_rgb, colour.r, colour.g, colour.b, colour.a);
+
+	glEnableVertexAttribArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, batch.buffer());
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), nullptr);
+
+	glDrawArrays(GL_LINE_STRIP, batch.firsts[index], batch.counts[index]);
+
+	glDisableVertexAttribArray(0);
+}
+
+void gl_renderer::draw_line_strip(const glm::vec4* vertices, std::size_t count, const glm::mat4& world_to_clip, const glm::vec4& colour) const {
 	glUniformMatrix4fv(shaders.solid_colour_transform, 1, GL_FALSE, &world_to_clip[0][0]);
 	glUniform4f(shaders.solid_colour_rgb, colour.r, colour.g, colour.b, colour.a);
 
@@ -229,18 +664,17 @@ void gl_renderer::draw_spline(spline_entity& spline, const glm::mat4& world_to_c
 	glGenBuffers(1, &vertex_buffer);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
 	glBufferData(GL_ARRAY_BUFFER,
-		spline.vertices.size() * sizeof(glm::vec4),
-		spline.vertices.data(), GL_STATIC_DRAW);
+		count * sizeof(glm::vec4),
+		vertices, GL_STATIC_DRAW);
 
 	glEnableVertexAttribArray(0);
 	glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec4), nullptr);
 
-	glDrawArrays(GL_LINE_STRIP, 0, spline.vertices.size());
+	glDrawArrays(GL_LINE_STRIP, 0, count);
 
 	glDisableVertexAttribArray(0);
 	glDeleteBuffers(1, &vertex_buffer);
-
 }
 
 void gl_renderer::draw_tris(const std::vector<float>& vertex_data, const glm::mat4& mvp, const glm::vec4& colour) const {
@@ -297,38 +731,40 @@ void gl_renderer::draw_model_vcolor(const model& mdl, const glm::mat4& mvp) cons
 		(void*)0                          // array buffer offset
 	);
 
-	glDrawArrays(GL_TRIANGLES, 0, mdl.vertex_buffer_size() / 3);
+	if(mdl.index_buffer() != 0) {
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mdl.index_buffer());
+		glDrawElements(GL_TRIANGLES, mdl.index_buffer_size(), GL_UNSIGNED_INT, nullptr);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+	} else {
+		glDrawArrays(GL_TRIANGLES, 0, mdl.vertex_buffer_size() / 3);
+	}
 
 	glDisableVertexAttribArray(0);
 	glDisableVertexAttribArray(1);
 }
 
+GLuint gl_renderer::cube_vertex_buffer() const {
+	static const float vertex_data[108] {
+		-1, -1, -1, -1, -1,  1, -1,  1,  1,
+		 1,  1, -1, -1, -1, -1, -1,  1, -1,
+		 1, -1,  1, -1, -1, -1,  1, -1, -1,
+		 1,  1, -1,  1, -1, -1, -1, -1, -1,
+		-1, -1, -1, -1,  1,  1, -1,  1, -1,
+		 1, -1,  1, -1, -1,  1, -1, -1, -1,
+		-1,  1,  1, -1, -1,  1,  1, -1,  1,
+		 1,  1,  1,  1, -1, -1,  1,  1, -1,
+		 1, -1, -1,  1,  1,  1,  1, -1,  1,
+		 1,  1,  1,  1,  1, -1, -1,  1, -1,
+		 1,  1,  1, -1,  1, -1, -1,  1,  1,
+		 1,  1,  1, -1,  1,  1,  1, -1,  1
+	};
+
+	return static_mesh_buffer(vertex_data, sizeof(vertex_data));
+}
+
 void gl_renderer::draw_cube(const glm::mat4& mvp, const glm::vec4& colour) const {
-	static GLuint vertex_buffer = 0;
-	
-	if(vertex_buffer == 0) {
-		const static std::vector<float> vertex_data {
-			-1, -1, -1, -1, -1,  1, -1,  1,  1,
-			 1,  1, -1, -1, -1, -1, -1,  1, -1,
-			 1, -1,  1, -1, -1, -1,  1, -1, -1,
-			 1,  1, -1,  1, -1, -1, -1, -1, -1,
-			-1, -1, -1, -1,  1,  1, -1,  1, -1,
-			 1, -1,  1, -1, -1,  1, -1, -1, -1,
-			-1,  1,  1, -1, -1,  1,  1, -1,  1,
-			 1,  1,  1,  1, -1, -1,  1,  1, -1,
-			 1, -1, -1,  1,  1,  1,  1, -1,  1,
-			 1,  1,  1,  1,  1, -1, -1,  1, -1,
-			 1,  1,  1, -1,  1, -1, -1,  1,  1,
-			 1,  1,  1, -1,  1,  1,  1, -1,  1
-		};
-		
-		glGenBuffers(1, &vertex_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-		glBufferData(GL_ARRAY_BUFFER,
-			108 * sizeof(float),
-			vertex_data.data(), GL_STATIC_DRAW);
-	}
-	
+	GLuint vertex_buffer = cube_vertex_buffer();
+
 	glUniformMatrix4fv(shaders.solid_colour_transform, 1, GL_FALSE, &mvp[0][0]);
 	glUniform4f(shaders.solid_colour_rgb, colour.r, colour.g, colour.b, colour.a);
 	
@@ -341,23 +777,25 @@ void gl_renderer::draw_cube(const glm::mat4& mvp, const glm::vec4& colour) const
 	glDisableVertexAttribArray(0);
 }
 
+GLuint gl_renderer::static_mesh_buffer(const float* vertex_data, size_t vertex_data_size) const {
+	auto cached = _static_mesh_buffers.find(vertex_data);
+	if(cached == _static_mesh_buffers.end()) {
+		GLuint vertex_buffer;
+		glGenBuffers(1, &vertex_buffer);
+		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
+		glBufferData(GL_ARRAY_BUFFER, vertex_data_size, vertex_data, GL_STATIC_DRAW);
+		cached = _static_mesh_buffers.emplace(vertex_data, vertex_buffer).first;
+	}
+	return cached->second;
+}
+
 void gl_renderer::draw_static_mesh(
 		const float* vertex_data,
 		size_t vertex_data_size, const
 		glm::mat4 local_to_clip,
 		glm::vec4 colour) {
-	static std::map<const float*, GLint> vertex_buffers;
-	
-	GLuint vertex_buffer = 0;
-	if(vertex_buffers.find(vertex_data) == vertex_buffers.end()) {
-		glGenBuffers(1, &vertex_buffer);
-		glBindBuffer(GL_ARRAY_BUFFER, vertex_buffer);
-		glBufferData(GL_ARRAY_BUFFER, vertex_data_size, vertex_data, GL_STATIC_DRAW);
-		vertex_buffers[vertex_data] = vertex_buffer;
-	} else {
-		vertex_buffer = vertex_buffers.at(vertex_data);
-	}
-	
+	GLuint vertex_buffer = static_mesh_buffer(vertex_data, vertex_data_size);
+
 	glUniformMatrix4fv(shaders.solid_colour_transform, 1, GL_FALSE, &local_to_clip[0][0]);
 	glUniform4f(shaders.solid_colour_rgb, colour.r, colour.g, colour.b, colour.a);
 	
@@ -377,7 +815,8 @@ void gl_renderer::draw_moby_models(
 		bool show_all_submodels,
 		GLuint local_to_world_buffer,
 		std::size_t instance_offset,
-		std::size_t count) const {
+		std::size_t count,
+		moby_lod lod) const {
 	switch(mode) {
 		case view_mode::WIREFRAME:
 			glPolygonMode(GL_FRONT_AND_BACK, GL_LINE);
@@ -405,8 +844,8 @@ void gl_renderer::draw_moby_models(
 	glVertexAttribDivisor(3, 1);
 	
 	moby_model_texture_data texture_data = {};
-	for(std::size_t i = 0; i < model.submodels.size(); i++) {
-		moby_submodel& submodel = model.submodels[i];
+	for(std::size_t i = 0; i < model.submodels->size(); i++) {
+		moby_submodel& submodel = (*model.submodels)[i];
 		if(!show_all_submodels && !submodel.visible_in_model_viewer) {
 			continue;
 		}
@@ -432,21 +871,30 @@ void gl_renderer::draw_moby_models(
 		}
 		
 		for(moby_subsubmodel& subsubmodel : submodel.subsubmodels) {
-			if(subsubmodel.index_buffer() == 0) {
-				glGenBuffers(1, &subsubmodel.index_buffer());
-				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subsubmodel.index_buffer());
+			// Subsubmodels too small to have a decimated index set always draw
+			// at full detail.
+			const std::vector<uint8_t>* indices = &subsubmodel.indices;
+			gl_buffer* index_buffer = &subsubmodel.index_buffer;
+			if(lod == moby_lod::LOW && subsubmodel.low_detail_indices.size() > 0) {
+				indices = &subsubmodel.low_detail_indices;
+				index_buffer = &subsubmodel.low_detail_index_buffer;
+			}
+
+			if((*index_buffer)() == 0) {
+				glGenBuffers(1, &(*index_buffer)());
+				glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (*index_buffer)());
 				glBufferData(GL_ELEMENT_ARRAY_BUFFER,
-					subsubmodel.indices.size(),
-					subsubmodel.indices.data(), GL_STATIC_DRAW);
+					indices->size(),
+					indices->data(), GL_STATIC_DRAW);
 			}
-			
+
 			if(subsubmodel.texture) {
 				texture_data = *subsubmodel.texture;
 			}
 			
 			switch(mode) {
 				case view_mode::WIREFRAME: {
-					glm::vec4 colour = colour_coded_submodel_index(i, model.submodels.size());
+					glm::vec4 colour = colour_coded_submodel_index(i, model.submodels->size());
 					glUniform4f(shaders.solid_colour_batch_rgb, colour.r, colour.g, colour.b, colour.a);
 					break;
 				}
@@ -478,10 +926,10 @@ void gl_renderer::draw_moby_models(
 			glBindBuffer(GL_ARRAY_BUFFER, submodel.st_buffer());
 			glVertexAttribPointer(5, 2, GL_SHORT, GL_TRUE, sizeof(moby_model_st), (void*) offsetof(moby_model_st, s));
 			
-			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, subsubmodel.index_buffer());
+			glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, (*index_buffer)());
 			glDrawElementsInstanced(
 				GL_TRIANGLES,
-				subsubmodel.indices.size(),
+				indices->size(),
 				GL_UNSIGNED_BYTE,
 				nullptr,
 				count);
@@ -43,17 +43,77 @@ enum class view_mode {
 	TEXTURED_POLYGONS = 1
 };
 
+enum class moby_lod {
+	FULL = 0,
+	LOW = 1 // Half the triangles, for instances that are small on screen.
+};
+
+// Bump allocator for per-frame scratch memory. Everything allocated from it
+// is freed in one go by reset() at the top of the next frame, so scratch
+// arrays built while drawing (tool previews, overlay labels) stop hitting the
+// heap in the steady state. Blocks are kept across frames and only grow when
+// a frame needs more scratch than any frame before it.
+class frame_arena {
+public:
+	char* alloc(std::size_t size);
+
+	template <typename T>
+	T* alloc_array(std::size_t count) {
+		return reinterpret_cast<T*>(alloc(sizeof(T) * count));
+	}
+
+	void reset();
+
+private:
+	struct block {
+		std::unique_ptr<char[]> bytes;
+		std::size_t size;
+		std::size_t used;
+	};
+	std::vector<block> _blocks;
+	std::size_t _current_block = 0;
+};
+
+// Collects solid colour triangle-list draws and submits them sorted by vertex
+// buffer, so drawing a thousand entity cubes binds the cube buffer once
+// instead of re-binding it per entity. The textured moby path doesn't go
+// through here - it already batches by model class.
+class render_queue {
+public:
+	void push(GLuint vertex_buffer, std::size_t vertex_count, const glm::mat4& mvp, const glm::vec4& colour);
+	// Sorts, submits and clears the queued records. Expects the polygon mode
+	// to already be set; binds the solid colour program itself.
+	void flush(const shader_programs& shaders);
+
+private:
+	struct record {
+		GLuint vertex_buffer;
+		std::size_t vertex_count;
+		glm::mat4 mvp;
+		glm::vec4 colour;
+	};
+	std::vector<record> _records;
+};
+
 struct gl_renderer {
 	void prepare_frame(level& lvl, glm::mat4 world_to_clip); // Compute local to world matrices for the moby batch renderer.
 	void draw_level(level& lvl, glm::mat4 world_to_clip) const;
-	void draw_pickframe(level& lvl, glm::mat4 world_to_clip) const;
+	void draw_pickframe(level& lvl, glm::mat4 world_to_clip, glm::vec3 pick_ray) const;
 	
-	void draw_spline(spline_entity& spline, const glm::mat4& world_to_clip, const glm::vec4& colour) const;
+	GLuint cube_vertex_buffer() const;
+
+	void draw_line_strip(const glm::vec4* vertices, std::size_t count, const glm::mat4& world_to_clip, const glm::vec4& colour) const;
 	void draw_tris  (const std::vector<float>& vertex_data, const glm::mat4& mvp, const glm::vec4& colour) const;
 	void draw_model (const model& mdl, const glm::mat4& mvp, const glm::vec4& colour) const;
 	void draw_model_vcolor (const model& mdl, const glm::mat4& mvp) const;
 	void draw_cube  (const glm::mat4& mvp, const glm::vec4& colour) const;
 	
+	// Returns a vertex buffer containing the given mesh, uploading it the
+	// first time it's seen. Only call this with vertex data that's completely
+	// static e.g. one of the const tables in meshes.h - the data pointer is
+	// the cache key.
+	GLuint static_mesh_buffer(const float* vertex_data, size_t vertex_data_size) const;
+
 	// Only call this with vertex data that's completely static e.g. a const global.
 	void draw_static_mesh(
 		const float* vertex_data,
@@ -67,8 +127,9 @@ struct gl_renderer {
 		view_mode mode,
 		bool show_all_submodels,
 		GLuint local_to_world_buffer,
-		std::size_t instance_offset, 
-		std::size_t count) const;
+		std::size_t instance_offset,
+		std::size_t count,
+		moby_lod lod) const;
 	
 	static glm::vec4 colour_coded_submodel_index(std::size_t index, std::size_t submodel_count);
 	
@@ -89,6 +150,9 @@ struct gl_renderer {
 	glm::vec3 camera_position { 0, 0, 0 };
 	glm::vec2 camera_rotation { 0, 0 };
 	
+	// Scratch space that lives until prepare_frame resets it next frame.
+	mutable frame_arena arena;
+
 	view_mode mode = view_mode::TEXTURED_POLYGONS;
 	bool draw_ties = true;
 	bool draw_shrubs = false;
@@ -98,32 +162,172 @@ struct gl_renderer {
 	bool draw_grind_rails = true;
 	bool draw_tfrags = true;
 	bool draw_tcols = true;
+	bool draw_frame_times = false;
+	bool occlusion_culling = true;
 	
+	std::vector<glm::mat4> moby_local_to_world_cache; // One entry per moby.
+	// Only the mobies that pass the frustum test get a clip matrix. Both of
+	// these are indexed by visible moby, not by moby - moby_visible_indices
+	// maps back to the index into world_segment::mobies.
+	std::vector<std::size_t> moby_visible_indices;
 	std::vector<glm::mat4> moby_local_to_clip_cache;
+	std::vector<moby_lod> moby_lod_cache; // Also indexed by visible moby.
+	std::vector<std::size_t> tie_visible_indices;
+	std::vector<std::size_t> shrub_visible_indices;
+
+	// True if a sphere of the given radius about the given world space
+	// position intersects the view frustum passed to prepare_frame.
+	bool test_frustum(glm::vec3 position, float radius) const;
+
+	// How many entities the frustum pass rejected last frame. Displayed in
+	// the view menu so the effect of culling is visible.
+	std::size_t culled_moby_count = 0;
+	std::size_t culled_tie_count = 0;
+	std::size_t culled_shrub_count = 0;
+
+	// How many of those rejections came from the occlusion pass.
+	std::size_t occluded_moby_count = 0;
+	std::size_t occluded_tie_count = 0;
+	std::size_t occluded_shrub_count = 0;
+
+private:
+	// Software occlusion culling. prepare_frame rasterises the merged tfrag
+	// terrain into a small CPU depth buffer, then entities whose bounding
+	// sphere is entirely behind it are dropped before batch submission. Dense
+	// interiors are the worst overdraw cases and the terrain is exactly the
+	// geometry hiding everything there.
+	static const int OCCLUSION_BUFFER_WIDTH = 128;
+	static const int OCCLUSION_BUFFER_HEIGHT = 72;
+
+	void rasterise_occluders(level& lvl, const glm::mat4& world_to_clip);
+	// True if a sphere of the given radius about the given world space
+	// position is hidden behind the rasterised terrain. Conservative: empty
+	// texels, spheres touching the near plane and levels without terrain all
+	// count as visible.
+	bool test_occluded(glm::vec3 position, float radius) const;
+
+	std::vector<float> _occlusion_buffer; // 1/w per texel, zero = no occluder.
+	bool _occlusion_ready = false;
+	glm::mat4 _occlusion_world_to_clip;
+	glm::vec3 _occlusion_scale; // Bounds on clip x/y/w change per world unit.
+	// CPU copy of the terrain triangles - model::triangles() returns by value,
+	// so it's only refreshed when the level's terrain model changes.
+	const model* _occluder_source = nullptr;
+	std::vector<float> _occluder_triangles;
+
+	// Ring of reusable streaming buffers for the per-instance moby matrices.
+	// Three deep with fences so writing this frame's matrices never waits on
+	// a draw from the last two frames, and the driver never has to allocate
+	// fresh storage mid-frame. glad is generated for GL 3.3, so this uses
+	// unsynchronised glMapBufferRange rather than persistent mapping.
+	struct instance_buffer {
+		gl_buffer buffer;
+		std::size_t capacity = 0; // In matrices.
+		GLsync fence = nullptr;
+	};
+
+	// Upload the given matrices into the next buffer in the ring and return
+	// its id, leaving it bound to GL_ARRAY_BUFFER. Call
+	// fence_streamed_instances once the draws reading from it are issued.
+	GLuint stream_instance_matrices(const std::vector<glm::mat4>& matrices) const;
+	void fence_streamed_instances() const;
+
+	mutable instance_buffer _instance_buffers[3];
+	mutable std::size_t _next_instance_buffer = 0;
+	mutable instance_buffer* _streaming_buffer = nullptr;
+
+	mutable render_queue _draw_queue; // Reused each frame so its storage sticks around.
+
+	// Persistent vertex buffers for the spline and grind rail line strips.
+	// Each category's splines live concatenated in one VBO that's only
+	// rebuilt when the world's spline_generation changes, so the steady
+	// state re-uploads nothing. firsts/counts are indexed like the source
+	// spline list.
+	struct spline_batch {
+		gl_buffer buffer;
+		std::vector<GLint> firsts;
+		std::vector<GLsizei> counts;
+		uint64_t world = 0; // world_id of the world the buffer was built from.
+		uint64_t generation = 0;
+	};
+
+	template <typename T> // Defined in renderer.cpp.
+	void update_spline_batch(spline_batch& batch, const world_segment& world, const std::vector<T>& splines) const;
+
+	// Draw the whole batch: the unselected splines share base_colour and go
+	// out in a single glMultiDrawArrays, the selected ones are drawn
+	// individually in the selection colour. Defined in renderer.cpp.
+	template <typename T>
+	void draw_spline_batch(spline_batch& batch, const world_segment& world, const std::vector<T>& splines, const glm::mat4& world_to_clip, const glm::vec4& base_colour) const;
+
+	// Draw one spline from the batch in the given colour. For the pickframe,
+	// where every spline needs its own colour. Defined in renderer.cpp.
+	void draw_spline_from_batch(spline_batch& batch, std::size_t index, const glm::mat4& world_to_clip, const glm::vec4& colour) const;
+
+	mutable spline_batch _spline_batch;
+	mutable spline_batch _grindrail_batch;
+
+	mutable std::map<const float*, GLuint> _static_mesh_buffers;
+
+	glm::vec4 _frustum_planes[6];
 };
 
 template <typename T>
 void render_to_texture(GLuint* target, int width, int height, T draw_callback) {
-	glDeleteTextures(1, target);
-	
-	glGenTextures(1, target);
-	glBindTexture(GL_TEXTURE_2D, *target);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-	static GLuint zbuffer_texture;
-	glGenTextures(1, &zbuffer_texture);
-	glBindTexture(GL_TEXTURE_2D, zbuffer_texture);
-	glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-
-	GLuint fb_id;
-	glGenFramebuffers(1, &fb_id);
-	glBindFramebuffer(GL_FRAMEBUFFER, fb_id);
+	// The framebuffers and depth textures are cached by viewport size and
+	// only created the first time a size is seen, so the steady state (same
+	// size every frame) does no driver object churn at all. Note that these
+	// statics are per call site since this is a template. The colour texture
+	// belongs to the caller - model thumbnails keep theirs around - so it's
+	// only respecified when its size doesn't match.
+	struct framebuffer_cache_entry {
+		GLuint fb_id;
+		GLuint zbuffer_texture;
+	};
+	static std::map<std::pair<int, int>, framebuffer_cache_entry> framebuffers;
+	static std::map<GLuint, std::pair<int, int>> colour_texture_sizes;
+
+	auto cached = framebuffers.find({ width, height });
+	if(cached == framebuffers.end()) {
+		// Don't accumulate framebuffers forever while a viewport is being
+		// dragged through lots of different sizes.
+		if(framebuffers.size() >= 8) {
+			for(auto& [size, entry] : framebuffers) {
+				glDeleteFramebuffers(1, &entry.fb_id);
+				glDeleteTextures(1, &entry.zbuffer_texture);
+			}
+			framebuffers.clear();
+		}
+
+		framebuffer_cache_entry entry;
+		glGenTextures(1, &entry.zbuffer_texture);
+		glBindTexture(GL_TEXTURE_2D, entry.zbuffer_texture);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT, width, height, 0, GL_DEPTH_COMPONENT, GL_FLOAT, 0);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+
+		glGenFramebuffers(1, &entry.fb_id);
+		glBindFramebuffer(GL_FRAMEBUFFER, entry.fb_id);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, entry.zbuffer_texture, 0);
+
+		cached = framebuffers.emplace(std::pair { width, height }, entry).first;
+	}
+
+	if(*target == 0) {
+		glGenTextures(1, target);
+		glBindTexture(GL_TEXTURE_2D, *target);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+		colour_texture_sizes[*target] = { 0, 0 };
+	}
+	if(colour_texture_sizes[*target] != std::pair { width, height }) {
+		glBindTexture(GL_TEXTURE_2D, *target);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA, width, height, 0, GL_RGBA, GL_UNSIGNED_INT_8_8_8_8, 0);
+		colour_texture_sizes[*target] = { width, height };
+	}
+
+	glBindFramebuffer(GL_FRAMEBUFFER, cached->second.fb_id);
 	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, *target, 0);
-	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, zbuffer_texture, 0);
 
 	glEnable(GL_DEPTH_TEST);
 	glDepthFunc(GL_LESS);
@@ -131,11 +335,10 @@ void render_to_texture(GLuint* target, int width, int height, T draw_callback) {
 	glClearColor(0, 0, 0, 1);
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glViewport(0, 0, width, height);
-	
+
 	draw_callback();
-	
-	glDeleteFramebuffers(1, &fb_id);
-	glDeleteTextures(1, &zbuffer_texture);
+
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
 }
 
 #endif
@@ -18,19 +18,116 @@
 
 #include "shaders.h"
 
+#include <string>
 #include <vector>
+#include <cstring>
+
+#include "util.h"
+#include "stream.h"
+#include "fs_includes.h"
+
+// Linked programs are cached on disk with ARB_get_program_binary so warm
+// launches skip GLSL compilation. Our glad loader only wraps 3.3 core, where
+// this is still an extension, so the entry points are looked up at runtime
+// and the cache is silently skipped on drivers that don't export them.
+#ifndef GL_PROGRAM_BINARY_LENGTH
+	#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+	#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87fe
+#endif
+
+typedef void (APIENTRY* get_program_binary_proc)(GLuint, GLsizei, GLsizei*, GLenum*, void*);
+typedef void (APIENTRY* program_binary_proc)(GLuint, GLenum, const void*, GLsizei);
+
+// The driver strings can be null if the context is in a bad state.
+static uint64_t fnv_hash(uint64_t hash, const char* str) {
+	return str != nullptr ? fnv1a(str, strlen(str), hash) : hash;
+}
+
+// Binary blobs are driver specific, so the file name mixes in the driver
+// identification strings as well as the shader source.
+static std::string program_binary_path(const GLchar* vertex_src, const GLchar* fragment_src) {
+	uint64_t driver = FNV1A_64_SEED;
+	driver = fnv_hash(driver, (const char*) glGetString(GL_VENDOR));
+	driver = fnv_hash(driver, (const char*) glGetString(GL_RENDERER));
+	driver = fnv_hash(driver, (const char*) glGetString(GL_VERSION));
+	uint64_t source = FNV1A_64_SEED;
+	source = fnv_hash(source, vertex_src);
+	source = fnv_hash(source, fragment_src);
+	return "cache/shaders/" +
+		std::to_string(driver) + "_" + std::to_string(source) + ".bin";
+}
+
+static bool load_program_binary(std::string path, GLuint& id) {
+	auto program_binary = (program_binary_proc) glfwGetProcAddress("glProgramBinary");
+	if(program_binary == nullptr || !fs::is_regular_file(path)) {
+		return false;
+	}
+	try {
+		file_stream file(path);
+		GLenum format = file.read<uint32_t>(0);
+		std::vector<char> binary(file.size() - sizeof(uint32_t));
+		file.read_n(binary.data(), binary.size());
+		GLuint program = glCreateProgram();
+		program_binary(program, format, binary.data(), binary.size());
+		GLint result = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &result);
+		if(result != GL_TRUE) {
+			// Stale blob, e.g. after a driver update.
+			glDeleteProgram(program);
+			return false;
+		}
+		id = program;
+		return true;
+	} catch(stream_error&) {
+		return false;
+	}
+}
+
+static void save_program_binary(std::string path, GLuint id) {
+	auto get_program_binary = (get_program_binary_proc) glfwGetProcAddress("glGetProgramBinary");
+	if(get_program_binary == nullptr) {
+		return;
+	}
+	GLint format_count = 0;
+	glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &format_count);
+	GLint length = 0;
+	glGetProgramiv(id, GL_PROGRAM_BINARY_LENGTH, &length);
+	if(format_count < 1 || length < 1) {
+		return;
+	}
+	std::vector<char> binary(length);
+	GLenum format = 0;
+	get_program_binary(id, length, nullptr, &format, binary.data());
+	try {
+		fs::create_directory("cache");
+		fs::create_directory("cache/shaders");
+		file_stream file(path, std::ios::in | std::ios::out | std::ios::trunc);
+		file.write<uint32_t>(0, format);
+		file.write_n(binary.data(), binary.size());
+	} catch(stream_error&) {
+		// Best effort - next launch just compiles from source again.
+	}
+}
 
 shader_program::shader_program(const GLchar* vertex_src, const GLchar* fragment_src, shader_callback after)
 	: _id(0), _vertex_src(vertex_src), _fragment_src(fragment_src), _after(after) {}
-	
+
 shader_program::~shader_program() {
 	glDeleteProgram(_id);
 }
 
 void shader_program::init() {
+	std::string binary_path = program_binary_path(_vertex_src, _fragment_src);
+	if(load_program_binary(binary_path, _id)) {
+		_after(_id);
+		return;
+	}
 	_id = link(
 		compile(_vertex_src,   GL_VERTEX_SHADER),
 		compile(_fragment_src, GL_FRAGMENT_SHADER));
+	save_program_binary(binary_path, _id);
 	_after(_id);
 }
 
@@ -0,0 +1,128 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "spatial_index.h"
+
+#include <cmath>
+
+void spatial_index::rebuild(world_segment& world) {
+	_cells.clear();
+	_cell_of_entity.clear();
+
+	auto insert = [&](entity_id id, spatial_index_record::entity_kind kind, std::size_t index, glm::vec3 position) {
+		uint64_t key = cell_key(position);
+		_cells[key].push_back({ id, kind, index, position });
+		_cell_of_entity[id] = key;
+	};
+	for(std::size_t i = 0; i < world.mobies.size(); i++) {
+		insert(world.mobies[i].id, spatial_index_record::MOBY, i, world.mobies[i].position);
+	}
+	for(std::size_t i = 0; i < world.ties.size(); i++) {
+		insert(world.ties[i].id, spatial_index_record::TIE, i, world.ties[i].local_to_world[3]);
+	}
+	for(std::size_t i = 0; i < world.shrubs.size(); i++) {
+		insert(world.shrubs[i].id, spatial_index_record::SHRUB, i, world.shrubs[i].local_to_world[3]);
+	}
+
+	_stale = false;
+}
+
+void spatial_index::mark_stale() {
+	_stale = true;
+}
+
+void spatial_index::move(entity_id id, glm::vec3 new_position) {
+	if(_stale) {
+		return;
+	}
+
+	auto cell_iter = _cell_of_entity.find(id);
+	if(cell_iter == _cell_of_entity.end()) {
+		mark_stale();
+		return;
+	}
+
+	uint64_t old_key = cell_iter->second;
+	uint64_t new_key = cell_key(new_position);
+	std::vector<spatial_index_record>& old_cell = _cells[old_key];
+	for(std::size_t i = 0; i < old_cell.size(); i++) {
+		if(old_cell[i].id == id) {
+			spatial_index_record record = old_cell[i];
+			record.position = new_position;
+			if(new_key == old_key) {
+				old_cell[i] = record;
+			} else {
+				old_cell.erase(old_cell.begin() + i);
+				_cells[new_key].push_back(record);
+				cell_iter->second = new_key;
+			}
+			return;
+		}
+	}
+
+	// The bookkeeping doesn't match the grid. This shouldn't happen, but a
+	// rebuild recovers either way.
+	mark_stale();
+}
+
+void spatial_index::for_each_near_ray(
+		world_segment& world,
+		glm::vec3 origin,
+		glm::vec3 direction,
+		float max_distance,
+		std::function<void(const spatial_index_record&)> callback) {
+	if(_stale) {
+		rebuild(world);
+	}
+
+	// March the ray at half a cell per step and visit the 3x3x3 neighbourhood
+	// of each cell it passes through. The neighbourhood means entities sitting
+	// just across a cell boundary from the ray still get visited, and the half
+	// cell step size means no pierced cell can be skipped over.
+	direction = glm::normalize(direction);
+	std::set<uint64_t> visited;
+	for(float travelled = 0.f; travelled <= max_distance; travelled += CELL_SIZE * 0.5f) {
+		glm::vec3 pos = origin + direction * travelled;
+		for(int x = -1; x <= 1; x++) {
+			for(int y = -1; y <= 1; y++) {
+				for(int z = -1; z <= 1; z++) {
+					glm::vec3 neighbour = pos + glm::vec3(x, y, z) * (float) CELL_SIZE;
+					uint64_t key = cell_key(neighbour);
+					if(!visited.insert(key).second) {
+						continue;
+					}
+					auto cell = _cells.find(key);
+					if(cell == _cells.end()) {
+						continue;
+					}
+					for(const spatial_index_record& record : cell->second) {
+						callback(record);
+					}
+				}
+			}
+		}
+	}
+}
+
+uint64_t spatial_index::cell_key(glm::vec3 position) const {
+	// 21 bits per axis is more than enough range for any level.
+	auto cell = [](float coord) {
+		return (uint64_t) ((int64_t) std::floor(coord / CELL_SIZE) & 0x1fffff);
+	};
+	return cell(position.x) | (cell(position.y) << 21) | (cell(position.z) << 42);
+}
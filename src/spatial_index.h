@@ -0,0 +1,80 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef SPATIAL_INDEX_H
+#define SPATIAL_INDEX_H
+
+#include <map>
+#include <set>
+#include <functional>
+
+#include <glm/glm.hpp>
+
+#include "formats/world.h"
+
+# /*
+#	Uniform grid over the positions of the point-like entities (mobies, ties
+#	and shrubs) so spatial queries don't have to touch every entity in the
+#	level. Splines aren't indexed - they're extended objects and there are
+#	comparatively few of them.
+# */
+
+struct spatial_index_record {
+	enum entity_kind { MOBY, TIE, SHRUB };
+
+	entity_id id; // Only valid as of the last rebuild, see spatial_index::move.
+	entity_kind kind;
+	std::size_t index; // Index into the corresponding world_segment vector.
+	glm::vec3 position;
+};
+
+class spatial_index {
+public:
+	// Entities are a few units across, so a query ray only has to visit a
+	// handful of cells.
+	static const int CELL_SIZE = 16;
+
+	void rebuild(world_segment& world);
+
+	// Drop the grid and rebuild it on the next query. For bulk edits where
+	// updating entries one by one isn't worth the bother.
+	void mark_stale();
+
+	// Update a single entry in place after an entity has moved. Falls back to
+	// marking the whole grid stale if the entity isn't in it, e.g. because
+	// entity ids have been reassigned since the last rebuild.
+	void move(entity_id id, glm::vec3 new_position);
+
+	// Visit the records in all cells within a cell's breadth of the given
+	// ray, in rough near-to-far order. Rebuilds the grid first if it's stale.
+	void for_each_near_ray(
+		world_segment& world,
+		glm::vec3 origin,
+		glm::vec3 direction,
+		float max_distance,
+		std::function<void(const spatial_index_record&)> callback);
+
+private:
+	uint64_t cell_key(glm::vec3 position) const;
+
+	std::map<uint64_t, std::vector<spatial_index_record>> _cells;
+	std::map<entity_id, uint64_t> _cell_of_entity;
+	bool _stale = true;
+};
+
+#endif
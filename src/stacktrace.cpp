@@ -203,24 +203,44 @@ void generate_stacktrace_win32(std::stringstream* result) {
 
 #endif
 
-std::string generate_stacktrace() {
+captured_stacktrace capture_stacktrace() {
+	captured_stacktrace trace;
+
+	#ifdef __GNUC__
+		trace.frame_count = backtrace(trace.frames, captured_stacktrace::MAX_FRAMES);
+	#elif defined(_WIN32)
+		// StackWalk64 needs the context from the point of the exception, so
+		// there's no cheap capture here - symbolise up front.
+		std::stringstream result;
+		generate_stacktrace_win32(&result);
+		trace.eager = result.str();
+	#else
+		trace.eager = "Taking a stacktrace on your OS is currently not supported.";
+	#endif
+
+	return trace;
+}
+
+std::string symbolise_stacktrace(const captured_stacktrace& trace) {
+	if(trace.eager.size() > 0) {
+		return trace.eager;
+	}
+
 	std::stringstream result;
-	
+
 	#ifdef __GNUC__
-		void* array[256];
-		std::size_t size = backtrace(array, 256);
-		char** strings = backtrace_symbols(array, size);
+		char** strings = backtrace_symbols(trace.frames, trace.frame_count);
 
-		for(std::size_t i = 0; i < size; i++) {
+		for(int i = 0; i < trace.frame_count; i++) {
 			result << std::string(strings[i]) + "\n";
 		}
 
 		free(strings);
-	#elif defined(_WIN32)
-		generate_stacktrace_win32(&result);
-	#else
-		result << "Taking a stacktrace on your OS is currently not supported.";
 	#endif
-	
+
 	return result.str();
 }
+
+std::string generate_stacktrace() {
+	return symbolise_stacktrace(capture_stacktrace());
+}
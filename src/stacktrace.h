@@ -18,4 +18,21 @@
 
 #include <string>
 
+// Raw return addresses grabbed at the point of capture. Recording these is
+// cheap; mapping them back to symbol names is not, so the two are split and
+// symbolisation only happens if a trace is actually printed. Code that uses
+// exceptions for flow control (e.g. scanning an ISO for textures) throws
+// thousands of times without ever reading the trace.
+struct captured_stacktrace {
+	static const int MAX_FRAMES = 256;
+	void* frames[MAX_FRAMES];
+	int frame_count = 0;
+	// On platforms where walking the stack after the fact isn't possible, the
+	// trace is symbolised eagerly into here instead.
+	std::string eager;
+};
+
+captured_stacktrace capture_stacktrace();
+std::string symbolise_stacktrace(const captured_stacktrace& trace);
+
 std::string generate_stacktrace();
@@ -18,69 +18,188 @@
 
 #include "stream.h"
 
+#include <mutex>
 #include <algorithm>
+#include <unordered_map>
+
+#ifdef _WIN32
+	#include <windows.h>
+	#include "unwindows.h"
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
 
 /*
 	stream
 */
 
-stream::stream(stream* parent_)
-	: parent(parent_) {
-	if(parent != nullptr) {
-		parent->children.push_back(this);
+// Registry of live streams for stream::is_live. Guarded by a mutex since
+// streams get constructed and destroyed on worker threads during loads.
+static std::mutex live_streams_mutex;
+static std::unordered_map<const stream*, uint64_t> live_streams;
+static uint64_t next_stream_generation = 1;
+
+static uint64_t register_live_stream(const stream* st) {
+	std::lock_guard<std::mutex> guard(live_streams_mutex);
+	uint64_t generation = next_stream_generation++;
+	live_streams[st] = generation;
+	return generation;
+}
+
+static void unregister_live_stream(const stream* st) {
+	std::lock_guard<std::mutex> guard(live_streams_mutex);
+	live_streams.erase(st);
+}
+
+bool stream::is_live(const stream* needle, uint64_t generation) {
+	std::lock_guard<std::mutex> guard(live_streams_mutex);
+	auto iter = live_streams.find(needle);
+	return iter != live_streams.end() && iter->second == generation;
+}
+
+// Append to the end of the parent's child list, so the stream viewer shows
+// children in creation order like it did when the list was a vector.
+static void attach_stream(stream* node) {
+	if(node->parent == nullptr) {
+		return;
 	}
+	node->prev_sibling = node->parent->last_child;
+	node->next_sibling = nullptr;
+	if(node->parent->last_child != nullptr) {
+		node->parent->last_child->next_sibling = node;
+	} else {
+		node->parent->first_child = node;
+	}
+	node->parent->last_child = node;
 }
 
-stream::stream(stream&& rhs)
-	: parent(rhs.parent),
-	  children(rhs.children),
-	  name(rhs.name) {
-	rhs.parent = nullptr;
-	rhs.children = {};
-	if(parent != nullptr) {
-		for(stream*& child : parent->children) {
-			if(child == &rhs) {
-				child = this;
-			}
-		}
+static void detach_stream(stream* node) {
+	if(node->parent == nullptr) {
+		return;
 	}
-	for(stream* child : children) {
-		if(child->parent == &rhs) {
-			child->parent = this;
-		}
+	if(node->prev_sibling != nullptr) {
+		node->prev_sibling->next_sibling = node->next_sibling;
+	} else {
+		node->parent->first_child = node->next_sibling;
+	}
+	if(node->next_sibling != nullptr) {
+		node->next_sibling->prev_sibling = node->prev_sibling;
+	} else {
+		node->parent->last_child = node->prev_sibling;
 	}
+	node->prev_sibling = nullptr;
+	node->next_sibling = nullptr;
 }
 
-stream& stream::operator=(stream&& rhs) {
-	parent = rhs.parent;
-	children = rhs.children;
-	name = rhs.name;
-	rhs.parent = nullptr;
-	rhs.children = {};
-	if(parent != nullptr) {
-		for(stream*& child : parent->children) {
-			if(child == &rhs) {
-				child = this;
-			}
+// Cut a dying node's children loose. Their sibling links die with the list,
+// but each child keeps its own subtree.
+static void orphan_children(stream* node) {
+	for(stream* child = node->first_child; child != nullptr;) {
+		stream* next = child->next_sibling;
+		if(child->parent == node) {
+			child->parent = nullptr;
 		}
+		child->prev_sibling = nullptr;
+		child->next_sibling = nullptr;
+		child = next;
 	}
-	for(stream* child : children) {
-		if(child->parent == &rhs) {
-			child->parent = this;
+	node->first_child = nullptr;
+	node->last_child = nullptr;
+}
+
+// Take over rhs's place in the tree, leaving rhs fully unlinked.
+static void replace_stream(stream* node, stream* rhs) {
+	node->parent = rhs->parent;
+	node->first_child = rhs->first_child;
+	node->last_child = rhs->last_child;
+	node->prev_sibling = rhs->prev_sibling;
+	node->next_sibling = rhs->next_sibling;
+	if(node->parent != nullptr) {
+		if(node->prev_sibling != nullptr) {
+			node->prev_sibling->next_sibling = node;
+		} else {
+			node->parent->first_child = node;
+		}
+		if(node->next_sibling != nullptr) {
+			node->next_sibling->prev_sibling = node;
+		} else {
+			node->parent->last_child = node;
 		}
 	}
+	for(stream* child = node->first_child; child != nullptr; child = child->next_sibling) {
+		if(child->parent == rhs) {
+			child->parent = node;
+		}
+	}
+	rhs->parent = nullptr;
+	rhs->first_child = nullptr;
+	rhs->last_child = nullptr;
+	rhs->prev_sibling = nullptr;
+	rhs->next_sibling = nullptr;
+}
+
+stream::stream(stream* parent_)
+	: parent(parent_) {
+	_generation = register_live_stream(this);
+	attach_stream(this);
+}
+
+stream::stream(stream&& rhs)
+	: name(rhs.name) {
+	_generation = register_live_stream(this);
+	replace_stream(this, &rhs);
+}
+
+stream& stream::operator=(stream&& rhs) {
+	detach_stream(this);
+	orphan_children(this);
+	name = rhs.name;
+	replace_stream(this, &rhs);
 	return *this;
 }
 
 stream::~stream() {
-	if(parent != nullptr) {
-		parent->children.erase(std::find(parent->children.begin(), parent->children.end(), this));
+	unregister_live_stream(this);
+	detach_stream(this);
+	orphan_children(this);
+}
+
+void stream::copy_n(stream& dest, stream& src, std::size_t size) {
+	// If the source bytes are already resident in memory, hand them straight
+	// to the destination instead of bouncing them through a staging buffer.
+	const char* resident = src.map_n(src.tell(), size);
+	if(resident != nullptr) {
+		dest.write_n(resident, size);
+		src.seek(src.tell() + size);
+		return;
 	}
-	for(stream* child : children) {
-		if(child->parent == this) {
-			child->parent = nullptr;
+
+	// If the destination is in memory, read straight into its buffer.
+	if(array_stream* dest_array = dynamic_cast<array_stream*>(&dest)) {
+		std::size_t pos = dest_array->pos;
+		if(pos + size > dest_array->buffer.size()) {
+			dest_array->buffer.resize(pos + size);
 		}
+		src.read_n(dest_array->buffer.data() + pos, size);
+		dest_array->pos = pos + size;
+		return;
+	}
+
+	// Copy a megabyte at a time. Level export and racpak extraction push lots
+	// of segments through here, so the staging buffer is kept around between
+	// calls rather than being a fresh allocation every time.
+	static const std::size_t chunk_size = 1024 * 1024;
+	thread_local std::vector<char> buffer(chunk_size);
+	for(std::size_t i = 0; i < size / chunk_size; i++) {
+		src.read_n(buffer.data(), chunk_size);
+		dest.write_n(buffer.data(), chunk_size);
 	}
+	std::size_t last_chunk_size = size % chunk_size;
+	src.read_n(buffer.data(), last_chunk_size);
+	dest.write_n(buffer.data(), last_chunk_size);
 }
 
 /*
@@ -101,30 +220,73 @@ file_stream::file_stream(std::string path, std::ios_base::openmode mode)
 
 std::size_t file_stream::size() const {
 	auto& file = const_cast<std::fstream&>(_file);
-	auto pos = tell();
+	file.clear();
 	file.seekg(0, std::ios_base::end);
-	std::size_t size = tell();
-	file.seekg(pos);
-	return size;
+	return file.tellg();
 }
 
 void file_stream::seek(std::size_t offset) {
-	_file.seekg(offset);
-	check_error();
+	// Reads seek the underlying file themselves, so this is free. If we're
+	// lucky the target is already in the read-ahead buffer.
+	_pos = offset;
 }
 
 std::size_t file_stream::tell() const {
-	return const_cast<std::fstream&>(_file).tellg();
+	return _pos;
 }
 
 void file_stream::read_n(char* dest, std::size_t size) {
-	_file.read((char*) dest, size);
-	check_error();
+	// Big reads would just evict the buffer, so service them directly.
+	if(size >= BUFFER_CAPACITY) {
+		_file.seekg(_pos);
+		_file.read(dest, size);
+		check_error();
+		_pos += size;
+		return;
+	}
+	while(size > 0) {
+		if(_pos < _buffer_offset || _pos >= _buffer_offset + _buffer_size) {
+			fill_buffer();
+		}
+		std::size_t bytes_buffered = _buffer_offset + _buffer_size - _pos;
+		std::size_t bytes_to_copy = std::min(size, bytes_buffered);
+		std::memcpy(dest, _buffer.data() + (_pos - _buffer_offset), bytes_to_copy);
+		_pos += bytes_to_copy;
+		dest += bytes_to_copy;
+		size -= bytes_to_copy;
+	}
 }
 
 void file_stream::write_n(const char* data, std::size_t size) {
-	_file.write((char*) data, size);
+	_file.seekp(_pos);
+	_file.write(data, size);
+	check_error();
+	// Drop any buffered bytes the write may have overlapped.
+	if(_pos < _buffer_offset + _buffer_size && _pos + size > _buffer_offset) {
+		_buffer_size = 0;
+	}
+	_pos += size;
+}
+
+void file_stream::fill_buffer() {
+	if(_buffer.size() < BUFFER_CAPACITY) {
+		_buffer.resize(BUFFER_CAPACITY);
+	}
+	_file.clear();
+	_file.seekg(_pos);
 	check_error();
+	_file.read(_buffer.data(), BUFFER_CAPACITY);
+	if(_file.eof()) {
+		// A short read near the end of the file is fine, the caller only gets
+		// an error if it then tries to read past what we got back.
+		_file.clear();
+	}
+	check_error();
+	_buffer_offset = _pos;
+	_buffer_size = _file.gcount();
+	if(_buffer_size == 0) {
+		throw stream_io_error("Tried to read past end of file_stream!");
+	}
 }
 
 std::string file_stream::resource_path() const {
@@ -133,10 +295,119 @@ std::string file_stream::resource_path() const {
 
 void file_stream::check_error() {
 	if(_file.fail()) {
-		throw stream_io_error("Bad stream."); 
+		throw stream_io_error("Bad stream.");
 	}
 }
 
+void file_stream::flush() {
+	_file.flush();
+	check_error();
+}
+
+/*
+	mapped_file_stream
+*/
+
+mapped_file_stream::mapped_file_stream(std::string path)
+	: stream(nullptr),
+	  _data(nullptr),
+	  _size(0),
+	  _pos(0),
+	  _path(path) {
+#ifdef _WIN32
+	_file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+		OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+	if(_file == INVALID_HANDLE_VALUE) {
+		throw stream_io_error("Failed to open file for memory mapping.");
+	}
+	LARGE_INTEGER file_size;
+	if(!GetFileSizeEx(_file, &file_size)) {
+		CloseHandle(_file);
+		throw stream_io_error("Failed to get size of memory mapped file.");
+	}
+	_size = static_cast<std::size_t>(file_size.QuadPart);
+	_mapping = CreateFileMappingA(_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if(_mapping == nullptr) {
+		CloseHandle(_file);
+		throw stream_io_error("Failed to create file mapping.");
+	}
+	_data = static_cast<char*>(MapViewOfFile(_mapping, FILE_MAP_READ, 0, 0, 0));
+	if(_data == nullptr) {
+		CloseHandle(_mapping);
+		CloseHandle(_file);
+		throw stream_io_error("Failed to map view of file.");
+	}
+#else
+	_fd = open(path.c_str(), O_RDONLY);
+	if(_fd == -1) {
+		throw stream_io_error("Failed to open file for memory mapping.");
+	}
+	struct stat file_info;
+	if(fstat(_fd, &file_info) == -1) {
+		close(_fd);
+		throw stream_io_error("Failed to get size of memory mapped file.");
+	}
+	_size = file_info.st_size;
+	_data = static_cast<char*>(mmap(nullptr, _size, PROT_READ, MAP_PRIVATE, _fd, 0));
+	if(_data == MAP_FAILED) {
+		close(_fd);
+		throw stream_io_error("Failed to memory map file.");
+	}
+	// We mostly read files like this front to back, so tell the kernel that.
+	madvise(_data, _size, MADV_SEQUENTIAL);
+#endif
+}
+
+mapped_file_stream::~mapped_file_stream() {
+#ifdef _WIN32
+	UnmapViewOfFile(_data);
+	CloseHandle(_mapping);
+	CloseHandle(_file);
+#else
+	munmap(_data, _size);
+	close(_fd);
+#endif
+}
+
+std::size_t mapped_file_stream::size() const {
+	return _size;
+}
+
+void mapped_file_stream::seek(std::size_t offset) {
+	_pos = offset;
+}
+
+std::size_t mapped_file_stream::tell() const {
+	return _pos;
+}
+
+void mapped_file_stream::read_n(char* dest, std::size_t size) {
+	if(_pos + size > _size) {
+		throw stream_io_error("Tried to read past end of mapped_file_stream!");
+	}
+	std::memcpy(dest, _data + _pos, size);
+	_pos += size;
+}
+
+void mapped_file_stream::write_n(const char* data, std::size_t size) {
+	throw stream_io_error("Tried to write to a read-only mapped_file_stream!");
+}
+
+std::string mapped_file_stream::resource_path() const {
+	return std::string("file(") + _path + ")";
+}
+
+const char* mapped_file_stream::map_n(std::size_t offset, std::size_t size) {
+	if(offset + size > _size) {
+		return nullptr;
+	}
+	return _data + offset;
+}
+
+const char* mapped_file_stream::data() const {
+	return _data;
+}
+
 /*
 	array_stream
 */
@@ -236,8 +507,7 @@ std::string proxy_stream::resource_path() const {
 */
 
 trace_stream::trace_stream(stream* parent)
-	: stream(parent),
-	  read_mask(parent->size(), false) {}
+	: stream(parent) {}
 
 std::size_t trace_stream::size() const {
 	return parent->size();
@@ -254,9 +524,43 @@ std::size_t trace_stream::tell() const {
 void trace_stream::read_n(char* dest, std::size_t size_) {
 	std::size_t pos = tell();
 	parent->read_n(dest, size_);
-	for(std::size_t i = pos; i < std::min(size(), pos + size_); i++) {
-		read_mask[i] = true;
+	std::size_t end = std::min(size(), pos + size_);
+	if(end <= pos) {
+		return;
+	}
+	// Sequential reads are by far the most common, so try to extend the last
+	// range before starting a new one.
+	if(_read_ranges.size() > 0) {
+		trace_stream_range& last = _read_ranges.back();
+		if(pos >= last.offset && pos <= last.offset + last.size) {
+			last.size = std::max(last.size, end - last.offset);
+			return;
+		}
+	}
+	_read_ranges.push_back({ pos, end - pos });
+}
+
+std::vector<trace_stream_range> trace_stream::coalesced_read_ranges() const {
+	return coalesce_ranges(_read_ranges);
+}
+
+std::vector<trace_stream_range> coalesce_ranges(std::vector<trace_stream_range> ranges) {
+	std::sort(ranges.begin(), ranges.end(),
+		[](const trace_stream_range& lhs, const trace_stream_range& rhs) {
+			return lhs.offset < rhs.offset;
+		});
+	std::vector<trace_stream_range> result;
+	for(trace_stream_range& range : ranges) {
+		if(result.size() > 0 &&
+				range.offset <= result.back().offset + result.back().size) {
+			result.back().size = std::max(
+				result.back().size,
+				range.offset + range.size - result.back().offset);
+		} else {
+			result.push_back(range);
+		}
 	}
+	return result;
 }
 
 void trace_stream::write_n(const char* data, std::size_t size) {
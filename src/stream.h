@@ -21,6 +21,7 @@
 
 #include <bitset>
 #include <vector>
+#include <algorithm>
 #include <cstring>
 #include <fstream>
 #include <sstream>
@@ -62,6 +63,19 @@ static const size_t SECTOR_SIZE = 0x800;
 		inmem = p; \
 	}
 
+// Exchange a contiguous run of fields that are laid out identically on both
+// sides with three memcpys instead of going field by field. The arguments
+// name the first field of the run on each side and the size of the run in
+// bytes; it's on the caller to make sure neither side reorders or pads
+// anything within the run.
+#define SWAP_PACKED_RUN(inmem, packed, size) \
+	{ \
+		char run_temp[size]; \
+		std::memcpy(run_temp, &(packed), size); \
+		std::memcpy(&(packed), &(inmem), size); \
+		std::memcpy(&(inmem), run_temp, size); \
+	}
+
 template <typename T>
 packed_struct(file_ptr,
 	file_ptr()           : value(0) {}
@@ -100,11 +114,17 @@ packed_struct(sector32,
 
 struct stream_error : public std::runtime_error {
 	stream_error(const char* what)
-		: std::runtime_error(what) {
-		stack_trace = generate_stacktrace();
+		: std::runtime_error(what),
+		  _trace(capture_stacktrace()) {}
+
+	// Symbolising the trace is expensive, so it's deferred until a handler
+	// actually wants to print it. Throwing is just a cheap frame capture.
+	std::string stack_trace() const {
+		return symbolise_stacktrace(_trace);
 	}
 
-	std::string stack_trace;
+private:
+	captured_stacktrace _trace;
 };
 
 // I/O error e.g. tried to read past end.
@@ -117,6 +137,28 @@ struct stream_format_error : public stream_error {
 	using stream_error::stream_error;
 };
 
+// A read-only view over an array of packed structs read from a stream. When
+// the stream's backing store is already resident in memory this points
+// straight into it, otherwise it owns a copy. Beware that a zero-copy view is
+// invalidated if the underlying buffer grows or is destroyed.
+template <typename T>
+class mapped_array {
+public:
+	mapped_array() : _data(nullptr), _count(0) {}
+
+	const T* data() const { return _fallback.empty() ? _data : _fallback.data(); }
+	std::size_t size() const { return _count; }
+	const T* begin() const { return data(); }
+	const T* end() const { return data() + _count; }
+	const T& operator[](std::size_t index) const { return data()[index]; }
+
+private:
+	friend class stream;
+	const T* _data;
+	std::size_t _count;
+	std::vector<T> _fallback;
+};
+
 class stream {
 public:
 	stream(stream* parent_);
@@ -125,10 +167,27 @@ public:
 	stream& operator=(stream&& rhs);
 	virtual ~stream();
 	
-	stream* parent;
-	std::vector<stream*> children;
+	stream* parent = nullptr;
+	// Intrusive sibling links. A stream hooks itself into its parent's child
+	// list on construction and unhooks on destruction; keeping the links in
+	// the nodes themselves makes attach and detach O(1), so tearing down the
+	// thousands of streams a project owns is linear instead of quadratic.
+	stream* first_child = nullptr;
+	stream* last_child = nullptr;
+	stream* prev_sibling = nullptr;
+	stream* next_sibling = nullptr;
 	std::string name; // Displayed in the string viewer.
 
+	// Number of direct children. Linear in the child count - only the stream
+	// viewer needs this.
+	std::size_t child_count() const {
+		std::size_t count = 0;
+		for(stream* child = first_child; child != nullptr; child = child->next_sibling) {
+			count++;
+		}
+		return count;
+	}
+
 	virtual std::size_t size() const = 0;
 	virtual void seek(std::size_t offset) = 0;
 	virtual std::size_t tell() const = 0;
@@ -160,10 +219,27 @@ public:
 	}
 
 	std::string read_string() {
+		// Scan for the terminator in fixed-size chunks instead of going
+		// through a virtual read_n call per character, which is painful on
+		// file-backed streams.
 		std::string result;
-		char c;
-		while((c = read<char>()) != '\0') {
-			result += c;
+		char chunk[64];
+		for(;;) {
+			std::size_t pos = tell();
+			std::size_t left = size() - pos;
+			if(left == 0) {
+				read<char>(); // Unterminated string. Throw like a plain read past the end would.
+			}
+			std::size_t chunk_size = std::min(sizeof(chunk), left);
+			read_n(chunk, chunk_size);
+			const char* terminator =
+				static_cast<const char*>(std::memchr(chunk, '\0', chunk_size));
+			if(terminator != nullptr) {
+				result.append(chunk, terminator - chunk);
+				seek(pos + (terminator - chunk) + 1);
+				break;
+			}
+			result.append(chunk, chunk_size);
 		}
 		return result;
 	}
@@ -197,6 +273,29 @@ public:
 		return value;
 	}
 	
+	// If the bytes in the given range are already resident in memory, return
+	// a pointer to them, otherwise return nullptr. Used by map_array below.
+	virtual const char* map_n(std::size_t offset, std::size_t size) {
+		return nullptr;
+	}
+
+	// Get a view over count items at the current position and seek past them.
+	// In-memory streams hand back a pointer straight into their buffer instead
+	// of copying like read_multiple. See mapped_array for lifetime caveats.
+	template <typename T>
+	mapped_array<T> map_array(std::size_t count) {
+		mapped_array<T> view;
+		view._count = count;
+		const char* resident = map_n(tell(), count * sizeof(T));
+		if(resident != nullptr) {
+			view._data = reinterpret_cast<const T*>(resident);
+			seek(tell() + count * sizeof(T));
+		} else {
+			view._fallback = read_multiple<T>(count);
+		}
+		return view;
+	}
+
 	template <typename T>
 	std::vector<T> read_multiple(size_t count) {
 		std::vector<T> buffer(count);
@@ -225,33 +324,20 @@ public:
 		}
 	}
 
-	// The dest and src streams should be different.
-	static void copy_n(stream& dest, stream& src, std::size_t size) {
-		// Copy a megabyte at a time.
-		static const std::size_t chunk_size = 1024 * 1024;
-		std::vector<char> buffer(chunk_size);
-		for(std::size_t i = 0; i < size / chunk_size; i++) {
-			src.read_n(buffer.data(), chunk_size);
-			dest.write_n(buffer.data(), chunk_size);
-		}
-		std::size_t last_chunk_size = size % chunk_size;
-		src.read_n(buffer.data(), last_chunk_size);
-		dest.write_n(buffer.data(), last_chunk_size);
-	}
+	// The dest and src streams should be different. Copies between resident
+	// and in-memory streams skip the staging buffer, see stream.cpp.
+	static void copy_n(stream& dest, stream& src, std::size_t size);
 	
-	// Check if the stream tree contains a given stream object. This is useful
-	// for checking if a pointer to a stream is still valid.
-	bool contains(stream* needle) {
-		if(needle == this) {
-			return true;
-		}
-		for(stream* child : children) {
-			if(child->contains(needle)) {
-				return true;
-			}
-		}
-		return false;
-	}
+	// The GUI caches raw stream pointers between frames, but streams are torn
+	// down in bulk whenever a project or level closes. Every stream gets a
+	// never-reused generation number at construction and registers itself in
+	// a global table of live streams, so "is this pointer still valid" is an
+	// O(1) lookup instead of a walk over the whole tree (which has thousands
+	// of nodes for an open project). Cache the generation alongside the
+	// pointer - the generation check catches a new stream being allocated at
+	// a recycled address.
+	uint64_t generation() const { return _generation; }
+	static bool is_live(const stream* needle, uint64_t generation);
 
 	// Pretty print new data that has been written to the end of the buffer.
 	// Compare said data to an 'expected' data file.
@@ -308,6 +394,7 @@ protected:
 private:
 
 	std::size_t _last_printed;
+	uint64_t _generation; // Set on construction, see register_live_stream.
 };
 
 class file_stream final: public stream {
@@ -322,10 +409,60 @@ public:
 	void write_n(const char* data, std::size_t size);
 	std::string resource_path() const;
 	void check_error();
-	
+
+	// Push buffered writes down to the OS. Needed before asking the kernel to
+	// do anything with the file's pages (e.g. iso_stream dropping them from
+	// the page cache after a commit).
+	void flush();
+
 private:
+	// Refill the read-ahead buffer starting at the current logical position.
+	void fill_buffer();
+
+	// Parsers issue thousands of tiny reads while walking over headers, so we
+	// read ahead in big chunks and serve small reads from memory.
+	static const std::size_t BUFFER_CAPACITY = 64 * 1024;
+
 	std::fstream _file;
 	std::string _path;
+	std::size_t _pos = 0; // Logical position. Seeks just update this.
+	std::vector<char> _buffer;
+	std::size_t _buffer_offset = 0; // File offset of the first byte in _buffer.
+	std::size_t _buffer_size = 0; // Number of valid bytes in _buffer.
+};
+
+// Read-only stream backed by a memory mapping of a file on disc. Reading a
+// packed struct from one of these is just a memcpy from the mapped view, so
+// parsers that issue lots of tiny reads (e.g. over a whole ISO) don't pay for
+// a seek+read syscall pair each time like they would with a file_stream.
+class mapped_file_stream final : public stream {
+public:
+	mapped_file_stream(std::string path);
+	mapped_file_stream(const mapped_file_stream&) = delete;
+	~mapped_file_stream() override;
+
+	std::size_t size() const override;
+	void seek(std::size_t offset) override;
+	std::size_t tell() const override;
+	void read_n(char* dest, std::size_t size) override;
+	void write_n(const char* data, std::size_t size) override;
+	std::string resource_path() const override;
+	const char* map_n(std::size_t offset, std::size_t size) override;
+
+	// Pointer into the mapped view. Valid for the lifetime of this object.
+	const char* data() const;
+
+private:
+	char* _data;
+	std::size_t _size;
+	std::size_t _pos;
+	std::string _path;
+#ifdef _WIN32
+	void* _file;
+	void* _mapping;
+#else
+	int _fd;
+#endif
 };
 
 class array_stream : public stream {
@@ -339,7 +476,14 @@ public:
 	void read_n(char* dest, std::size_t size);
 	void write_n(const char* data, std::size_t size);
 	std::string resource_path() const;
-	
+
+	const char* map_n(std::size_t offset, std::size_t size) override {
+		if(offset + size > buffer.size()) {
+			return nullptr;
+		}
+		return buffer.data() + offset;
+	}
+
 	char* data();
 	static bool compare_contents(array_stream& a, array_stream& b);
 	
@@ -389,6 +533,10 @@ public:
 	void write_n(const char* data, std::size_t size);
 	std::string resource_path() const;
 
+	const char* map_n(std::size_t offset, std::size_t size) override {
+		return parent->map_n(offset + _zero, size);
+	}
+
 private:
 	std::size_t _zero;
 	std::size_t _size;
@@ -399,7 +547,13 @@ struct trace_stream_range {
 	std::size_t size;
 };
 
-// Records all the locations that have been read from using it.
+// Sort ranges by offset and merge overlapping/adjacent ones together.
+std::vector<trace_stream_range> coalesce_ranges(std::vector<trace_stream_range> ranges);
+
+// Records all the locations that have been read from using it. The ranges are
+// stored as coalesced intervals rather than a bit per byte, so tracing a scan
+// over a whole ISO doesn't cost a per-byte loop on every read or hundreds of
+// megabytes of mask.
 class trace_stream : public stream {
 public:
 	trace_stream(stream* parent);
@@ -411,7 +565,14 @@ public:
 	void write_n(const char* data, std::size_t size) override;
 	std::string resource_path() const override;
 
-	std::vector<bool> read_mask;
+	// The recorded ranges sorted by offset, with overlapping and adjacent
+	// ranges merged together.
+	std::vector<trace_stream_range> coalesced_read_ranges() const;
+
+private:
+	// In read order. Each read only coalesces against the last range, since
+	// most reads are sequential; coalesced_read_ranges sorts out the rest.
+	std::vector<trace_stream_range> _read_ranges;
 };
 
 #endif
@@ -0,0 +1,120 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "string_index.h"
+
+#include <cctype>
+#include <cstring>
+
+#include "stream.h"
+#include "fs_includes.h"
+
+void string_index::add(uint16_t level, uint16_t language, uint32_t id, const char* text, uint32_t size) {
+	entry e;
+	e.level = level;
+	e.language = language;
+	e.id = id;
+	e.offset = _text.size();
+	_entries.push_back(e);
+	_text.insert(_text.end(), text, text + size);
+	_text.push_back('\0');
+}
+
+// Case-insensitive substring match. strcasestr isn't portable.
+static bool contains_ci(const char* haystack, const std::string& needle) {
+	for(const char* pos = haystack; *pos != '\0'; pos++) {
+		std::size_t i = 0;
+		while(needle[i] != '\0' && pos[i] != '\0' &&
+				std::tolower((uint8_t) pos[i]) == (uint8_t) needle[i]) {
+			i++;
+		}
+		if(needle[i] == '\0') {
+			return true;
+		}
+	}
+	return false;
+}
+
+std::vector<string_index::result> string_index::search(std::string query, std::size_t max_results) const {
+	std::vector<result> results;
+	if(query.size() == 0) {
+		return results;
+	}
+	for(char& c : query) {
+		c = std::tolower((uint8_t) c);
+	}
+	for(const entry& e : _entries) {
+		const char* text = _text.data() + e.offset;
+		if(contains_ci(text, query)) {
+			results.push_back({ e.level, e.language, e.id, text });
+			if(results.size() >= max_results) {
+				break;
+			}
+		}
+	}
+	return results;
+}
+
+packed_struct(string_index_header,
+	char magic[4]; // "WSTR"
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t text_size;
+)
+
+static const uint32_t STRING_INDEX_VERSION = 1;
+
+std::optional<string_index> string_index::read(std::string path) {
+	if(!fs::is_regular_file(path)) {
+		return {};
+	}
+	try {
+		file_stream file(path);
+		auto header = file.read<string_index_header>(0);
+		if(std::memcmp(header.magic, "WSTR", 4) != 0 ||
+		   header.version != STRING_INDEX_VERSION) {
+			return {};
+		}
+		string_index index;
+		index._entries.resize(header.entry_count);
+		file.read_n(reinterpret_cast<char*>(index._entries.data()),
+			header.entry_count * sizeof(entry));
+		index._text.resize(header.text_size);
+		file.read_n(index._text.data(), header.text_size);
+		return index;
+	} catch(stream_error&) {
+		return {};
+	}
+}
+
+void string_index::write(std::string path) const {
+	try {
+		file_stream file(path, std::ios::in | std::ios::out | std::ios::trunc);
+		string_index_header header;
+		std::memcpy(header.magic, "WSTR", 4);
+		header.version = STRING_INDEX_VERSION;
+		header.entry_count = _entries.size();
+		header.text_size = _text.size();
+		file.write<string_index_header>(0, header);
+		file.write_n(reinterpret_cast<const char*>(_entries.data()),
+			_entries.size() * sizeof(entry));
+		file.write_n(_text.data(), _text.size());
+	} catch(stream_error&) {
+		// Best effort - the next session just rebuilds from the levels.
+	}
+}
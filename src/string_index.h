@@ -0,0 +1,68 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef STRING_INDEX_H
+#define STRING_INDEX_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <optional>
+
+# /*
+#	Project-wide index over every level's game strings, so searching the
+#	whole game's text doesn't mean loading every level each time. The index
+#	is built once, serialized to the cache directory, and invalidated with
+#	the rest of the derived caches (see iso_stream::derived_cache_path).
+# */
+
+class string_index {
+public:
+	struct result {
+		uint16_t level;
+		uint16_t language;
+		uint32_t id;
+		const char* text; // Points into the index, valid as long as it is.
+	};
+
+	void add(uint16_t level, uint16_t language, uint32_t id, const char* text, uint32_t size);
+
+	// Case-insensitive substring search over every indexed string. The whole
+	// corpus is a few megabytes of flat memory, so a scan is instant - no
+	// need for postings lists until someone wants whole-word queries.
+	std::vector<result> search(std::string query, std::size_t max_results) const;
+
+	std::size_t string_count() const { return _entries.size(); }
+
+	// On-disk cache, best effort like the texture list cache: read returns
+	// nothing if the file is missing or malformed, write swallows I/O errors.
+	static std::optional<string_index> read(std::string path);
+	void write(std::string path) const;
+
+private:
+	struct entry {
+		uint16_t level;
+		uint16_t language;
+		uint32_t id;
+		uint32_t offset; // Into _text, null terminated.
+	};
+	std::vector<entry> _entries;
+	std::vector<char> _text;
+};
+
+#endif
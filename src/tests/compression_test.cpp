@@ -18,20 +18,36 @@
 
 #include <time.h>
 #include <stdlib.h>
+#include <chrono>
+#include <fstream>
+#include <algorithm>
 
 #include "../formats/wad.h"
+#include "../fs_includes.h"
 
 static const int TEST_ITERATIONS = 128;
 
+// The codec throughputs observed by previous runs on this machine live here.
+// A run that comes in at under half the recorded speed fails the test, so a
+// codec change that tanks performance can't slip through on correctness
+// alone. Delete the file to reset the baseline (e.g. after moving the
+// repo between machines).
+static const char* BASELINE_PATH = "cache/compression_baseline.txt";
+static const double REGRESSION_FACTOR = 0.5;
+
 void compression_test_iter(int buffer_size, int& happy, int& sad);
+static void check_throughput_baseline(double compress_mbs, double decompress_mbs, int& sad);
 
 void compression_test() {
 	printf("**** compression test ****\n");
 	
 	srand(time(NULL));
-	
+
 	int happy = 0, sad = 0;
-	
+
+	double compress_seconds = 0, decompress_seconds = 0;
+	std::size_t compress_bytes = 0, decompress_bytes = 0;
+
 	for(int i = 0; i < TEST_ITERATIONS; i++) {
 		int buffer_size = rand() % (64 * 1024);
 		
@@ -56,16 +72,24 @@ void compression_test() {
 		array_stream compressed;
 		try {
 			int thread_count = 1 + (rand() % 15);
+			auto start = std::chrono::steady_clock::now();
 			compress_wad(compressed, plaintext, thread_count);
+			compress_seconds += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+			compress_bytes += plaintext.size();
 		} catch(std::exception& e) {
 			printf("compress_wad threw: %s\n", e.what());
 			write_sad_file();
 			continue;
 		}
-		
+
 		array_stream output;
 		try {
+			auto start = std::chrono::steady_clock::now();
 			decompress_wad(output, compressed);
+			decompress_seconds += std::chrono::duration<double>(
+				std::chrono::steady_clock::now() - start).count();
+			decompress_bytes += compressed.size();
 		} catch(std::exception& e) {
 			printf("decompress_wad threw: %s\n", e.what());
 			write_sad_file();
@@ -79,6 +103,49 @@ void compression_test() {
 		
 		happy++;
 	}
-	
+
+	double compress_mbs = compress_bytes / (compress_seconds * 1024.0 * 1024.0);
+	double decompress_mbs = decompress_bytes / (decompress_seconds * 1024.0 * 1024.0);
+	printf("compress_wad: %.2f MB/s, decompress_wad: %.2f MB/s\n",
+		compress_mbs, decompress_mbs);
+	check_throughput_baseline(compress_mbs, decompress_mbs, sad);
+
 	printf("results: %d happy, %d sad\n", happy, sad);
 }
+
+static void check_throughput_baseline(double compress_mbs, double decompress_mbs, int& sad) {
+	double baseline_compress = 0, baseline_decompress = 0;
+	{
+		std::ifstream baseline(BASELINE_PATH);
+		if(!(baseline >> baseline_compress >> baseline_decompress)) {
+			baseline_compress = 0;
+			baseline_decompress = 0;
+		}
+	}
+
+	if(baseline_compress > 0 && compress_mbs < baseline_compress * REGRESSION_FACTOR) {
+		printf("*** PERFORMANCE REGRESSION: compress_wad ran at %.2f MB/s, baseline is %.2f MB/s! ***\n",
+			compress_mbs, baseline_compress);
+		sad++;
+	}
+	if(baseline_decompress > 0 && decompress_mbs < baseline_decompress * REGRESSION_FACTOR) {
+		printf("*** PERFORMANCE REGRESSION: decompress_wad ran at %.2f MB/s, baseline is %.2f MB/s! ***\n",
+			decompress_mbs, baseline_decompress);
+		sad++;
+	}
+
+	// Only ever ratchet the baseline upwards, so a couple of slow runs can't
+	// quietly lower the bar for the real regressions. The thresholds are slack
+	// enough (see REGRESSION_FACTOR) that run-to-run noise won't trip them.
+	double new_compress = std::max(baseline_compress, compress_mbs);
+	double new_decompress = std::max(baseline_decompress, decompress_mbs);
+	if(new_compress > baseline_compress || new_decompress > baseline_decompress) {
+		try {
+			fs::create_directory("cache");
+		} catch(fs::filesystem_error&) {
+			return; // Best effort - we just keep measuring from scratch.
+		}
+		std::ofstream baseline(BASELINE_PATH);
+		baseline << new_compress << " " << new_decompress << "\n";
+	}
+}
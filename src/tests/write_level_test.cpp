@@ -18,10 +18,47 @@
 
 
 #include "../app.h"
+#include "../xxhash.h"
 #include "../project.h"
 
 #include <stdlib.h>
 
+// Compare the rebuilt level against the original in 64 KB blocks by hash,
+// then only walk the bytes of the first differing block to report the exact
+// offset. Way faster over a whole game's worth of levels than a linear byte
+// compare, and it doesn't go anywhere near the glacial print_diff path.
+static bool compare_level_contents(array_stream& original, array_stream& written) {
+	if(original.buffer.size() != written.buffer.size()) {
+		printf("Size mismatch: original is 0x%lx bytes, written is 0x%lx bytes.\n",
+			original.buffer.size(), written.buffer.size());
+		return false;
+	}
+
+	static const std::size_t BLOCK_SIZE = 64 * 1024;
+	for(std::size_t pos = 0; pos < original.buffer.size(); pos += BLOCK_SIZE) {
+		std::size_t block_size = std::min(BLOCK_SIZE, original.buffer.size() - pos);
+		uint64_t original_hash = xxh64((uint8_t*) &original.buffer[pos], block_size, 0);
+		uint64_t written_hash = xxh64((uint8_t*) &written.buffer[pos], block_size, 0);
+		if(original_hash == written_hash) {
+			continue;
+		}
+
+		for(std::size_t i = 0; i < block_size; i++) {
+			if(original.buffer[pos + i] != written.buffer[pos + i]) {
+				printf("First difference at 0x%lx: expected %02x, got %02x.\n",
+					pos + i,
+					(uint8_t) original.buffer[pos + i],
+					(uint8_t) written.buffer[pos + i]);
+				return false;
+			}
+		}
+		// A hash mismatch with no differing byte would be a bug in xxh64.
+		assert(false);
+	}
+
+	return true;
+}
+
 void write_level_test() {
 	printf("**** write level test ****\n");
 	
@@ -65,7 +102,7 @@ void write_level_test() {
 		array_stream written;
 		lvl->write(written);
 		
-		if(!array_stream::compare_contents(original, written)) {
+		if(!compare_level_contents(original, written)) {
 			sad++;
 			
 			std::string original_path = "/tmp/LEVEL" + std::to_string(i) + "_original.bin";
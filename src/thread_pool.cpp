@@ -0,0 +1,141 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "thread_pool.h"
+
+#include <atomic>
+#include <memory>
+
+thread_pool& thread_pool::shared() {
+	static thread_pool pool(std::thread::hardware_concurrency());
+	return pool;
+}
+
+thread_pool::thread_pool(std::size_t thread_count) {
+	if(thread_count < 1) {
+		thread_count = 1;
+	}
+	for(std::size_t i = 0; i < thread_count; i++) {
+		_threads.emplace_back([this]() { run_worker(); });
+	}
+}
+
+thread_pool::~thread_pool() {
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		_shutting_down = true;
+	}
+	_wake.notify_all();
+	for(std::thread& thread : _threads) {
+		thread.join();
+	}
+}
+
+std::size_t thread_pool::thread_count() const {
+	return _threads.size();
+}
+
+void thread_pool::post(std::function<void()> task) {
+	{
+		std::lock_guard<std::mutex> guard(_mutex);
+		_tasks.emplace_back(std::move(task));
+	}
+	_wake.notify_one();
+}
+
+void thread_pool::run_worker() {
+	for(;;) {
+		std::function<void()> task;
+		{
+			std::unique_lock<std::mutex> lock(_mutex);
+			_wake.wait(lock, [this]() {
+				return _shutting_down || _tasks.size() > 0;
+			});
+			if(_tasks.size() == 0) {
+				return; // Shutting down.
+			}
+			task = std::move(_tasks.front());
+			_tasks.pop_front();
+		}
+		task();
+	}
+}
+
+void thread_pool::parallel_for(
+		std::size_t count,
+		std::function<void(std::size_t)> job,
+		std::size_t max_threads) {
+	if(count == 0) {
+		return;
+	}
+
+	// Helper tasks may still be sitting in the queue after this call returns
+	// (if the other threads finished the loop without them), so everything
+	// they touch lives in shared state they keep alive.
+	struct loop_state {
+		std::size_t count;
+		std::function<void(std::size_t)> job;
+		std::atomic<std::size_t> next {0};
+		std::atomic<std::size_t> done {0};
+		std::mutex mutex;
+		std::condition_variable finished;
+		std::exception_ptr error;
+	};
+	auto state = std::make_shared<loop_state>();
+	state->count = count;
+	state->job = std::move(job);
+
+	auto work = [](std::shared_ptr<loop_state> state) {
+		for(;;) {
+			std::size_t i = state->next.fetch_add(1);
+			if(i >= state->count) {
+				break;
+			}
+			try {
+				state->job(i);
+			} catch(...) {
+				std::lock_guard<std::mutex> guard(state->mutex);
+				if(state->error == nullptr) {
+					state->error = std::current_exception();
+				}
+			}
+			if(state->done.fetch_add(1) + 1 == state->count) {
+				std::lock_guard<std::mutex> guard(state->mutex);
+				state->finished.notify_all();
+			}
+		}
+	};
+
+	std::size_t helper_count = _threads.size() + 1;
+	if(helper_count > count) {
+		helper_count = count;
+	}
+	if(helper_count > max_threads) {
+		helper_count = max_threads;
+	}
+	for(std::size_t i = 1; i < helper_count; i++) {
+		post([work, state]() { work(state); });
+	}
+	work(state); // The calling thread participates.
+
+	std::unique_lock<std::mutex> lock(state->mutex);
+	state->finished.wait(lock, [&]() { return state->done == state->count; });
+	if(state->error != nullptr) {
+		std::rethrow_exception(state->error);
+	}
+}
@@ -0,0 +1,70 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef THREAD_POOL_H
+#define THREAD_POOL_H
+
+#include <deque>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <condition_variable>
+
+# /*
+#	Shared pool of worker threads, so the various subsystems that want
+#	parallelism don't each spawn their own set and oversubscribe the CPU.
+# */
+
+class thread_pool {
+public:
+	// Process-wide pool, sized to the machine. Safe to use from any thread.
+	static thread_pool& shared();
+
+	thread_pool(std::size_t thread_count);
+	thread_pool(const thread_pool&) = delete;
+	~thread_pool();
+
+	std::size_t thread_count() const;
+
+	// Run a task on a pool thread at some point in the future. The task must
+	// not throw.
+	void post(std::function<void()> task);
+
+	// Run job(0) .. job(count - 1) across the pool and block until they've
+	// all finished. The calling thread works on jobs too, so this makes
+	// progress even when every pool thread is busy (including when it's
+	// called from a pool thread). At most max_threads threads work on the
+	// loop at once. The first exception thrown by a job is rethrown here.
+	void parallel_for(
+		std::size_t count,
+		std::function<void(std::size_t)> job,
+		std::size_t max_threads = SIZE_MAX);
+
+private:
+	void run_worker();
+
+	std::vector<std::thread> _threads;
+	std::deque<std::function<void()>> _tasks;
+	std::mutex _mutex;
+	std::condition_variable _wake;
+	bool _shutting_down = false;
+};
+
+#endif
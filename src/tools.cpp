@@ -18,6 +18,8 @@
 
 #include "tools.h"
 
+#include <cstring>
+
 #include <glm/gtx/intersect.hpp>
 
 #include "app.h"
@@ -32,46 +34,97 @@ std::vector<std::unique_ptr<tool>> enumerate_tools() {
 	return tools;
 }
 
+GLuint tool::icon() {
+	if(!_icon_loaded) {
+		_icon = load_icon(_icon_path);
+		_icon_loaded = true;
+	}
+	return _icon();
+}
+
 picker_tool::picker_tool() {
-	icon = load_icon("data/icons/picker_tool.txt");
+	_icon_path = "data/icons/picker_tool.txt";
+}
+
+picker_tool::~picker_tool() {
+	if(_pick_buffer != 0) {
+		glDeleteBuffers(1, &_pick_buffer);
+	}
 }
 
+// Select the object under the cursor, with a few pixels of leeway.
+static const int PICK_SELECT_SIZE = 9;
+static const int PICK_BUFFER_PIXELS = PICK_SELECT_SIZE * PICK_SELECT_SIZE;
+
 void picker_tool::draw(app& a, glm::mat4 world_to_clip) {
+	// Consume the readback issued last frame. By now the pickframe has long
+	// since been drawn, so mapping the buffer doesn't stall.
+	if(_pick_pending) {
+		finish_pick(a);
+	}
+
 	if(ImGui::IsMouseClicked(0) && ImGui::IsWindowHovered()) {
 		ImVec2 rel_pos {
 			ImGui::GetMousePos().x - ImGui::GetWindowPos().x,
 			ImGui::GetMousePos().y - ImGui::GetWindowPos().y - 20
 		};
-		pick_object(a, world_to_clip, rel_pos);
+		begin_pick(a, world_to_clip, rel_pos);
 	}
 }
 
-void picker_tool::pick_object(app& a, glm::mat4 world_to_clip, ImVec2 position) {
+void picker_tool::begin_pick(app& a, glm::mat4 world_to_clip, ImVec2 position) {
 	level& lvl = *a.get_level();
-	
+
 	GLint last_framebuffer;
 	glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &last_framebuffer);
-	
+
 	glBindFramebuffer(GL_FRAMEBUFFER, 0);
-	a.renderer.draw_pickframe(lvl, world_to_clip);
-	
-	glFlush();
-	glFinish();
+	glm::vec3 pick_ray = a.renderer.create_ray(world_to_clip, ImGui::GetMousePos());
+	a.renderer.draw_pickframe(lvl, world_to_clip, pick_ray);
+
 	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
-	
-	// Select the object under the cursor, with a few pixels of leeway.
-	constexpr int select_size = 9;
-	constexpr int size = select_size * select_size;
-	constexpr int middle = select_size / 2;
-	
-	uint32_t buffer[size];
-	glReadPixels(position.x - middle, position.y - middle, select_size, select_size, GL_RGBA, GL_UNSIGNED_BYTE, buffer);
 
+	if(_pick_buffer == 0) {
+		glGenBuffers(1, &_pick_buffer);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, _pick_buffer);
+	glBufferData(GL_PIXEL_PACK_BUFFER, PICK_BUFFER_PIXELS * sizeof(uint32_t), nullptr, GL_STREAM_READ);
+
+	constexpr int middle = PICK_SELECT_SIZE / 2;
+	glReadPixels(position.x - middle, position.y - middle, PICK_SELECT_SIZE, PICK_SELECT_SIZE, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glFlush();
+
+	glBindFramebuffer(GL_FRAMEBUFFER, last_framebuffer);
+
+	_pick_pending = true;
+}
+
+void picker_tool::finish_pick(app& a) {
+	_pick_pending = false;
+
+	level* lvl = a.get_level();
+	if(lvl == nullptr) {
+		return;
+	}
+
+	uint32_t buffer[PICK_BUFFER_PIXELS];
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, _pick_buffer);
+	void* mapped = glMapBuffer(GL_PIXEL_PACK_BUFFER, GL_READ_ONLY);
+	if(mapped == nullptr) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		return;
+	}
+	std::memcpy(buffer, mapped, sizeof(buffer));
+	glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+	constexpr int middle = PICK_SELECT_SIZE / 2;
 	int smallest_index = -1;
-	int smallest_value = size;
-	for(int i = 0; i < size; i++) {
+	int smallest_value = PICK_BUFFER_PIXELS;
+	for(int i = 0; i < PICK_BUFFER_PIXELS; i++) {
 		if(buffer[i] > 0) {
-			auto current_value = glm::abs(middle - i % select_size) + glm::abs(middle - i / select_size);
+			auto current_value = glm::abs(middle - i % PICK_SELECT_SIZE) + glm::abs(middle - i / PICK_SELECT_SIZE);
 			if(current_value < smallest_value) {
 				smallest_index = i;
 				smallest_value = current_value;
@@ -79,20 +132,19 @@ void picker_tool::pick_object(app& a, glm::mat4 world_to_clip, ImVec2 position)
 		}
 	}
 
-	if(smallest_value == -1) {
-		lvl.clear_selection();
+	if(smallest_index == -1) {
+		lvl->clear_selection();
 		return;
 	}
 
-	lvl.for_each<entity>([&](entity& ent) {
+	lvl->for_each<entity>([&](entity& ent) {
 		ent.selected = ent.id.value == buffer[smallest_index];
 	});
-	
-	glBindFramebuffer(GL_FRAMEBUFFER, last_framebuffer);
+	lvl->update_selection();
 }
 
 selection_tool::selection_tool() {
-	icon = load_icon("data/icons/selection_tool.txt");
+	_icon_path = "data/icons/selection_tool.txt";
 }
 
 void selection_tool::draw(app& a, glm::mat4 world_to_clip) {
@@ -132,14 +184,15 @@ void selection_tool::draw(app& a, glm::mat4 world_to_clip) {
 			ent.selected = in_bounds(screen_pos);
 		});
 		lvl.for_each<euler_entity>([&](euler_entity& ent) {
-			glm::vec3 screen_pos = a.renderer.apply_local_to_screen(world_to_clip, ent.local_to_world_cache);
+			glm::vec3 screen_pos = a.renderer.apply_local_to_screen(world_to_clip, ent.local_to_world());
 			ent.selected = in_bounds(screen_pos);
 		});
+		lvl.update_selection();
 	}
 }
 
 translate_tool::translate_tool() {
-	icon = load_icon("data/icons/translate_tool.txt");
+	_icon_path = "data/icons/translate_tool.txt";
 }
 
 void translate_tool::draw(app& a, glm::mat4 world_to_clip) {
@@ -170,11 +223,13 @@ void translate_tool::draw(app& a, glm::mat4 world_to_clip) {
 						ent.local_to_world[3].x += displacement.x;
 						ent.local_to_world[3].y += displacement.y;
 						ent.local_to_world[3].z += displacement.z;
+						lvlp.get().entity_index.move(ent.id, ent.local_to_world[3]);
 					}
 				});
 				lvlp.get().for_each<euler_entity>([&](euler_entity& ent) {
 					if(contains(ids, ent.id)) {
 						ent.position += displacement;
+						lvlp.get().entity_index.move(ent.id, ent.position);
 					}
 				});
 			},
@@ -185,11 +240,13 @@ void translate_tool::draw(app& a, glm::mat4 world_to_clip) {
 						ent.local_to_world[3].x = pos.x;
 						ent.local_to_world[3].y = pos.y;
 						ent.local_to_world[3].z = pos.z;
+						lvlp.get().entity_index.move(ent.id, pos);
 					}
 				});
 				lvlp.get().for_each<euler_entity>([&](euler_entity& ent) {
 					if(map_contains(old_positions, ent.id)) {
 						ent.position = old_positions.at(ent.id);
+						lvlp.get().entity_index.move(ent.id, ent.position);
 					}
 				});
 			});
@@ -199,7 +256,7 @@ void translate_tool::draw(app& a, glm::mat4 world_to_clip) {
 }
 
 spline_tool::spline_tool() {
-	icon = load_icon("data/icons/spline_tool.txt");
+	_icon_path = "data/icons/spline_tool.txt";
 }
 
 void spline_tool::draw(app& a, glm::mat4 world_to_clip) {
@@ -244,15 +301,17 @@ void spline_tool::draw(app& a, glm::mat4 world_to_clip) {
 		spline_entity* spline = lvl.entity_from_id<spline_entity>(_selected_spline);
 		auto point = calculate_new_point(spline, ray);
 		if(point) {
-			spline_entity preview;
+			// Built from frame scratch since this runs every frame of a drag.
+			glm::vec4* preview = a.renderer.arena.alloc_array<glm::vec4>(3);
+			std::size_t preview_size = 0;
 			if(_selected_vertex >= 1) {
-				preview.vertices.push_back(spline->vertices[_selected_vertex - 1]);
+				preview[preview_size++] = spline->vertices[_selected_vertex - 1];
 			}
-			preview.vertices.push_back(glm::vec4(*point, -1.f));
+			preview[preview_size++] = glm::vec4(*point, -1.f);
 			if(_selected_vertex < spline->vertices.size() - 1) {
-				preview.vertices.push_back(spline->vertices[_selected_vertex + 1]);
+				preview[preview_size++] = spline->vertices[_selected_vertex + 1];
 			}
-			a.renderer.draw_spline(preview, world_to_clip, glm::vec4(1.f, 0.5f, 0.7f, 1.f));
+			a.renderer.draw_line_strip(preview, preview_size, world_to_clip, glm::vec4(1.f, 0.5f, 0.7f, 1.f));
 		}
 	}
 	
@@ -265,19 +324,25 @@ void spline_tool::draw(app& a, glm::mat4 world_to_clip) {
 			auto id = _selected_spline;
 			auto vertex = _selected_vertex;
 			glm::vec4 old_point = spline->vertices[_selected_vertex];
+			// Repeated drags of the same vertex coalesce into one undo entry.
+			uint64_t coalesce_key = fnv1a(&id.value, sizeof(id.value));
+			coalesce_key = fnv1a(&vertex, sizeof(vertex), coalesce_key);
 			a.get_project()->push_command(
 				[lvlp, id, vertex, old_point, point]() {
 					spline_entity* spline = lvlp.get().entity_from_id<spline_entity>(id);
 					assert(spline != nullptr);
 					assert(spline->vertices.size() > vertex);
 					spline->vertices[vertex] = glm::vec4(*point, old_point.w);
+					lvlp.get().world.mark_splines_dirty();
 				},
 				[lvlp, id, vertex, old_point]() {
 					spline_entity* spline = lvlp.get().entity_from_id<spline_entity>(id);
 					assert(spline != nullptr);
 					assert(spline->vertices.size() > vertex);
 					spline->vertices[vertex] = old_point;
-				});
+					lvlp.get().world.mark_splines_dirty();
+				},
+				coalesce_key);
 		}
 		_selected_spline = NULL_ENTITY_ID;
 	}
@@ -30,9 +30,18 @@ class tool {
 public:
 	virtual ~tool() {}
 
-	gl_texture icon;
-	
+	// The icon texture is loaded the first time the toolbar draws it, so
+	// constructing tools at startup does no file or GL work.
+	GLuint icon();
+
 	virtual void draw(app& a, glm::mat4 world_to_clip) = 0;
+
+protected:
+	std::string _icon_path;
+
+private:
+	gl_texture _icon;
+	bool _icon_loaded = false;
 };
 
 std::vector<std::unique_ptr<tool>> enumerate_tools();
@@ -40,13 +49,20 @@ std::vector<std::unique_ptr<tool>> enumerate_tools();
 class picker_tool : public tool {
 public:
 	picker_tool();
+	~picker_tool();
 
 	void draw(app& a, glm::mat4 world_to_clip) override;
 
 private:
 	// Allows the user to select an object by clicking on it. See:
 	// https://www.opengl-tutorial.org/miscellaneous/clicking-on-objects/picking-with-an-opengl-hack/
-	void pick_object(app& a, glm::mat4 world_to_clip, ImVec2 position);
+	// The readback goes through a pixel buffer object and is consumed on the
+	// next frame, so a click never forces a full pipeline sync.
+	void begin_pick(app& a, glm::mat4 world_to_clip, ImVec2 position);
+	void finish_pick(app& a);
+
+	GLuint _pick_buffer = 0;
+	bool _pick_pending = false;
 };
 
 class selection_tool : public tool {
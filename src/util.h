@@ -36,6 +36,17 @@ std::size_t parse_number(std::string x);
 
 std::vector<std::string> to_hex_dump(uint32_t* data, std::size_t align, std::size_t size_in_u32s);
 
+// FNV-1a over a byte range. Pass a previous result back in as hash to chain
+// multiple buffers into one digest.
+static const uint64_t FNV1A_64_SEED = 0xcbf29ce484222325;
+inline uint64_t fnv1a(const void* data, std::size_t size, uint64_t hash = FNV1A_64_SEED) {
+	const uint8_t* bytes = static_cast<const uint8_t*>(data);
+	for(std::size_t i = 0; i < size; i++) {
+		hash = (hash ^ bytes[i]) * 0x100000001b3;
+	}
+	return hash;
+}
+
 #define	MD5_DIGEST_LENGTH 16
 std::string md5_to_printable_string(uint8_t in[MD5_DIGEST_LENGTH]);
 
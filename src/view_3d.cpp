@@ -18,6 +18,10 @@
 
 #include "view_3d.h"
 
+#include <cstdio>
+
+#include "gui.h"
+#include "frame_profiler.h"
 #include "formats/level_impl.h"
 
 view_3d::~view_3d() {
@@ -49,34 +53,99 @@ void view_3d::render(app& a) {
 	viewport_size.y -= ImGui::GetWindowContentRegionMin().y;
 	
 	glm::mat4 world_to_clip = a.renderer.get_world_to_clip();
-	a.renderer.prepare_frame(*lvl, world_to_clip);
-	
-	render_to_texture(&_frame_buffer_texture, viewport_size.x, viewport_size.y, [&]() {
-		glClearColor(0, 0, 0, 1);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glViewport(0, 0, viewport_size.x, viewport_size.y);
-		
-		a.renderer.draw_level(*lvl, world_to_clip);
-		
-		ImGuiContext& g = *GImGui;
-		ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, g.Style.WindowPadding * 2.0f);
-		a.active_tool().draw(a, world_to_clip);
-		ImGui::PopStyleVar();
-	});
-	
+
+	// Redrawing the level is by far the most expensive part of a frame, so
+	// it's skipped when the result would be identical to the last one. The
+	// level is only ever edited in response to input, so any held mouse button
+	// or key conservatively counts as a change, plus a couple of frames after
+	// it's released so the final state of an edit always lands on screen.
+	uint64_t scene_hash = scene_state_hash(a, *lvl, viewport_size);
+	if(gui::input_active() || a.renderer.camera_control) {
+		_forced_redraws = 2;
+	}
+	bool scene_changed =
+		scene_hash != _last_scene_hash ||
+		_forced_redraws > 0 ||
+		_frame_buffer_texture == 0;
+	_last_scene_hash = scene_hash;
+	if(_forced_redraws > 0) {
+		_forced_redraws--;
+	}
+
+	if(scene_changed) {
+		frame_profiler_begin_frame();
+
+		{
+			frame_timer timer("prepare frame");
+			a.renderer.prepare_frame(*lvl, world_to_clip);
+		}
+
+		render_to_texture(&_frame_buffer_texture, viewport_size.x, viewport_size.y, [&]() {
+			glClearColor(0, 0, 0, 1);
+			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+			glViewport(0, 0, viewport_size.x, viewport_size.y);
+
+			{
+				frame_timer timer("draw level");
+				a.renderer.draw_level(*lvl, world_to_clip);
+			}
+
+			frame_timer timer("tools");
+			ImGuiContext& g = *GImGui;
+			ImGui::PushStyleVar(ImGuiStyleVar_WindowPadding, g.Style.WindowPadding * 2.0f);
+			a.active_tool().draw(a, world_to_clip);
+			ImGui::PopStyleVar();
+		});
+	} else {
+		// The overlay below still allocates labels from the frame arena, which
+		// prepare_frame would normally have reset.
+		a.renderer.arena.reset();
+	}
+
 	ImGui::Image((void*) (intptr_t) _frame_buffer_texture, viewport_size);
 
 	draw_overlay_text(a, world_to_clip);
+
+	if(a.renderer.draw_frame_times) {
+		ImGui::SetCursorPos(ImVec2(8, 28));
+		frame_profiler_draw_overlay();
+	}
 }
 
 bool view_3d::has_padding() const {
 	return false;
 }
 
+uint64_t view_3d::scene_state_hash(app& a, level& lvl, ImVec2 viewport_size) const {
+	uint64_t hash = FNV1A_64_SEED;
+	auto mix = [&](const void* data, std::size_t size) {
+		hash = fnv1a(data, size, hash);
+	};
+	mix(&a.renderer.camera_position, sizeof(a.renderer.camera_position));
+	mix(&a.renderer.camera_rotation, sizeof(a.renderer.camera_rotation));
+	int width = viewport_size.x, height = viewport_size.y;
+	mix(&width, sizeof(width));
+	mix(&height, sizeof(height));
+	mix(&a.renderer.mode, sizeof(a.renderer.mode));
+	bool flags[] = {
+		a.renderer.draw_ties, a.renderer.draw_shrubs, a.renderer.draw_mobies,
+		a.renderer.draw_triggers, a.renderer.draw_splines,
+		a.renderer.draw_grind_rails, a.renderer.draw_tfrags,
+		a.renderer.draw_tcols, a.renderer.occlusion_culling
+	};
+	mix(flags, sizeof(flags));
+	// Switching levels or tools changes what gets drawn.
+	level* lvl_ptr = &lvl;
+	mix(&lvl_ptr, sizeof(lvl_ptr));
+	mix(&a.active_tool_index, sizeof(a.active_tool_index));
+	mix(lvl.selection.data(), lvl.selection.size() * sizeof(entity_id));
+	return hash;
+}
+
 void view_3d::draw_overlay_text(app& a, glm::mat4 world_to_clip) const {
 	auto draw_list = ImGui::GetWindowDrawList();
 	
-	auto draw_text = [&](glm::mat4 mat, std::string text) {
+	auto draw_text = [&](glm::mat4 mat, const char* text) {
 		
 		static const float max_distance = glm::pow(100.f, 2); // squared units
 		float distance =
@@ -88,7 +157,7 @@ void view_3d::draw_overlay_text(app& a, glm::mat4 world_to_clip) const {
 			glm::vec3 screen_pos = a.renderer.apply_local_to_screen(world_to_clip, mat);
 			if (screen_pos.z > 0 && screen_pos.z < 1) {
 				static const int colour = ImColor(1.0f, 1.0f, 1.0f, 1.0f);
-				draw_list->AddText(ImVec2(screen_pos.x, screen_pos.y), colour, text.c_str());
+				draw_list->AddText(ImVec2(screen_pos.x, screen_pos.y), colour, text);
 			}
 		}
 	};
@@ -103,16 +172,23 @@ void view_3d::draw_overlay_text(app& a, glm::mat4 world_to_clip) const {
 		draw_text(shrub.local_to_world, "s");
 	}
 	
-	for(moby_entity& moby : lvl.world.mobies) {
+	for(std::size_t i = 0; i < lvl.world.mobies.size(); i++) {
+		moby_entity& moby = lvl.world.mobies[i];
 		static const std::map<uint16_t, const char*> moby_class_names {
 			{ 0x1f4, "crate" },
 			{ 0x2f6, "swingshot_grapple" },
 			{ 0x323, "swingshot_swinging" }
 		};
+		const glm::mat4& local_to_world =
+			i < a.renderer.moby_local_to_world_cache.size() ?
+			a.renderer.moby_local_to_world_cache[i] : moby.local_to_world();
 		if(moby_class_names.find(moby.class_num) != moby_class_names.end()) {
-			draw_text(moby.local_to_world_cache, moby_class_names.at(moby.class_num));
+			draw_text(local_to_world, moby_class_names.at(moby.class_num));
 		} else {
-			draw_text(moby.local_to_world_cache, std::to_string(moby.class_num));
+			// Frame scratch rather than a std::string per moby per frame.
+			char* label = a.renderer.arena.alloc_array<char>(16);
+			snprintf(label, 16, "%d", moby.class_num);
+			draw_text(local_to_world, label);
 		}
 	}
 }
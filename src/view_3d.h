@@ -22,6 +22,8 @@
 
 #define GLM_ENABLE_EXPERIMENTAL
 
+#include <stdint.h>
+
 #include "app.h"
 #include "model.h"
 #include "window.h"
@@ -43,7 +45,13 @@ public:
 	void draw_overlay_text(app& a, glm::mat4 world_to_clip) const;
 	
 private:
+	// Fingerprint of everything the 3D view depends on, so render() can skip
+	// re-drawing the level into the framebuffer when nothing has changed.
+	uint64_t scene_state_hash(app& a, level& lvl, ImVec2 viewport_size) const;
+
 	GLuint _frame_buffer_texture = 0;
+	uint64_t _last_scene_hash = 0;
+	int _forced_redraws = 0;
 };
 
 #endif
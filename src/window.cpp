@@ -37,6 +37,10 @@ bool window::has_padding() const {
 	return true;
 }
 
+bool window::is_busy() const {
+	return false;
+}
+
 void window::close(app& a) {
 	auto iter = std::find_if(a.windows.begin(), a.windows.end(),
 		[&](auto& ptr) { return ptr.get() == this; });
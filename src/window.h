@@ -38,6 +38,9 @@ public:
 	
 	[[nodiscard]] virtual bool is_unique() const; // Can multiple instances of this window appear at once?
 	[[nodiscard]] virtual bool has_padding() const;
+	// Should the main loop keep redrawing at full rate for this window even
+	// without user input? e.g. a background job streaming progress text.
+	[[nodiscard]] virtual bool is_busy() const;
 
 	int id();
 	void close(app& a);
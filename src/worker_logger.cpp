@@ -18,13 +18,46 @@
 
 #include "worker_logger.h"
 
-worker_logger::worker_logger() {}
+#include <cstring>
+
+worker_logger::worker_logger()
+	: _buffer(BUFFER_SIZE), _read_pos(0), _write_pos(0) {}
+
+void worker_logger::append(const char* data, std::size_t size) {
+	std::size_t write_pos = _write_pos.load(std::memory_order_relaxed);
+	std::size_t read_pos = _read_pos.load(std::memory_order_acquire);
+
+	std::size_t space = BUFFER_SIZE - (write_pos - read_pos);
+	if(size > space) {
+		// Nobody's draining the ring (e.g. a CLI tool passed in a logger it
+		// never reads while the job runs). Dropping the excess beats
+		// stalling the job on the reader.
+		size = space;
+	}
+
+	while(size > 0) {
+		std::size_t offset = write_pos & (BUFFER_SIZE - 1);
+		std::size_t chunk = std::min(size, BUFFER_SIZE - offset);
+		std::memcpy(&_buffer[offset], data, chunk);
+		data += chunk;
+		size -= chunk;
+		write_pos += chunk;
+	}
+
+	_write_pos.store(write_pos, std::memory_order_release);
+}
 
 std::string worker_logger::str() {
-	std::string result;
-	{
-		std::lock_guard<std::mutex> guard(_mutex);
-		result = _stream.str();
+	std::size_t write_pos = _write_pos.load(std::memory_order_acquire);
+	std::size_t read_pos = _read_pos.load(std::memory_order_relaxed);
+
+	while(read_pos < write_pos) {
+		std::size_t offset = read_pos & (BUFFER_SIZE - 1);
+		std::size_t chunk = std::min(write_pos - read_pos, BUFFER_SIZE - offset);
+		_text.append(&_buffer[offset], chunk);
+		read_pos += chunk;
 	}
-	return result;
+
+	_read_pos.store(read_pos, std::memory_order_release);
+	return _text;
 }
@@ -19,33 +19,47 @@
 #ifndef WORKER_LOGGER_H
 #define WORKER_LOGGER_H
 
+#include <atomic>
 #include <string>
-#include <mutex>
+#include <vector>
 #include <sstream>
 
-
 # /*
-#	Thread-safe stringstream.
+#	Log text from a background job to the GUI. Lock-free single
+#	producer/single consumer: the job thread appends via operator<< and the
+#	render thread drains via str(), neither ever blocks on the other.
 # */
 
 class worker_logger {
 public:
 	worker_logger();
 
+	// Call from the job thread only.
 	template <typename T>
 	worker_logger& operator<<(T data);
 
+	// Call from the reader thread only. Returns everything logged so far.
 	std::string str();
 
 private:
-	std::mutex _mutex;
-	std::stringstream _stream;
+	void append(const char* data, std::size_t size);
+
+	// The positions are monotonic counters, masked on access. If the ring
+	// fills up faster than the reader drains it, the excess is dropped
+	// rather than blocking the writer.
+	static const std::size_t BUFFER_SIZE = 0x10000; // Must be a power of two.
+	std::vector<char> _buffer;
+	std::atomic<std::size_t> _read_pos;
+	std::atomic<std::size_t> _write_pos;
+	std::string _text; // Drained log text. Only touched by the reader.
 };
 
 template <typename T>
 worker_logger& worker_logger::operator<<(T data) {
-	std::lock_guard<std::mutex> guard(_mutex);
-	_stream << data;
+	std::stringstream formatter;
+	formatter << data;
+	std::string text = formatter.str();
+	append(text.data(), text.size());
 	return *this;
 }
 
@@ -20,15 +20,18 @@
 #define WORKER_THREAD_H
 
 #include <atomic>
-#include <thread>
+#include <mutex>
 #include <optional>
 #include <functional>
+#include <condition_variable>
 
 #include "window.h"
+#include "thread_pool.h"
 #include "worker_logger.h"
 
 # /*
-#	 A background thread and associated GUI that displays its state via worker_logger.
+#	 A background job on the shared thread pool and associated GUI that
+#	 displays its state via worker_logger.
 # */
 
 // Must not throw.
@@ -48,16 +51,19 @@ public:
 	const char* title_text() const override;
 	ImVec2 initial_size() const override;
 	void render(app& a) override;
+	bool is_busy() const override;
 
 private:
-	void run_thread(T_in in, job_function<T_out, T_in> job);
+	void run_job(T_in in, job_function<T_out, T_in> job);
 
 	const char* _title;
 	std::optional<T_out> _result;
 	std::atomic<bool> _ready;
 	worker_logger _log;
 	std::function<void(T_out)> _on_done;
-	std::thread _thread;
+	std::mutex _mutex;
+	std::condition_variable _finished_cond;
+	bool _finished = false;
 };
 
 template <typename T_out, typename T_in>
@@ -68,12 +74,17 @@ worker_thread<T_out, T_in>::worker_thread(
 	std::function<void(T_out)> on_done)
 	: _title(title),
 	  _ready(false),
-	  _on_done(on_done),
-	  _thread(&worker_thread::run_thread, this, in, job) {}
+	  _on_done(on_done) {
+	thread_pool::shared().post([this, in = std::move(in), job]() mutable {
+		run_job(std::move(in), job);
+	});
+}
 
 template <typename T_out, typename T_in>
 worker_thread<T_out, T_in>::~worker_thread() {
-	_thread.join();
+	// The job captures this, so it has to finish before we can be destroyed.
+	std::unique_lock<std::mutex> lock(_mutex);
+	_finished_cond.wait(lock, [this]() { return _finished; });
 }
 
 template <typename T_out, typename T_in>
@@ -109,9 +120,18 @@ void worker_thread<T_out, T_in>::render(app& a) {
 }
 
 template <typename T_out, typename T_in>
-void worker_thread<T_out, T_in>::run_thread(T_in in, job_function<T_out, T_in> job) {
+bool worker_thread<T_out, T_in>::is_busy() const {
+	// Keep frames coming while the job is streaming out log text.
+	return !_ready;
+}
+
+template <typename T_out, typename T_in>
+void worker_thread<T_out, T_in>::run_job(T_in in, job_function<T_out, T_in> job) {
 	_result = job(std::move(in), _log);
 	_ready = true;
+	std::lock_guard<std::mutex> guard(_mutex);
+	_finished = true;
+	_finished_cond.notify_all();
 }
 
 #endif
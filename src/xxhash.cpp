@@ -0,0 +1,154 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#include "xxhash.h"
+
+#include <string.h>
+
+// Algorithm by Yann Collet. See https://github.com/Cyan4973/xxHash for the
+// specification this was written against.
+
+static const uint64_t PRIME64_1 = 0x9e3779b185ebca87ull;
+static const uint64_t PRIME64_2 = 0xc2b2ae3d27d4eb4full;
+static const uint64_t PRIME64_3 = 0x165667b19e3779f9ull;
+static const uint64_t PRIME64_4 = 0x85ebca77c2b2ae63ull;
+static const uint64_t PRIME64_5 = 0x27d4eb2f165667c5ull;
+
+static uint64_t rotl64(uint64_t value, int bits) {
+	return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read_u64(const uint8_t* ptr) {
+	uint64_t value;
+	memcpy(&value, ptr, 8);
+	return value;
+}
+
+static uint32_t read_u32(const uint8_t* ptr) {
+	uint32_t value;
+	memcpy(&value, ptr, 4);
+	return value;
+}
+
+static uint64_t round64(uint64_t acc, uint64_t input) {
+	acc += input * PRIME64_2;
+	acc = rotl64(acc, 31);
+	acc *= PRIME64_1;
+	return acc;
+}
+
+static uint64_t merge_round64(uint64_t acc, uint64_t val) {
+	acc ^= round64(0, val);
+	acc = acc * PRIME64_1 + PRIME64_4;
+	return acc;
+}
+
+void XXH64Init(XXH64_CTX* ctx, uint64_t seed) {
+	ctx->acc[0] = seed + PRIME64_1 + PRIME64_2;
+	ctx->acc[1] = seed + PRIME64_2;
+	ctx->acc[2] = seed;
+	ctx->acc[3] = seed - PRIME64_1;
+	ctx->total = 0;
+	ctx->buffered = 0;
+}
+
+static void consume_stripe(XXH64_CTX* ctx, const uint8_t* stripe) {
+	ctx->acc[0] = round64(ctx->acc[0], read_u64(stripe));
+	ctx->acc[1] = round64(ctx->acc[1], read_u64(stripe + 8));
+	ctx->acc[2] = round64(ctx->acc[2], read_u64(stripe + 16));
+	ctx->acc[3] = round64(ctx->acc[3], read_u64(stripe + 24));
+}
+
+void XXH64Update(XXH64_CTX* ctx, const uint8_t* data, size_t size) {
+	ctx->total += size;
+
+	if(ctx->buffered > 0) {
+		size_t needed = 32 - ctx->buffered;
+		if(size < needed) {
+			memcpy(ctx->buffer + ctx->buffered, data, size);
+			ctx->buffered += size;
+			return;
+		}
+		memcpy(ctx->buffer + ctx->buffered, data, needed);
+		consume_stripe(ctx, ctx->buffer);
+		data += needed;
+		size -= needed;
+		ctx->buffered = 0;
+	}
+
+	while(size >= 32) {
+		consume_stripe(ctx, data);
+		data += 32;
+		size -= 32;
+	}
+
+	memcpy(ctx->buffer, data, size);
+	ctx->buffered = size;
+}
+
+uint64_t XXH64Final(XXH64_CTX* ctx) {
+	uint64_t result;
+	if(ctx->total >= 32) {
+		result =
+			rotl64(ctx->acc[0], 1) + rotl64(ctx->acc[1], 7) +
+			rotl64(ctx->acc[2], 12) + rotl64(ctx->acc[3], 18);
+		result = merge_round64(result, ctx->acc[0]);
+		result = merge_round64(result, ctx->acc[1]);
+		result = merge_round64(result, ctx->acc[2]);
+		result = merge_round64(result, ctx->acc[3]);
+	} else {
+		result = ctx->acc[2] + PRIME64_5; // acc[2] holds the raw seed.
+	}
+
+	result += ctx->total;
+
+	const uint8_t* ptr = ctx->buffer;
+	size_t left = ctx->buffered;
+	while(left >= 8) {
+		result ^= round64(0, read_u64(ptr));
+		result = rotl64(result, 27) * PRIME64_1 + PRIME64_4;
+		ptr += 8;
+		left -= 8;
+	}
+	if(left >= 4) {
+		result ^= ((uint64_t) read_u32(ptr)) * PRIME64_1;
+		result = rotl64(result, 23) * PRIME64_2 + PRIME64_3;
+		ptr += 4;
+		left -= 4;
+	}
+	while(left > 0) {
+		result ^= (*ptr) * PRIME64_5;
+		result = rotl64(result, 11) * PRIME64_1;
+		ptr++;
+		left--;
+	}
+
+	result ^= result >> 33;
+	result *= PRIME64_2;
+	result ^= result >> 29;
+	result *= PRIME64_3;
+	result ^= result >> 32;
+	return result;
+}
+
+uint64_t xxh64(const uint8_t* data, size_t size, uint64_t seed) {
+	XXH64_CTX ctx;
+	XXH64Init(&ctx, seed);
+	XXH64Update(&ctx, data, size);
+	return XXH64Final(&ctx);
+}
@@ -0,0 +1,45 @@
+/*
+	wrench - A set of modding tools for the Ratchet & Clank PS2 games.
+	Copyright (C) 2019-2020 chaoticgd
+
+	This program is free software: you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation, either version 3 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program.  If not, see <https://www.gnu.org/licenses/>.
+*/
+
+#ifndef XXHASH_H
+#define XXHASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+# /*
+#	Streaming implementation of the non-cryptographic XXH64 hash. Used for
+#	cache keys and content fingerprints where collision resistance doesn't
+#	matter and MD5 is needlessly slow. The API mirrors md5.h.
+# */
+
+typedef struct XXH64Context {
+	uint64_t acc[4];
+	uint64_t total;
+	uint8_t buffer[32];
+	size_t buffered;
+} XXH64_CTX;
+
+void     XXH64Init(XXH64_CTX* ctx, uint64_t seed);
+void     XXH64Update(XXH64_CTX* ctx, const uint8_t* data, size_t size);
+uint64_t XXH64Final(XXH64_CTX* ctx);
+
+// One-shot convenience wrapper.
+uint64_t xxh64(const uint8_t* data, size_t size, uint64_t seed);
+
+#endif